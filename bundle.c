@@ -0,0 +1,163 @@
+#include "bundle.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* "dir/racing.cfg" -> "racing" */
+static void profile_name(const char *path, char *name, size_t size) {
+  const char *base = strrchr(path, '/');
+  size_t len;
+
+  base = base ? base + 1 : path;
+  len = strlen(base);
+  if (len > 4 && strcmp(base + len - 4, ".cfg") == 0) {
+    len -= 4;
+  }
+  snprintf(name, size, "%.*s", (int)len, base);
+}
+
+static int bundle_alloc(ProfileBundle *bundle, int count) {
+  memset(bundle, 0, sizeof(*bundle));
+  if (count < 1 || count > BUNDLE_MAX_PROFILES) {
+    fprintf(stderr, "A bundle holds 1 to %d profiles\n", BUNDLE_MAX_PROFILES);
+    return -1;
+  }
+  bundle->profiles = calloc((size_t)count, sizeof(Profile));
+  if (!bundle->profiles) {
+    fprintf(stderr, "Failed to allocate %d profiles\n", count);
+    return -1;
+  }
+  bundle->count = count;
+  return 0;
+}
+
+/* Parses and compiles .cfg profiles straight into the arena */
+int bundle_compile(ProfileBundle *bundle, char *const *paths, int count) {
+  if (bundle_alloc(bundle, count) != 0) {
+    return -1;
+  }
+  for (int i = 0; i < count; i++) {
+    if (load_profile(&bundle->profiles[i], paths[i]) != 0) {
+      fprintf(stderr, "Failed to load profile %s\n", paths[i]);
+      bundle_free(bundle);
+      return -1;
+    }
+    profile_name(paths[i], bundle->names[i], BUNDLE_NAME_LEN);
+  }
+  return 0;
+}
+
+int bundle_load(ProfileBundle *bundle, const char *path) {
+  BundleHeader header;
+  FILE *file = fopen(path, "rb");
+
+  memset(bundle, 0, sizeof(*bundle));
+  if (!file) {
+    fprintf(stderr, "Failed to open bundle %s\n", path);
+    return -1;
+  }
+  if (fread(&header, sizeof(header), 1, file) != 1 ||
+      memcmp(header.magic, BUNDLE_MAGIC, sizeof(header.magic)) != 0 ||
+      header.version != BUNDLE_VERSION) {
+    fprintf(stderr, "%s is not a profile bundle\n", path);
+    fclose(file);
+    return -1;
+  }
+  if (header.profile_size != sizeof(Profile)) {
+    fprintf(stderr, "%s was built by another version, rebuild it with "
+                    "--make-bundle\n", path);
+    fclose(file);
+    return -1;
+  }
+  if (bundle_alloc(bundle, (int)header.count) != 0) {
+    fclose(file);
+    return -1;
+  }
+  if (fread(bundle->profiles, sizeof(Profile), header.count, file) !=
+      header.count) {
+    fprintf(stderr, "Bundle %s is truncated\n", path);
+    bundle_free(bundle);
+    fclose(file);
+    return -1;
+  }
+  fclose(file);
+
+  /* The file is trusted no more than a profile's text would be */
+  for (int i = 0; i < bundle->count; i++) {
+    if (check_profile(&bundle->profiles[i]) != 0) {
+      fprintf(stderr, "Bundle %s: profile %d is corrupt\n", path, i + 1);
+      bundle_free(bundle);
+      return -1;
+    }
+  }
+  for (int i = 0; i < bundle->count; i++) {
+    memcpy(bundle->names[i], header.names[i], BUNDLE_NAME_LEN);
+    bundle->names[i][BUNDLE_NAME_LEN - 1] = '\0';
+  }
+  bundle->active = header.active < header.count ? (int)header.active : 0;
+  return 0;
+}
+
+int bundle_save(const ProfileBundle *bundle, const char *path) {
+  BundleHeader header;
+  FILE *file = fopen(path, "wb");
+
+  if (!file) {
+    fprintf(stderr, "Failed to open bundle %s for writing\n", path);
+    return -1;
+  }
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, BUNDLE_MAGIC, sizeof(header.magic));
+  header.version = BUNDLE_VERSION;
+  header.profile_size = sizeof(Profile);
+  header.count = (uint32_t)bundle->count;
+  header.active = (uint32_t)bundle_active(bundle);
+  memcpy(header.names, bundle->names, sizeof(header.names));
+
+  if (fwrite(&header, sizeof(header), 1, file) != 1 ||
+      fwrite(bundle->profiles, sizeof(Profile), (size_t)bundle->count,
+             file) != (size_t)bundle->count) {
+    fprintf(stderr, "Failed to write bundle %s\n", path);
+    fclose(file);
+    return -1;
+  }
+  return fclose(file) == 0 ? 0 : -1;
+}
+
+void bundle_free(ProfileBundle *bundle) {
+  free(bundle->profiles);
+  bundle->profiles = NULL;
+  bundle->count = 0;
+}
+
+/* Any thread; the engine picks it up on the next report */
+int bundle_select(ProfileBundle *bundle, int index) {
+  if (index < 0 || index >= bundle->count) {
+    return -1;
+  }
+  __atomic_store_n(&bundle->active, index, __ATOMIC_RELEASE);
+  return 0;
+}
+
+int bundle_active(const ProfileBundle *bundle) {
+  return __atomic_load_n(&bundle->active, __ATOMIC_ACQUIRE);
+}
+
+/* --make-bundle OUT FILE...: compile profiles into a bundle file */
+int run_make_bundle(const char *path, char *const *profiles, int count) {
+  ProfileBundle bundle;
+
+  if (bundle_compile(&bundle, profiles, count) != 0) {
+    return -1;
+  }
+  int ret = bundle_save(&bundle, path);
+  if (ret == 0) {
+    printf("Wrote %d profiles (%zu bytes each) to %s\n", bundle.count,
+           sizeof(Profile), path);
+    for (int i = 0; i < bundle.count; i++) {
+      printf("  %d: %s\n", i + 1, bundle.names[i]);
+    }
+  }
+  bundle_free(&bundle);
+  return ret;
+}
@@ -0,0 +1,55 @@
+#ifndef BUNDLE_H
+#define BUNDLE_H
+
+#include "translator.h"
+#include <stdint.h>
+
+/*
+ * A profile set: several compiled profiles loaded side by side into one
+ * allocation, with the active one picked by index. Switching is a single
+ * atomic store that any thread may do (the engine also does it for the
+ * Guide chords below); the engine notices it on the pad's next report and
+ * swaps the translator over, with no file I/O, parsing or allocation.
+ *
+ * A Profile is plain data with no pointers, so the file format is the
+ * compiled profiles as they sit in memory behind a small header. The header
+ * records sizeof(Profile), and a bundle written by a build with a
+ * different layout is refused rather than misread.
+ *
+ * While a bundle is in use the Guide button is the switch modifier:
+ *   Guide + RB / LB          next / previous profile
+ *   Guide + A / B / X / Y    profile 1 / 2 / 3 / 4
+ * Guide itself and the buttons pressed with it are not translated.
+ */
+
+#define BUNDLE_MAGIC "FAKYPSET"
+#define BUNDLE_VERSION 1
+#define BUNDLE_MAX_PROFILES 8
+#define BUNDLE_NAME_LEN 64
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t profile_size; /* sizeof(Profile) of the build that wrote it */
+  uint32_t count;
+  uint32_t active;
+  char names[BUNDLE_MAX_PROFILES][BUNDLE_NAME_LEN];
+} BundleHeader;
+
+typedef struct {
+  int count;
+  Profile *profiles; /* count profiles in one allocation */
+  char names[BUNDLE_MAX_PROFILES][BUNDLE_NAME_LEN];
+  volatile int active;
+} ProfileBundle;
+
+int bundle_compile(ProfileBundle *bundle, char *const *paths, int count);
+int bundle_load(ProfileBundle *bundle, const char *path);
+int bundle_save(const ProfileBundle *bundle, const char *path);
+void bundle_free(ProfileBundle *bundle);
+int bundle_select(ProfileBundle *bundle, int index);
+int bundle_active(const ProfileBundle *bundle);
+
+int run_make_bundle(const char *path, char *const *profiles, int count);
+
+#endif /* BUNDLE_H */
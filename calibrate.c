@@ -0,0 +1,223 @@
+#include "calibrate.h"
+#include "utils.h"
+#include <stdio.h>
+#include <string.h>
+
+#define CALIBRATION_HEADER "# faky-controller calibration v1"
+
+static const char *axis_keys[CAL_AXES] = {
+    "left_x", "left_y", "right_x", "right_y", "left_trigger", "right_trigger",
+};
+
+void calibration_default(Calibration *cal) {
+  for (int axis = 0; axis < CAL_STICK_AXES; axis++) {
+    cal->axes[axis].min = -32768;
+    cal->axes[axis].center = 0;
+    cal->axes[axis].max = 32767;
+  }
+  for (int axis = CAL_STICK_AXES; axis < CAL_AXES; axis++) {
+    cal->axes[axis].min = 0;
+    cal->axes[axis].center = 0;
+    cal->axes[axis].max = 255;
+  }
+}
+
+int calibration_is_default(const Calibration *cal) {
+  Calibration def;
+
+  calibration_default(&def);
+  return memcmp(cal, &def, sizeof(def)) == 0;
+}
+
+/* Leaves the defaults in place for axes the file does not mention */
+int calibration_load(Calibration *cal, const char *path) {
+  FILE *file = fopen(path, "r");
+  char line[128];
+
+  calibration_default(cal);
+  if (!file) {
+    return -1;
+  }
+
+  while (fgets(line, sizeof(line), file)) {
+    char *value = strchr(line, '=');
+    if (line[0] == '#' || !value) {
+      continue;
+    }
+    *value++ = '\0';
+
+    for (int axis = 0; axis < CAL_AXES; axis++) {
+      AxisRange range = {0, 0, 0};
+      if (strcmp(line, axis_keys[axis]) != 0) {
+        continue;
+      }
+      int ok = axis < CAL_STICK_AXES
+                   ? sscanf(value, "%d %d %d", &range.min, &range.center,
+                            &range.max) == 3
+                   : sscanf(value, "%d %d", &range.min, &range.max) == 2;
+      if (!ok || range.min >= range.max) {
+        fprintf(stderr, "Ignoring calibration %s=%s", line, value);
+        break;
+      }
+      cal->axes[axis] = range;
+    }
+  }
+
+  fclose(file);
+  return 0;
+}
+
+int calibration_save(const Calibration *cal, const char *path) {
+  FILE *file = fopen(path, "w");
+
+  if (!file) {
+    fprintf(stderr, "Failed to open calibration %s for writing\n", path);
+    return -1;
+  }
+  fprintf(file, "%s\n", CALIBRATION_HEADER);
+  for (int axis = 0; axis < CAL_AXES; axis++) {
+    const AxisRange *range = &cal->axes[axis];
+    if (axis < CAL_STICK_AXES) {
+      fprintf(file, "%s=%d %d %d\n", axis_keys[axis], range->min,
+              range->center, range->max);
+    } else {
+      fprintf(file, "%s=%d %d\n", axis_keys[axis], range->min, range->max);
+    }
+  }
+  fclose(file);
+  return 0;
+}
+
+/*
+ * Observed ranges start empty, sticks at the stored centre and triggers
+ * inverted so the first report sets both ends. They follow what the pad
+ * really reaches instead of only ever widening the loaded range.
+ */
+void tracker_init(CalibrationTracker *tracker, const Calibration *start) {
+  memset(tracker, 0, sizeof(*tracker));
+  tracker->start = *start;
+  for (int axis = 0; axis < CAL_STICK_AXES; axis++) {
+    tracker->min[axis] = start->axes[axis].center;
+    tracker->max[axis] = start->axes[axis].center;
+    tracker->center_q8[axis] = start->axes[axis].center * 256;
+  }
+  for (int axis = CAL_STICK_AXES; axis < CAL_AXES; axis++) {
+    tracker->min[axis] = start->axes[axis].max;
+    tracker->max[axis] = start->axes[axis].min;
+  }
+}
+
+/* Hot path: a few compares per axis, shifts instead of divides */
+void tracker_update(CalibrationTracker *tracker, const ControllerState *state) {
+  int32_t values[CAL_AXES] = {state->left_thumb_x,  state->left_thumb_y,
+                              state->right_thumb_x, state->right_thumb_y,
+                              state->left_trigger,  state->right_trigger};
+
+  for (int axis = 0; axis < CAL_AXES; axis++) {
+    tracker->min[axis] = MIN(tracker->min[axis], values[axis]);
+    tracker->max[axis] = MAX(tracker->max[axis], values[axis]);
+  }
+  for (int axis = 0; axis < CAL_STICK_AXES; axis++) {
+    int32_t delta = values[axis] * 256 - tracker->center_q8[axis];
+    if (delta > -CAL_REST_RADIUS * 256 && delta < CAL_REST_RADIUS * 256) {
+      tracker->center_q8[axis] += delta / (1 << CAL_CENTER_SHIFT);
+    }
+  }
+  tracker->samples++;
+}
+
+/* An observed end counts once it got at least half as far as the stored one */
+static int32_t pick_end(int32_t from, int32_t stored, int32_t observed) {
+  int64_t reach = (int64_t)observed - from;
+  int64_t full = (int64_t)stored - from;
+
+  return (full < 0 ? reach * 2 <= full : reach * 2 >= full) ? observed
+                                                              : stored;
+}
+
+/*
+ * The stored calibration until enough reports were seen, then per end of
+ * each axis what was observed, unless that end was never really reached
+ * (a stick left alone this session keeps its stored range).
+ */
+void tracker_result(const CalibrationTracker *tracker, Calibration *cal) {
+  *cal = tracker->start;
+  if (tracker->samples < CAL_SAVE_MIN_SAMPLES) {
+    return;
+  }
+
+  for (int axis = 0; axis < CAL_STICK_AXES; axis++) {
+    const AxisRange *start = &tracker->start.axes[axis];
+    int32_t center = tracker->center_q8[axis] / 256;
+    int32_t min = pick_end(start->center, start->min, tracker->min[axis]);
+    int32_t max = pick_end(start->center, start->max, tracker->max[axis]);
+
+    cal->axes[axis].min = min;
+    cal->axes[axis].max = max;
+    cal->axes[axis].center = MAX(min + 1, MIN(center, max - 1));
+  }
+  for (int axis = CAL_STICK_AXES; axis < CAL_AXES; axis++) {
+    const AxisRange *start = &tracker->start.axes[axis];
+    int32_t max = pick_end(start->min, start->max, tracker->max[axis]);
+
+    if (tracker->min[axis] < max) {
+      cal->axes[axis].min = tracker->min[axis];
+      cal->axes[axis].max = max;
+    }
+  }
+}
+
+/* Each half of the range scaled onto its half of -32768..32767 */
+static int16_t scale_stick(const AxisRange *range, int32_t value) {
+  int32_t offset = value - range->center;
+  int64_t scaled;
+
+  if (offset >= 0) {
+    int32_t span = MAX(range->max - range->center, 1);
+    scaled = (int64_t)offset * 32767 / span;
+  } else {
+    int32_t span = MAX(range->center - range->min, 1);
+    scaled = (int64_t)offset * 32768 / span;
+  }
+  return (int16_t)MAX(-32768, MIN(scaled, 32767));
+}
+
+/* An all-default calibration leaves the map disabled and costs nothing */
+void axis_map_build(AxisMap *map, const Calibration *cal) {
+  map->enabled = !calibration_is_default(cal);
+
+  for (int axis = 0; axis < CAL_STICK_AXES; axis++) {
+    for (int i = 0; i <= CAL_LUT_SIZE; i++) {
+      int32_t raw = i * (1 << CAL_LUT_SHIFT) - 32768;
+      map->stick[axis][i] = scale_stick(&cal->axes[axis], raw);
+    }
+  }
+  for (int t = 0; t < 2; t++) {
+    const AxisRange *range = &cal->axes[CAL_STICK_AXES + t];
+    int32_t span = MAX(range->max - range->min, 1);
+    for (int value = 0; value < 256; value++) {
+      int32_t scaled = (value - range->min) * 255 / span;
+      map->trigger[t][value] = (uint8_t)MAX(0, MIN(scaled, 255));
+    }
+  }
+}
+
+static int16_t map_stick(const int16_t *table, int16_t value) {
+  uint32_t offset = (uint32_t)(value + 32768);
+  uint32_t i = offset >> CAL_LUT_SHIFT;
+  int32_t frac = (int32_t)(offset & ((1 << CAL_LUT_SHIFT) - 1));
+
+  return (int16_t)(table[i] +
+                   (((int32_t)table[i + 1] - table[i]) * frac >> CAL_LUT_SHIFT));
+}
+
+void axis_map_apply(const AxisMap *map, ControllerState *state) {
+  state->left_thumb_x = map_stick(map->stick[CAL_LEFT_X], state->left_thumb_x);
+  state->left_thumb_y = map_stick(map->stick[CAL_LEFT_Y], state->left_thumb_y);
+  state->right_thumb_x =
+      map_stick(map->stick[CAL_RIGHT_X], state->right_thumb_x);
+  state->right_thumb_y =
+      map_stick(map->stick[CAL_RIGHT_Y], state->right_thumb_y);
+  state->left_trigger = map->trigger[0][state->left_trigger];
+  state->right_trigger = map->trigger[1][state->right_trigger];
+}
@@ -0,0 +1,74 @@
+#ifndef CALIBRATE_H
+#define CALIBRATE_H
+
+#include "controller.h"
+#include <stdint.h>
+
+/*
+ * Stick and trigger calibration. The engine keeps a cheap running track of
+ * every axis on the hot path: the observed min/max and, while a stick rests
+ * near its centre, a fixed-point moving average of the centre. Results are
+ * kept per pad in the profile store and, when a pad starts, folded into
+ * one lookup table per axis that rescales raw values to the full range,
+ * so a calibrated pad costs one table step per axis and nothing more.
+ */
+
+enum {
+  CAL_LEFT_X = 0,
+  CAL_LEFT_Y,
+  CAL_RIGHT_X,
+  CAL_RIGHT_Y,
+  CAL_LEFT_TRIGGER,
+  CAL_RIGHT_TRIGGER,
+  CAL_AXES
+};
+
+#define CAL_STICK_AXES 4
+#define CAL_REST_RADIUS 3000  /* a stick this close to centre is at rest */
+#define CAL_CENTER_SHIFT 10   /* centre average weight, 1/2^n per report */
+#define CAL_SAVE_MIN_SAMPLES 1000 /* reports before tracking is kept */
+#define CAL_LUT_BITS 10       /* stick table steps, interpolated between */
+#define CAL_LUT_SIZE (1 << CAL_LUT_BITS)
+#define CAL_LUT_SHIFT (16 - CAL_LUT_BITS)
+
+typedef struct {
+  int32_t min;
+  int32_t center; /* sticks only */
+  int32_t max;
+} AxisRange;
+
+typedef struct {
+  AxisRange axes[CAL_AXES];
+} Calibration;
+
+/*
+ * Running track of the raw values; centres in Q8 fixed point. min/max hold
+ * only what was observed, start is what the pad was loaded with.
+ */
+typedef struct {
+  Calibration start;
+  int32_t min[CAL_AXES];
+  int32_t max[CAL_AXES];
+  int32_t center_q8[CAL_STICK_AXES];
+  uint64_t samples;
+} CalibrationTracker;
+
+typedef struct {
+  int enabled;
+  int16_t stick[CAL_STICK_AXES][CAL_LUT_SIZE + 1];
+  uint8_t trigger[2][256];
+} AxisMap;
+
+void calibration_default(Calibration *cal);
+int calibration_is_default(const Calibration *cal);
+int calibration_load(Calibration *cal, const char *path);
+int calibration_save(const Calibration *cal, const char *path);
+
+void tracker_init(CalibrationTracker *tracker, const Calibration *start);
+void tracker_update(CalibrationTracker *tracker, const ControllerState *state);
+void tracker_result(const CalibrationTracker *tracker, Calibration *cal);
+
+void axis_map_build(AxisMap *map, const Calibration *cal);
+void axis_map_apply(const AxisMap *map, ControllerState *state);
+
+#endif /* CALIBRATE_H */
@@ -0,0 +1,379 @@
+#include "combo.h"
+#include "controller.h"
+#include "input.h"
+#include "utils.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define COMBO_CHORD_TERM_MS 50
+#define DPAD_SHIFT XBOX_BUTTON_DPAD_UP
+#define DPAD_BITS 0xfu
+
+/* Numpad-style order, indexed by the symbol value */
+static const char *direction_names[COMBO_DIRECTIONS] = {
+    "neutral", "up",        "up-right", "right",  "down-right",
+    "down",    "down-left", "left",     "up-left"};
+
+/* Up/down/left/right bits (in XBOX_BUTTON_DPAD_* order) to a direction */
+static const uint8_t dpad_directions[16] = {
+    /* ----  */ 0, /* U */ 1, /* D */ 5, /* UD */ 0,
+    /* L */ 7,     /* UL */ 8, /* DL */ 6, /* UDL */ 7,
+    /* R */ 3,     /* UR */ 2, /* DR */ 4, /* UDR */ 3,
+    /* LR */ 0,    /* ULR */ 1, /* DLR */ 5, /* UDLR */ 0};
+
+static int symbol_from_name(const char *name) {
+  for (int i = 0; i < COMBO_DIRECTIONS; i++) {
+    if (strcmp(direction_names[i], name) == 0) {
+      return i;
+    }
+  }
+
+  int button = button_id_from_string(name);
+  if (button < 0) {
+    return -1;
+  }
+  if (button >= XBOX_BUTTON_DPAD_UP) {
+    return dpad_directions[1u << (button - DPAD_SHIFT)];
+  }
+  return COMBO_DIRECTIONS + button;
+}
+
+/*
+ * "<pattern> <KEY> [window_ms]" where the pattern is either a chord of
+ * buttons joined with "+", or a sequence of buttons/directions joined with
+ * ",". Chords hold the key while held, sequences tap it.
+ */
+int parse_combo(const char *text, ComboRule *rule) {
+  char buffer[sizeof(rule->text)];
+  char *saveptr = NULL;
+
+  memset(rule, 0, sizeof(*rule));
+  snprintf(rule->text, sizeof(rule->text), "%s", text);
+  snprintf(buffer, sizeof(buffer), "%s", text);
+
+  char *pattern = strtok_r(buffer, " \t", &saveptr);
+  char *key = strtok_r(NULL, " \t", &saveptr);
+  char *window = strtok_r(NULL, " \t", &saveptr);
+  if (!pattern || !key) {
+    return -1;
+  }
+
+  int code = key_code_from_name(key);
+  if (code < 0) {
+    fprintf(stderr, "Unknown key in combo: %s\n", key);
+    return -1;
+  }
+  rule->key = (uint16_t)code;
+  rule->window_ms = window ? (uint32_t)strtoul(window, NULL, 10) : 0;
+
+  for (char *p = pattern; *p; p++) {
+    *p = (char)tolower((unsigned char)*p);
+  }
+
+  int sequence = strchr(pattern, ',') != NULL;
+  const char *delim = sequence ? "," : "+";
+  char *step_save = NULL;
+
+  rule->kind = sequence ? COMBO_SEQUENCE : COMBO_CHORD;
+  for (char *step = strtok_r(pattern, delim, &step_save); step;
+       step = strtok_r(NULL, delim, &step_save)) {
+    int symbol = symbol_from_name(step);
+    int limit = sequence ? MAX_COMBO_STEPS : MAX_CHORD_BUTTONS;
+
+    if (symbol < 0 || rule->length >= limit) {
+      fprintf(stderr, "Invalid combo step: %s\n", step);
+      return -1;
+    }
+    if (symbol == 0) {
+      fprintf(stderr, "Neutral is implied between directions, leave it out\n");
+      return -1;
+    }
+    if (!sequence) {
+      if (symbol < COMBO_DIRECTIONS) {
+        fprintf(stderr, "D-pad directions can't be part of a chord\n");
+        return -1;
+      }
+      rule->mask |= 1u << (symbol - COMBO_DIRECTIONS);
+    }
+    rule->symbols[rule->length++] = (uint8_t)symbol;
+  }
+
+  if (!sequence && rule->length < 2) {
+    fprintf(stderr, "A chord needs at least two buttons\n");
+    return -1;
+  }
+  if (!sequence && rule->window_ms == 0) {
+    rule->window_ms = COMBO_CHORD_TERM_MS;
+  }
+  return 0;
+}
+
+int add_combo(ComboMachine *machine, const ComboRule *rule) {
+  if (machine->rule_count >= MAX_COMBOS) {
+    fprintf(stderr, "Profile already has %d combos\n", MAX_COMBOS);
+    return -1;
+  }
+  machine->rules[machine->rule_count++] = *rule;
+  return 0;
+}
+
+typedef struct {
+  uint16_t state;
+  ComboOutput output;
+} Keyword;
+
+typedef struct {
+  ComboMachine *machine;
+  Keyword keywords[MAX_COMBO_OUTPUTS];
+  int keyword_count;
+  int overflow;
+} ComboBuild;
+
+static void insert_keyword(ComboBuild *build, const uint8_t *symbols,
+                           int length, uint16_t rule) {
+  ComboMachine *machine = build->machine;
+  uint16_t state = 0;
+
+  for (int i = 0; i < length; i++) {
+    uint16_t *child = &machine->next[state][symbols[i]];
+    if (*child == 0) {
+      if (machine->state_count >= MAX_COMBO_STATES) {
+        build->overflow = 1;
+        return;
+      }
+      *child = (uint16_t)machine->state_count++;
+    }
+    state = *child;
+  }
+
+  if (build->keyword_count >= MAX_COMBO_OUTPUTS) {
+    build->overflow = 1;
+    return;
+  }
+  Keyword *kw = &build->keywords[build->keyword_count++];
+  kw->state = state;
+  kw->output.rule = rule;
+  kw->output.length = (uint8_t)length;
+}
+
+/* Chords may be pressed in any order, so every permutation is a keyword */
+static void insert_permutations(ComboBuild *build, uint8_t *symbols,
+                                int length, int fixed, uint16_t rule) {
+  if (fixed == length) {
+    insert_keyword(build, symbols, length, rule);
+    return;
+  }
+  for (int i = fixed; i < length; i++) {
+    uint8_t tmp = symbols[fixed];
+    symbols[fixed] = symbols[i];
+    symbols[i] = tmp;
+    insert_permutations(build, symbols, length, fixed + 1, rule);
+    symbols[i] = symbols[fixed];
+    symbols[fixed] = tmp;
+  }
+}
+
+int compile_combos(ComboMachine *machine) {
+  static ComboBuild build;
+  uint16_t fail[MAX_COMBO_STATES];
+  uint16_t queue[MAX_COMBO_STATES];
+  int head = 0, tail = 0, used = 0;
+
+  memset(&build, 0, sizeof(build));
+  build.machine = machine;
+  memset(machine->next, 0, sizeof(machine->next));
+  machine->state_count = 1;
+  machine->chord_buttons = 0;
+  machine->chord_term_ms = 0;
+
+  for (int r = 0; r < machine->rule_count; r++) {
+    ComboRule *rule = &machine->rules[r];
+    uint8_t symbols[MAX_COMBO_STEPS];
+
+    memcpy(symbols, rule->symbols, rule->length);
+    if (rule->kind == COMBO_CHORD) {
+      machine->chord_buttons |= rule->mask;
+      machine->chord_term_ms = MAX(machine->chord_term_ms, rule->window_ms);
+      insert_permutations(&build, symbols, rule->length, 0, (uint16_t)r);
+    } else {
+      insert_keyword(&build, symbols, rule->length, (uint16_t)r);
+    }
+  }
+
+  if (build.overflow) {
+    fprintf(stderr, "Too many combos to compile (max %d states)\n",
+            MAX_COMBO_STATES);
+    machine->rule_count = 0;
+    machine->state_count = 1;
+    machine->chord_buttons = 0;
+    memset(machine->next, 0, sizeof(machine->next));
+    memset(machine->output_count, 0, sizeof(machine->output_count));
+    return -1;
+  }
+
+  /* Breadth-first failure links, turning the trie into a full DFA */
+  fail[0] = 0;
+  queue[tail++] = 0;
+  while (head < tail) {
+    uint16_t state = queue[head++];
+
+    machine->output_start[state] = (uint16_t)used;
+    for (int k = 0; k < build.keyword_count; k++) {
+      if (build.keywords[k].state == state && used < MAX_COMBO_OUTPUTS) {
+        machine->outputs[used++] = build.keywords[k].output;
+      }
+    }
+    if (state != 0) {
+      uint16_t suffix = fail[state];
+      for (int i = 0; i < machine->output_count[suffix] &&
+                      used < MAX_COMBO_OUTPUTS;
+           i++) {
+        machine->outputs[used++] =
+            machine->outputs[machine->output_start[suffix] + i];
+      }
+    }
+    machine->output_count[state] =
+        (uint16_t)(used - machine->output_start[state]);
+
+    for (int c = 0; c < COMBO_SYMBOLS; c++) {
+      uint16_t child = machine->next[state][c];
+      if (child != 0) {
+        fail[child] = state == 0 ? 0 : machine->next[fail[state]][c];
+        queue[tail++] = child;
+      } else if (state != 0) {
+        machine->next[state][c] = machine->next[fail[state]][c];
+      }
+    }
+  }
+
+  return 0;
+}
+
+/*
+ * For a machine that was not built by compile_combos(), e.g. read back from
+ * a bundle: every transition, output and rule index must stay in range.
+ */
+int check_combos(const ComboMachine *machine) {
+  if (machine->rule_count < 0 || machine->rule_count > MAX_COMBOS ||
+      machine->state_count < 1 || machine->state_count > MAX_COMBO_STATES) {
+    return -1;
+  }
+  for (int i = 0; i < machine->rule_count; i++) {
+    const ComboRule *rule = &machine->rules[i];
+    if (rule->kind > COMBO_SEQUENCE || rule->length > MAX_COMBO_STEPS ||
+        rule->key >= OUTPUT_KEY_CNT ||
+        !memchr(rule->text, '\0', sizeof(rule->text))) {
+      return -1;
+    }
+  }
+  for (int state = 0; state < machine->state_count; state++) {
+    int start = machine->output_start[state];
+    int count = machine->output_count[state];
+
+    for (int c = 0; c < COMBO_SYMBOLS; c++) {
+      if (machine->next[state][c] >= machine->state_count) {
+        return -1;
+      }
+    }
+    if (start + count > MAX_COMBO_OUTPUTS) {
+      return -1;
+    }
+    for (int i = start; i < start + count; i++) {
+      if (machine->outputs[i].rule >= machine->rule_count ||
+          machine->outputs[i].length < 1 ||
+          machine->outputs[i].length > MAX_COMBO_STEPS) {
+        return -1;
+      }
+    }
+  }
+  return 0;
+}
+
+void combo_reset(ComboTracker *tracker) {
+  memset(tracker, 0, sizeof(*tracker));
+}
+
+static void feed_symbol(const ComboMachine *machine, ComboTracker *tracker,
+                        uint8_t symbol, uint32_t mask, uint64_t now,
+                        uint16_t *pressed, int *pressed_count) {
+  uint16_t state = machine->next[tracker->state][symbol];
+
+  tracker->state = state;
+  tracker->symbol_times[tracker->symbol_count % MAX_COMBO_STEPS] = now;
+  tracker->symbol_count++;
+
+  for (int i = 0; i < machine->output_count[state]; i++) {
+    const ComboOutput *out = &machine->outputs[machine->output_start[state] + i];
+    const ComboRule *rule = &machine->rules[out->rule];
+    uint64_t start = tracker->symbol_times[(tracker->symbol_count - out->length) %
+                                           MAX_COMBO_STEPS];
+
+    if (rule->window_ms && now - start > rule->window_ms * NSEC_PER_MSEC) {
+      continue;
+    }
+    if (rule->kind == COMBO_CHORD) {
+      int held = 0;
+      for (int a = 0; a < tracker->active_count; a++) {
+        held |= tracker->active[a] == out->rule;
+      }
+      if (held || (mask & rule->mask) != rule->mask ||
+          tracker->active_count >= MAX_ACTIVE_CHORDS) {
+        continue;
+      }
+      tracker->active[tracker->active_count++] = out->rule;
+    }
+    if (*pressed_count < MAX_ACTIVE_CHORDS) {
+      pressed[(*pressed_count)++] = out->rule;
+    }
+  }
+}
+
+/*
+ * Feeds the edges between two button masks through the automaton. Matched
+ * rules are returned in pressed[], chords that are no longer fully held in
+ * released[]; both arrays hold MAX_ACTIVE_CHORDS entries.
+ */
+int combo_step(const ComboMachine *machine, ComboTracker *tracker,
+               uint32_t prev_mask, uint32_t mask, uint64_t now,
+               uint16_t *pressed, int *pressed_count, uint16_t *released,
+               int *released_count) {
+  uint8_t direction = dpad_directions[(mask >> DPAD_SHIFT) & DPAD_BITS];
+  uint32_t presses = mask & ~prev_mask & ((1u << XBOX_BUTTON_DPAD_UP) - 1);
+
+  *pressed_count = 0;
+  *released_count = 0;
+
+  for (int i = 0; i < tracker->active_count;) {
+    const ComboRule *rule = &machine->rules[tracker->active[i]];
+    if ((mask & rule->mask) != rule->mask) {
+      released[(*released_count)++] = tracker->active[i];
+      tracker->active[i] = tracker->active[--tracker->active_count];
+    } else {
+      i++;
+    }
+  }
+
+  if (machine->rule_count == 0) {
+    return 0;
+  }
+
+  /* Letting go of the d-pad only ends a direction, it is not a symbol */
+  if (direction != tracker->direction) {
+    tracker->direction = direction;
+    if (direction != 0) {
+      feed_symbol(machine, tracker, direction, mask, now, pressed,
+                  pressed_count);
+    }
+  }
+
+  while (presses) {
+    int button = __builtin_ctz(presses);
+    presses &= presses - 1;
+    feed_symbol(machine, tracker, (uint8_t)(COMBO_DIRECTIONS + button), mask,
+                now, pressed, pressed_count);
+  }
+
+  return *pressed_count;
+}
@@ -0,0 +1,76 @@
+#ifndef COMBO_H
+#define COMBO_H
+
+#include <stdint.h>
+
+/*
+ * Chords ("lb+a") and sequences ("down,down-right,right,x") are compiled
+ * into one Aho-Corasick automaton. Its alphabet is the d-pad direction
+ * (9 symbols, emitted when it changes) plus a press of any other button, so
+ * motion inputs read the way they are written. Returning to neutral is not
+ * a symbol, so "down,down" is two separate taps of down. Matching costs one
+ * table load per symbol no matter how many combos the profile has.
+ */
+
+#define COMBO_DIRECTIONS 9
+#define COMBO_SYMBOLS (COMBO_DIRECTIONS + 11)
+#define MAX_COMBOS 64
+#define MAX_COMBO_STEPS 8
+#define MAX_CHORD_BUTTONS 4
+#define MAX_COMBO_STATES 1024
+#define MAX_COMBO_OUTPUTS 2048
+#define MAX_ACTIVE_CHORDS 8
+
+typedef enum {
+  COMBO_CHORD = 0,
+  COMBO_SEQUENCE,
+} ComboKind;
+
+typedef struct {
+  uint8_t kind;
+  uint8_t length;
+  uint8_t symbols[MAX_COMBO_STEPS];
+  uint32_t mask;      /* buttons that must be held for a chord */
+  uint32_t window_ms; /* 0 means no time limit */
+  uint16_t key;
+  char text[96];
+} ComboRule;
+
+typedef struct {
+  uint16_t rule;
+  uint8_t length;
+} ComboOutput;
+
+typedef struct {
+  int rule_count;
+  ComboRule rules[MAX_COMBOS];
+  int state_count;
+  uint16_t next[MAX_COMBO_STATES][COMBO_SYMBOLS];
+  uint16_t output_start[MAX_COMBO_STATES];
+  uint16_t output_count[MAX_COMBO_STATES];
+  ComboOutput outputs[MAX_COMBO_OUTPUTS];
+  uint32_t chord_buttons; /* every button that is part of a chord */
+  uint32_t chord_term_ms; /* longest chord window */
+} ComboMachine;
+
+typedef struct {
+  uint16_t state;
+  uint8_t direction;
+  uint32_t symbol_count;
+  uint64_t symbol_times[MAX_COMBO_STEPS];
+  int active_count;
+  uint16_t active[MAX_ACTIVE_CHORDS];
+} ComboTracker;
+
+int parse_combo(const char *text, ComboRule *rule);
+int add_combo(ComboMachine *machine, const ComboRule *rule);
+int compile_combos(ComboMachine *machine);
+int check_combos(const ComboMachine *machine);
+
+void combo_reset(ComboTracker *tracker);
+int combo_step(const ComboMachine *machine, ComboTracker *tracker,
+               uint32_t prev_mask, uint32_t mask, uint64_t now,
+               uint16_t *pressed, int *pressed_count, uint16_t *released,
+               int *released_count);
+
+#endif /* COMBO_H */
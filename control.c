@@ -0,0 +1,678 @@
+#include "control.h"
+#include "engine.h"
+#include "utils.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+typedef struct {
+  int fd;
+  uint16_t used;
+  uint8_t buffer[CONTROL_MAX_FRAME + 2];
+} ControlClient;
+
+typedef struct {
+  uint8_t data[CONTROL_MAX_FRAME + 2];
+  uint16_t length;
+} Frame;
+
+/* Internal: the reply goes out later, when the deferred work is done */
+#define CTL_DEFERRED 0xff
+
+/*
+ * One CTL_PROFILE at a time. The file is read and parsed on the loader
+ * thread; only the finished Profile is handed to the engine loop.
+ */
+typedef struct {
+  ControlClient *client; /* NULL once it disconnected */
+  uint8_t device;
+  char path[256];
+  Profile *profile;
+  int result;
+} ProfileLoad;
+
+static int listen_fd = -1;
+static char socket_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+static ControlClient clients[CONTROL_MAX_CLIENTS];
+
+static ProfileLoad load;
+static int load_busy = 0; /* engine thread: a load is queued or running */
+static int load_queued = 0;
+static int load_stopping = 0;
+static int load_fd = -1;
+static pthread_t loader;
+static pthread_mutex_t load_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t load_wake = PTHREAD_COND_INITIALIZER;
+
+static void put_u8(Frame *frame, uint8_t value) {
+  if (frame->length < sizeof(frame->data)) {
+    frame->data[frame->length++] = value;
+  }
+}
+
+static void put_u16(Frame *frame, uint16_t value) {
+  put_u8(frame, value & 0xff);
+  put_u8(frame, value >> 8);
+}
+
+static void put_u32(Frame *frame, uint32_t value) {
+  put_u16(frame, value & 0xffff);
+  put_u16(frame, value >> 16);
+}
+
+static uint16_t get_u16(const uint8_t *data) {
+  return (uint16_t)(data[0] | data[1] << 8);
+}
+
+static uint32_t get_u32(const uint8_t *data) {
+  return get_u16(data) | (uint32_t)get_u16(data + 2) << 16;
+}
+
+/* Starts a frame with room for the length, finished by end_frame() */
+static void begin_frame(Frame *frame, uint8_t first) {
+  frame->length = 2;
+  put_u8(frame, first);
+}
+
+static void end_frame(Frame *frame) {
+  uint16_t body = frame->length - 2;
+  frame->data[0] = body & 0xff;
+  frame->data[1] = body >> 8;
+}
+
+const char *control_socket_path(void) {
+  const char *env = getenv("FAKY_CONTROL_SOCKET");
+  return env && *env ? env : CONTROL_SOCKET_PATH;
+}
+
+static int set_nonblocking(int fd) {
+  int flags = fcntl(fd, F_GETFL);
+  return flags < 0 ? -1 : fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+static void set_cloexec(int fd) { fcntl(fd, F_SETFD, FD_CLOEXEC); }
+
+static void close_client(ControlClient *client) {
+  if (load.client == client) {
+    load.client = NULL;
+  }
+  engine_unwatch(client->fd);
+  close(client->fd);
+  client->fd = -1;
+  client->used = 0;
+}
+
+static void cmd_list(Frame *reply) {
+  int count = engine_device_count();
+
+  put_u8(reply, (uint8_t)count);
+  for (int i = 0; i < count; i++) {
+    const EngineDevice *dev = engine_device(i);
+    const char *name = dev->profile ? dev->profile->config.controller_name : "";
+    size_t len = 0;
+
+    while (len < sizeof(dev->profile->config.controller_name) && name[len]) {
+      len++;
+    }
+
+    put_u8(reply, (uint8_t)i);
+    put_u16(reply, dev->vendor_id);
+    put_u16(reply, dev->product_id);
+    put_u8(reply, (dev->active ? CTL_FLAG_ACTIVE : 0) |
+                      (dev->paused ? CTL_FLAG_PAUSED : 0));
+    put_u8(reply, (uint8_t)len);
+    for (size_t c = 0; c < len; c++) {
+      put_u8(reply, (uint8_t)name[c]);
+    }
+  }
+}
+
+/* Replies come once the device uses the profile, or the load failed */
+static uint8_t cmd_profile(ControlClient *client, const uint8_t *args,
+                           int length) {
+  if (length < 2 || length - 1 >= (int)sizeof(load.path)) {
+    return CTL_BAD_REQUEST;
+  }
+  if (!engine_device(args[0])) {
+    return CTL_NO_DEVICE;
+  }
+  if (load_busy || load_fd < 0) {
+    return CTL_FAILED;
+  }
+
+  Profile *profile = malloc(sizeof(*profile));
+  if (!profile) {
+    return CTL_FAILED;
+  }
+  pthread_mutex_lock(&load_lock);
+  load.client = client;
+  load.device = args[0];
+  memcpy(load.path, args + 1, length - 1);
+  load.path[length - 1] = '\0';
+  load.profile = profile;
+  load_queued = 1;
+  pthread_cond_signal(&load_wake);
+  pthread_mutex_unlock(&load_lock);
+  load_busy = 1;
+  return CTL_DEFERRED;
+}
+
+static uint8_t cmd_pause(const uint8_t *args, int length, int paused) {
+  if (length != 1) {
+    return CTL_BAD_REQUEST;
+  }
+  if (args[0] != CONTROL_ALL_DEVICES) {
+    return engine_set_paused(args[0], paused) == 0 ? CTL_OK : CTL_NO_DEVICE;
+  }
+  for (int i = 0; i < engine_device_count(); i++) {
+    engine_set_paused(i, paused);
+  }
+  return CTL_OK;
+}
+
+/*
+ * Binds the recording into a copy of the device's profile and switches to
+ * it, since the running profile may be shared and is never edited in place.
+ */
+static uint8_t cmd_record_stop(const uint8_t *args, int length,
+                               Frame *reply) {
+  Macro macro;
+
+  if (length != 3 || args[1] >= XBOX_BUTTON_COUNT || args[2] >= MAX_LAYERS) {
+    return CTL_BAD_REQUEST;
+  }
+  const EngineDevice *dev = engine_device(args[0]);
+  if (!dev || !dev->profile) {
+    return CTL_NO_DEVICE;
+  }
+  if (!macro_is_recording() || macro_record_stop(&macro) <= 0) {
+    return CTL_FAILED;
+  }
+
+  Profile *profile = malloc(sizeof(*profile));
+  if (!profile) {
+    return CTL_FAILED;
+  }
+  *profile = *dev->profile;
+  if (bind_macro(profile, args[2], args[1], &macro) != 0 ||
+      engine_switch_profile(args[0], profile, 1) != 0) {
+    free(profile);
+    return CTL_FAILED;
+  }
+  put_u16(reply, (uint16_t)macro.step_count);
+  return CTL_OK;
+}
+
+static uint8_t cmd_state(const uint8_t *args, int length, Frame *reply) {
+  if (length != 1) {
+    return CTL_BAD_REQUEST;
+  }
+  const EngineDevice *dev = engine_device(args[0]);
+  if (!dev) {
+    return CTL_NO_DEVICE;
+  }
+
+  const ControllerState *state = &dev->state;
+  put_u32(reply, state->button_mask);
+  put_u16(reply, (uint16_t)state->left_thumb_x);
+  put_u16(reply, (uint16_t)state->left_thumb_y);
+  put_u16(reply, (uint16_t)state->right_thumb_x);
+  put_u16(reply, (uint16_t)state->right_thumb_y);
+  put_u8(reply, state->left_trigger);
+  put_u8(reply, state->right_trigger);
+  put_u8(reply, (dev->active ? CTL_FLAG_ACTIVE : 0) |
+                    (dev->paused ? CTL_FLAG_PAUSED : 0));
+  put_u32(reply, dev->translator.layer_state);
+  return CTL_OK;
+}
+
+static void send_reply(ControlClient *client, Frame *reply, uint8_t status) {
+  if (status != CTL_OK) {
+    reply->length = 3;
+  }
+  reply->data[2] = status;
+  end_frame(reply);
+
+  /* Replies are tiny; a client that cannot take one is dropped */
+  if (send(client->fd, reply->data, reply->length, MSG_NOSIGNAL) !=
+      (ssize_t)reply->length) {
+    close_client(client);
+  }
+}
+
+static void handle_request(ControlClient *client, const uint8_t *body,
+                           int length) {
+  Frame reply;
+  const uint8_t *args = body + 1;
+  int arg_length = length - 1;
+  uint8_t status = CTL_OK;
+
+  begin_frame(&reply, CTL_OK);
+  switch (length > 0 ? body[0] : 0) {
+  case CTL_LIST:
+    cmd_list(&reply);
+    break;
+  case CTL_PROFILE:
+    status = cmd_profile(client, args, arg_length);
+    break;
+  case CTL_PAUSE:
+  case CTL_RESUME:
+    status = cmd_pause(args, arg_length, body[0] == CTL_PAUSE);
+    break;
+  case CTL_RECORD_START:
+    macro_record_start();
+    break;
+  case CTL_RECORD_STOP:
+    status = cmd_record_stop(args, arg_length, &reply);
+    break;
+  case CTL_STATE:
+    status = cmd_state(args, arg_length, &reply);
+    break;
+  default:
+    status = CTL_BAD_REQUEST;
+    break;
+  }
+
+  if (status != CTL_DEFERRED) {
+    send_reply(client, &reply, status);
+  }
+}
+
+static void on_client(int fd, uint32_t events, void *data) {
+  ControlClient *client = data;
+  (void)fd;
+
+  if (events & (EPOLLERR | EPOLLHUP)) {
+    close_client(client);
+    return;
+  }
+
+  ssize_t n = read(client->fd, client->buffer + client->used,
+                   sizeof(client->buffer) - client->used);
+  if (n <= 0) {
+    if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+      close_client(client);
+    }
+    return;
+  }
+  client->used += (uint16_t)n;
+
+  while (client->fd >= 0 && client->used >= 2) {
+    uint16_t body = get_u16(client->buffer);
+    if (body == 0 || body > CONTROL_MAX_FRAME) {
+      close_client(client);
+      return;
+    }
+    if (client->used < body + 2) {
+      break;
+    }
+    handle_request(client, client->buffer + 2, body);
+    if (client->fd < 0) {
+      return;
+    }
+    client->used -= body + 2;
+    memmove(client->buffer, client->buffer + body + 2, client->used);
+  }
+}
+
+static void on_accept(int fd, uint32_t events, void *data) {
+  (void)events;
+  (void)data;
+
+  int client_fd = accept(fd, NULL, NULL);
+  if (client_fd < 0) {
+    return;
+  }
+  set_cloexec(client_fd);
+
+  for (int i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+    ControlClient *client = &clients[i];
+    if (client->fd < 0) {
+      if (set_nonblocking(client_fd) != 0 ||
+          engine_watch(client_fd, EPOLLIN, on_client, client) != 0) {
+        break;
+      }
+      client->fd = client_fd;
+      client->used = 0;
+      return;
+    }
+  }
+  close(client_fd);
+}
+
+static void *loader_thread(void *arg) {
+  (void)arg;
+
+  pthread_mutex_lock(&load_lock);
+  for (;;) {
+    while (!load_queued && !load_stopping) {
+      pthread_cond_wait(&load_wake, &load_lock);
+    }
+    if (load_stopping) {
+      break;
+    }
+    pthread_mutex_unlock(&load_lock);
+
+    int result = load_profile(load.profile, load.path);
+
+    pthread_mutex_lock(&load_lock);
+    load.result = result;
+    load_queued = 0;
+    uint64_t one = 1;
+    if (write(load_fd, &one, sizeof(one)) < 0) {
+      perror("Failed to signal profile load");
+    }
+  }
+  pthread_mutex_unlock(&load_lock);
+  return NULL;
+}
+
+/* Engine loop: switches to the parsed profile and answers the client */
+static void on_load_done(int fd, uint32_t events, void *data) {
+  uint64_t value;
+  uint8_t status = CTL_OK;
+  Frame reply;
+  (void)events;
+  (void)data;
+
+  if (read(fd, &value, sizeof(value)) < 0 || !load_busy) {
+    return;
+  }
+  pthread_mutex_lock(&load_lock);
+  int done = !load_queued;
+  int result = load.result;
+  pthread_mutex_unlock(&load_lock);
+  if (!done) {
+    return;
+  }
+  if (result != 0) {
+    fprintf(stderr, "Failed to load profile %s\n", load.path);
+    status = CTL_FAILED;
+  } else if (engine_switch_profile(load.device, load.profile, 1) != 0) {
+    status = CTL_NO_DEVICE;
+  }
+  if (status != CTL_OK) {
+    free(load.profile);
+  }
+  load.profile = NULL;
+  load_busy = 0;
+
+  if (load.client) {
+    begin_frame(&reply, CTL_OK);
+    send_reply(load.client, &reply, status);
+    load.client = NULL;
+  }
+}
+
+static int start_loader(void) {
+  load_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (load_fd < 0) {
+    perror("Failed to create profile load eventfd");
+    return -1;
+  }
+  load_busy = 0;
+  load_queued = 0;
+  load_stopping = 0;
+  if (engine_watch(load_fd, EPOLLIN, on_load_done, NULL) != 0 ||
+      pthread_create(&loader, NULL, loader_thread, NULL) != 0) {
+    fprintf(stderr, "Failed to start the profile loader\n");
+    engine_unwatch(load_fd);
+    close(load_fd);
+    load_fd = -1;
+    return -1;
+  }
+  return 0;
+}
+
+/* Waits out a load in progress; a profile never handed over is freed */
+static void stop_loader(void) {
+  if (load_fd < 0) {
+    return;
+  }
+  pthread_mutex_lock(&load_lock);
+  load_stopping = 1;
+  pthread_cond_signal(&load_wake);
+  pthread_mutex_unlock(&load_lock);
+  pthread_join(loader, NULL);
+
+  if (load_busy) {
+    free(load.profile);
+    load.profile = NULL;
+    load_busy = 0;
+  }
+  engine_unwatch(load_fd);
+  close(load_fd);
+  load_fd = -1;
+}
+
+/* Call after engine_init() and before the engine thread starts */
+int control_start(const char *path) {
+  struct sockaddr_un addr;
+
+  for (int i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+    clients[i].fd = -1;
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "Control socket path too long: %s\n", path);
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+
+  listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listen_fd < 0) {
+    perror("Failed to create control socket");
+    return -1;
+  }
+  set_cloexec(listen_fd);
+  unlink(path);
+
+  if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      chmod(path, 0600) != 0 || listen(listen_fd, CONTROL_MAX_CLIENTS) != 0 ||
+      set_nonblocking(listen_fd) != 0 ||
+      engine_watch(listen_fd, EPOLLIN, on_accept, NULL) != 0) {
+    fprintf(stderr, "Failed to listen on %s: %s\n", path, strerror(errno));
+    close(listen_fd);
+    listen_fd = -1;
+    return -1;
+  }
+  strcpy(socket_path, path);
+  if (start_loader() != 0) {
+    fprintf(stderr, "Profile switching over the socket is unavailable\n");
+  }
+  return 0;
+}
+
+/* Call once the engine thread has stopped */
+void control_stop(void) {
+  if (listen_fd < 0) {
+    return;
+  }
+  for (int i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+    if (clients[i].fd >= 0) {
+      close_client(&clients[i]);
+    }
+  }
+  engine_unwatch(listen_fd);
+  close(listen_fd);
+  listen_fd = -1;
+  unlink(socket_path);
+  stop_loader();
+}
+
+static int read_full(int fd, uint8_t *buffer, size_t length) {
+  size_t done = 0;
+  while (done < length) {
+    ssize_t n = read(fd, buffer + done, length - done);
+    if (n <= 0) {
+      return -1;
+    }
+    done += (size_t)n;
+  }
+  return 0;
+}
+
+static int transact(const char *path, const Frame *request, uint8_t *reply,
+                    uint16_t *reply_length) {
+  struct sockaddr_un addr;
+  uint8_t header[2];
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+
+  if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    fprintf(stderr, "Failed to connect to %s: %s\n", path, strerror(errno));
+    if (fd >= 0) {
+      close(fd);
+    }
+    return -1;
+  }
+
+  if (write(fd, request->data, request->length) != (ssize_t)request->length ||
+      read_full(fd, header, 2) != 0 ||
+      (*reply_length = get_u16(header)) > CONTROL_MAX_FRAME ||
+      *reply_length == 0 || read_full(fd, reply, *reply_length) != 0) {
+    fprintf(stderr, "Control request failed\n");
+    close(fd);
+    return -1;
+  }
+  close(fd);
+  return 0;
+}
+
+static const char *status_string(uint8_t status) {
+  switch (status) {
+  case CTL_OK:
+    return "ok";
+  case CTL_BAD_REQUEST:
+    return "bad request";
+  case CTL_NO_DEVICE:
+    return "no such device";
+  default:
+    return "failed";
+  }
+}
+
+static void print_list(const uint8_t *data, int length) {
+  int count = length > 0 ? data[0] : 0;
+  int pos = 1;
+
+  printf("%d device(s)\n", count);
+  for (int i = 0; i < count && pos + 7 <= length; i++) {
+    int name_len = data[pos + 6];
+    if (pos + 7 + name_len > length) {
+      break;
+    }
+    printf("  %d: %04x:%04x %-6s %.*s\n", data[pos], get_u16(data + pos + 1),
+           get_u16(data + pos + 3),
+           data[pos + 5] & CTL_FLAG_PAUSED  ? "paused"
+           : data[pos + 5] & CTL_FLAG_ACTIVE ? "active"
+                                             : "gone",
+           name_len, (const char *)data + pos + 7);
+    pos += 7 + name_len;
+  }
+}
+
+static void print_state(const uint8_t *data, int length) {
+  if (length < 19) {
+    return;
+  }
+  printf("buttons: ");
+  for (int i = 0; i < XBOX_BUTTON_COUNT; i++) {
+    if (CHECK_BIT(get_u32(data), i)) {
+      printf("%s ", button_id_to_string(i));
+    }
+  }
+  printf("\nleft stick: %d,%d  right stick: %d,%d\n",
+         (int16_t)get_u16(data + 4), (int16_t)get_u16(data + 6),
+         (int16_t)get_u16(data + 8), (int16_t)get_u16(data + 10));
+  printf("triggers: %d %d\n", data[12], data[13]);
+  printf("%s, layers 0x%02x\n", data[14] & CTL_FLAG_PAUSED ? "paused" : "running",
+         get_u32(data + 15));
+}
+
+static void print_client_usage(void) {
+  fprintf(stderr, "Control commands:\n"
+                  "  list\n"
+                  "  profile DEVICE FILE\n"
+                  "  pause [DEVICE]\n"
+                  "  resume [DEVICE]\n"
+                  "  record start\n"
+                  "  record stop DEVICE BUTTON [LAYER]\n"
+                  "  state DEVICE\n");
+}
+
+/* argv holds the command words after --ctl */
+int run_control_client(const char *path, int argc, char **argv) {
+  Frame request;
+  uint8_t reply[CONTROL_MAX_FRAME];
+  uint16_t reply_length;
+  const char *cmd = argc > 0 ? argv[0] : "";
+
+  if (strcmp(cmd, "list") == 0) {
+    begin_frame(&request, CTL_LIST);
+  } else if (strcmp(cmd, "profile") == 0 && argc == 3) {
+    begin_frame(&request, CTL_PROFILE);
+    put_u8(&request, (uint8_t)atoi(argv[1]));
+    for (const char *p = argv[2]; *p; p++) {
+      put_u8(&request, (uint8_t)*p);
+    }
+  } else if ((strcmp(cmd, "pause") == 0 || strcmp(cmd, "resume") == 0) &&
+             argc <= 2) {
+    begin_frame(&request, cmd[0] == 'p' ? CTL_PAUSE : CTL_RESUME);
+    put_u8(&request, argc == 2 ? (uint8_t)atoi(argv[1]) : CONTROL_ALL_DEVICES);
+  } else if (strcmp(cmd, "record") == 0 && argc == 2 &&
+             strcmp(argv[1], "start") == 0) {
+    begin_frame(&request, CTL_RECORD_START);
+  } else if (strcmp(cmd, "record") == 0 && (argc == 4 || argc == 5) &&
+             strcmp(argv[1], "stop") == 0) {
+    int button = button_id_from_string(argv[3]);
+    if (button < 0) {
+      fprintf(stderr, "Unknown button: %s\n", argv[3]);
+      return -1;
+    }
+    begin_frame(&request, CTL_RECORD_STOP);
+    put_u8(&request, (uint8_t)atoi(argv[2]));
+    put_u8(&request, (uint8_t)button);
+    put_u8(&request, argc == 5 ? (uint8_t)atoi(argv[4]) : 0);
+  } else if (strcmp(cmd, "state") == 0 && argc == 2) {
+    begin_frame(&request, CTL_STATE);
+    put_u8(&request, (uint8_t)atoi(argv[1]));
+  } else {
+    print_client_usage();
+    return -1;
+  }
+  end_frame(&request);
+
+  if (transact(path, &request, reply, &reply_length) != 0) {
+    return -1;
+  }
+  if (reply[0] != CTL_OK) {
+    fprintf(stderr, "%s: %s\n", cmd, status_string(reply[0]));
+    return -1;
+  }
+
+  if (request.data[2] == CTL_LIST) {
+    print_list(reply + 1, reply_length - 1);
+  } else if (request.data[2] == CTL_STATE) {
+    print_state(reply + 1, reply_length - 1);
+  } else if (request.data[2] == CTL_RECORD_STOP && reply_length >= 3) {
+    printf("Recorded %d steps\n", get_u16(reply + 1));
+  } else {
+    printf("ok\n");
+  }
+  return 0;
+}
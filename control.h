@@ -0,0 +1,47 @@
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include <stdint.h>
+
+/*
+ * Control socket for a running translator. Every frame is a little-endian
+ * u16 body length followed by the body; a request body is an opcode and
+ * its arguments, a response body a status and its result. Requests run on
+ * the engine loop between reports, so nothing on the input path locks.
+ * CTL_PROFILE reads its file on a loader thread instead and replies once
+ * the device has switched to it.
+ */
+
+#define CONTROL_SOCKET_PATH "/run/faky-controller.sock"
+#define CONTROL_MAX_FRAME 512
+#define CONTROL_MAX_CLIENTS 8
+#define CONTROL_ALL_DEVICES 0xff
+
+typedef enum {
+  CTL_LIST = 1,         /* -> u8 count, {u8 index, u16 vid, u16 pid,
+                           u8 flags, u8 name_len, name}... */
+  CTL_PROFILE = 2,      /* u8 device, path */
+  CTL_PAUSE = 3,        /* u8 device or CONTROL_ALL_DEVICES */
+  CTL_RESUME = 4,       /* u8 device or CONTROL_ALL_DEVICES */
+  CTL_RECORD_START = 5, /* */
+  CTL_RECORD_STOP = 6,  /* u8 device, u8 button, u8 layer -> u16 steps */
+  CTL_STATE = 7,        /* u8 device -> u32 buttons, 4 x i16 sticks,
+                           2 x u8 triggers, u8 flags, u32 layers */
+} ControlOpcode;
+
+typedef enum {
+  CTL_OK = 0,
+  CTL_BAD_REQUEST = 1,
+  CTL_NO_DEVICE = 2,
+  CTL_FAILED = 3,
+} ControlStatus;
+
+#define CTL_FLAG_ACTIVE 0x01
+#define CTL_FLAG_PAUSED 0x02
+
+const char *control_socket_path(void);
+int control_start(const char *path);
+void control_stop(void);
+int run_control_client(const char *path, int argc, char **argv);
+
+#endif /* CONTROL_H */
@@ -1,15 +1,11 @@
 #include "controller.h"
+#include "recovery.h"
 #include <libusb-1.0/libusb.h>
-#include <pthread.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
 #include <unistd.h>
-#include <errno.h>
-
-static volatile int keep_reading = 0;
-static libusb_device_handle *active_handle = NULL;
 
 /*
  *
@@ -68,16 +64,21 @@ int wait_for_button_press(libusb_device_handle *handle, const char *button_name,
             continue;
         }
 
+        if (ret == LIBUSB_ERROR_NO_DEVICE) {
+            fprintf(stderr, "Controller disconnected\n");
+            return -1;
+        }
+
+        /* libusb returns its own codes, errno says nothing here */
         if (ret < 0) {
-            if (errno == EBUSY) {
-                fprintf(stderr, "Device busy, reinitializing interface...\n");
-                release_interface_safe(handle);
-                usleep(100000); 
-                if (claim_interface_safe(handle) != 0) {
-                    fprintf(stderr, "Failed to reinitialize interface\n");
+            if (ret == LIBUSB_ERROR_PIPE || ret == LIBUSB_ERROR_BUSY) {
+                DeviceHealth step = recovery_step_for_error(ret);
+                fprintf(stderr, "Transfer failed (%s), %s\n",
+                        libusb_strerror(ret), device_health_name(step));
+                if (recovery_run_step(handle, step) != 0) {
+                    fprintf(stderr, "Failed to recover the interface\n");
                     return -1;
                 }
-                printf("Interface reinitialized successfully\n");
             }
             attempts++;
             continue;
@@ -197,57 +198,89 @@ int interactive_setup(libusb_device_handle *handle, ControllerConfig *config) {
   return 0;
 }
 
-int read_controller_input_with_config(libusb_device_handle *handle,
-                                      ControllerState *state,
-                                      const ControllerConfig *config) {
-  uint8_t buffer[MAX_INPUT_PACKET_SIZE];
-  int actual_length;
-  int ret;
-
-  ret = libusb_interrupt_transfer(handle, 0x81, buffer, sizeof(buffer),
-                                  &actual_length, 0);
-
-  if (ret == LIBUSB_ERROR_TIMEOUT) {
-    return 0;
-  }
-
-  if (ret < 0 || actual_length < 20) {
+/* Wired Xbox 360 report layout, used when no discovered config is given */
+static const ControllerConfig default_config = {
+    .a_button_byte = 3,     .a_button_bit = 4,
+    .b_button_byte = 3,     .b_button_bit = 5,
+    .x_button_byte = 3,     .x_button_bit = 6,
+    .y_button_byte = 3,     .y_button_bit = 7,
+    .lb_button_byte = 3,    .lb_button_bit = 0,
+    .rb_button_byte = 3,    .rb_button_bit = 1,
+    .back_button_byte = 2,  .back_button_bit = 5,
+    .start_button_byte = 2, .start_button_bit = 4,
+    .l3_button_byte = 2,    .l3_button_bit = 6,
+    .r3_button_byte = 2,    .r3_button_bit = 7,
+    .xbox_button_byte = 3,  .xbox_button_bit = 2,
+    .dpad_up_byte = 2,      .dpad_up_bit = 0,
+    .dpad_down_byte = 2,    .dpad_down_bit = 1,
+    .dpad_left_byte = 2,    .dpad_left_bit = 2,
+    .dpad_right_byte = 2,   .dpad_right_bit = 3,
+    .controller_name = "Xbox 360 (default)",
+};
+
+/* The wired Xbox 360 report layout, used when a device has no profile */
+void get_default_config(ControllerConfig *config) { *config = default_config; }
+
+static const char *button_ids[XBOX_BUTTON_COUNT] = {
+    "a",     "b",  "x",  "y",       "lb",        "rb",        "back",      "start",
+    "xbox",  "l3", "r3", "dpad_up", "dpad_down", "dpad_left", "dpad_right"};
+
+#define REPORT_BIT(buffer, byte, bit) (((buffer)[(byte)] >> (bit)) & 1)
+
+int decode_input_report(const uint8_t *buffer, int length,
+                        const ControllerConfig *config,
+                        ControllerState *state) {
+  if (length < 20) {
     return -1;
   }
+  if (!config) {
+    config = &default_config;
+  }
+
+  memcpy(state->buttons, &buffer[2], sizeof(state->buttons));
 
-  state->a_button =
-      (buffer[config->a_button_byte] & (1 << config->a_button_bit)) ? 1 : 0;
-  state->b_button =
-      (buffer[config->b_button_byte] & (1 << config->b_button_bit)) ? 1 : 0;
-  state->x_button =
-      (buffer[config->x_button_byte] & (1 << config->x_button_bit)) ? 1 : 0;
-  state->y_button =
-      (buffer[config->y_button_byte] & (1 << config->y_button_bit)) ? 1 : 0;
+  state->a_button = REPORT_BIT(buffer, config->a_button_byte, config->a_button_bit);
+  state->b_button = REPORT_BIT(buffer, config->b_button_byte, config->b_button_bit);
+  state->x_button = REPORT_BIT(buffer, config->x_button_byte, config->x_button_bit);
+  state->y_button = REPORT_BIT(buffer, config->y_button_byte, config->y_button_bit);
   state->lb_button =
-      (buffer[config->lb_button_byte] & (1 << config->lb_button_bit)) ? 1 : 0;
+      REPORT_BIT(buffer, config->lb_button_byte, config->lb_button_bit);
   state->rb_button =
-      (buffer[config->rb_button_byte] & (1 << config->rb_button_bit)) ? 1 : 0;
+      REPORT_BIT(buffer, config->rb_button_byte, config->rb_button_bit);
   state->back_button =
-      (buffer[config->back_button_byte] & (1 << config->back_button_bit)) ? 1
-                                                                          : 0;
+      REPORT_BIT(buffer, config->back_button_byte, config->back_button_bit);
   state->start_button =
-      (buffer[config->start_button_byte] & (1 << config->start_button_bit)) ? 1
-                                                                            : 0;
+      REPORT_BIT(buffer, config->start_button_byte, config->start_button_bit);
   state->l3_button =
-      (buffer[config->l3_button_byte] & (1 << config->l3_button_bit)) ? 1 : 0;
+      REPORT_BIT(buffer, config->l3_button_byte, config->l3_button_bit);
   state->r3_button =
-      (buffer[config->r3_button_byte] & (1 << config->r3_button_bit)) ? 1 : 0;
+      REPORT_BIT(buffer, config->r3_button_byte, config->r3_button_bit);
   state->xbox_button =
-      (buffer[config->xbox_button_byte] & (1 << config->xbox_button_bit)) ? 1
-                                                                          : 0;
-  state->dpad_up =
-      (buffer[config->dpad_up_byte] & (1 << config->dpad_up_bit)) ? 1 : 0;
+      REPORT_BIT(buffer, config->xbox_button_byte, config->xbox_button_bit);
+  state->dpad_up = REPORT_BIT(buffer, config->dpad_up_byte, config->dpad_up_bit);
   state->dpad_down =
-      (buffer[config->dpad_down_byte] & (1 << config->dpad_down_bit)) ? 1 : 0;
+      REPORT_BIT(buffer, config->dpad_down_byte, config->dpad_down_bit);
   state->dpad_left =
-      (buffer[config->dpad_left_byte] & (1 << config->dpad_left_bit)) ? 1 : 0;
+      REPORT_BIT(buffer, config->dpad_left_byte, config->dpad_left_bit);
   state->dpad_right =
-      (buffer[config->dpad_right_byte] & (1 << config->dpad_right_bit)) ? 1 : 0;
+      REPORT_BIT(buffer, config->dpad_right_byte, config->dpad_right_bit);
+
+  state->button_mask =
+      (uint32_t)state->a_button << XBOX_BUTTON_A |
+      (uint32_t)state->b_button << XBOX_BUTTON_B |
+      (uint32_t)state->x_button << XBOX_BUTTON_X |
+      (uint32_t)state->y_button << XBOX_BUTTON_Y |
+      (uint32_t)state->lb_button << XBOX_BUTTON_LB |
+      (uint32_t)state->rb_button << XBOX_BUTTON_RB |
+      (uint32_t)state->back_button << XBOX_BUTTON_BACK |
+      (uint32_t)state->start_button << XBOX_BUTTON_START |
+      (uint32_t)state->xbox_button << XBOX_BUTTON_HOME |
+      (uint32_t)state->l3_button << XBOX_BUTTON_L3 |
+      (uint32_t)state->r3_button << XBOX_BUTTON_R3 |
+      (uint32_t)state->dpad_up << XBOX_BUTTON_DPAD_UP |
+      (uint32_t)state->dpad_down << XBOX_BUTTON_DPAD_DOWN |
+      (uint32_t)state->dpad_left << XBOX_BUTTON_DPAD_LEFT |
+      (uint32_t)state->dpad_right << XBOX_BUTTON_DPAD_RIGHT;
 
   state->left_trigger = buffer[4];
   state->right_trigger = buffer[5];
@@ -256,78 +289,40 @@ int read_controller_input_with_config(libusb_device_handle *handle,
   state->right_thumb_x = (int16_t)((buffer[11] << 8) | buffer[10]);
   state->right_thumb_y = (int16_t)((buffer[13] << 8) | buffer[12]);
 
-  return 1;
-}
-
-void *input_reader_thread(void *arg) {
-  (void)arg;
-  ControllerState state;
-
-  while (keep_reading) {
-    int result = read_input(active_handle, &state);
-
-    if (result > 0) {
-      /*      printf("Buttons: A:%d B:%d X:%d Y:%d | ", state.a_button,
-         state.b_button, state.x_button, state.y_button); printf("LB:%d RB:%d |
-         ", state.lb_button, state.rb_button); printf("Back:%d Start:%d | ",
-         state.back_button, state.start_button); printf("L3:%d R3:%d Xbox:%d |
-         ", state.l3_button, state.r3_button, state.xbox_button); printf("D-pad:
-         U:%d R:%d D:%d L:%d | ", state.dpad_up, state.dpad_right,
-                   state.dpad_down, state.dpad_left);
-            printf("L: (%d,%d) R: (%d,%d) | ", state.left_thumb_x,
-         state.left_thumb_y, state.right_thumb_x, state.right_thumb_y);
-            printf("Triggers: L:%d R:%d\n", state.left_trigger,
-         state.right_trigger);
-      */
-    } else if (result < 0) {
-      break;
-    }
-    usleep(10000);
-  }
-  return NULL;
+  return 0;
 }
 
-int start_input_reader(libusb_device_handle *handle) {
-  pthread_t thread;
+int read_controller_input_with_config(libusb_device_handle *handle,
+                                      ControllerState *state,
+                                      const ControllerConfig *config) {
+  uint8_t buffer[MAX_INPUT_PACKET_SIZE];
+  int actual_length;
   int ret;
 
-  if (libusb_kernel_driver_active(handle, 0) == 1) {
-    ret = libusb_detach_kernel_driver(handle, 0);
-    if (ret != 0) {
-      fprintf(stderr, "Failed to detach kernel driver: %s\n",
-              libusb_strerror(ret));
-      return -1;
-    }
-    printf("Kernel driver detached");
-  }
-  ret = libusb_claim_interface(handle, 0);
-  if (ret != 0) {
-    fprintf(stderr, "Failed to claim the interface: %s\n",
-            libusb_strerror(ret));
-    return -1;
-  }
+  ret = libusb_interrupt_transfer(handle, 0x81, buffer, sizeof(buffer),
+                                  &actual_length, 0);
 
-  active_handle = handle;
-  keep_reading = 1;
+  if (ret == LIBUSB_ERROR_TIMEOUT) {
+    return 0;
+  }
 
-  ret = pthread_create(&thread, NULL, input_reader_thread, NULL);
-  if (ret != 0) {
-    fprintf(stderr, "Failed to innitialize reader thread\n");
-    keep_reading = 0;
-    libusb_release_interface(handle, 0);
+  if (ret < 0 || decode_input_report(buffer, actual_length, config, state) != 0) {
     return -1;
   }
 
-  pthread_detach(thread);
-  return 0;
+  return 1;
 }
 
-void stop_input_reader() {
-  keep_reading = 0;
-  if (active_handle) {
-    libusb_release_interface(active_handle, 0);
-    active_handle = NULL;
+int read_input(libusb_device_handle *handle, ControllerState *state) {
+  uint8_t buffer[MAX_INPUT_PACKET_SIZE];
+  int actual_length;
+
+  if (libusb_interrupt_transfer(handle, 0x81, buffer, sizeof(buffer),
+                                &actual_length, 100) != 0) {
+    return -1;
   }
+
+  return decode_input_report(buffer, actual_length, NULL, state);
 }
 
 int is_button_pressed(const ControllerState *state, int button) {
@@ -365,9 +360,13 @@ ControllerType detect_controller_type(libusb_device *device) {
   if (libusb_get_device_descriptor(device, &DESC) != 0) {
     return CONTROLLER_TYPE_UNKNOWN;
   }
+  return controller_type_from_ids(DESC.idVendor, DESC.idProduct);
+}
 
-  if (DESC.idVendor == VENDOR_MICROSOFT) {
-    switch (DESC.idProduct) {
+ControllerType controller_type_from_ids(uint16_t vendor_id,
+                                        uint16_t product_id) {
+  if (vendor_id == VENDOR_MICROSOFT) {
+    switch (product_id) {
     case PRODUCT_XBOX_360:
     case PRODUCT_XBOX_360_W:
       return CONTROLLER_TYPE_XBOX_360;
@@ -378,8 +377,8 @@ ControllerType detect_controller_type(libusb_device *device) {
     }
   }
 
-  if (DESC.idVendor == VENDOR_SONY) {
-    switch (DESC.idProduct) {
+  if (vendor_id == VENDOR_SONY) {
+    switch (product_id) {
     case PRODUCT_DS3:
       return CONTROLLER_TYPE_PLAYSTATION_DS3;
     case PRODUCT_DS4:
@@ -388,8 +387,8 @@ ControllerType detect_controller_type(libusb_device *device) {
     }
   }
 
-  if (DESC.idVendor == VENDOR_NINTENDO) {
-    switch (DESC.idProduct) {
+  if (vendor_id == VENDOR_NINTENDO) {
+    switch (product_id) {
     case PRODUCT_SWITCH_PRO:
     case PRODUCT_JOYCON_L:
     case PRODUCT_JOYCON_R:
@@ -397,8 +396,8 @@ ControllerType detect_controller_type(libusb_device *device) {
     }
   }
 
-  if (DESC.idVendor == VENDOR_LOGITECH) {
-    switch (DESC.idProduct) {
+  if (vendor_id == VENDOR_LOGITECH) {
+    switch (product_id) {
     case PRODUCT_F310:
     case PRODUCT_F510:
     case PRODUCT_F710:
@@ -406,8 +405,7 @@ ControllerType detect_controller_type(libusb_device *device) {
     }
   }
 
-  if (DESC.idVendor == VENDOR_VALVE &&
-      DESC.idProduct == PRODUCT_STEAM_CONTROLLER) {
+  if (vendor_id == VENDOR_VALVE && product_id == PRODUCT_STEAM_CONTROLLER) {
     return CONTROLLER_TYPE_OTHER;
   }
   return CONTROLLER_TYPE_UNKNOWN;
@@ -437,6 +435,24 @@ int get_controller_name(libusb_device *device, char *name, size_t name_size) {
   return 0;
 }
 
+/* Empty when the pad has no serial number string */
+int get_controller_serial(libusb_device_handle *handle, char *serial,
+                          size_t size) {
+  struct libusb_device_descriptor desc;
+
+  serial[0] = '\0';
+  if (libusb_get_device_descriptor(libusb_get_device(handle), &desc) != 0) {
+    return -1;
+  }
+  if (desc.iSerialNumber == 0 ||
+      libusb_get_string_descriptor_ascii(handle, desc.iSerialNumber,
+                                         (unsigned char *)serial,
+                                         (int)size) < 0) {
+    serial[0] = '\0';
+  }
+  return 0;
+}
+
 int find_all_controllers(libusb_context *lctx, ControllerInfo **controllers,
                          int *count) {
   libusb_device **list;
@@ -683,3 +699,19 @@ void free_controllers(ControllerInfo *controllers, int count) {
     free(controllers);
   }
 }
+
+const char *button_id_to_string(int button) {
+  if (button >= 0 && button < XBOX_BUTTON_COUNT) {
+    return button_ids[button];
+  }
+  return "unknown";
+}
+
+int button_id_from_string(const char *name) {
+  for (int i = 0; i < XBOX_BUTTON_COUNT; i++) {
+    if (strcmp(button_ids[i], name) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
\ No newline at end of file
@@ -57,6 +57,11 @@ typedef enum {
 #define XBOX_BUTTON_HOME 8
 #define XBOX_BUTTON_L3 9
 #define XBOX_BUTTON_R3 10
+#define XBOX_BUTTON_DPAD_UP 11
+#define XBOX_BUTTON_DPAD_DOWN 12
+#define XBOX_BUTTON_DPAD_LEFT 13
+#define XBOX_BUTTON_DPAD_RIGHT 14
+#define XBOX_BUTTON_COUNT 15
 
 typedef struct {
   libusb_device *device;
@@ -68,6 +73,7 @@ typedef struct {
 
 typedef struct {
   uint8_t buttons[4];
+  uint32_t button_mask; /* bit n set when XBOX_BUTTON_n is held */
 
   uint8_t a_button;
   uint8_t b_button;
@@ -144,25 +150,32 @@ typedef struct {
 } ControllerConfig;
 
 ControllerType detect_controller_type(libusb_device *device);
+ControllerType controller_type_from_ids(uint16_t vendor_id,
+                                        uint16_t product_id);
 int is_controller(libusb_device *device);
 int open_controller(libusb_device *device, libusb_device_handle **handle);
 void close_controller(libusb_device_handle *handle);
 int get_controller_name(libusb_device *device, char *name, size_t name_size);
+int get_controller_serial(libusb_device_handle *handle, char *serial,
+                          size_t size);
 int find_all_controllers(libusb_context *lctx, ControllerInfo **controllers,
                          int *count);
 const char *controller_type_to_string(ControllerType type);
 void free_controllers(ControllerInfo *controllers, int count);
 int read_input(libusb_device_handle *handle, ControllerState *state);
-int start_input_reader(libusb_device_handle *handle);
-void stop_input_reader();
+int decode_input_report(const uint8_t *buffer, int length,
+                        const ControllerConfig *config, ControllerState *state);
 int is_button_pressed(const ControllerState *state, int button);
 int interactive_setup(libusb_device_handle *handle, ControllerConfig *config);
 void save_config(const ControllerConfig *config, const char *filename);
 int load_config(ControllerConfig *config, const char *filename);
+void get_default_config(ControllerConfig *config);
 int read_controller_input_with_config(libusb_device_handle *handle,
                                       ControllerState *state,
                                       const ControllerConfig *config);
 int claim_interface_safe(libusb_device_handle *handle);
 void release_interface_safe(libusb_device_handle *handle);
+const char *button_id_to_string(int button);
+int button_id_from_string(const char *name);
 
 #endif /* CONTROLLER_H */
@@ -0,0 +1,88 @@
+#include "debounce.h"
+#include "utils.h"
+#include <string.h>
+
+/* count += ms for every button at once, ripple carry across the planes */
+static void advance(uint32_t *count, uint32_t ms) {
+  uint32_t carry = 0;
+
+  for (int i = 0; i < DEBOUNCE_BITS; i++) {
+    uint32_t add = 0u - ((ms >> i) & 1);
+    uint32_t sum = count[i] ^ add ^ carry;
+    carry = (count[i] & add) | (carry & (count[i] ^ add));
+    count[i] = sum;
+  }
+  /* Overflowed counters stick at DEBOUNCE_MAX_MS */
+  for (int i = 0; i < DEBOUNCE_BITS; i++) {
+    count[i] |= carry;
+  }
+}
+
+/* Buttons whose a >= b, compared from the top plane down */
+static uint32_t at_least(const uint32_t *a, const uint32_t *b) {
+  uint32_t greater = 0;
+  uint32_t equal = ~0u;
+
+  for (int i = DEBOUNCE_BITS - 1; i >= 0; i--) {
+    greater |= equal & a[i] & ~b[i];
+    equal &= ~(a[i] ^ b[i]);
+  }
+  return greater | equal;
+}
+
+static void reset(uint32_t *count, uint32_t buttons) {
+  for (int i = 0; i < DEBOUNCE_BITS; i++) {
+    count[i] &= ~buttons;
+  }
+}
+
+/* A NULL config, or one with no windows, disables the filter */
+void debounce_init(Debouncer *deb, const DebounceConfig *config) {
+  memset(deb, 0, sizeof(*deb));
+  if (!config) {
+    return;
+  }
+
+  for (int button = 0; button < XBOX_BUTTON_COUNT; button++) {
+    uint32_t window = MIN(config->window_ms[button], DEBOUNCE_MAX_MS);
+    for (int i = 0; i < DEBOUNCE_BITS; i++) {
+      deb->window[i] |= ((window >> i) & 1u) << button;
+    }
+    deb->enabled |= window != 0;
+  }
+  deb->deferred = config->deferred;
+
+  /* Nothing has changed for a long time, so the first press goes through */
+  for (int i = 0; i < DEBOUNCE_BITS; i++) {
+    deb->count[i] = ~0u;
+  }
+}
+
+/*
+ * Filters one report's raw mask, returning the debounced one. Also called
+ * with an unchanged mask when debounce_pending(), so held-back changes go
+ * through once their window has passed.
+ */
+uint32_t debounce_update(Debouncer *deb, uint32_t raw, uint64_t now) {
+  uint64_t ms = now / NSEC_PER_MSEC;
+  uint64_t elapsed = ms - deb->last_ms;
+
+  deb->last_ms = ms;
+  advance(deb->count, (uint32_t)MIN(elapsed, DEBOUNCE_MAX_MS));
+
+  /* Deferred buttons time from their last raw change */
+  reset(deb->count, (raw ^ deb->raw) & deb->deferred);
+  deb->raw = raw;
+
+  uint32_t changed = raw ^ deb->stable;
+  uint32_t accept = changed & at_least(deb->count, deb->window);
+  deb->stable ^= accept;
+
+  /* Eager buttons time from their last accepted change */
+  reset(deb->count, accept & ~deb->deferred);
+
+  deb->suppressed += changed != accept;
+  return deb->stable;
+}
+
+int debounce_pending(const Debouncer *deb) { return deb->raw != deb->stable; }
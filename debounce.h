@@ -0,0 +1,45 @@
+#ifndef DEBOUNCE_H
+#define DEBOUNCE_H
+
+#include "controller.h"
+#include <stdint.h>
+
+/*
+ * Contact bounce filter over the packed button mask. Each button has a
+ * window in ms and one of two modes:
+ *   eager     a change goes through at once, then the button ignores
+ *             changes until its window has passed (no added latency)
+ *   deferred  a change only goes through once the button has held still
+ *             for its window (also rejects single-report glitches)
+ * The per-button ms counters and windows are stored bit-sliced, plane i
+ * holding bit i of every button's value, so advancing, resetting and
+ * comparing them is a fixed handful of word operations for all buttons
+ * at once, with no per-button branches.
+ */
+
+#define DEBOUNCE_BITS 5
+#define DEBOUNCE_MAX_MS ((1 << DEBOUNCE_BITS) - 1)
+
+typedef char debounce_buttons_fit[XBOX_BUTTON_COUNT <= 32 ? 1 : -1];
+
+typedef struct {
+  uint8_t window_ms[XBOX_BUTTON_COUNT]; /* 0 leaves the button unfiltered */
+  uint32_t deferred;                    /* buttons in deferred mode */
+} DebounceConfig;
+
+typedef struct {
+  uint32_t window[DEBOUNCE_BITS];
+  uint32_t count[DEBOUNCE_BITS]; /* ms since the last change, saturating */
+  uint32_t deferred;
+  uint32_t raw;
+  uint32_t stable;
+  uint64_t last_ms;
+  int enabled;
+  uint64_t suppressed; /* reports where a raw change was held back */
+} Debouncer;
+
+void debounce_init(Debouncer *deb, const DebounceConfig *config);
+uint32_t debounce_update(Debouncer *deb, uint32_t raw, uint64_t now);
+int debounce_pending(const Debouncer *deb);
+
+#endif /* DEBOUNCE_H */
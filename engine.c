@@ -0,0 +1,1168 @@
+#include "engine.h"
+#include "fanout.h"
+#include "netstream.h"
+#include "trace.h"
+#include "turbo.h"
+#include "uring.h"
+#include "utils.h"
+#include <errno.h>
+#include <linux/input.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#define MAX_EPOLL_EVENTS 32
+#define MAX_WATCHES 48
+#define HIDRAW_MIN_REPORT 20
+
+typedef struct {
+  int fd;
+  engine_fd_fn fn;
+  void *data;
+} Watch;
+
+static libusb_context *usb_ctx = NULL;
+static int epoll_fd = -1;
+static int wake_fd = -1;
+static int notify_fd = -1;
+static volatile int notify_enabled = 0;
+static int published = 0;
+static Watch watches[MAX_WATCHES];
+static int watch_count = 0;
+static TimerWheel timers;
+static OutputDevice output = {.fd = -1};
+static EngineDevice devices[MAX_DEVICES];
+static int device_count = 0;
+static pthread_t reader_thread;
+static volatile int keep_reading = 0;
+static RealtimeConfig realtime = {0, -1, RT_DEFAULT_PRIORITY};
+static UringReader ring;
+static int ring_wanted = 0;
+static int ring_open = 0;
+static Calibration calibration;
+static int calibration_set = 0;
+static ProfileBundle *bundle = NULL;
+static const int bundle_picks[4] = {XBOX_BUTTON_A, XBOX_BUTTON_B,
+                                    XBOX_BUTTON_X, XBOX_BUTTON_Y};
+
+static void watch_fd(int fd, uint32_t events) {
+  struct epoll_event ev;
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events = events;
+  ev.data.fd = fd;
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0 && errno == EEXIST) {
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+  }
+}
+
+static void wake_engine(void) {
+  uint64_t one = 1;
+
+  if (wake_fd >= 0 && write(wake_fd, &one, sizeof(one)) < 0) {
+    perror("Failed to wake reader thread");
+  }
+}
+
+static void LIBUSB_CALL usb_fd_added(int fd, short events, void *user_data) {
+  (void)user_data;
+  watch_fd(fd, (events & POLLIN ? EPOLLIN : 0) |
+                   (events & POLLOUT ? EPOLLOUT : 0));
+}
+
+static void LIBUSB_CALL usb_fd_removed(int fd, void *user_data) {
+  (void)user_data;
+  epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+/* Edges against the previous snapshot, for event subscribers */
+static void publish_events(EngineDevice *dev, const ControllerState *state,
+                           uint64_t now) {
+  const ControllerState *old = &dev->snapshot;
+  uint8_t index = (uint8_t)(dev - devices);
+  uint32_t changed = old->button_mask ^ state->button_mask;
+  int32_t before[6] = {old->left_thumb_x,  old->left_thumb_y,
+                       old->right_thumb_x, old->right_thumb_y,
+                       old->left_trigger,  old->right_trigger};
+  int32_t after[6] = {state->left_thumb_x,  state->left_thumb_y,
+                      state->right_thumb_x, state->right_thumb_y,
+                      state->left_trigger,  state->right_trigger};
+
+  for (int i = 0; changed; i++, changed >>= 1) {
+    if (changed & 1) {
+      fanout_push(index, FANOUT_BUTTON, (uint16_t)i,
+                  CHECK_BIT(state->button_mask, i), now);
+    }
+  }
+  for (int i = 0; i < 6; i++) {
+    if (before[i] != after[i]) {
+      fanout_push(index, FANOUT_AXIS, (uint16_t)i, after[i], now);
+    }
+  }
+}
+
+/* Odd sequence while writing, readers retry instead of waiting */
+static void publish_snapshot(EngineDevice *dev, const ControllerState *state,
+                             uint64_t now) {
+  if (fanout_has_subscribers()) {
+    publish_events(dev, state, now);
+  }
+
+  __atomic_store_n(&dev->snapshot_seq, dev->snapshot_seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  dev->snapshot = *state;
+  __atomic_store_n(&dev->snapshot_seq, dev->snapshot_seq + 1, __ATOMIC_RELEASE);
+  published = 1;
+
+  /* Same state for out-of-process readers; a no-op unless a segment is open */
+  ShmDeviceState shared;
+  shared.vendor_id = dev->vendor_id;
+  shared.product_id = dev->product_id;
+  shared.buttons = state->button_mask;
+  shared.axes[0] = state->left_thumb_x;
+  shared.axes[1] = state->left_thumb_y;
+  shared.axes[2] = state->right_thumb_x;
+  shared.axes[3] = state->right_thumb_y;
+  shared.triggers[0] = state->left_trigger;
+  shared.triggers[1] = state->right_trigger;
+  shared.flags = SHM_FLAG_ACTIVE | (dev->paused ? SHM_FLAG_PAUSED : 0);
+  shared.timestamp_ns = now;
+  shared.sequence = ++dev->reports;
+  shm_publish((int)(dev - devices), &shared);
+}
+
+static void process_state(EngineDevice *dev, const ControllerState *state,
+                          uint64_t now) {
+  publish_snapshot(dev, state, now);
+  if (stream_sending()) {
+    stream_send_state((int)(dev - devices), state);
+  }
+  if (dev->profile && !dev->paused) {
+    translate_state(&dev->translator, state, now);
+  }
+}
+
+static void init_pipeline(EngineDevice *dev, const Profile *profile);
+
+/*
+ * Moves the device onto the bundle's active profile if it changed. This
+ * runs in the report path, so it neither prints nor frees: a profile the
+ * device owned (from the control socket) stays allocated until the next
+ * engine_switch_profile() or shutdown releases it.
+ */
+static void follow_bundle(EngineDevice *dev) {
+  int index = bundle_active(dev->bundle);
+
+  if (index == dev->bundle_index) {
+    return;
+  }
+  translator_reset(&dev->translator);
+  dev->bundle_index = index;
+  dev->profile = &dev->bundle->profiles[index];
+  timer_cancel(&timers, &dev->debounce_timer);
+  init_pipeline(dev, dev->profile);
+}
+
+/*
+ * Guide chords select within the bundle. Guide, and every button pressed
+ * while it is held, stay out of translation until released, so neither
+ * the profile being left nor the one switched to sees the chord.
+ */
+static uint32_t bundle_filter(EngineDevice *dev, uint32_t mask) {
+  ProfileBundle *set = dev->bundle;
+  uint32_t pressed = mask & ~dev->chord_held;
+  uint32_t guide = 1u << XBOX_BUTTON_HOME;
+
+  dev->chord_held = mask;
+  dev->chord_swallow &= mask;
+  if (mask & guide) {
+    int index = bundle_active(set);
+    if (CHECK_BIT(pressed, XBOX_BUTTON_RB)) {
+      bundle_select(set, (index + 1) % set->count);
+    } else if (CHECK_BIT(pressed, XBOX_BUTTON_LB)) {
+      bundle_select(set, (index + set->count - 1) % set->count);
+    }
+    for (int i = 0; i < 4; i++) {
+      if (CHECK_BIT(pressed, bundle_picks[i])) {
+        bundle_select(set, i);
+      }
+    }
+    dev->chord_swallow |= pressed;
+  }
+  follow_bundle(dev);
+  return mask & ~(dev->chord_swallow | guide);
+}
+
+/*
+ * dev->state stays as the pad reported it (evdev events keep applying to
+ * it); everything downstream gets a calibrated, debounced copy.
+ */
+static void handle_state(EngineDevice *dev, uint64_t now) {
+  ControllerState state = dev->state;
+
+  TRACE_BEGIN(TRACE_MAP);
+  tracker_update(&dev->tracker, &state);
+  if (dev->axis_map.enabled) {
+    axis_map_apply(&dev->axis_map, &state);
+  }
+  if (dev->debounce.enabled) {
+    state.button_mask = debounce_update(&dev->debounce, state.button_mask, now);
+    if (debounce_pending(&dev->debounce) &&
+        !timer_pending(&dev->debounce_timer)) {
+      timer_schedule(&timers, &dev->debounce_timer, NSEC_PER_MSEC);
+    }
+  }
+  if (dev->bundle) {
+    state.button_mask = bundle_filter(dev, state.button_mask);
+  }
+  process_state(dev, &state, now);
+  TRACE_END(TRACE_MAP);
+}
+
+/* Re-runs the filter each ms while a change is held back */
+static void on_debounce_timer(Timer *timer, uint64_t now) {
+  EngineDevice *dev = timer->data;
+  ControllerState state = dev->snapshot;
+
+  if (!dev->active) {
+    return;
+  }
+  state.button_mask =
+      debounce_update(&dev->debounce, dev->state.button_mask, now);
+  if (debounce_pending(&dev->debounce)) {
+    timer_schedule(&timers, &dev->debounce_timer, NSEC_PER_MSEC);
+  }
+  if (dev->bundle) {
+    state.button_mask = bundle_filter(dev, state.button_mask);
+  }
+  if (state.button_mask != dev->snapshot.button_mask) {
+    process_state(dev, &state, now);
+  }
+}
+
+static void init_pipeline(EngineDevice *dev, const Profile *profile) {
+  translator_init(&dev->translator, profile, &output, &timers);
+  debounce_init(&dev->debounce, profile ? &profile->debounce : NULL);
+  timer_init(&dev->debounce_timer, on_debounce_timer, dev);
+}
+
+/*
+ * A new device: its pipeline plus the calibration and bundle set for it.
+ * A translated device with a bundle starts on the bundle's active profile.
+ */
+static void setup_device(EngineDevice *dev, const Profile *profile) {
+  if (!calibration_set) {
+    engine_set_calibration(NULL);
+  }
+  dev->bundle = profile ? bundle : NULL;
+  dev->chord_held = 0;
+  dev->chord_swallow = 0;
+  if (dev->bundle) {
+    dev->bundle_index = bundle_active(bundle);
+    dev->profile = profile = &bundle->profiles[dev->bundle_index];
+  }
+  init_pipeline(dev, profile);
+  tracker_init(&dev->tracker, &calibration);
+  axis_map_build(&dev->axis_map, &calibration);
+}
+
+static void fill_input_transfer(EngineDevice *dev);
+
+/*
+ * Whatever the pad held goes up before recovery starts: the keys it was
+ * pressing, its macros and pending taps, and a feedback packet or retry.
+ * Input picks up from a clean pipeline once the pad is back.
+ */
+static void begin_recovery(EngineDevice *dev, DeviceHealth step) {
+  dev->active = 0;
+  if (dev->profile) {
+    translator_reset(&dev->translator);
+  }
+  timer_cancel(&timers, &dev->debounce_timer);
+  init_pipeline(dev, dev->profile);
+  dev->chord_held = 0;
+  dev->chord_swallow = 0;
+  feedback_cancel(&dev->feedback);
+  dev->health = step;
+  dev->attempts = 0;
+  fprintf(stderr, "Device %d: input transfer failed, %s\n",
+          (int)(dev - devices), device_health_name(step));
+  timer_schedule(&timers, &dev->recovery_timer, recovery_backoff_ns(0));
+}
+
+/*
+ * Frees what a libusb device holds once recovery gave up on it. Nothing is
+ * in flight: the input transfer failed and feedback was cancelled before
+ * the last attempt. The slot stays, inactive and without a handle.
+ */
+static void drop_device(EngineDevice *dev) {
+  timer_cancel(&timers, &dev->recovery_timer);
+  libusb_free_transfer(dev->transfer);
+  dev->transfer = NULL;
+  feedback_destroy(&dev->feedback);
+  release_interface_safe(dev->handle);
+  if (dev->owned_handle) {
+    libusb_close(dev->handle);
+  }
+  dev->handle = NULL;
+  dev->owned_handle = 0;
+  dev->type = CONTROLLER_TYPE_UNKNOWN;
+  dev->bundle = NULL;
+  dev->profile = NULL;
+  free(dev->owned_profile);
+  dev->owned_profile = NULL;
+}
+
+/* Next attempt at the same step, or the next step once it ran out */
+static void retry_recovery(EngineDevice *dev, int error) {
+  int limit = dev->health == DEVICE_REOPENING ? RECOVERY_REOPEN_ATTEMPTS
+                                              : RECOVERY_STEP_ATTEMPTS;
+
+  if (error == LIBUSB_ERROR_NO_DEVICE && dev->health < DEVICE_REOPENING) {
+    dev->health = DEVICE_REOPENING;
+    dev->attempts = 0;
+  } else if (++dev->attempts >= limit) {
+    dev->health++;
+    dev->attempts = 0;
+    if (dev->health == DEVICE_GONE) {
+      fprintf(stderr, "Device %d: giving up, dropping it\n",
+              (int)(dev - devices));
+      drop_device(dev);
+      return;
+    }
+    fprintf(stderr, "Device %d: %s\n", (int)(dev - devices),
+            device_health_name(dev->health));
+  }
+  timer_schedule(&timers, &dev->recovery_timer,
+                 recovery_backoff_ns(dev->attempts));
+}
+
+/*
+ * A reopen may close the old handle, so the feedback transfer on it is
+ * cancelled first and the job only posted once it is back.
+ */
+static void on_recovery_timer(Timer *timer, uint64_t now) {
+  EngineDevice *dev = timer->data;
+  (void)now;
+
+  if (!keep_reading) {
+    return;
+  }
+  if (dev->feedback.in_flight) {
+    feedback_cancel(&dev->feedback);
+    timer_schedule(&timers, &dev->recovery_timer,
+                   recovery_backoff_ns(0));
+    return;
+  }
+  dev->recovery.step = dev->health;
+  dev->recovery.handle = dev->handle;
+  dev->recovery.close_old = dev->owned_handle;
+  recovery_post(&dev->recovery);
+}
+
+/*
+ * Engine thread, or the stopping thread from recovery_flush(); a reopened
+ * handle is adopted either way so it gets closed.
+ */
+static void on_recovery_done(RecoveryJob *job) {
+  EngineDevice *dev = job->data;
+  int ret = job->result;
+
+  if (ret == 0 && job->handle != dev->handle) {
+    dev->handle = job->handle;
+    dev->feedback.handle = job->handle;
+    dev->owned_handle = 1;
+  }
+  if (!keep_reading) {
+    return;
+  }
+  if (ret == 0) {
+    fill_input_transfer(dev);
+    ret = libusb_submit_transfer(dev->transfer);
+  }
+  if (ret != 0) {
+    retry_recovery(dev, ret);
+    return;
+  }
+  fprintf(stderr, "Device %d: recovered\n", (int)(dev - devices));
+  dev->health = DEVICE_HEALTHY;
+  dev->attempts = 0;
+  dev->active = 1;
+  feedback_restore(&dev->feedback);
+}
+
+static void LIBUSB_CALL on_input_transfer(struct libusb_transfer *transfer) {
+  EngineDevice *dev = transfer->user_data;
+
+  if (transfer->status == LIBUSB_TRANSFER_COMPLETED) {
+    TRACE_BEGIN(TRACE_DECODE);
+    int decoded = decode_input_report(
+        transfer->buffer, transfer->actual_length,
+        dev->profile ? &dev->profile->config : NULL, &dev->state);
+    TRACE_END(TRACE_DECODE);
+    if (decoded == 0) {
+      handle_state(dev, now_ns());
+    }
+  } else if (transfer->status != LIBUSB_TRANSFER_TIMED_OUT) {
+    dev->active = 0;
+    if (transfer->status != LIBUSB_TRANSFER_CANCELLED && keep_reading) {
+      begin_recovery(dev, recovery_step_for_status(transfer->status));
+    }
+    return;
+  }
+
+  if (!keep_reading) {
+    dev->active = 0;
+    return;
+  }
+  int ret = libusb_submit_transfer(transfer);
+  if (ret != 0) {
+    begin_recovery(dev, recovery_step_for_error(ret));
+  }
+}
+
+static void fill_input_transfer(EngineDevice *dev) {
+  libusb_fill_interrupt_transfer(dev->transfer, dev->handle, 0x81, dev->buffer,
+                                 sizeof(dev->buffer), on_input_transfer, dev,
+                                 0);
+}
+
+static int dispatch_watch(int fd, uint32_t events) {
+  for (int i = 0; i < watch_count; i++) {
+    if (watches[i].fd == fd) {
+      watches[i].fn(fd, events, watches[i].data);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static void *input_reader_thread(void *arg) {
+  (void)arg;
+  struct epoll_event events[MAX_EPOLL_EVENTS];
+  struct timeval zero = {0, 0};
+
+  if (realtime.enabled) {
+    realtime_prefault_stack();
+    realtime_apply_thread(pthread_self(), &realtime);
+  }
+  trace_thread("engine");
+
+  while (keep_reading) {
+    int n = epoll_wait(epoll_fd, events, MAX_EPOLL_EVENTS, -1);
+    int usb_ready = 0;
+
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("epoll_wait");
+      break;
+    }
+
+    for (int i = 0; i < n; i++) {
+      int fd = events[i].data.fd;
+      if (fd == timers.fd) {
+        TRACE_BEGIN(TRACE_TIMERS);
+        timer_wheel_process(&timers);
+        TRACE_END(TRACE_TIMERS);
+      } else if (fd == wake_fd) {
+        uint64_t value;
+        if (read(wake_fd, &value, sizeof(value)) < 0) {
+          continue;
+        }
+      } else if (!dispatch_watch(fd, events[i].events)) {
+        usb_ready = 1;
+      }
+    }
+
+    if (usb_ready) {
+      TRACE_BEGIN(TRACE_USB);
+      libusb_handle_events_timeout_completed(usb_ctx, &zero, NULL);
+      TRACE_END(TRACE_USB);
+    }
+    for (int i = 0; i < device_count; i++) {
+      if (devices[i].active && devices[i].feedback.pending) {
+        feedback_service(&devices[i].feedback, now_ns());
+      }
+    }
+    TRACE_BEGIN(TRACE_FLUSH);
+    flush_output(&output);
+    TRACE_END(TRACE_FLUSH);
+    if (fanout_has_subscribers()) {
+      fanout_flush(now_ns());
+    }
+    if (stream_sending()) {
+      stream_flush();
+    }
+
+    /* One notification per loop pass, however many reports it handled */
+    if (published && notify_enabled) {
+      uint64_t one = 1;
+      if (write(notify_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        perror("Failed to notify engine listener");
+      }
+    }
+    published = 0;
+  }
+  return NULL;
+}
+
+/* Applies to the loop thread started by the next start_input_reader() */
+void engine_set_realtime(const RealtimeConfig *config) { realtime = *config; }
+
+/*
+ * Folded into the axis tables of the devices started after it, and where
+ * their tracking starts from. NULL goes back to the raw, uncalibrated range.
+ */
+void engine_set_calibration(const Calibration *cal) {
+  if (cal) {
+    calibration = *cal;
+  } else {
+    calibration_default(&calibration);
+  }
+  calibration_set = 1;
+}
+
+/*
+ * Devices started after it follow the bundle's active profile, whatever
+ * profile they were started with. The bundle must outlive the engine loop.
+ */
+void engine_set_bundle(ProfileBundle *set) { bundle = set; }
+
+/*
+ * What tracking has learned so far, and over how many reports. Exact once
+ * the loop is stopped; from other threads a value may lag by a report.
+ */
+int engine_calibration(int device, Calibration *cal, uint64_t *samples) {
+  if (device < 0 || device >= device_count) {
+    return -1;
+  }
+  tracker_result(&devices[device].tracker, cal);
+  if (samples) {
+    *samples = devices[device].tracker.samples;
+  }
+  return 0;
+}
+
+/* Before engine_init(): read hidraw/evdev devices through io_uring */
+void engine_set_uring(int enabled) { ring_wanted = enabled; }
+
+static void on_ring_readable(int fd, uint32_t events, void *data) {
+  (void)fd;
+  (void)events;
+  (void)data;
+  uring_reader_reap(&ring);
+}
+
+int engine_init(libusb_context *lctx) {
+  const struct libusb_pollfd **pollfds;
+
+  usb_ctx = lctx;
+  device_count = 0;
+  watch_count = 0;
+
+  epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  notify_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (epoll_fd < 0 || wake_fd < 0 || notify_fd < 0) {
+    perror("Failed to create engine fds");
+    engine_shutdown();
+    return -1;
+  }
+
+  if (timer_wheel_init(&timers, TIMER_TICK_US) != 0) {
+    engine_shutdown();
+    return -1;
+  }
+  watch_fd(timers.fd, EPOLLIN);
+  watch_fd(wake_fd, EPOLLIN);
+
+  if (ring_wanted) {
+    if (uring_reader_open(&ring) == 0) {
+      ring_open = engine_watch(ring.fd, EPOLLIN, on_ring_readable, NULL) == 0;
+      if (!ring_open) {
+        uring_reader_close(&ring);
+      }
+    }
+    if (!ring_open) {
+      fprintf(stderr, "Reading hidraw/evdev devices through epoll instead\n");
+    }
+  }
+
+  if (recovery_start(lctx, on_recovery_done) != 0) {
+    engine_shutdown();
+    return -1;
+  }
+
+  if (!libusb_pollfds_handle_timeouts(lctx)) {
+    fprintf(stderr, "libusb needs external timeout handling, not supported\n");
+    engine_shutdown();
+    return -1;
+  }
+
+  pollfds = libusb_get_pollfds(lctx);
+  for (int i = 0; pollfds && pollfds[i]; i++) {
+    usb_fd_added(pollfds[i]->fd, pollfds[i]->events, NULL);
+  }
+  libusb_free_pollfds(pollfds);
+  libusb_set_pollfd_notifiers(lctx, usb_fd_added, usb_fd_removed, NULL);
+
+  if (open_output_device(&output, "Faky Controller") != 0) {
+    engine_shutdown();
+    return -1;
+  }
+
+  return 0;
+}
+
+void engine_shutdown(void) {
+  if (keep_reading) {
+    stop_input_reader();
+  }
+  if (usb_ctx) {
+    libusb_set_pollfd_notifiers(usb_ctx, NULL, NULL, NULL);
+  }
+  recovery_stop();
+  close_output_device(&output);
+  timer_wheel_destroy(&timers);
+  if (ring_open) {
+    uring_reader_close(&ring);
+    ring_open = 0;
+  }
+  if (wake_fd >= 0) {
+    close(wake_fd);
+    wake_fd = -1;
+  }
+  if (notify_fd >= 0) {
+    close(notify_fd);
+    notify_fd = -1;
+  }
+  notify_enabled = 0;
+  if (epoll_fd >= 0) {
+    close(epoll_fd);
+    epoll_fd = -1;
+  }
+  usb_ctx = NULL;
+}
+
+static int start_loop_thread(void) {
+  if (keep_reading) {
+    return 0;
+  }
+
+  keep_reading = 1;
+  int ret = pthread_create(&reader_thread, NULL, input_reader_thread, NULL);
+  if (ret != 0) {
+    fprintf(stderr, "Failed to innitialize reader thread\n");
+    keep_reading = 0;
+    stop_input_reader();
+    return -1;
+  }
+  return 0;
+}
+
+int start_input_reader(libusb_device_handle *handle, const Profile *profile) {
+  if (device_count >= MAX_DEVICES) {
+    fprintf(stderr, "Too many devices (max %d)\n", MAX_DEVICES);
+    return -1;
+  }
+  if (claim_interface_safe(handle) != 0) {
+    return -1;
+  }
+
+  EngineDevice *dev = &devices[device_count];
+  struct libusb_device_descriptor desc;
+  memset(dev, 0, sizeof(*dev));
+  dev->handle = handle;
+  dev->fd = -1;
+  dev->profile = profile;
+  if (libusb_get_device_descriptor(libusb_get_device(handle), &desc) == 0) {
+    dev->vendor_id = desc.idVendor;
+    dev->product_id = desc.idProduct;
+  }
+  dev->type = controller_type_from_ids(dev->vendor_id, dev->product_id);
+  setup_device(dev, profile);
+
+  /* The packets are the 360's; other pads get no feedback queue at all */
+  if (dev->type == CONTROLLER_TYPE_XBOX_360 &&
+      feedback_init(&dev->feedback, handle, &timers) != 0) {
+    release_interface_safe(handle);
+    return -1;
+  }
+
+  dev->transfer = libusb_alloc_transfer(0);
+  if (!dev->transfer) {
+    feedback_destroy(&dev->feedback);
+    release_interface_safe(handle);
+    return -1;
+  }
+  fill_input_transfer(dev);
+  timer_init(&dev->recovery_timer, on_recovery_timer, dev);
+  dev->recovery.data = dev;
+  if (recovery_locate(&dev->recovery, handle) != 0) {
+    fprintf(stderr, "Unknown port, the pad cannot be reopened if it drops\n");
+  }
+
+  int ret = libusb_submit_transfer(dev->transfer);
+  if (ret != 0) {
+    fprintf(stderr, "Failed to submit input transfer: %s\n",
+            libusb_strerror(ret));
+    libusb_free_transfer(dev->transfer);
+    feedback_destroy(&dev->feedback);
+    release_interface_safe(handle);
+    return -1;
+  }
+  dev->active = 1;
+  device_count++;
+
+  return start_loop_thread();
+}
+
+/*
+ * A device whose reports arrive some other way (e.g. over the network) and
+ * are handed over with engine_feed_state(). It has no USB handle, so no
+ * rumble or LEDs.
+ */
+int start_remote_device(uint16_t vendor_id, uint16_t product_id,
+                        const Profile *profile) {
+  if (device_count >= MAX_DEVICES) {
+    fprintf(stderr, "Too many devices (max %d)\n", MAX_DEVICES);
+    return -1;
+  }
+
+  EngineDevice *dev = &devices[device_count];
+  memset(dev, 0, sizeof(*dev));
+  dev->fd = -1;
+  dev->vendor_id = vendor_id;
+  dev->product_id = product_id;
+  dev->profile = profile;
+  setup_device(dev, profile);
+  dev->active = 1;
+  device_count++;
+
+  if (start_loop_thread() != 0) {
+    return -1;
+  }
+  return device_count - 1;
+}
+
+/* Through the ring when it is open, else one epoll watch per fd */
+static int watch_device(EngineDevice *dev, engine_fd_fn readable,
+                        uring_data_fn data) {
+  if (ring_open) {
+    return uring_reader_add(&ring, dev->fd, data, dev);
+  }
+  return engine_watch(dev->fd, EPOLLIN, readable, dev);
+}
+
+static void unwatch_device(EngineDevice *dev) {
+  if (ring_open) {
+    uring_reader_remove(&ring, dev->fd);
+  } else {
+    engine_unwatch(dev->fd);
+  }
+}
+
+static void drop_fd_device(EngineDevice *dev) {
+  unwatch_device(dev);
+  close(dev->fd);
+  dev->fd = -1;
+  dev->active = 0;
+}
+
+/*
+ * Short reports are zero-extended so the profile's byte/bit positions
+ * decode as for USB. report has room for at least HIDRAW_MIN_REPORT bytes.
+ */
+static void handle_hidraw_report(EngineDevice *dev, uint8_t *report,
+                                  int length) {
+  if (length < HIDRAW_MIN_REPORT) {
+    memset(report + length, 0, HIDRAW_MIN_REPORT - length);
+    length = HIDRAW_MIN_REPORT;
+  }
+  TRACE_BEGIN(TRACE_DECODE);
+  int decoded = decode_input_report(
+      report, length, dev->profile ? &dev->profile->config : NULL,
+      &dev->state);
+  TRACE_END(TRACE_DECODE);
+  if (decoded == 0) {
+    handle_state(dev, now_ns());
+  }
+}
+
+static void on_hidraw_data(int fd, uint8_t *data, int length, void *user) {
+  EngineDevice *dev = user;
+  (void)fd;
+
+  if (length <= 0) {
+    fprintf(stderr, "hidraw device gone, dropping it\n");
+    drop_fd_device(dev);
+    return;
+  }
+  handle_hidraw_report(dev, data, length);
+}
+
+/* One read() per report until the node is drained */
+static void on_hidraw_readable(int fd, uint32_t events, void *data) {
+  EngineDevice *dev = data;
+
+  for (;;) {
+    ssize_t n = read(fd, dev->buffer, sizeof(dev->buffer));
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0 && errno == EAGAIN) {
+      break;
+    }
+    if (n <= 0) {
+      fprintf(stderr, "hidraw device gone, dropping it\n");
+      drop_fd_device(dev);
+      return;
+    }
+    handle_hidraw_report(dev, dev->buffer, (int)n);
+  }
+
+  if (events & (EPOLLERR | EPOLLHUP)) {
+    drop_fd_device(dev);
+  }
+}
+
+/*
+ * Takes ownership of a non-blocking hidraw fd (see hidraw_open()). There is
+ * no OUT endpoint behind it, so no rumble or LEDs.
+ */
+int start_hidraw_device(int fd, uint16_t vendor_id, uint16_t product_id,
+                        const Profile *profile) {
+  if (device_count >= MAX_DEVICES) {
+    fprintf(stderr, "Too many devices (max %d)\n", MAX_DEVICES);
+    close(fd);
+    return -1;
+  }
+
+  EngineDevice *dev = &devices[device_count];
+  memset(dev, 0, sizeof(*dev));
+  dev->fd = fd;
+  dev->vendor_id = vendor_id;
+  dev->product_id = product_id;
+  dev->profile = profile;
+  setup_device(dev, profile);
+
+  if (watch_device(dev, on_hidraw_readable, on_hidraw_data) != 0) {
+    fprintf(stderr, "Could not watch another hidraw device\n");
+    close(fd);
+    return -1;
+  }
+  dev->active = 1;
+  device_count++;
+
+  return start_loop_thread();
+}
+
+/* Each SYN_REPORT that changed something runs the pipeline once */
+static void handle_evdev_events(EngineDevice *dev,
+                                const struct input_event *events,
+                                size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    if (evdev_apply(&dev->evdev, &events[i], &dev->state)) {
+      handle_state(dev, now_ns());
+    }
+  }
+}
+
+static void on_evdev_data(int fd, uint8_t *data, int length, void *user) {
+  EngineDevice *dev = user;
+  (void)fd;
+
+  if (length <= 0) {
+    fprintf(stderr, "evdev device gone, dropping it\n");
+    drop_fd_device(dev);
+    return;
+  }
+  handle_evdev_events(dev, (const struct input_event *)data,
+                      (size_t)length / sizeof(struct input_event));
+}
+
+/*
+ * Whole input_event arrays per read(); the kernel only hands out complete
+ * events.
+ */
+static void on_evdev_readable(int fd, uint32_t events, void *data) {
+  EngineDevice *dev = data;
+  struct input_event batch[EVDEV_BATCH];
+
+  for (;;) {
+    ssize_t n = read(fd, batch, sizeof(batch));
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0 && errno == EAGAIN) {
+      break;
+    }
+    if (n <= 0) {
+      fprintf(stderr, "evdev device gone, dropping it\n");
+      drop_fd_device(dev);
+      return;
+    }
+    size_t count = (size_t)n / sizeof(batch[0]);
+    handle_evdev_events(dev, batch, count);
+    if (count < EVDEV_BATCH) {
+      break;
+    }
+  }
+
+  if (events & (EPOLLERR | EPOLLHUP)) {
+    drop_fd_device(dev);
+  }
+}
+
+/*
+ * Takes ownership of an fd from evdev_open(), together with the pad's axis
+ * table. The current key and axis state is read first so a button held
+ * while starting does not show up as a press later.
+ */
+int start_evdev_device(int fd, const EvdevPad *pad, uint16_t vendor_id,
+                       uint16_t product_id, const Profile *profile) {
+  if (device_count >= MAX_DEVICES) {
+    fprintf(stderr, "Too many devices (max %d)\n", MAX_DEVICES);
+    close(fd);
+    return -1;
+  }
+
+  EngineDevice *dev = &devices[device_count];
+  memset(dev, 0, sizeof(*dev));
+  dev->fd = fd;
+  dev->evdev = *pad;
+  dev->evdev.fd = fd;
+  dev->vendor_id = vendor_id;
+  dev->product_id = product_id;
+  dev->profile = profile;
+  setup_device(dev, profile);
+  evdev_resync(&dev->evdev, &dev->state);
+
+  if (watch_device(dev, on_evdev_readable, on_evdev_data) != 0) {
+    fprintf(stderr, "Could not watch another evdev device\n");
+    close(fd);
+    return -1;
+  }
+  dev->active = 1;
+  device_count++;
+
+  return start_loop_thread();
+}
+
+/* Engine thread only: a decoded report for a start_remote_device() device */
+void engine_feed_state(int device, const ControllerState *state) {
+  if (device < 0 || device >= device_count || devices[device].handle ||
+      devices[device].fd >= 0) {
+    return;
+  }
+  devices[device].state = *state;
+  handle_state(&devices[device], now_ns());
+}
+
+void stop_input_reader(void) {
+  struct timeval tick = {0, 10000};
+
+  if (keep_reading) {
+    keep_reading = 0;
+    wake_engine();
+    pthread_join(reader_thread, NULL);
+  }
+  recovery_flush();
+
+  for (int i = 0; i < device_count; i++) {
+    timer_cancel(&timers, &devices[i].debounce_timer);
+    if (!devices[i].handle) {
+      continue;
+    }
+    timer_cancel(&timers, &devices[i].recovery_timer);
+    if (devices[i].active) {
+      libusb_cancel_transfer(devices[i].transfer);
+    }
+    feedback_cancel(&devices[i].feedback);
+  }
+  for (int i = 0; i < device_count; i++) {
+    EngineDevice *dev = &devices[i];
+    if (!dev->handle) {
+      if (dev->fd >= 0) {
+        unwatch_device(dev);
+        close(dev->fd);
+        dev->fd = -1;
+      }
+      dev->active = 0;
+      free(dev->owned_profile);
+      dev->owned_profile = NULL;
+      continue;
+    }
+    for (int tries = 0;
+         (dev->active || dev->feedback.in_flight) && tries < 100; tries++) {
+      libusb_handle_events_timeout_completed(usb_ctx, &tick, NULL);
+    }
+    libusb_free_transfer(dev->transfer);
+    feedback_destroy(&dev->feedback);
+    release_interface_safe(dev->handle);
+    if (dev->owned_handle) {
+      libusb_close(dev->handle);
+    }
+    free(dev->owned_profile);
+    dev->owned_profile = NULL;
+  }
+  device_count = 0;
+
+  macro_cancel_all(&timers);
+  turbo_stop_all();
+  flush_output(&output);
+}
+
+/*
+ * Safe from any thread, the engine loop sends the packet. Only wired 360
+ * pads read through libusb take these; anything else returns -1.
+ */
+int engine_set_rumble(int device, uint8_t large, uint8_t small) {
+  if (device < 0 || device >= device_count || !devices[device].active ||
+      devices[device].type != CONTROLLER_TYPE_XBOX_360) {
+    return -1;
+  }
+  feedback_set_rumble(&devices[device].feedback, large, small);
+  wake_engine();
+  return 0;
+}
+
+int engine_set_led(int device, LedPattern pattern) {
+  if (device < 0 || device >= device_count || !devices[device].active ||
+      devices[device].type != CONTROLLER_TYPE_XBOX_360) {
+    return -1;
+  }
+  feedback_set_led(&devices[device].feedback, pattern);
+  wake_engine();
+  return 0;
+}
+
+/*
+ * Copies the latest published state without ever blocking the engine.
+ * Returns 0 with a consistent copy, -1 if the device is gone or kept
+ * changing underneath us (the caller keeps its previous copy).
+ */
+int engine_snapshot(int device, ControllerState *state, uint32_t *seq) {
+  if (device < 0 || device >= device_count || !devices[device].active) {
+    return -1;
+  }
+
+  EngineDevice *dev = &devices[device];
+  for (int tries = 0; tries < 4; tries++) {
+    uint32_t begin = __atomic_load_n(&dev->snapshot_seq, __ATOMIC_ACQUIRE);
+    if (begin & 1) {
+      continue;
+    }
+    *state = dev->snapshot;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&dev->snapshot_seq, __ATOMIC_RELAXED) == begin) {
+      if (seq) {
+        *seq = begin;
+      }
+      return 0;
+    }
+  }
+  return -1;
+}
+
+/*
+ * Readable whenever new state was published since the last
+ * engine_ack_notify(). The engine only writes it once somebody asked for it.
+ */
+int engine_notify_fd(void) {
+  notify_enabled = notify_fd >= 0;
+  return notify_fd;
+}
+
+void engine_ack_notify(void) {
+  uint64_t value;
+
+  if (notify_fd >= 0 && read(notify_fd, &value, sizeof(value)) < 0 &&
+      errno != EAGAIN) {
+    perror("Failed to read engine notification");
+  }
+}
+
+/*
+ * Extra fds on the engine loop (the control socket and its clients). The
+ * handler runs on the engine thread; call these from it, or before the
+ * loop starts.
+ */
+int engine_watch(int fd, uint32_t events, engine_fd_fn fn, void *data) {
+  if (watch_count >= MAX_WATCHES) {
+    return -1;
+  }
+  watches[watch_count].fd = fd;
+  watches[watch_count].fn = fn;
+  watches[watch_count].data = data;
+  watch_count++;
+  watch_fd(fd, events);
+  return 0;
+}
+
+/* Changes the events of an fd already registered with engine_watch() */
+void engine_rewatch(int fd, uint32_t events) { watch_fd(fd, events); }
+
+void engine_unwatch(int fd) {
+  for (int i = 0; i < watch_count; i++) {
+    if (watches[i].fd == fd) {
+      watches[i] = watches[--watch_count];
+      break;
+    }
+  }
+  epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+int engine_device_count(void) { return device_count; }
+
+EngineDevice *engine_device(int device) {
+  if (device < 0 || device >= device_count) {
+    return NULL;
+  }
+  return &devices[device];
+}
+
+/*
+ * Engine thread only. Releases whatever the old profile was holding, so the
+ * very next report is translated with the new one. An owned profile is
+ * freed when it is replaced or the device stops.
+ */
+int engine_switch_profile(int device, Profile *profile, int owned) {
+  EngineDevice *dev = engine_device(device);
+  if (!dev || !dev->active) {
+    return -1;
+  }
+
+  if (dev->profile) {
+    translator_reset(&dev->translator);
+  }
+  free(dev->owned_profile);
+  dev->owned_profile = owned ? profile : NULL;
+  dev->profile = profile;
+  timer_cancel(&timers, &dev->debounce_timer);
+  init_pipeline(dev, profile);
+  return 0;
+}
+
+/* Engine thread only */
+int engine_set_paused(int device, int paused) {
+  EngineDevice *dev = engine_device(device);
+  if (!dev || !dev->active) {
+    return -1;
+  }
+
+  if (paused && !dev->paused && dev->profile) {
+    translator_reset(&dev->translator);
+  }
+  dev->paused = paused;
+  return 0;
+}
+
+TimerWheel *engine_timers(void) { return &timers; }
+
+OutputDevice *engine_output(void) { return &output; }
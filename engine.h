@@ -0,0 +1,100 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include "bundle.h"
+#include "calibrate.h"
+#include "controller.h"
+#include "evdev.h"
+#include "feedback.h"
+#include "input.h"
+#include "realtime.h"
+#include "recovery.h"
+#include "shm.h"
+#include "timer.h"
+#include "translator.h"
+
+#define MAX_DEVICES 16
+
+/*
+ * The input engine runs every connected pad on one thread: libusb async
+ * transfers, the timer wheel and the uinput output all share a single epoll
+ * loop, so nothing on the hot path sleeps or blocks. A device started with
+ * a NULL profile is only decoded and published, for monitoring. Besides
+ * libusb, reports can come from a hidraw or evdev fd or be fed in by
+ * another part of the loop (remote devices).
+ */
+
+typedef void (*engine_fd_fn)(int fd, uint32_t events, void *data);
+
+typedef struct {
+  libusb_device_handle *handle; /* NULL unless read through libusb */
+  int fd;                       /* hidraw or evdev node, -1 otherwise */
+  uint16_t vendor_id;
+  uint16_t product_id;
+  ControllerType type; /* libusb devices; rumble and LEDs only on 360 pads */
+  struct libusb_transfer *transfer;
+  uint8_t buffer[MAX_INPUT_PACKET_SIZE];
+  const Profile *profile;
+  Profile *owned_profile;
+  ControllerState state; /* as reported, before calibration and debounce */
+  EvdevPad evdev; /* axis table, evdev devices only */
+  Translator translator;
+  Debouncer debounce;
+  Timer debounce_timer;
+  CalibrationTracker tracker;
+  AxisMap axis_map;
+  FeedbackQueue feedback;
+  ProfileBundle *bundle; /* profile set this device follows, if any */
+  int bundle_index;
+  uint32_t chord_held;    /* buttons in the last report */
+  uint32_t chord_swallow; /* pressed with Guide, kept from translation */
+  int active;
+  int paused;
+
+  /* Transfer error recovery, libusb devices only */
+  DeviceHealth health;
+  int attempts;     /* at the current step */
+  int owned_handle; /* opened by a reopen, closed by the engine */
+  Timer recovery_timer;
+  RecoveryJob recovery;
+
+  /* Seqlock-published copy of state for readers on other threads */
+  volatile uint32_t snapshot_seq;
+  ControllerState snapshot;
+  uint64_t reports;
+} EngineDevice;
+
+int engine_init(libusb_context *lctx);
+void engine_shutdown(void);
+int start_input_reader(libusb_device_handle *handle, const Profile *profile);
+int start_remote_device(uint16_t vendor_id, uint16_t product_id,
+                        const Profile *profile);
+void engine_feed_state(int device, const ControllerState *state);
+int start_hidraw_device(int fd, uint16_t vendor_id, uint16_t product_id,
+                        const Profile *profile);
+int start_evdev_device(int fd, const EvdevPad *pad, uint16_t vendor_id,
+                       uint16_t product_id, const Profile *profile);
+void stop_input_reader(void);
+void engine_set_realtime(const RealtimeConfig *config);
+void engine_set_uring(int enabled);
+void engine_set_calibration(const Calibration *cal);
+int engine_calibration(int device, Calibration *cal, uint64_t *samples);
+void engine_set_bundle(ProfileBundle *bundle);
+int engine_set_rumble(int device, uint8_t large, uint8_t small);
+int engine_set_led(int device, LedPattern pattern);
+int engine_snapshot(int device, ControllerState *state, uint32_t *seq);
+int engine_notify_fd(void);
+void engine_ack_notify(void);
+
+int engine_watch(int fd, uint32_t events, engine_fd_fn fn, void *data);
+void engine_rewatch(int fd, uint32_t events);
+void engine_unwatch(int fd);
+int engine_device_count(void);
+EngineDevice *engine_device(int device);
+int engine_switch_profile(int device, Profile *profile, int owned);
+int engine_set_paused(int device, int paused);
+
+TimerWheel *engine_timers(void);
+OutputDevice *engine_output(void);
+
+#endif /* ENGINE_H */
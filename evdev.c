@@ -0,0 +1,331 @@
+#include "evdev.h"
+#include "utils.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/input.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#define BITS_PER_LONG (8 * sizeof(long))
+#define LONGS(bits) (((bits) + BITS_PER_LONG - 1) / BITS_PER_LONG)
+#define TEST_LONG_BIT(array, bit)                                              \
+  (((array)[(bit) / BITS_PER_LONG] >> ((bit) % BITS_PER_LONG)) & 1)
+
+typedef char evdev_abs_cnt_matches[EVDEV_ABS_CNT == ABS_CNT ? 1 : -1];
+
+typedef struct {
+  uint16_t code;
+  EvdevSlot slot;
+} SlotEntry;
+
+/*
+ * xpad's naming: BTN_X/BTN_Y (BTN_NORTH/BTN_WEST) are the Xbox X and Y.
+ * Drivers that name buttons by position instead swap those two, which a
+ * profile remaps like any other button.
+ */
+static const SlotEntry key_map[] = {
+    {BTN_SOUTH, {EVDEV_SLOT_BUTTON, XBOX_BUTTON_A}},
+    {BTN_EAST, {EVDEV_SLOT_BUTTON, XBOX_BUTTON_B}},
+    {BTN_X, {EVDEV_SLOT_BUTTON, XBOX_BUTTON_X}},
+    {BTN_Y, {EVDEV_SLOT_BUTTON, XBOX_BUTTON_Y}},
+    {BTN_TL, {EVDEV_SLOT_BUTTON, XBOX_BUTTON_LB}},
+    {BTN_TR, {EVDEV_SLOT_BUTTON, XBOX_BUTTON_RB}},
+    {BTN_SELECT, {EVDEV_SLOT_BUTTON, XBOX_BUTTON_BACK}},
+    {BTN_START, {EVDEV_SLOT_BUTTON, XBOX_BUTTON_START}},
+    {BTN_MODE, {EVDEV_SLOT_BUTTON, XBOX_BUTTON_HOME}},
+    {BTN_THUMBL, {EVDEV_SLOT_BUTTON, XBOX_BUTTON_L3}},
+    {BTN_THUMBR, {EVDEV_SLOT_BUTTON, XBOX_BUTTON_R3}},
+    {BTN_DPAD_UP, {EVDEV_SLOT_BUTTON, XBOX_BUTTON_DPAD_UP}},
+    {BTN_DPAD_DOWN, {EVDEV_SLOT_BUTTON, XBOX_BUTTON_DPAD_DOWN}},
+    {BTN_DPAD_LEFT, {EVDEV_SLOT_BUTTON, XBOX_BUTTON_DPAD_LEFT}},
+    {BTN_DPAD_RIGHT, {EVDEV_SLOT_BUTTON, XBOX_BUTTON_DPAD_RIGHT}},
+    /* Digital triggers (Switch Pro, Joy-Cons) read as fully pulled */
+    {BTN_TL2, {EVDEV_SLOT_TRIGGER, 0}},
+    {BTN_TR2, {EVDEV_SLOT_TRIGGER, 1}},
+};
+
+static const SlotEntry abs_map[] = {
+    {ABS_X, {EVDEV_SLOT_STICK, 0}},     {ABS_Y, {EVDEV_SLOT_STICK, 1}},
+    {ABS_RX, {EVDEV_SLOT_STICK, 2}},    {ABS_RY, {EVDEV_SLOT_STICK, 3}},
+    {ABS_Z, {EVDEV_SLOT_TRIGGER, 0}},   {ABS_RZ, {EVDEV_SLOT_TRIGGER, 1}},
+    {ABS_HAT0X, {EVDEV_SLOT_HAT, 0}},   {ABS_HAT0Y, {EVDEV_SLOT_HAT, 1}},
+};
+
+static EvdevSlot key_slots[KEY_CNT];
+static int key_slots_ready = 0;
+
+static void build_key_slots(void) {
+  if (key_slots_ready) {
+    return;
+  }
+  for (size_t i = 0; i < ARRAY_SIZE(key_map); i++) {
+    key_slots[key_map[i].code] = key_map[i].slot;
+  }
+  key_slots_ready = 1;
+}
+
+static int read_sysfs(const char *node, const char *file, char *buffer,
+                      size_t size) {
+  char path[128];
+
+  snprintf(path, sizeof(path), EVDEV_SYSFS_DIR "/%s/device/%s", node, file);
+  FILE *f = fopen(path, "r");
+  if (!f) {
+    return -1;
+  }
+  if (!fgets(buffer, (int)size, f)) {
+    fclose(f);
+    return -1;
+  }
+  fclose(f);
+  buffer[strcspn(buffer, "\n")] = '\0';
+  return 0;
+}
+
+/*
+ * capabilities/key is the key bitmap as space separated longs, most
+ * significant first; a gamepad has BTN_GAMEPAD (BTN_SOUTH).
+ */
+static int has_gamepad_buttons(const char *node) {
+  char line[1024];
+  unsigned long words[LONGS(KEY_CNT)];
+  int count = 0;
+
+  if (read_sysfs(node, "capabilities/key", line, sizeof(line)) != 0) {
+    return 0;
+  }
+  for (char *token = strtok(line, " "); token && count < (int)LONGS(KEY_CNT);
+       token = strtok(NULL, " ")) {
+    words[count++] = strtoul(token, NULL, 16);
+  }
+
+  size_t word = BTN_GAMEPAD / BITS_PER_LONG;
+  if (word >= (size_t)count) {
+    return 0;
+  }
+  return (words[count - 1 - word] >> (BTN_GAMEPAD % BITS_PER_LONG)) & 1;
+}
+
+static int compare_nodes(const void *a, const void *b) {
+  const EvdevInfo *x = a;
+  const EvdevInfo *y = b;
+  return atoi(x->path + 16) - atoi(y->path + 16);
+}
+
+/* Event nodes of known controllers or anything with gamepad buttons */
+int evdev_find_controllers(EvdevInfo *found, int max) {
+  struct dirent *entry;
+  char value[64];
+  int count = 0;
+
+  DIR *dir = opendir(EVDEV_SYSFS_DIR);
+  if (!dir) {
+    fprintf(stderr, "Failed to open %s: %s\n", EVDEV_SYSFS_DIR,
+            strerror(errno));
+    return -1;
+  }
+
+  while ((entry = readdir(dir)) && count < max) {
+    EvdevInfo *info = &found[count];
+    if (strncmp(entry->d_name, "event", 5) != 0) {
+      continue;
+    }
+
+    info->vendor_id = info->product_id = 0;
+    if (read_sysfs(entry->d_name, "id/vendor", value, sizeof(value)) == 0) {
+      info->vendor_id = (uint16_t)strtoul(value, NULL, 16);
+    }
+    if (read_sysfs(entry->d_name, "id/product", value, sizeof(value)) == 0) {
+      info->product_id = (uint16_t)strtoul(value, NULL, 16);
+    }
+    if (controller_type_from_ids(info->vendor_id, info->product_id) ==
+            CONTROLLER_TYPE_UNKNOWN &&
+        !has_gamepad_buttons(entry->d_name)) {
+      continue;
+    }
+
+    if (read_sysfs(entry->d_name, "name", info->name, sizeof(info->name)) !=
+        0) {
+      snprintf(info->name, sizeof(info->name), "Gamepad (0x%04x:0x%04x)",
+               info->vendor_id, info->product_id);
+    }
+    snprintf(info->path, sizeof(info->path), "/dev/input/%.20s",
+             entry->d_name);
+    count++;
+  }
+  closedir(dir);
+
+  qsort(found, count, sizeof(*found), compare_nodes);
+  return count;
+}
+
+/*
+ * Opens the node non-blocking and builds its axis table from the ranges
+ * the driver reports. Returns the fd, or -1 (also if a grab was asked for
+ * and another process holds one).
+ */
+int evdev_open(const char *path, int grab, EvdevPad *pad) {
+  unsigned long abs_bits[LONGS(ABS_CNT)];
+  struct input_absinfo info;
+
+  build_key_slots();
+  memset(pad, 0, sizeof(*pad));
+
+  int fd = open(path, O_RDONLY | O_NONBLOCK);
+  if (fd < 0) {
+    fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+  if (grab && ioctl(fd, EVIOCGRAB, 1) != 0) {
+    fprintf(stderr, "Failed to grab %s: %s\n", path, strerror(errno));
+    close(fd);
+    return -1;
+  }
+
+  memset(abs_bits, 0, sizeof(abs_bits));
+  ioctl(fd, EVIOCGBIT(EV_ABS, sizeof(abs_bits)), abs_bits);
+  for (size_t i = 0; i < ARRAY_SIZE(abs_map); i++) {
+    uint16_t code = abs_map[i].code;
+    if (!TEST_LONG_BIT(abs_bits, code) ||
+        ioctl(fd, EVIOCGABS(code), &info) != 0 ||
+        info.maximum <= info.minimum) {
+      continue;
+    }
+    pad->axes[code].slot = abs_map[i].slot;
+    pad->axes[code].minimum = info.minimum;
+    pad->axes[code].range = info.maximum - info.minimum;
+    if (abs_map[i].slot.kind == EVDEV_SLOT_TRIGGER) {
+      pad->analog_triggers |= 1 << abs_map[i].slot.index;
+    }
+  }
+  pad->fd = fd;
+  return fd;
+}
+
+static void set_button(ControllerState *state, int button, int pressed) {
+  if (pressed) {
+    state->button_mask |= 1u << button;
+  } else {
+    state->button_mask &= ~(1u << button);
+  }
+}
+
+static void set_trigger(ControllerState *state, int index, uint8_t value) {
+  if (index == 0) {
+    state->left_trigger = value;
+  } else {
+    state->right_trigger = value;
+  }
+}
+
+static void apply_key(const EvdevPad *pad, ControllerState *state,
+                      EvdevSlot slot, int32_t value) {
+  if (slot.kind == EVDEV_SLOT_BUTTON) {
+    set_button(state, slot.index, value != 0);
+  } else if (slot.kind == EVDEV_SLOT_TRIGGER &&
+             !(pad->analog_triggers & (1 << slot.index))) {
+    set_trigger(state, slot.index, value ? 255 : 0);
+  }
+}
+
+/* Scaled into the USB report's ranges; evdev Y grows downwards, ours up */
+static void apply_abs(ControllerState *state, const EvdevAxis *axis,
+                      int32_t value) {
+  int64_t offset = (int64_t)value - axis->minimum;
+
+  switch (axis->slot.kind) {
+  case EVDEV_SLOT_STICK: {
+    int64_t scaled = offset * 65535 / axis->range - 32768;
+    if (axis->slot.index & 1) {
+      scaled = -scaled - 1;
+    }
+    int16_t *sticks[] = {&state->left_thumb_x, &state->left_thumb_y,
+                         &state->right_thumb_x, &state->right_thumb_y};
+    *sticks[axis->slot.index] = (int16_t)MAX(-32768, MIN(32767, scaled));
+    break;
+  }
+  case EVDEV_SLOT_TRIGGER:
+    set_trigger(state, axis->slot.index,
+                (uint8_t)MAX(0, MIN(255, offset * 255 / axis->range)));
+    break;
+  case EVDEV_SLOT_HAT:
+    if (axis->slot.index == 0) {
+      set_button(state, XBOX_BUTTON_DPAD_LEFT, value < 0);
+      set_button(state, XBOX_BUTTON_DPAD_RIGHT, value > 0);
+    } else {
+      set_button(state, XBOX_BUTTON_DPAD_UP, value < 0);
+      set_button(state, XBOX_BUTTON_DPAD_DOWN, value > 0);
+    }
+    break;
+  }
+}
+
+/*
+ * Folds one event into state. Returns 1 at a SYN_REPORT that completes a
+ * changed report, i.e. when the state should go down the pipeline.
+ */
+int evdev_apply(EvdevPad *pad, const struct input_event *event,
+                ControllerState *state) {
+  switch (event->type) {
+  case EV_SYN:
+    if (event->code == SYN_DROPPED) {
+      pad->dropped = 1;
+      return 0;
+    }
+    if (event->code != SYN_REPORT) {
+      return 0;
+    }
+    /* Events up to here were lost in the kernel buffer; ask for the state */
+    if (pad->dropped) {
+      evdev_resync(pad, state);
+    }
+    if (pad->dirty) {
+      pad->dirty = 0;
+      return 1;
+    }
+    return 0;
+  case EV_KEY:
+    if (!pad->dropped && event->code < KEY_CNT &&
+        key_slots[event->code].kind != EVDEV_SLOT_NONE) {
+      apply_key(pad, state, key_slots[event->code], event->value);
+      pad->dirty = 1;
+    }
+    return 0;
+  case EV_ABS:
+    if (!pad->dropped && event->code < ABS_CNT &&
+        pad->axes[event->code].range) {
+      apply_abs(state, &pad->axes[event->code], event->value);
+      pad->dirty = 1;
+    }
+    return 0;
+  default:
+    return 0;
+  }
+}
+
+/* Reads the full current state back after a SYN_DROPPED, or at start */
+void evdev_resync(EvdevPad *pad, ControllerState *state) {
+  unsigned long keys[LONGS(KEY_CNT)];
+  struct input_absinfo info;
+
+  memset(keys, 0, sizeof(keys));
+  ioctl(pad->fd, EVIOCGKEY(sizeof(keys)), keys);
+  for (size_t i = 0; i < ARRAY_SIZE(key_map); i++) {
+    apply_key(pad, state, key_map[i].slot,
+              TEST_LONG_BIT(keys, key_map[i].code));
+  }
+  for (int code = 0; code < EVDEV_ABS_CNT; code++) {
+    if (pad->axes[code].range &&
+        ioctl(pad->fd, EVIOCGABS(code), &info) == 0) {
+      apply_abs(state, &pad->axes[code], info.value);
+    }
+  }
+  pad->dropped = 0;
+  pad->dirty = 1;
+}
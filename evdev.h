@@ -0,0 +1,66 @@
+#ifndef EVDEV_H
+#define EVDEV_H
+
+#include "controller.h"
+#include <stdint.h>
+
+/*
+ * Pads already bound to a kernel driver (xpad, hid-sony, hid-playstation,
+ * hid-nintendo), read from /dev/input/event* without detaching anything.
+ * Events are read in batches and mapped through a code -> slot table built
+ * once per device, with each axis scaled from the range the driver reports
+ * into the same ranges the USB decoder produces. EVIOCGRAB is optional and
+ * keeps the pad's own events away from other readers while we translate.
+ *
+ * linux/input.h is kept out of this header: its KEY_* names clash with
+ * curses, and engine.h (included by the TUI) embeds an EvdevPad.
+ */
+
+#define EVDEV_MAX_DEVICES 16
+#define EVDEV_BATCH 64
+#define EVDEV_SYSFS_DIR "/sys/class/input"
+#define EVDEV_ABS_CNT 0x40 /* ABS_CNT, checked in evdev.c */
+
+struct input_event;
+
+typedef enum {
+  EVDEV_SLOT_NONE,
+  EVDEV_SLOT_BUTTON,  /* index: XBOX_BUTTON_n */
+  EVDEV_SLOT_STICK,   /* index: left x, left y, right x, right y */
+  EVDEV_SLOT_TRIGGER, /* index: left, right */
+  EVDEV_SLOT_HAT,     /* index: 0 x, 1 y; drives the d-pad buttons */
+} EvdevSlotKind;
+
+typedef struct {
+  uint8_t kind;
+  uint8_t index;
+} EvdevSlot;
+
+typedef struct {
+  EvdevSlot slot;
+  int32_t minimum;
+  int32_t range; /* maximum - minimum, 0 if the axis is unused */
+} EvdevAxis;
+
+typedef struct {
+  int fd;
+  int dropped;         /* SYN_DROPPED seen, resync at the next SYN_REPORT */
+  int dirty;           /* state changed since the last SYN_REPORT */
+  int analog_triggers; /* bit n: trigger n has an axis, ignore its button */
+  EvdevAxis axes[EVDEV_ABS_CNT];
+} EvdevPad;
+
+typedef struct {
+  char path[32]; /* /dev/input/eventN */
+  uint16_t vendor_id;
+  uint16_t product_id;
+  char name[64];
+} EvdevInfo;
+
+int evdev_find_controllers(EvdevInfo *found, int max);
+int evdev_open(const char *path, int grab, EvdevPad *pad);
+int evdev_apply(EvdevPad *pad, const struct input_event *event,
+                ControllerState *state);
+void evdev_resync(EvdevPad *pad, ControllerState *state);
+
+#endif /* EVDEV_H */
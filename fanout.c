@@ -0,0 +1,483 @@
+#define _GNU_SOURCE
+#include "fanout.h"
+#include "controller.h"
+#include "engine.h"
+#include "stats.h"
+#include "utils.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define RING_MASK (FANOUT_RING_SIZE - 1)
+#define MAX_FRAMES (FANOUT_RING_SIZE / FANOUT_FRAME_EVENTS + 1)
+
+typedef struct {
+  int fd;
+  int want_write;      /* EPOLLOUT registered while the socket is full */
+  uint32_t head;       /* free-running, masked on access */
+  uint32_t tail;
+  uint32_t lost;       /* events dropped since the last FANOUT_LOST */
+  uint64_t lost_since; /* when the ring first overflowed, 0 if it has not */
+  FanoutEvent ring[FANOUT_RING_SIZE];
+} Subscriber;
+
+static int listen_fd = -1;
+static int use_engine = 0;
+static char socket_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+static Subscriber subscribers[FANOUT_MAX_SUBSCRIBERS];
+static int subscriber_count = 0;
+
+const char *fanout_socket_path(void) {
+  const char *env = getenv("FAKY_EVENT_SOCKET");
+  return env && *env ? env : FANOUT_SOCKET_PATH;
+}
+
+static int set_nonblocking(int fd) {
+  int flags = fcntl(fd, F_GETFL);
+  return flags < 0 ? -1 : fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+static void set_cloexec(int fd) { fcntl(fd, F_SETFD, FD_CLOEXEC); }
+
+static void close_subscriber(Subscriber *sub) {
+  if (use_engine) {
+    engine_unwatch(sub->fd);
+  }
+  close(sub->fd);
+  sub->fd = -1;
+  subscriber_count--;
+}
+
+static void append(Subscriber *sub, const FanoutEvent *event) {
+  sub->ring[sub->tail++ & RING_MASK] = *event;
+}
+
+/* Reports dropped events once there is room again, ahead of anything newer */
+static void settle_lost(Subscriber *sub, uint64_t now) {
+  if (sub->lost && sub->tail - sub->head < FANOUT_RING_SIZE) {
+    FanoutEvent lost = {now, 0, FANOUT_LOST, 0, (int32_t)sub->lost};
+    append(sub, &lost);
+    sub->lost = 0;
+    sub->lost_since = 0;
+  }
+}
+
+int fanout_has_subscribers(void) { return subscriber_count > 0; }
+
+void fanout_push(uint8_t device, uint8_t type, uint16_t code, int32_t value,
+                 uint64_t timestamp) {
+  FanoutEvent event = {timestamp, device, type, code, value};
+
+  for (int i = 0; i < FANOUT_MAX_SUBSCRIBERS && subscriber_count; i++) {
+    Subscriber *sub = &subscribers[i];
+    if (sub->fd < 0) {
+      continue;
+    }
+    settle_lost(sub, timestamp);
+    if (sub->tail - sub->head == FANOUT_RING_SIZE) {
+      if (!sub->lost++) {
+        sub->lost_since = timestamp;
+      }
+      continue;
+    }
+    append(sub, &event);
+  }
+}
+
+static void set_want_write(Subscriber *sub, int want) {
+  if (sub->want_write != want) {
+    sub->want_write = want;
+    if (use_engine) {
+      engine_rewatch(sub->fd, EPOLLIN | (want ? EPOLLOUT : 0));
+    }
+  }
+}
+
+/*
+ * Sends everything queued as FANOUT_FRAME_EVENTS-sized frames in a single
+ * sendmmsg(); the ring's wrap point becomes a second iovec rather than a
+ * copy. Whatever the socket does not take stays queued for next time.
+ */
+static int flush_subscriber(Subscriber *sub, uint64_t now) {
+  struct mmsghdr msgs[MAX_FRAMES];
+  struct iovec iov[MAX_FRAMES][2];
+  uint32_t counts[MAX_FRAMES];
+  uint32_t pos = sub->head;
+  int frames = 0;
+
+  settle_lost(sub, now);
+  while (pos != sub->tail && frames < MAX_FRAMES) {
+    uint32_t count = MIN(sub->tail - pos, FANOUT_FRAME_EVENTS);
+    uint32_t start = pos & RING_MASK;
+    uint32_t first = MIN(count, FANOUT_RING_SIZE - start);
+
+    memset(&msgs[frames], 0, sizeof(msgs[frames]));
+    iov[frames][0].iov_base = &sub->ring[start];
+    iov[frames][0].iov_len = first * sizeof(FanoutEvent);
+    iov[frames][1].iov_base = &sub->ring[0];
+    iov[frames][1].iov_len = (count - first) * sizeof(FanoutEvent);
+    msgs[frames].msg_hdr.msg_iov = iov[frames];
+    msgs[frames].msg_hdr.msg_iovlen = first < count ? 2 : 1;
+    counts[frames] = count;
+    pos += count;
+    frames++;
+  }
+  if (frames == 0) {
+    set_want_write(sub, 0);
+    return 0;
+  }
+
+  int sent = sendmmsg(sub->fd, msgs, frames, MSG_NOSIGNAL | MSG_DONTWAIT);
+  if (sent < 0) {
+    if (errno != EAGAIN && errno != EINTR) {
+      return -1;
+    }
+    sent = 0;
+  }
+  for (int i = 0; i < sent; i++) {
+    sub->head += counts[i];
+  }
+  set_want_write(sub, sub->head != sub->tail);
+  return 0;
+}
+
+/* Once per engine loop pass, after the pass's reports have been decoded */
+void fanout_flush(uint64_t now) {
+  for (int i = 0; i < FANOUT_MAX_SUBSCRIBERS && subscriber_count; i++) {
+    Subscriber *sub = &subscribers[i];
+    if (sub->fd < 0) {
+      continue;
+    }
+    if (sub->lost_since &&
+        now - sub->lost_since >= FANOUT_DROP_AFTER_MS * NSEC_PER_MSEC) {
+      fprintf(stderr, "Dropping event subscriber that stopped reading\n");
+      close_subscriber(sub);
+      continue;
+    }
+    if (flush_subscriber(sub, now) != 0) {
+      close_subscriber(sub);
+    }
+  }
+}
+
+static void on_subscriber(int fd, uint32_t events, void *data) {
+  Subscriber *sub = data;
+  char discard[64];
+
+  if (events & (EPOLLERR | EPOLLHUP)) {
+    close_subscriber(sub);
+    return;
+  }
+  /* Subscribers never send anything; reading only notices them leaving */
+  if (events & EPOLLIN) {
+    ssize_t n = recv(fd, discard, sizeof(discard), MSG_DONTWAIT);
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+      close_subscriber(sub);
+      return;
+    }
+  }
+  if ((events & EPOLLOUT) && flush_subscriber(sub, now_ns()) != 0) {
+    close_subscriber(sub);
+  }
+}
+
+static Subscriber *attach_subscriber(int fd) {
+  for (int i = 0; i < FANOUT_MAX_SUBSCRIBERS; i++) {
+    Subscriber *sub = &subscribers[i];
+    if (sub->fd >= 0) {
+      continue;
+    }
+    if (set_nonblocking(fd) != 0 ||
+        (use_engine && engine_watch(fd, EPOLLIN, on_subscriber, sub) != 0)) {
+      return NULL;
+    }
+    sub->fd = fd;
+    sub->want_write = 0;
+    sub->head = sub->tail = 0;
+    sub->lost = 0;
+    sub->lost_since = 0;
+    subscriber_count++;
+    return sub;
+  }
+  return NULL;
+}
+
+static void on_accept(int fd, uint32_t events, void *data) {
+  (void)events;
+  (void)data;
+
+  int sub_fd = accept(fd, NULL, NULL);
+  if (sub_fd < 0) {
+    return;
+  }
+  set_cloexec(sub_fd);
+  if (!attach_subscriber(sub_fd)) {
+    close(sub_fd);
+  }
+}
+
+static void reset_subscribers(void) {
+  for (int i = 0; i < FANOUT_MAX_SUBSCRIBERS; i++) {
+    subscribers[i].fd = -1;
+  }
+  subscriber_count = 0;
+}
+
+/* Call after engine_init() and before the engine thread starts */
+int fanout_start(const char *path) {
+  struct sockaddr_un addr;
+
+  reset_subscribers();
+  use_engine = 1;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "Event socket path too long: %s\n", path);
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+
+  listen_fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+  if (listen_fd < 0) {
+    perror("Failed to create event socket");
+    return -1;
+  }
+  set_cloexec(listen_fd);
+  unlink(path);
+
+  if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      chmod(path, 0600) != 0 ||
+      listen(listen_fd, FANOUT_MAX_SUBSCRIBERS) != 0 ||
+      set_nonblocking(listen_fd) != 0 ||
+      engine_watch(listen_fd, EPOLLIN, on_accept, NULL) != 0) {
+    fprintf(stderr, "Failed to listen on %s: %s\n", path, strerror(errno));
+    close(listen_fd);
+    listen_fd = -1;
+    return -1;
+  }
+  strcpy(socket_path, path);
+  return 0;
+}
+
+/* Call once the engine thread has stopped */
+void fanout_stop(void) {
+  if (listen_fd < 0) {
+    return;
+  }
+  for (int i = 0; i < FANOUT_MAX_SUBSCRIBERS; i++) {
+    if (subscribers[i].fd >= 0) {
+      close_subscriber(&subscribers[i]);
+    }
+  }
+  engine_unwatch(listen_fd);
+  close(listen_fd);
+  listen_fd = -1;
+  unlink(socket_path);
+}
+
+static const char *axis_names[] = {"left_x",       "left_y",
+                                   "right_x",      "right_y",
+                                   "left_trigger", "right_trigger"};
+
+/* Prints events from a running --run instance until it goes away */
+int run_fanout_client(const char *path) {
+  struct sockaddr_un addr;
+  FanoutEvent frame[FANOUT_FRAME_EVENTS];
+  int fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+
+  if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    fprintf(stderr, "Failed to connect to %s: %s\n", path, strerror(errno));
+    if (fd >= 0) {
+      close(fd);
+    }
+    return -1;
+  }
+
+  for (;;) {
+    ssize_t n = recv(fd, frame, sizeof(frame), 0);
+    if (n <= 0) {
+      break;
+    }
+    for (size_t i = 0; i < (size_t)n / sizeof(FanoutEvent); i++) {
+      const FanoutEvent *ev = &frame[i];
+      printf("%llu.%06llu ", (unsigned long long)(ev->timestamp_ns / NSEC_PER_SEC),
+             (unsigned long long)(ev->timestamp_ns % NSEC_PER_SEC / NSEC_PER_USEC));
+      if (ev->type == FANOUT_BUTTON) {
+        printf("%u button %s %s\n", ev->device, button_id_to_string(ev->code),
+               ev->value ? "down" : "up");
+      } else if (ev->type == FANOUT_AXIS && ev->code < ARRAY_SIZE(axis_names)) {
+        printf("%u axis %s %d\n", ev->device, axis_names[ev->code], ev->value);
+      } else if (ev->type == FANOUT_LOST) {
+        printf("lost %d events\n", ev->value);
+      }
+    }
+    fflush(stdout);
+  }
+  close(fd);
+  return 0;
+}
+
+#define BENCH_PASS_EVENTS 16
+#define BENCH_SLOW_DELAY_US 5000
+
+typedef enum { BENCH_FAST, BENCH_SLOW, BENCH_STALLED } BenchKind;
+
+typedef struct {
+  pthread_t thread;
+  int fd;
+  BenchKind kind;
+  uint64_t received;
+  uint64_t lost;
+} BenchSubscriber;
+
+static volatile int bench_running = 0;
+
+static void *bench_subscriber(void *arg) {
+  BenchSubscriber *s = arg;
+  FanoutEvent frame[FANOUT_FRAME_EVENTS];
+
+  if (s->kind == BENCH_STALLED) {
+    while (bench_running) {
+      usleep(10000);
+    }
+    return NULL;
+  }
+  for (;;) {
+    ssize_t n = recv(s->fd, frame, sizeof(frame), 0);
+    if (n <= 0) {
+      break;
+    }
+    for (size_t i = 0; i < (size_t)n / sizeof(FanoutEvent); i++) {
+      if (frame[i].type == FANOUT_LOST) {
+        s->lost += (uint64_t)frame[i].value;
+      } else {
+        s->received++;
+      }
+    }
+    if (s->kind == BENCH_SLOW) {
+      usleep(BENCH_SLOW_DELAY_US);
+    }
+  }
+  return NULL;
+}
+
+static int bench_pending(void) {
+  for (int i = 0; i < FANOUT_MAX_SUBSCRIBERS; i++) {
+    const Subscriber *sub = &subscribers[i];
+    if (sub->fd >= 0 && (sub->head != sub->tail || sub->lost)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/*
+ * Drives the fan-out the way the engine does (a pass of edge events, then a
+ * flush) against one stalled, one slow and the rest fast subscribers, and
+ * reports what each pass cost the input path and what each subscriber got.
+ */
+int run_fanout_benchmark(int count, int seconds) {
+  static BenchSubscriber subs[FANOUT_MAX_SUBSCRIBERS];
+  static const char *kinds[] = {"fast", "slow", "stalled"};
+  LatencyHistogram pass_cost;
+  uint64_t offered = 0;
+  int started = 0;
+  int ret = 0;
+
+  if (count > FANOUT_MAX_SUBSCRIBERS) {
+    count = FANOUT_MAX_SUBSCRIBERS;
+  }
+  reset_subscribers();
+  use_engine = 0;
+  latency_reset(&pass_cost);
+  bench_running = 1;
+
+  for (int i = 0; i < count; i++) {
+    int pair[2];
+    BenchSubscriber *s = &subs[i];
+
+    memset(s, 0, sizeof(*s));
+    s->kind = i == 0 ? BENCH_STALLED : i == 1 ? BENCH_SLOW : BENCH_FAST;
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, pair) != 0) {
+      perror("socketpair");
+      break;
+    }
+    s->fd = pair[1];
+    if (!attach_subscriber(pair[0]) ||
+        pthread_create(&s->thread, NULL, bench_subscriber, s) != 0) {
+      close(pair[0]);
+      close(pair[1]);
+      break;
+    }
+    started++;
+  }
+
+  printf("Event fan-out benchmark: %d subscribers, %d s, %d events per pass\n",
+         started, seconds, BENCH_PASS_EVENTS);
+
+  uint64_t start = now_ns();
+  uint64_t end = start + (uint64_t)seconds * NSEC_PER_SEC;
+  uint64_t now = start;
+  while (now < end) {
+    for (int i = 0; i < BENCH_PASS_EVENTS; i++, offered++) {
+      fanout_push(0, FANOUT_BUTTON, offered % XBOX_BUTTON_COUNT,
+                  (offered / XBOX_BUTTON_COUNT) & 1, now);
+    }
+    fanout_flush(now);
+    uint64_t done = now_ns();
+    latency_record(&pass_cost, done - now);
+    now = done;
+  }
+
+  /* Let the live subscribers drain what is still queued */
+  uint64_t deadline = now_ns() + NSEC_PER_SEC;
+  while (bench_pending() && now_ns() < deadline) {
+    fanout_flush(now_ns());
+    usleep(1000);
+  }
+  double elapsed = (double)(now - start) / NSEC_PER_SEC;
+
+  bench_running = 0;
+  for (int i = 0; i < FANOUT_MAX_SUBSCRIBERS; i++) {
+    if (subscribers[i].fd >= 0) {
+      close_subscriber(&subscribers[i]);
+    }
+  }
+
+  printf("Offered %llu events (%.0f/s), %.0f ns per event on the input path\n",
+         (unsigned long long)offered, offered / elapsed,
+         (double)pass_cost.total_ns / offered);
+  latency_print(&pass_cost, "Push + flush per pass", stdout);
+  printf("%4s %-8s %12s %10s %14s\n", "sub", "kind", "received", "lost",
+         "received/s");
+  for (int i = 0; i < started; i++) {
+    BenchSubscriber *s = &subs[i];
+    pthread_join(s->thread, NULL);
+    close(s->fd);
+    printf("%4d %-8s %12llu %10llu %14.0f", i, kinds[s->kind],
+           (unsigned long long)s->received, (unsigned long long)s->lost,
+           s->received / elapsed);
+    if (s->kind == BENCH_STALLED) {
+      printf("  (dropped)");
+    } else if (s->received + s->lost != offered) {
+      printf("  (%llu unaccounted)",
+             (unsigned long long)(offered - s->received - s->lost));
+      ret = -1;
+    }
+    printf("\n");
+  }
+  return ret;
+}
@@ -0,0 +1,57 @@
+#ifndef FANOUT_H
+#define FANOUT_H
+
+#include <stdint.h>
+
+/*
+ * Edge events for local subscribers (loggers, overlays, analytics) over a
+ * SOCK_SEQPACKET Unix socket. The engine appends each event to every
+ * subscriber's own bounded ring and flushes all rings once per loop pass,
+ * several frames per sendmmsg() call. The input path never waits on a
+ * subscriber: a full ring drops new events and later reports how many with
+ * a FANOUT_LOST event, and a subscriber that stays full for
+ * FANOUT_DROP_AFTER_MS is disconnected.
+ *
+ * Each frame is a whole number of FanoutEvent records in host byte order.
+ */
+
+#define FANOUT_SOCKET_PATH "/run/faky-controller-events.sock"
+#define FANOUT_MAX_SUBSCRIBERS 16
+#define FANOUT_RING_SIZE 1024 /* events per subscriber, power of two */
+#define FANOUT_FRAME_EVENTS 64
+#define FANOUT_DROP_AFTER_MS 1000
+
+typedef enum {
+  FANOUT_BUTTON = 1, /* code XBOX_BUTTON_n, value 1 pressed / 0 released */
+  FANOUT_AXIS = 2,   /* code FANOUT_AXIS_*, value the new position */
+  FANOUT_LOST = 3,   /* value events dropped before this one */
+} FanoutType;
+
+typedef enum {
+  FANOUT_AXIS_LEFT_X,
+  FANOUT_AXIS_LEFT_Y,
+  FANOUT_AXIS_RIGHT_X,
+  FANOUT_AXIS_RIGHT_Y,
+  FANOUT_AXIS_LEFT_TRIGGER,
+  FANOUT_AXIS_RIGHT_TRIGGER,
+} FanoutAxis;
+
+typedef struct {
+  uint64_t timestamp_ns;
+  uint8_t device;
+  uint8_t type;
+  uint16_t code;
+  int32_t value;
+} FanoutEvent;
+
+const char *fanout_socket_path(void);
+int fanout_start(const char *path);
+void fanout_stop(void);
+int fanout_has_subscribers(void);
+void fanout_push(uint8_t device, uint8_t type, uint16_t code, int32_t value,
+                 uint64_t timestamp);
+void fanout_flush(uint64_t now);
+int run_fanout_client(const char *path);
+int run_fanout_benchmark(int subscribers, int seconds);
+
+#endif /* FANOUT_H */
@@ -0,0 +1,163 @@
+#include "feedback.h"
+#include "utils.h"
+#include <stdio.h>
+#include <string.h>
+
+static void LIBUSB_CALL on_feedback_transfer(struct libusb_transfer *transfer) {
+  FeedbackQueue *queue = transfer->user_data;
+
+  queue->in_flight = 0;
+  if (transfer->status == LIBUSB_TRANSFER_CANCELLED) {
+    return;
+  }
+  if (transfer->status != LIBUSB_TRANSFER_COMPLETED) {
+    fprintf(stderr, "Feedback transfer failed (status %d)\n",
+            transfer->status);
+  }
+  feedback_service(queue, now_ns());
+}
+
+static void on_feedback_retry(Timer *timer, uint64_t now) {
+  feedback_service(timer->data, now);
+}
+
+int feedback_init(FeedbackQueue *queue, libusb_device_handle *handle,
+                  TimerWheel *wheel) {
+  memset(queue, 0, sizeof(*queue));
+  queue->handle = handle;
+  queue->wheel = wheel;
+  queue->interval_ns = (uint64_t)FEEDBACK_MIN_INTERVAL_US * NSEC_PER_USEC;
+  timer_init(&queue->retry, on_feedback_retry, queue);
+
+  queue->transfer = libusb_alloc_transfer(0);
+  if (!queue->transfer) {
+    return -1;
+  }
+  pthread_mutex_init(&queue->lock, NULL);
+  return 0;
+}
+
+/* Engine thread only; the caller keeps handling events until !in_flight */
+void feedback_cancel(FeedbackQueue *queue) {
+  timer_cancel(queue->wheel, &queue->retry);
+  if (queue->in_flight) {
+    libusb_cancel_transfer(queue->transfer);
+  }
+}
+
+/*
+ * Stops the motors with a plain synchronous write, since the loop is gone
+ * by now and leaving a pad rumbling after exit is worse than a short wait.
+ */
+void feedback_destroy(FeedbackQueue *queue) {
+  uint8_t stop[FEEDBACK_PACKET_SIZE] = {0x00, 0x08, 0, 0, 0, 0, 0, 0};
+  int transferred;
+
+  if (!queue->transfer) {
+    return;
+  }
+  if (queue->rumble_large || queue->rumble_small) {
+    libusb_interrupt_transfer(queue->handle, FEEDBACK_ENDPOINT, stop,
+                              sizeof(stop), &transferred, 100);
+  }
+  libusb_free_transfer(queue->transfer);
+  queue->transfer = NULL;
+  pthread_mutex_destroy(&queue->lock);
+}
+
+void feedback_set_rumble(FeedbackQueue *queue, uint8_t large, uint8_t small) {
+  pthread_mutex_lock(&queue->lock);
+  if (queue->pending & FEEDBACK_RUMBLE) {
+    queue->coalesced++;
+  }
+  queue->rumble_large = large;
+  queue->rumble_small = small;
+  queue->pending |= FEEDBACK_RUMBLE;
+  pthread_mutex_unlock(&queue->lock);
+}
+
+void feedback_set_led(FeedbackQueue *queue, LedPattern pattern) {
+  pthread_mutex_lock(&queue->lock);
+  if (queue->pending & FEEDBACK_LED) {
+    queue->coalesced++;
+  }
+  queue->led = (uint8_t)pattern;
+  queue->pending |= FEEDBACK_LED;
+  pthread_mutex_unlock(&queue->lock);
+}
+
+/* Sends the wanted state again, to a pad that lost it while recovering */
+void feedback_restore(FeedbackQueue *queue) {
+  if (!queue->transfer) {
+    return;
+  }
+  pthread_mutex_lock(&queue->lock);
+  queue->pending |= queue->sent_kinds;
+  pthread_mutex_unlock(&queue->lock);
+}
+
+/*
+ * Sends the next pending packet if the endpoint is idle and the interval
+ * has passed, otherwise leaves it to the completion callback or the retry
+ * timer. Rumble and LED take turns so neither can starve the other.
+ */
+void feedback_service(FeedbackQueue *queue, uint64_t now) {
+  uint8_t kind;
+
+  if (queue->in_flight || !queue->pending || !queue->transfer) {
+    return;
+  }
+  if (queue->last_sent_ns &&
+      now < queue->last_sent_ns + queue->interval_ns) {
+    if (!timer_pending(&queue->retry)) {
+      timer_schedule_at(queue->wheel, &queue->retry,
+                        queue->last_sent_ns + queue->interval_ns);
+    }
+    return;
+  }
+
+  memset(queue->buffer, 0, sizeof(queue->buffer));
+  pthread_mutex_lock(&queue->lock);
+  if ((queue->pending & FEEDBACK_RUMBLE) &&
+      (!(queue->pending & FEEDBACK_LED) || queue->last_kind != FEEDBACK_RUMBLE)) {
+    kind = FEEDBACK_RUMBLE;
+    queue->buffer[0] = 0x00;
+    queue->buffer[1] = 0x08;
+    queue->buffer[3] = queue->rumble_large;
+    queue->buffer[4] = queue->rumble_small;
+  } else {
+    kind = FEEDBACK_LED;
+    queue->buffer[0] = 0x01;
+    queue->buffer[1] = 0x03;
+    queue->buffer[2] = queue->led;
+  }
+  pthread_mutex_unlock(&queue->lock);
+
+  libusb_fill_interrupt_transfer(queue->transfer, queue->handle,
+                                 FEEDBACK_ENDPOINT, queue->buffer,
+                                 kind == FEEDBACK_LED ? 3 : 8,
+                                 on_feedback_transfer, queue, 0);
+  int ret = libusb_submit_transfer(queue->transfer);
+  if (ret != 0) {
+    /* Still pending, tried again once the interval has passed */
+    fprintf(stderr, "Failed to submit feedback transfer: %s\n",
+            libusb_strerror(ret));
+    queue->last_sent_ns = now;
+    timer_schedule_at(queue->wheel, &queue->retry, now + queue->interval_ns);
+    return;
+  }
+
+  /* Sent; a newer value set meanwhile stays pending for the next packet */
+  pthread_mutex_lock(&queue->lock);
+  if (kind == FEEDBACK_RUMBLE ? queue->rumble_large == queue->buffer[3] &&
+                                    queue->rumble_small == queue->buffer[4]
+                              : queue->led == queue->buffer[2]) {
+    queue->pending &= ~kind;
+  }
+  pthread_mutex_unlock(&queue->lock);
+  queue->in_flight = 1;
+  queue->last_kind = kind;
+  queue->sent_kinds |= kind;
+  queue->last_sent_ns = now;
+  queue->sent++;
+}
@@ -0,0 +1,73 @@
+#ifndef FEEDBACK_H
+#define FEEDBACK_H
+
+#include "timer.h"
+#include <libusb-1.0/libusb.h>
+#include <pthread.h>
+#include <stdint.h>
+
+/*
+ * Rumble and player LED output for wired 360 pads. Requests only update the
+ * latest wanted value per kind, so a burst of rumble changes collapses into
+ * one packet. Packets go out as async interrupt OUT transfers on the engine
+ * loop, one at a time and no faster than the pad's OUT interval, so they
+ * never hold up input transfers.
+ */
+
+#define FEEDBACK_ENDPOINT 0x02
+#define FEEDBACK_PACKET_SIZE 8
+#define FEEDBACK_MIN_INTERVAL_US 8000
+
+#define FEEDBACK_RUMBLE 0x01
+#define FEEDBACK_LED 0x02
+
+typedef enum {
+  LED_OFF = 0,
+  LED_BLINK_ALL = 1,
+  LED_FLASH_1 = 2,
+  LED_FLASH_2 = 3,
+  LED_FLASH_3 = 4,
+  LED_FLASH_4 = 5,
+  LED_PLAYER_1 = 6,
+  LED_PLAYER_2 = 7,
+  LED_PLAYER_3 = 8,
+  LED_PLAYER_4 = 9,
+  LED_ROTATE = 10,
+  LED_BLINK = 11,
+  LED_SLOW_BLINK = 12,
+  LED_ALTERNATE = 13
+} LedPattern;
+
+typedef struct {
+  libusb_device_handle *handle;
+  struct libusb_transfer *transfer;
+  uint8_t buffer[FEEDBACK_PACKET_SIZE];
+  TimerWheel *wheel;
+  Timer retry;
+  uint64_t interval_ns;
+  uint64_t last_sent_ns; /* or the last failed submit */
+  int in_flight;
+  uint8_t last_kind;
+  uint8_t sent_kinds; /* every kind sent at least once */
+
+  /* Written by any thread under lock, consumed by the engine loop */
+  pthread_mutex_t lock;
+  volatile uint8_t pending;
+  uint8_t rumble_large;
+  uint8_t rumble_small;
+  uint8_t led;
+
+  uint32_t sent;
+  uint32_t coalesced;
+} FeedbackQueue;
+
+int feedback_init(FeedbackQueue *queue, libusb_device_handle *handle,
+                  TimerWheel *wheel);
+void feedback_cancel(FeedbackQueue *queue);
+void feedback_destroy(FeedbackQueue *queue);
+void feedback_set_rumble(FeedbackQueue *queue, uint8_t large, uint8_t small);
+void feedback_set_led(FeedbackQueue *queue, LedPattern pattern);
+void feedback_restore(FeedbackQueue *queue);
+void feedback_service(FeedbackQueue *queue, uint64_t now);
+
+#endif /* FEEDBACK_H */
@@ -0,0 +1,92 @@
+#include "hidraw.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* HID_ID=bus:vendor:product and HID_NAME from the node's uevent */
+static int read_uevent(const char *node, HidrawInfo *info) {
+  char path[128];
+  char line[256];
+  unsigned int bus, vendor, product;
+  int found = 0;
+
+  snprintf(path, sizeof(path), HIDRAW_SYSFS_DIR "/%s/device/uevent", node);
+  FILE *file = fopen(path, "r");
+  if (!file) {
+    return -1;
+  }
+
+  info->name[0] = '\0';
+  while (fgets(line, sizeof(line), file)) {
+    line[strcspn(line, "\n")] = '\0';
+    if (sscanf(line, "HID_ID=%x:%x:%x", &bus, &vendor, &product) == 3) {
+      info->vendor_id = (uint16_t)vendor;
+      info->product_id = (uint16_t)product;
+      found = 1;
+    } else if (strncmp(line, "HID_NAME=", 9) == 0) {
+      snprintf(info->name, sizeof(info->name), "%s", line + 9);
+    }
+  }
+  fclose(file);
+  return found ? 0 : -1;
+}
+
+static int compare_nodes(const void *a, const void *b) {
+  const HidrawInfo *x = a;
+  const HidrawInfo *y = b;
+  return atoi(x->path + 11) - atoi(y->path + 11);
+}
+
+/* Fills found[] with hidraw nodes of known controllers, lowest node first */
+int hidraw_find_controllers(HidrawInfo *found, int max) {
+  struct dirent *entry;
+  int count = 0;
+
+  DIR *dir = opendir(HIDRAW_SYSFS_DIR);
+  if (!dir) {
+    fprintf(stderr, "Failed to open %s: %s\n", HIDRAW_SYSFS_DIR,
+            strerror(errno));
+    return -1;
+  }
+
+  while ((entry = readdir(dir)) && count < max) {
+    HidrawInfo *info = &found[count];
+    if (strncmp(entry->d_name, "hidraw", 6) != 0 ||
+        read_uevent(entry->d_name, info) != 0) {
+      continue;
+    }
+    info->type = controller_type_from_ids(info->vendor_id, info->product_id);
+    if (info->type == CONTROLLER_TYPE_UNKNOWN) {
+      continue;
+    }
+    snprintf(info->path, sizeof(info->path), "/dev/%.20s", entry->d_name);
+    if (!info->name[0]) {
+      snprintf(info->name, sizeof(info->name), "%s (0x%04x:0x%04x)",
+               controller_type_to_string(info->type), info->vendor_id,
+               info->product_id);
+    }
+    count++;
+  }
+  closedir(dir);
+
+  qsort(found, count, sizeof(*found), compare_nodes);
+  return count;
+}
+
+/* Non-blocking, for the engine's epoll loop; write access is optional */
+int hidraw_open(const char *path) {
+  int fd = open(path, O_RDWR | O_NONBLOCK);
+  if (fd < 0 && errno == EACCES) {
+    fd = open(path, O_RDONLY | O_NONBLOCK);
+  }
+  if (fd < 0) {
+    fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+  fcntl(fd, F_SETFD, FD_CLOEXEC);
+  return fd;
+}
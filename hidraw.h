@@ -0,0 +1,29 @@
+#ifndef HIDRAW_H
+#define HIDRAW_H
+
+#include "controller.h"
+#include <stdint.h>
+
+/*
+ * Pads through the kernel's hidraw nodes instead of libusb. Nothing is
+ * detached or claimed, so other users of the device keep working, and with
+ * a udev rule granting access to /dev/hidraw* no root is needed. Nodes are
+ * matched to controllers by the VID:PID sysfs reports for them, which also
+ * covers virtual devices created through /dev/uhid.
+ */
+
+#define HIDRAW_MAX_DEVICES 16
+#define HIDRAW_SYSFS_DIR "/sys/class/hidraw"
+
+typedef struct {
+  char path[32]; /* /dev/hidrawN */
+  uint16_t vendor_id;
+  uint16_t product_id;
+  ControllerType type;
+  char name[64];
+} HidrawInfo;
+
+int hidraw_find_controllers(HidrawInfo *found, int max);
+int hidraw_open(const char *path);
+
+#endif /* HIDRAW_H */
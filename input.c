@@ -0,0 +1,255 @@
+#include "input.h"
+#include "utils.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/uinput.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+typedef struct {
+  const char *name;
+  int code;
+} KeyName;
+
+#define KEY_ENTRY(code) {#code, code}
+
+static const KeyName key_names[] = {
+    KEY_ENTRY(KEY_ESC),        KEY_ENTRY(KEY_1),          KEY_ENTRY(KEY_2),
+    KEY_ENTRY(KEY_3),          KEY_ENTRY(KEY_4),          KEY_ENTRY(KEY_5),
+    KEY_ENTRY(KEY_6),          KEY_ENTRY(KEY_7),          KEY_ENTRY(KEY_8),
+    KEY_ENTRY(KEY_9),          KEY_ENTRY(KEY_0),          KEY_ENTRY(KEY_MINUS),
+    KEY_ENTRY(KEY_EQUAL),      KEY_ENTRY(KEY_BACKSPACE),  KEY_ENTRY(KEY_TAB),
+    KEY_ENTRY(KEY_Q),          KEY_ENTRY(KEY_W),          KEY_ENTRY(KEY_E),
+    KEY_ENTRY(KEY_R),          KEY_ENTRY(KEY_T),          KEY_ENTRY(KEY_Y),
+    KEY_ENTRY(KEY_U),          KEY_ENTRY(KEY_I),          KEY_ENTRY(KEY_O),
+    KEY_ENTRY(KEY_P),          KEY_ENTRY(KEY_LEFTBRACE),  KEY_ENTRY(KEY_RIGHTBRACE),
+    KEY_ENTRY(KEY_ENTER),      KEY_ENTRY(KEY_LEFTCTRL),   KEY_ENTRY(KEY_A),
+    KEY_ENTRY(KEY_S),          KEY_ENTRY(KEY_D),          KEY_ENTRY(KEY_F),
+    KEY_ENTRY(KEY_G),          KEY_ENTRY(KEY_H),          KEY_ENTRY(KEY_J),
+    KEY_ENTRY(KEY_K),          KEY_ENTRY(KEY_L),          KEY_ENTRY(KEY_SEMICOLON),
+    KEY_ENTRY(KEY_APOSTROPHE), KEY_ENTRY(KEY_GRAVE),      KEY_ENTRY(KEY_LEFTSHIFT),
+    KEY_ENTRY(KEY_BACKSLASH),  KEY_ENTRY(KEY_Z),          KEY_ENTRY(KEY_X),
+    KEY_ENTRY(KEY_C),          KEY_ENTRY(KEY_V),          KEY_ENTRY(KEY_B),
+    KEY_ENTRY(KEY_N),          KEY_ENTRY(KEY_M),          KEY_ENTRY(KEY_COMMA),
+    KEY_ENTRY(KEY_DOT),        KEY_ENTRY(KEY_SLASH),      KEY_ENTRY(KEY_RIGHTSHIFT),
+    KEY_ENTRY(KEY_LEFTALT),    KEY_ENTRY(KEY_SPACE),      KEY_ENTRY(KEY_CAPSLOCK),
+    KEY_ENTRY(KEY_F1),         KEY_ENTRY(KEY_F2),         KEY_ENTRY(KEY_F3),
+    KEY_ENTRY(KEY_F4),         KEY_ENTRY(KEY_F5),         KEY_ENTRY(KEY_F6),
+    KEY_ENTRY(KEY_F7),         KEY_ENTRY(KEY_F8),         KEY_ENTRY(KEY_F9),
+    KEY_ENTRY(KEY_F10),        KEY_ENTRY(KEY_F11),        KEY_ENTRY(KEY_F12),
+    KEY_ENTRY(KEY_RIGHTCTRL),  KEY_ENTRY(KEY_RIGHTALT),   KEY_ENTRY(KEY_HOME),
+    KEY_ENTRY(KEY_UP),         KEY_ENTRY(KEY_PAGEUP),     KEY_ENTRY(KEY_LEFT),
+    KEY_ENTRY(KEY_RIGHT),      KEY_ENTRY(KEY_END),        KEY_ENTRY(KEY_DOWN),
+    KEY_ENTRY(KEY_PAGEDOWN),   KEY_ENTRY(KEY_INSERT),     KEY_ENTRY(KEY_DELETE),
+    KEY_ENTRY(KEY_LEFTMETA),   KEY_ENTRY(KEY_RIGHTMETA),  KEY_ENTRY(KEY_VOLUMEUP),
+    KEY_ENTRY(KEY_VOLUMEDOWN), KEY_ENTRY(KEY_MUTE),       KEY_ENTRY(KEY_PLAYPAUSE),
+    KEY_ENTRY(BTN_LEFT),       KEY_ENTRY(BTN_RIGHT),      KEY_ENTRY(BTN_MIDDLE),
+    KEY_ENTRY(BTN_SIDE),       KEY_ENTRY(BTN_EXTRA),
+};
+
+static const KeyName rel_names[] = {
+    KEY_ENTRY(REL_X),
+    KEY_ENTRY(REL_Y),
+    KEY_ENTRY(REL_WHEEL),
+    KEY_ENTRY(REL_HWHEEL),
+};
+
+typedef char output_key_cnt_matches[OUTPUT_KEY_CNT == KEY_CNT ? 1 : -1];
+typedef char output_rel_cnt_matches[OUTPUT_REL_CNT == REL_CNT ? 1 : -1];
+
+int open_output_device(OutputDevice *dev, const char *name) {
+  struct uinput_setup setup;
+
+  memset(dev, 0, sizeof(*dev));
+  dev->fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK);
+  if (dev->fd < 0) {
+    fprintf(stderr, "Failed to open /dev/uinput: %s\n", strerror(errno));
+    return -1;
+  }
+
+  ioctl(dev->fd, UI_SET_EVBIT, EV_KEY);
+  ioctl(dev->fd, UI_SET_EVBIT, EV_REL);
+  ioctl(dev->fd, UI_SET_EVBIT, EV_SYN);
+
+  for (int code = KEY_ESC; code <= KEY_MICMUTE; code++) {
+    ioctl(dev->fd, UI_SET_KEYBIT, code);
+  }
+  for (int code = BTN_LEFT; code <= BTN_TASK; code++) {
+    ioctl(dev->fd, UI_SET_KEYBIT, code);
+  }
+
+  ioctl(dev->fd, UI_SET_RELBIT, REL_X);
+  ioctl(dev->fd, UI_SET_RELBIT, REL_Y);
+  ioctl(dev->fd, UI_SET_RELBIT, REL_WHEEL);
+  ioctl(dev->fd, UI_SET_RELBIT, REL_HWHEEL);
+
+  memset(&setup, 0, sizeof(setup));
+  setup.id.bustype = BUS_VIRTUAL;
+  setup.id.vendor = 0x1209;
+  setup.id.product = 0xfa4c;
+  snprintf(setup.name, sizeof(setup.name), "%s", name);
+
+  if (ioctl(dev->fd, UI_DEV_SETUP, &setup) < 0 ||
+      ioctl(dev->fd, UI_DEV_CREATE) < 0) {
+    fprintf(stderr, "Failed to create uinput device: %s\n", strerror(errno));
+    close(dev->fd);
+    dev->fd = -1;
+    return -1;
+  }
+
+  return 0;
+}
+
+void close_output_device(OutputDevice *dev) {
+  if (dev->fd >= 0) {
+    ioctl(dev->fd, UI_DEV_DESTROY);
+    close(dev->fd);
+    dev->fd = -1;
+  }
+}
+
+/* Key transitions in the order emitted, then the summed motion */
+int flush_output(OutputDevice *dev) {
+  struct input_event batch[OUTPUT_FRAME_EVENTS + OUTPUT_REL_CNT + 1];
+  size_t n = 0;
+
+  if (!dev->dirty) {
+    return 0;
+  }
+  memset(batch, 0, sizeof(batch));
+  for (int i = 0; i < dev->count; i++) {
+    const OutputEvent *event = &dev->frame[i];
+    batch[n].type = event->type;
+    batch[n].code = event->code;
+    batch[n].value = event->value;
+    n++;
+    if (event->type == EV_KEY) {
+      CLEAR_BIT(dev->changed[event->code / 8], event->code % 8);
+    }
+  }
+  for (uint16_t mask = dev->rel_mask; mask; mask &= mask - 1) {
+    int code = __builtin_ctz(mask);
+    if (dev->rel[code] != 0) {
+      batch[n].type = EV_REL;
+      batch[n].code = (uint16_t)code;
+      batch[n].value = dev->rel[code];
+      n++;
+    }
+    dev->rel[code] = 0;
+  }
+  dev->count = 0;
+  dev->rel_mask = 0;
+  dev->dirty = 0;
+  if (n == 0) {
+    return 0; /* the motion summed to nothing */
+  }
+  batch[n].type = EV_SYN;
+  batch[n].code = SYN_REPORT;
+  n++;
+
+  dev->frames++;
+  dev->written += n;
+  if (write(dev->fd, batch, n * sizeof(batch[0])) !=
+      (ssize_t)(n * sizeof(batch[0]))) {
+    return -1;
+  }
+  return 0;
+}
+
+int emit_event(OutputDevice *dev, uint16_t type, uint16_t code, int32_t value) {
+  if (type == EV_SYN) {
+    /* Frames end in flush_output(), this only marks a report boundary */
+    return 0;
+  }
+
+  dev->emitted++;
+  if (type == EV_REL && code < OUTPUT_REL_CNT) {
+    if (value == 0) {
+      return 0;
+    }
+    dev->rel[code] += value;
+    dev->rel_mask |= (uint16_t)(1u << code);
+    dev->dirty = 1;
+    return 0;
+  }
+
+  if (type == EV_KEY && code < OUTPUT_KEY_CNT) {
+    int down = value != 0;
+    if (CHECK_BIT(dev->keys[code / 8], code % 8) == down) {
+      return 0;
+    }
+    if (CHECK_BIT(dev->changed[code / 8], code % 8) &&
+        flush_output(dev) != 0) {
+      return -1;
+    }
+    if (down) {
+      SET_BIT(dev->keys[code / 8], code % 8);
+    } else {
+      CLEAR_BIT(dev->keys[code / 8], code % 8);
+    }
+    SET_BIT(dev->changed[code / 8], code % 8);
+    value = down;
+  }
+
+  if (dev->count == OUTPUT_FRAME_EVENTS && flush_output(dev) != 0) {
+    return -1;
+  }
+  dev->frame[dev->count].type = type;
+  dev->frame[dev->count].code = code;
+  dev->frame[dev->count].value = value;
+  dev->count++;
+  dev->dirty = 1;
+  return 0;
+}
+
+int emit_key(OutputDevice *dev, uint16_t code, int pressed) {
+  return emit_event(dev, EV_KEY, code, pressed ? 1 : 0);
+}
+
+int emit_rel(OutputDevice *dev, uint16_t code, int32_t value) {
+  return emit_event(dev, EV_REL, code, value);
+}
+
+int emit_sync(OutputDevice *dev) { return emit_event(dev, EV_SYN, SYN_REPORT, 0); }
+
+void print_output_stats(const OutputDevice *dev, FILE *out) {
+  fprintf(out, "Output: %llu events emitted, %llu written in %llu writes\n",
+          (unsigned long long)dev->emitted, (unsigned long long)dev->written,
+          (unsigned long long)dev->frames);
+}
+
+static int lookup_code(const KeyName *table, size_t count, const char *name) {
+  for (size_t i = 0; i < count; i++) {
+    if (strcmp(table[i].name, name) == 0) {
+      return table[i].code;
+    }
+  }
+  return -1;
+}
+
+static const char *lookup_name(const KeyName *table, size_t count, int code) {
+  for (size_t i = 0; i < count; i++) {
+    if (table[i].code == code) {
+      return table[i].name;
+    }
+  }
+  return NULL;
+}
+
+int key_code_from_name(const char *name) {
+  return lookup_code(key_names, ARRAY_SIZE(key_names), name);
+}
+
+const char *key_name_from_code(int code) {
+  return lookup_name(key_names, ARRAY_SIZE(key_names), code);
+}
+
+int rel_code_from_name(const char *name) {
+  return lookup_code(rel_names, ARRAY_SIZE(rel_names), name);
+}
+
+const char *rel_name_from_code(int code) {
+  return lookup_name(rel_names, ARRAY_SIZE(rel_names), code);
+}
@@ -0,0 +1,57 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Virtual keyboard/mouse created through /dev/uinput. Events are not
+ * written as they are emitted but gathered into a frame that the engine
+ * loop writes once per pass with flush_output(), as one write() ending in
+ * one SYN_REPORT: presses of keys already down and releases of keys
+ * already up are dropped, relative motion is summed per axis and zero
+ * motion never goes out. A key that changes twice within a frame (a tap)
+ * closes the frame first, so no transition is lost.
+ */
+
+#define OUTPUT_FRAME_EVENTS 64
+#define OUTPUT_KEY_CNT 0x300 /* KEY_CNT */
+#define OUTPUT_REL_CNT 0x10  /* REL_CNT */
+
+typedef struct {
+  uint16_t type;
+  uint16_t code;
+  int32_t value;
+} OutputEvent;
+
+typedef struct {
+  int fd;
+  int dirty; /* a frame is pending */
+  uint8_t keys[OUTPUT_KEY_CNT / 8];    /* down as of the pending frame */
+  uint8_t changed[OUTPUT_KEY_CNT / 8]; /* in the pending frame */
+  int32_t rel[OUTPUT_REL_CNT];
+  uint16_t rel_mask;
+  int count;
+  OutputEvent frame[OUTPUT_FRAME_EVENTS];
+
+  uint64_t emitted;
+  uint64_t written; /* including SYN_REPORTs */
+  uint64_t frames;  /* write() calls */
+} OutputDevice;
+
+int open_output_device(OutputDevice *dev, const char *name);
+void close_output_device(OutputDevice *dev);
+
+int emit_event(OutputDevice *dev, uint16_t type, uint16_t code, int32_t value);
+int emit_key(OutputDevice *dev, uint16_t code, int pressed);
+int emit_rel(OutputDevice *dev, uint16_t code, int32_t value);
+int emit_sync(OutputDevice *dev);
+int flush_output(OutputDevice *dev);
+void print_output_stats(const OutputDevice *dev, FILE *out);
+
+int key_code_from_name(const char *name);
+const char *key_name_from_code(int code);
+int rel_code_from_name(const char *name);
+const char *rel_name_from_code(int code);
+
+#endif /* INPUT_H */
@@ -0,0 +1,297 @@
+#include "macro.h"
+#include "utils.h"
+#include <linux/input.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Playback instances come from a fixed pool and each one owns a Timer on the
+ * shared wheel, so a running macro costs nothing until its next step is due.
+ * Steps are scheduled against the previous step's deadline, not against the
+ * time the callback ran, so late ticks don't accumulate drift. Each playback
+ * remembers who started it, so a translator can stop its own macros before
+ * the profile they point into goes away.
+ */
+
+typedef struct MacroPlayback {
+  Timer timer;
+  const Macro *macro;
+  OutputDevice *out;
+  TimerWheel *wheel;
+  const void *owner;
+  int next_step;
+  struct MacroPlayback *next_free;
+} MacroPlayback;
+
+static MacroPlayback playbacks[MAX_MACRO_PLAYBACKS];
+static MacroPlayback *free_playbacks = NULL;
+static int pool_ready = 0;
+static int active_playbacks = 0;
+static LatencyHistogram step_latency;
+
+static int recording = 0;
+static uint64_t record_last_ns = 0;
+static Macro record_buffer;
+
+static void init_pool(void) {
+  free_playbacks = NULL;
+  for (int i = MAX_MACRO_PLAYBACKS - 1; i >= 0; i--) {
+    playbacks[i].next_free = free_playbacks;
+    free_playbacks = &playbacks[i];
+  }
+  latency_reset(&step_latency);
+  pool_ready = 1;
+}
+
+static void release_playback(MacroPlayback *pb) {
+  pb->macro = NULL;
+  pb->next_free = free_playbacks;
+  free_playbacks = pb;
+  active_playbacks--;
+}
+
+static void on_macro_step(Timer *timer, uint64_t now) {
+  MacroPlayback *pb = timer->data;
+  const Macro *macro = pb->macro;
+  uint64_t deadline = timer->deadline_ns;
+
+  latency_record(&step_latency, now > deadline ? now - deadline : 0);
+
+  /* Steps with no delay between them go out in the same report */
+  do {
+    const MacroStep *step = &macro->steps[pb->next_step++];
+    emit_event(pb->out, step->type, step->code, step->value);
+  } while (pb->next_step < macro->step_count &&
+           macro->steps[pb->next_step].delay_ms == 0);
+  emit_sync(pb->out);
+
+  if (pb->next_step >= macro->step_count) {
+    release_playback(pb);
+    return;
+  }
+
+  timer_schedule_at(pb->wheel, &pb->timer,
+                    deadline + macro->steps[pb->next_step].delay_ms *
+                                   NSEC_PER_MSEC);
+}
+
+int macro_play(const Macro *macro, OutputDevice *out, TimerWheel *wheel,
+               const void *owner) {
+  if (!pool_ready) {
+    init_pool();
+  }
+  if (macro->step_count == 0) {
+    return 0;
+  }
+  if (!free_playbacks) {
+    fprintf(stderr, "Macro playback pool exhausted\n");
+    return -1;
+  }
+
+  MacroPlayback *pb = free_playbacks;
+  free_playbacks = pb->next_free;
+  active_playbacks++;
+
+  pb->macro = macro;
+  pb->out = out;
+  pb->wheel = wheel;
+  pb->owner = owner;
+  pb->next_step = 0;
+  timer_init(&pb->timer, on_macro_step, pb);
+
+  uint64_t now = now_ns();
+  if (macro->steps[0].delay_ms == 0) {
+    pb->timer.deadline_ns = now;
+    on_macro_step(&pb->timer, now);
+    return 0;
+  }
+
+  timer_schedule_at(wheel, &pb->timer,
+                    now + macro->steps[0].delay_ms * NSEC_PER_MSEC);
+  return 0;
+}
+
+/* Whether the steps already run from from on leave code pressed */
+static int still_pressed(const MacroPlayback *pb, int from, uint16_t code) {
+  int down = 0;
+
+  for (int i = from; i < pb->next_step; i++) {
+    const MacroStep *step = &pb->macro->steps[i];
+    if (step->type == EV_KEY && step->code == code) {
+      down = step->value != 0;
+    }
+  }
+  return down;
+}
+
+/*
+ * Only keys this playback pressed and still holds go up, so a key held
+ * through another binding is left alone.
+ */
+static void stop_playback(TimerWheel *wheel, MacroPlayback *pb) {
+  const Macro *macro = pb->macro;
+
+  timer_cancel(wheel, &pb->timer);
+  for (int i = 0; i < pb->next_step; i++) {
+    const MacroStep *step = &macro->steps[i];
+    if (step->type == EV_KEY && step->value != 0 &&
+        still_pressed(pb, i, step->code)) {
+      emit_event(pb->out, EV_KEY, step->code, 0);
+    }
+  }
+  emit_sync(pb->out);
+  release_playback(pb);
+}
+
+/* Stops every macro started with this owner */
+void macro_cancel(TimerWheel *wheel, const void *owner) {
+  if (!pool_ready || active_playbacks == 0) {
+    return;
+  }
+  for (int i = 0; i < MAX_MACRO_PLAYBACKS; i++) {
+    if (playbacks[i].macro && playbacks[i].owner == owner) {
+      stop_playback(wheel, &playbacks[i]);
+    }
+  }
+}
+
+void macro_cancel_all(TimerWheel *wheel) {
+  if (!pool_ready) {
+    return;
+  }
+  for (int i = 0; i < MAX_MACRO_PLAYBACKS; i++) {
+    if (playbacks[i].macro) {
+      stop_playback(wheel, &playbacks[i]);
+    }
+  }
+}
+
+int macro_active_count(void) { return active_playbacks; }
+
+const LatencyHistogram *macro_latency(void) { return &step_latency; }
+
+void macro_record_start(void) {
+  memset(&record_buffer, 0, sizeof(record_buffer));
+  record_last_ns = 0;
+  recording = 1;
+}
+
+void macro_record_event(uint16_t type, uint16_t code, int32_t value) {
+  if (!recording || record_buffer.step_count >= MAX_MACRO_STEPS) {
+    return;
+  }
+
+  uint64_t now = now_ns();
+  MacroStep *step = &record_buffer.steps[record_buffer.step_count++];
+
+  step->delay_ms =
+      record_last_ns ? (uint32_t)((now - record_last_ns) / NSEC_PER_MSEC) : 0;
+  step->type = type;
+  step->code = code;
+  step->value = value;
+  record_last_ns = now;
+}
+
+int macro_record_stop(Macro *macro) {
+  recording = 0;
+  *macro = record_buffer;
+  return macro->step_count;
+}
+
+int macro_is_recording(void) { return recording; }
+
+/* For a macro that was not parsed here, e.g. read back from a bundle */
+int check_macro(const Macro *macro) {
+  if (macro->step_count < 0 || macro->step_count > MAX_MACRO_STEPS) {
+    return -1;
+  }
+  for (int i = 0; i < macro->step_count; i++) {
+    const MacroStep *step = &macro->steps[i];
+    if (!(step->type == EV_KEY && step->code < OUTPUT_KEY_CNT) &&
+        !(step->type == EV_REL && step->code < OUTPUT_REL_CNT)) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/*
+ * Text form used in profiles, one token per step:
+ *   +KEY_A/0 -KEY_A/30 REL_X:15/16
+ * "+"/"-" press or release a key, REL_* moves by the given amount, and the
+ * number after "/" is the delay in ms since the previous step.
+ */
+int parse_macro(const char *text, Macro *macro) {
+  char buffer[1024];
+  char *saveptr = NULL;
+
+  snprintf(buffer, sizeof(buffer), "%s", text);
+  macro->step_count = 0;
+
+  for (char *token = strtok_r(buffer, " \t", &saveptr); token;
+       token = strtok_r(NULL, " \t", &saveptr)) {
+    if (macro->step_count >= MAX_MACRO_STEPS) {
+      fprintf(stderr, "Macro has more than %d steps\n", MAX_MACRO_STEPS);
+      return -1;
+    }
+
+    MacroStep *step = &macro->steps[macro->step_count];
+    char *delay = strchr(token, '/');
+    if (delay) {
+      *delay++ = '\0';
+      step->delay_ms = (uint32_t)strtoul(delay, NULL, 10);
+    } else {
+      step->delay_ms = 0;
+    }
+
+    if (token[0] == '+' || token[0] == '-') {
+      int code = key_code_from_name(token + 1);
+      if (code < 0) {
+        fprintf(stderr, "Unknown key in macro: %s\n", token + 1);
+        return -1;
+      }
+      step->type = EV_KEY;
+      step->code = (uint16_t)code;
+      step->value = token[0] == '+';
+    } else {
+      char *amount = strchr(token, ':');
+      int code;
+      if (!amount) {
+        fprintf(stderr, "Invalid macro step: %s\n", token);
+        return -1;
+      }
+      *amount++ = '\0';
+      code = rel_code_from_name(token);
+      if (code < 0) {
+        fprintf(stderr, "Unknown axis in macro: %s\n", token);
+        return -1;
+      }
+      step->type = EV_REL;
+      step->code = (uint16_t)code;
+      step->value = (int32_t)strtol(amount, NULL, 10);
+    }
+    macro->step_count++;
+  }
+
+  return 0;
+}
+
+void write_macro(FILE *file, const Macro *macro) {
+  for (int i = 0; i < macro->step_count; i++) {
+    const MacroStep *step = &macro->steps[i];
+    const char *sep = i ? " " : "";
+
+    if (step->type == EV_KEY) {
+      const char *name = key_name_from_code(step->code);
+      if (name) {
+        fprintf(file, "%s%c%s/%u", sep, step->value ? '+' : '-', name,
+                step->delay_ms);
+      }
+    } else if (step->type == EV_REL) {
+      const char *name = rel_name_from_code(step->code);
+      if (name) {
+        fprintf(file, "%s%s:%d/%u", sep, name, step->value, step->delay_ms);
+      }
+    }
+  }
+}
@@ -0,0 +1,44 @@
+#ifndef MACRO_H
+#define MACRO_H
+
+#include "input.h"
+#include "stats.h"
+#include "timer.h"
+#include <stdint.h>
+#include <stdio.h>
+
+#define MAX_MACRO_STEPS 64
+#define MAX_MACROS 16
+#define MAX_MACRO_PLAYBACKS 256
+
+typedef struct {
+  uint32_t delay_ms; /* relative to the previous step */
+  uint16_t type;     /* EV_KEY or EV_REL */
+  uint16_t code;
+  int32_t value;
+} MacroStep;
+
+typedef struct {
+  int button;
+  int layer;
+  int step_count;
+  MacroStep steps[MAX_MACRO_STEPS];
+} Macro;
+
+int macro_play(const Macro *macro, OutputDevice *out, TimerWheel *wheel,
+               const void *owner);
+void macro_cancel(TimerWheel *wheel, const void *owner);
+void macro_cancel_all(TimerWheel *wheel);
+int macro_active_count(void);
+const LatencyHistogram *macro_latency(void);
+
+void macro_record_start(void);
+void macro_record_event(uint16_t type, uint16_t code, int32_t value);
+int macro_record_stop(Macro *macro);
+int macro_is_recording(void);
+
+int parse_macro(const char *text, Macro *macro);
+int check_macro(const Macro *macro);
+void write_macro(FILE *file, const Macro *macro);
+
+#endif /* MACRO_H */
@@ -1,5 +1,7 @@
 #include "main.h"
 #include "controller.h"
+#include "engine.h"
+#include "translator.h"
 #include "tui.h"
 #include <ctype.h>
 #include <libusb-1.0/libusb.h>
@@ -99,25 +101,506 @@ int discover_devices(libusb_context *lctx) {
   return count;
 }
 
+/* The sockets and shared memory every engine mode exposes */
+static void start_services(void) {
+  if (control_start(control_socket_path()) != 0) {
+    fprintf(stderr, "Continuing without the control socket\n");
+  }
+  if (fanout_start(fanout_socket_path()) != 0) {
+    fprintf(stderr, "Continuing without the event socket\n");
+  }
+  if (shm_publisher_open(NULL) != 0) {
+    fprintf(stderr, "Continuing without shared-memory state\n");
+  }
+}
+
+static void stop_services(void) {
+  control_stop();
+  fanout_stop();
+  shm_publisher_close();
+}
+
+/* The first controller found by the chosen backend */
+typedef struct {
+  uint16_t vendor_id;
+  uint16_t product_id;
+  char name[64];
+  char serial[64]; /* libusb pads only, may be empty */
+  libusb_device_handle *handle;
+  int fd;
+  InputBackend backend;
+  EvdevPad evdev;
+} Pad;
+
+static int open_first_pad(libusb_context *lctx, const RunOptions *options,
+                          Pad *pad) {
+  InputBackend backend = options->backend;
+
+  pad->handle = NULL;
+  pad->fd = -1;
+  pad->backend = backend;
+  pad->serial[0] = '\0';
+
+  if (backend == BACKEND_EVDEV) {
+    EvdevInfo found[EVDEV_MAX_DEVICES];
+    int count = evdev_find_controllers(found, EVDEV_MAX_DEVICES);
+    if (count <= 0) {
+      fprintf(stderr, "No evdev controllers found\n");
+      return -1;
+    }
+    pad->vendor_id = found[0].vendor_id;
+    pad->product_id = found[0].product_id;
+    snprintf(pad->name, sizeof(pad->name), "%s", found[0].name);
+    pad->fd = evdev_open(found[0].path, options->grab, &pad->evdev);
+    return pad->fd >= 0 ? 0 : -1;
+  }
+
+  if (backend == BACKEND_HIDRAW) {
+    HidrawInfo found[HIDRAW_MAX_DEVICES];
+    int count = hidraw_find_controllers(found, HIDRAW_MAX_DEVICES);
+    if (count <= 0) {
+      fprintf(stderr, "No hidraw controllers found\n");
+      return -1;
+    }
+    pad->vendor_id = found[0].vendor_id;
+    pad->product_id = found[0].product_id;
+    snprintf(pad->name, sizeof(pad->name), "%s", found[0].name);
+    pad->fd = hidraw_open(found[0].path);
+    return pad->fd >= 0 ? 0 : -1;
+  }
+
+  ControllerInfo *controllers = NULL;
+  int count = 0;
+  if (find_all_controllers(lctx, &controllers, &count) != 0 || count == 0) {
+    fprintf(stderr, "No controllers found\n");
+    free(controllers);
+    return -1;
+  }
+  pad->vendor_id = controllers[0].vendor_id;
+  pad->product_id = controllers[0].product_id;
+  snprintf(pad->name, sizeof(pad->name), "%s", controllers[0].name);
+  int ret = open_controller(controllers[0].device, &pad->handle);
+  free(controllers);
+  if (ret == 0) {
+    get_controller_serial(pad->handle, pad->serial, sizeof(pad->serial));
+  }
+  return ret;
+}
+
+/*
+ * The pad's calibration from the store, by serial first and then by
+ * VID:PID. cal_path is where tracking results are saved back to.
+ */
+static void load_calibration(const Pad *pad, Calibration *cal, char *cal_path,
+                             size_t size) {
+  ProfileStore store;
+
+  calibration_default(cal);
+  cal_path[0] = '\0';
+  if (store_open(&store, NULL) != 0) {
+    return;
+  }
+  store_calibration_path(&store, pad->vendor_id, pad->product_id, pad->serial,
+                         cal_path, size);
+  if (calibration_load(cal, cal_path) != 0 && pad->serial[0]) {
+    char shared[STORE_DIR_LEN + STORE_FILE_LEN];
+    store_calibration_path(&store, pad->vendor_id, pad->product_id, NULL,
+                           shared, sizeof(shared));
+    calibration_load(cal, shared);
+  }
+  store_close(&store);
+}
+
+/* Keeps what tracking learned, once it has seen enough reports */
+static void save_calibration(const Calibration *loaded, const char *cal_path) {
+  Calibration learned;
+  uint64_t samples = 0;
+
+  if (!cal_path[0] || engine_calibration(0, &learned, &samples) != 0 ||
+      samples < CAL_SAVE_MIN_SAMPLES ||
+      memcmp(&learned, loaded, sizeof(learned)) == 0) {
+    return;
+  }
+  if (calibration_save(&learned, cal_path) == 0) {
+    printf("Saved stick calibration to %s\n", cal_path);
+  }
+}
+
+/* Releases a pad the engine never took over */
+static void close_pad(Pad *pad) {
+  close_controller(pad->handle);
+  pad->handle = NULL;
+  if (pad->fd >= 0) {
+    close(pad->fd);
+    pad->fd = -1;
+  }
+}
+
+int run_translator(libusb_context *lctx, const RunOptions *options) {
+  static Profile profile;
+  static ProfileBundle bundle;
+  const Profile *active = &profile;
+  ProfileStore store;
+  Pad pad;
+  char default_path[STORE_DIR_LEN + STORE_FILE_LEN];
+  char cal_path[STORE_DIR_LEN + STORE_FILE_LEN];
+  Calibration calibration;
+  const char *profile_path = options->profile_path;
+  const char *stream_to = options->stream_to;
+  int record_id = -1;
+  int ret = -1;
+
+  if (options->record_button) {
+    record_id = button_id_from_string(options->record_button);
+    if (record_id < 0) {
+      fprintf(stderr, "Unknown button: %s\n", options->record_button);
+      return -1;
+    }
+    if (options->bundle_path) {
+      fprintf(stderr, "--record saves into a profile, not a bundle\n");
+      return -1;
+    }
+  }
+
+  if (open_first_pad(lctx, options, &pad) != 0) {
+    close_pad(&pad);
+    return -1;
+  }
+
+  /*
+   * The store's default for this VID:PID, else the old per-device file. A
+   * profile re-saved by --record is picked up by the next store refresh.
+   */
+  if (options->bundle_path) {
+    if (bundle_load(&bundle, options->bundle_path) != 0) {
+      close_pad(&pad);
+      return -1;
+    }
+    active = &bundle.profiles[bundle_active(&bundle)];
+    profile_path = options->bundle_path;
+    engine_set_bundle(&bundle);
+  } else if (!profile_path) {
+    int index = -1;
+    if (store_open(&store, NULL) == 0) {
+      index = store_find_default(&store, pad.vendor_id, pad.product_id);
+      store_path(&store, index, default_path, sizeof(default_path));
+      store_close(&store);
+    }
+    if (index < 0) {
+      snprintf(default_path, sizeof(default_path), "controller_%04x_%04x.cfg",
+               pad.vendor_id, pad.product_id);
+    }
+    profile_path = default_path;
+  }
+
+  if (!options->bundle_path && load_profile(&profile, profile_path) != 0) {
+    fprintf(stderr, "Failed to load profile %s\n", profile_path);
+    close_pad(&pad);
+    return -1;
+  }
+
+  if (options->rt.enabled) {
+    /* Lock after the profile and pools are in place so they are faulted in */
+    if (realtime_lock_memory() != 0) {
+      fprintf(stderr, "Continuing without locked memory\n");
+    }
+    engine_set_realtime(&options->rt);
+  }
+  engine_set_uring(options->uring);
+  load_calibration(&pad, &calibration, cal_path, sizeof(cal_path));
+  engine_set_calibration(&calibration);
+
+  if (engine_init(lctx) != 0) {
+    close_pad(&pad);
+    bundle_free(&bundle);
+    return -1;
+  }
+
+  start_services();
+  if (options->trace_path && trace_start(options->trace_path) != 0) {
+    fprintf(stderr, "Continuing without tracing\n");
+  }
+  if (stream_to && stream_start_sender(stream_to) != 0) {
+    fprintf(stderr, "Continuing without streaming\n");
+    stream_to = NULL;
+  }
+
+  if (record_id >= 0) {
+    macro_record_start();
+  }
+
+  /* The engine owns a hidraw/evdev fd from here on, even if starting fails */
+  int started;
+  if (pad.backend == BACKEND_EVDEV) {
+    started = start_evdev_device(pad.fd, &pad.evdev, pad.vendor_id,
+                                 pad.product_id, active);
+  } else if (pad.backend == BACKEND_HIDRAW) {
+    started = start_hidraw_device(pad.fd, pad.vendor_id, pad.product_id,
+                                  active);
+  } else {
+    started = start_input_reader(pad.handle, active);
+  }
+  pad.fd = -1;
+
+  if (started == 0) {
+    printf("Translating %s with %s (Ctrl+C to stop)...\n", pad.name,
+           profile_path);
+    /* Refused (-1) by anything but a wired 360 pad */
+    engine_set_led(0, LED_PLAYER_1);
+    if (stream_to) {
+      /* The pad drives the receiving side, not this machine */
+      engine_set_paused(0, 1);
+      printf("Streaming to %s\n", stream_to);
+    }
+    if (record_id >= 0) {
+      printf("Recording macro for %s...\n", options->record_button);
+    }
+    if (options->bundle_path) {
+      printf("%d profiles, starting on %s (Guide + RB/LB or A/B/X/Y "
+             "switches)\n",
+             bundle.count, bundle.names[bundle_active(&bundle)]);
+    }
+
+    running = 1;
+    while (running) {
+      pause();
+    }
+
+    stop_input_reader();
+    save_calibration(&calibration, cal_path);
+    ret = 0;
+  }
+  trace_stop();
+  stop_services();
+  stream_stop_sender();
+
+  if (record_id >= 0) {
+    Macro macro;
+    if (macro_record_stop(&macro) > 0 &&
+        bind_macro(&profile, 0, record_id, &macro) == 0 &&
+        save_profile(&profile, profile_path) == 0) {
+      printf("Recorded %d steps for %s into %s\n", macro.step_count,
+             options->record_button, profile_path);
+    } else {
+      printf("Nothing recorded\n");
+    }
+  }
+
+  latency_print(&engine_timers()->lateness, "Timer lateness", stdout);
+  latency_print(macro_latency(), "Macro step lateness", stdout);
+  print_output_stats(engine_output(), stdout);
+
+  engine_shutdown();
+  engine_set_bundle(NULL);
+  bundle_free(&bundle);
+  close_pad(&pad);
+  return ret;
+}
+
+/* Translates a pad streamed from another --run --stream-to instance */
+int run_stream_receiver(libusb_context *lctx, const RunOptions *options) {
+  static Profile profile;
+  const char *profile_path = options->profile_path;
+  int port = options->receive_port;
+  int ret = -1;
+
+  if (!profile_path) {
+    fprintf(stderr, "--receive needs a profile: --run FILE --receive\n");
+    return -1;
+  }
+  if (load_profile(&profile, profile_path) != 0) {
+    fprintf(stderr, "Failed to load profile %s\n", profile_path);
+    return -1;
+  }
+
+  if (options->rt.enabled) {
+    if (realtime_lock_memory() != 0) {
+      fprintf(stderr, "Continuing without locked memory\n");
+    }
+    engine_set_realtime(&options->rt);
+  }
+
+  if (engine_init(lctx) != 0) {
+    return -1;
+  }
+  start_services();
+
+  if (stream_start_receiver((uint16_t)port, engine_device_count(), 1) == 0) {
+    if (start_remote_device(0, 0, &profile) >= 0) {
+      printf("Receiving on UDP port %d with %s (Ctrl+C to stop)...\n", port,
+             profile_path);
+      running = 1;
+      while (running) {
+        pause();
+      }
+      ret = 0;
+    }
+    stop_input_reader();
+    stream_stop_receiver();
+  }
+  stop_services();
+
+  engine_shutdown();
+  return ret;
+}
+
 void print_usage(const char *program_name) {
   printf("Usage: %s [OPTIONS]\n", program_name);
   printf("Options:\n");
   printf("  --tui       Launch Text User Interface for configuration\n");
   printf("  --cli       Use command line interface (default)\n");
+  printf("  --run [FILE] Translate the first controller using a profile\n");
+  printf("  --hidraw    With --run, read the pad through /dev/hidraw* "
+         "instead of detaching its driver\n");
+  printf("  --evdev     With --run, read the pad's kernel driver events from "
+         "/dev/input/event*\n");
+  printf("  --grab      With --evdev, keep the pad's events from other "
+         "readers (EVIOCGRAB)\n");
+  printf("  --io-uring  With --hidraw or --evdev, read reports through "
+         "io_uring\n");
+  printf("  --record BUTTON  With --run, record output into a macro for "
+         "BUTTON\n");
+  printf("  --bundle FILE  With --run, translate with a profile bundle "
+         "switched by Guide chords\n");
+  printf("  --make-bundle OUT FILE...  Compile up to %d profiles into a "
+         "bundle\n",
+         BUNDLE_MAX_PROFILES);
+  printf("  --trace FILE  With --run, record pipeline stages as a Chrome "
+         "trace (chrome://tracing, ui.perfetto.dev)\n");
+  printf("  --realtime  With --run, lock memory and run the engine thread "
+         "under SCHED_FIFO\n");
+  printf("  --rt-cpu N  CPU to pin the engine thread to (default: last)\n");
+  printf("  --rt-priority N  SCHED_FIFO priority (default: %d)\n",
+         RT_DEFAULT_PRIORITY);
+  printf("  --stream-to HOST[:PORT]  With --run, send the pad to a --receive "
+         "instance instead of translating it here\n");
+  printf("  --receive [PORT]  With --run FILE, translate a pad streamed over "
+         "UDP (default port %d)\n",
+         STREAM_DEFAULT_PORT);
+  printf("  --stream-bench [SECONDS]  Measure streaming over loopback with "
+         "simulated packet loss\n");
+  printf("  --jitter-test [SECONDS]  Compare wake-up jitter with and without "
+         "real-time settings\n");
+  printf("  --uhid-bench [SECONDS]  End-to-end latency and throughput with a "
+         "virtual uhid pad (hidraw, or --evdev)\n");
+  printf("  --uring-bench [DEVICES]  Compare epoll and io_uring report "
+         "ingestion for DEVICES synthetic pads\n");
+  printf("  --rules-bench [RULES]  Measure rule evaluation per report for "
+         "up to RULES rules (default %d)\n",
+         MAX_RULES);
+  printf("  --shm-bench [READERS]  Measure shared-memory state publishing "
+         "against up to READERS readers\n");
+  printf("  --subscribe  Print button and axis events from a running --run "
+         "instance\n");
+  printf("  --fanout-bench [SUBSCRIBERS]  Measure event fan-out to "
+         "SUBSCRIBERS local subscribers\n");
+  printf("  --ctl COMMAND...  Send a command to a running --run instance "
+         "(--ctl help lists them)\n");
   printf("  --help, -h  Show this help message\n");
   printf("\nExamples:\n");
   printf("  %s --tui    # Launch TUI configuration\n", program_name);
   printf("  %s          # Use CLI mode (default)\n", program_name);
+  printf("  %s --run --record a  # Record a macro bound to A\n",
+         program_name);
 }
 
 int main(int argc, char *argv[]) {
   int use_tui = 0;
+  int use_run = 0;
+  RunOptions run = {NULL, NULL, NULL, NULL, NULL, -1, BACKEND_LIBUSB, 0, 0,
+                    {0, -1, RT_DEFAULT_PRIORITY}};
+  int jitter_seconds = 0;
+  int shm_readers = -1;
+  int fanout_subscribers = -1;
+  int stream_seconds = 0;
+  int uring_devices = -1;
+  int uhid_seconds = 0;
+  int bench_rules = -1;
   
   for (int i = 1; i < argc; i++) {
     if (strcmp(argv[i], "--tui") == 0) {
       use_tui = 1;
     } else if (strcmp(argv[i], "--cli") == 0) {
       use_tui = 0;
+    } else if (strcmp(argv[i], "--run") == 0) {
+      use_run = 1;
+      if (i + 1 < argc && strncmp(argv[i + 1], "--", 2) != 0) {
+        run.profile_path = argv[++i];
+      }
+    } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+      run.record_button = argv[++i];
+    } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+      run.trace_path = argv[++i];
+    } else if (strcmp(argv[i], "--bundle") == 0 && i + 1 < argc) {
+      run.bundle_path = argv[++i];
+    } else if (strcmp(argv[i], "--make-bundle") == 0 && i + 1 < argc) {
+      /* Touches no devices, so it does not need root either */
+      return run_make_bundle(argv[i + 1], argv + i + 2, argc - i - 2) == 0
+                 ? 0
+                 : 1;
+    } else if (strcmp(argv[i], "--realtime") == 0) {
+      run.rt.enabled = 1;
+    } else if (strcmp(argv[i], "--rt-cpu") == 0 && i + 1 < argc) {
+      run.rt.cpu = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--rt-priority") == 0 && i + 1 < argc) {
+      run.rt.priority = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--jitter-test") == 0) {
+      jitter_seconds = 5;
+      if (i + 1 < argc && strncmp(argv[i + 1], "--", 2) != 0) {
+        jitter_seconds = atoi(argv[++i]);
+      }
+    } else if (strcmp(argv[i], "--shm-bench") == 0) {
+      shm_readers = 8;
+      if (i + 1 < argc && strncmp(argv[i + 1], "--", 2) != 0) {
+        shm_readers = atoi(argv[++i]);
+      }
+    } else if (strcmp(argv[i], "--hidraw") == 0) {
+      run.backend = BACKEND_HIDRAW;
+    } else if (strcmp(argv[i], "--evdev") == 0) {
+      run.backend = BACKEND_EVDEV;
+    } else if (strcmp(argv[i], "--grab") == 0) {
+      run.grab = 1;
+    } else if (strcmp(argv[i], "--io-uring") == 0) {
+      run.uring = 1;
+    } else if (strcmp(argv[i], "--uhid-bench") == 0) {
+      uhid_seconds = 3;
+      if (i + 1 < argc && strncmp(argv[i + 1], "--", 2) != 0) {
+        uhid_seconds = atoi(argv[++i]);
+      }
+    } else if (strcmp(argv[i], "--uring-bench") == 0) {
+      uring_devices = 16;
+      if (i + 1 < argc && strncmp(argv[i + 1], "--", 2) != 0) {
+        uring_devices = atoi(argv[++i]);
+      }
+    } else if (strcmp(argv[i], "--rules-bench") == 0) {
+      bench_rules = MAX_RULES;
+      if (i + 1 < argc && strncmp(argv[i + 1], "--", 2) != 0) {
+        bench_rules = atoi(argv[++i]);
+      }
+    } else if (strcmp(argv[i], "--stream-to") == 0 && i + 1 < argc) {
+      run.stream_to = argv[++i];
+    } else if (strcmp(argv[i], "--receive") == 0) {
+      run.receive_port = STREAM_DEFAULT_PORT;
+      if (i + 1 < argc && strncmp(argv[i + 1], "--", 2) != 0) {
+        run.receive_port = atoi(argv[++i]);
+      }
+    } else if (strcmp(argv[i], "--stream-bench") == 0) {
+      stream_seconds = 2;
+      if (i + 1 < argc && strncmp(argv[i + 1], "--", 2) != 0) {
+        stream_seconds = atoi(argv[++i]);
+      }
+    } else if (strcmp(argv[i], "--fanout-bench") == 0) {
+      fanout_subscribers = 12;
+      if (i + 1 < argc && strncmp(argv[i + 1], "--", 2) != 0) {
+        fanout_subscribers = atoi(argv[++i]);
+      }
+    } else if (strcmp(argv[i], "--subscribe") == 0) {
+      return run_fanout_client(fanout_socket_path()) == 0 ? 0 : 1;
+    } else if (strcmp(argv[i], "--ctl") == 0) {
+      return run_control_client(control_socket_path(), argc - i - 1,
+                                argv + i + 1) == 0
+                 ? 0
+                 : 1;
     } else if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
       print_usage(argv[0]);
       return 0;
@@ -128,14 +611,39 @@ int main(int argc, char *argv[]) {
     }
   }
 
+  /* These touch no devices, so they do not need root */
+  if (shm_readers >= 0) {
+    return run_shm_benchmark(shm_readers, 2) == 0 ? 0 : 1;
+  }
+  if (fanout_subscribers >= 0) {
+    return run_fanout_benchmark(fanout_subscribers, 3) == 0 ? 0 : 1;
+  }
+  if (stream_seconds > 0) {
+    return run_stream_benchmark(stream_seconds) == 0 ? 0 : 1;
+  }
+  if (uring_devices >= 0) {
+    return run_uring_benchmark(uring_devices, 2) == 0 ? 0 : 1;
+  }
+  if (bench_rules >= 0) {
+    return run_rules_benchmark(bench_rules, 1) == 0 ? 0 : 1;
+  }
+
+  /*
+   * hidraw and evdev nodes and uinput can be opened without root given
+   * udev rules (or the input group)
+   */
   int permission_status = check_root_permissions();
-  if (permission_status == 0) {
+  if (permission_status == 0 && run.backend == BACKEND_LIBUSB) {
     fprintf(stderr, "[Error]: This program requires sudo permissions to "
                     "access USB devices!\n");
     fprintf(stderr, "Please run with: sudo %s\n", "main");
     return 1;
   }
 
+  if (jitter_seconds > 0) {
+    return run_jitter_test(&run.rt, jitter_seconds) == 0 ? 0 : 1;
+  }
+
   signal(SIGINT, signal_handler);
 
   libusb_context *lctx = NULL;
@@ -154,11 +662,26 @@ int main(int argc, char *argv[]) {
     return 1;
   }
 
+  if (uhid_seconds > 0) {
+    int ret = run_uhid_benchmark(lctx, run.backend == BACKEND_EVDEV,
+                                 uhid_seconds);
+    libusb_exit(lctx);
+    return ret == 0 ? 0 : 1;
+  }
+
   printf("Scanning for controllers...\n");
 
   int found;
   
-  if (use_tui) {
+  if (use_run && run.receive_port >= 0) {
+    int ret = run_stream_receiver(lctx, &run);
+    libusb_exit(lctx);
+    return ret == 0 ? 0 : 1;
+  } else if (use_run) {
+    int ret = run_translator(lctx, &run);
+    libusb_exit(lctx);
+    return ret == 0 ? 0 : 1;
+  } else if (use_tui) {
     if (init_tui() != 0) {
       fprintf(stderr, "Failed to initialize TUI\n");
       libusb_exit(lctx);
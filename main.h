@@ -1,6 +1,17 @@
 #ifndef MAIN_H
 #define MAIN_H
 
+#include "control.h"
+#include "evdev.h"
+#include "fanout.h"
+#include "hidraw.h"
+#include "netstream.h"
+#include "realtime.h"
+#include "shm.h"
+#include "store.h"
+#include "trace.h"
+#include "uhid.h"
+#include "uring.h"
 #include <libusb-1.0/libusb.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -8,5 +19,22 @@
 
 int check_root_permissions();
 int discover_devices(libusb_context *lctx);
+typedef enum { BACKEND_LIBUSB, BACKEND_HIDRAW, BACKEND_EVDEV } InputBackend;
+
+typedef struct {
+  const char *profile_path;  /* NULL picks the store default */
+  const char *record_button; /* --record, or NULL */
+  const char *bundle_path;   /* --bundle, or NULL */
+  const char *trace_path;    /* --trace, or NULL */
+  const char *stream_to;     /* --stream-to destination, or NULL */
+  int receive_port;          /* --receive port, or -1 */
+  InputBackend backend;
+  int grab;                  /* --grab: EVIOCGRAB the evdev node */
+  int uring;                 /* --io-uring: hidraw/evdev reads via io_uring */
+  RealtimeConfig rt;
+} RunOptions;
+
+int run_translator(libusb_context *lctx, const RunOptions *options);
+int run_stream_receiver(libusb_context *lctx, const RunOptions *options);
 
 #endif /* MAIN_H */
@@ -0,0 +1,649 @@
+#define _GNU_SOURCE
+#include "netstream.h"
+#include "engine.h"
+#include "stats.h"
+#include "utils.h"
+#include <errno.h>
+#include <math.h>
+#include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+static StreamSender sender;
+static int sender_open = 0;
+static Timer keyframe_timer;
+static StreamReceiver receiver;
+static int receiver_open = 0;
+static int receiver_first = 0;
+static int receiver_devices = 0;
+
+/* 8-bit sticks; full deflection survives the round trip both ways */
+void stream_quantise(const ControllerState *state, StreamState *out) {
+  out->buttons = (uint16_t)state->button_mask;
+  out->sticks[0] = (int8_t)(state->left_thumb_x >> 8);
+  out->sticks[1] = (int8_t)(state->left_thumb_y >> 8);
+  out->sticks[2] = (int8_t)(state->right_thumb_x >> 8);
+  out->sticks[3] = (int8_t)(state->right_thumb_y >> 8);
+  out->triggers[0] = state->left_trigger;
+  out->triggers[1] = state->right_trigger;
+}
+
+static int16_t dequantise_stick(int8_t value) {
+  return (int16_t)(value * 256 + (value > 0 ? 255 : 0));
+}
+
+/* Remote states have no USB report behind them, so the raw bytes stay 0 */
+void stream_dequantise(const StreamState *state, ControllerState *out) {
+  memset(out, 0, sizeof(*out));
+  out->button_mask = state->buttons;
+  out->left_thumb_x = dequantise_stick(state->sticks[0]);
+  out->left_thumb_y = dequantise_stick(state->sticks[1]);
+  out->right_thumb_x = dequantise_stick(state->sticks[2]);
+  out->right_thumb_y = dequantise_stick(state->sticks[3]);
+  out->left_trigger = state->triggers[0];
+  out->right_trigger = state->triggers[1];
+}
+
+static void encode_update(const StreamState *prev, const StreamState *state,
+                          int keyframe, StreamUpdate *out) {
+  uint8_t *p = out->data + 1;
+  uint8_t mask = keyframe ? STREAM_FIELD_KEYFRAME : 0;
+
+  if (keyframe || state->buttons != prev->buttons) {
+    mask |= STREAM_FIELD_BUTTONS;
+    *p++ = state->buttons & 0xff;
+    *p++ = state->buttons >> 8;
+  }
+  for (int i = 0; i < 4; i++) {
+    if (keyframe || state->sticks[i] != prev->sticks[i]) {
+      mask |= STREAM_FIELD_STICK(i);
+      *p++ = (uint8_t)state->sticks[i];
+    }
+  }
+  for (int i = 0; i < 2; i++) {
+    if (keyframe || state->triggers[i] != prev->triggers[i]) {
+      mask |= STREAM_FIELD_TRIGGER(i);
+      *p++ = state->triggers[i];
+    }
+  }
+  out->data[0] = mask;
+  out->length = (uint8_t)(p - out->data);
+}
+
+static size_t update_length(uint8_t mask) {
+  size_t length = 1;
+  if (mask & STREAM_FIELD_BUTTONS) {
+    length += 2;
+  }
+  for (int i = 0; i < 4; i++) {
+    length += (mask & STREAM_FIELD_STICK(i)) != 0;
+  }
+  for (int i = 0; i < 2; i++) {
+    length += (mask & STREAM_FIELD_TRIGGER(i)) != 0;
+  }
+  return length;
+}
+
+static void apply_update(StreamState *state, const uint8_t *p) {
+  uint8_t mask = *p++;
+
+  if (mask & STREAM_FIELD_BUTTONS) {
+    state->buttons = (uint16_t)(p[0] | p[1] << 8);
+    p += 2;
+  }
+  for (int i = 0; i < 4; i++) {
+    if (mask & STREAM_FIELD_STICK(i)) {
+      state->sticks[i] = (int8_t)*p++;
+    }
+  }
+  for (int i = 0; i < 2; i++) {
+    if (mask & STREAM_FIELD_TRIGGER(i)) {
+      state->triggers[i] = *p++;
+    }
+  }
+}
+
+/* "host", "host:port" or "[v6]:port" */
+static int resolve(const char *destination, int passive,
+                   struct addrinfo **result) {
+  struct addrinfo hints;
+  char host[256];
+  char port[8];
+  const char *colon = strrchr(destination, ':');
+
+  snprintf(port, sizeof(port), "%d", STREAM_DEFAULT_PORT);
+  snprintf(host, sizeof(host), "%s", destination);
+  if (destination[0] == '[') {
+    const char *end = strchr(destination, ']');
+    if (!end) {
+      return -1;
+    }
+    snprintf(host, sizeof(host), "%.*s", (int)(end - destination - 1),
+             destination + 1);
+    colon = end[1] == ':' ? end + 1 : NULL;
+  } else if (colon && strchr(destination, ':') == colon) {
+    snprintf(host, sizeof(host), "%.*s", (int)(colon - destination),
+             destination);
+  } else {
+    colon = NULL;
+  }
+  if (colon) {
+    snprintf(port, sizeof(port), "%s", colon + 1);
+  }
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_DGRAM;
+  hints.ai_flags = AI_NUMERICSERV | (passive ? AI_PASSIVE : 0);
+  int ret = getaddrinfo(host[0] ? host : NULL, port, &hints, result);
+  if (ret != 0) {
+    fprintf(stderr, "Failed to resolve %s: %s\n", destination,
+            gai_strerror(ret));
+    return -1;
+  }
+  return 0;
+}
+
+int stream_sender_open(StreamSender *s, const char *destination) {
+  struct addrinfo *addrs;
+
+  memset(s, 0, sizeof(*s));
+  s->fd = -1;
+  if (resolve(destination, 0, &addrs) != 0) {
+    return -1;
+  }
+  for (struct addrinfo *a = addrs; a && s->fd < 0; a = a->ai_next) {
+    s->fd = socket(a->ai_family, a->ai_socktype | SOCK_CLOEXEC, 0);
+    if (s->fd >= 0) {
+      memcpy(&s->dest, a->ai_addr, a->ai_addrlen);
+      s->dest_length = a->ai_addrlen;
+    }
+  }
+  freeaddrinfo(addrs);
+  if (s->fd < 0) {
+    perror("Failed to create stream socket");
+    return -1;
+  }
+  s->loss_seed = (unsigned int)now_ns();
+  return 0;
+}
+
+void stream_sender_close(StreamSender *s) {
+  if (s->fd >= 0) {
+    close(s->fd);
+    s->fd = -1;
+  }
+}
+
+/*
+ * Queues a packet if the quantised state changed (or a keyframe is due).
+ * Packets go out on the next stream_sender_flush(), so every report of one
+ * engine pass shares a sendmmsg().
+ */
+void stream_sender_push(StreamSender *s, int device, const StreamState *state,
+                        int keyframe) {
+  if (device < 0 || device >= STREAM_MAX_DEVICES) {
+    return;
+  }
+  if (!keyframe && s->has_last[device] &&
+      memcmp(state, &s->last[device], sizeof(*state)) == 0) {
+    return;
+  }
+
+  StreamUpdate *history = s->history[device];
+  memmove(history + 1, history, (STREAM_REDUNDANCY - 1) * sizeof(*history));
+  encode_update(&s->last[device], state, keyframe || !s->has_last[device],
+                &history[0]);
+  if (s->history_count[device] < STREAM_REDUNDANCY) {
+    s->history_count[device]++;
+  }
+  s->last[device] = *state;
+  s->has_last[device] = 1;
+  s->updates++;
+
+  if (s->pending == STREAM_BATCH) {
+    stream_sender_flush(s);
+  }
+  uint16_t seq = ++s->seq[device];
+  uint8_t *p = s->packets[s->pending];
+  uint8_t *start = p;
+  *p++ = STREAM_MAGIC;
+  *p++ = (uint8_t)device;
+  *p++ = seq & 0xff;
+  *p++ = seq >> 8;
+  *p++ = (uint8_t)s->history_count[device];
+  for (int i = 0; i < s->history_count[device]; i++) {
+    memcpy(p, history[i].data, history[i].length);
+    p += history[i].length;
+  }
+  s->lengths[s->pending++] = (uint8_t)(p - start);
+}
+
+/* Full state for every device seen, so receivers resync after a long loss */
+void stream_sender_keyframes(StreamSender *s) {
+  for (int i = 0; i < STREAM_MAX_DEVICES; i++) {
+    if (s->has_last[i]) {
+      stream_sender_push(s, i, &s->last[i], 1);
+    }
+  }
+}
+
+void stream_sender_flush(StreamSender *s) {
+  struct mmsghdr msgs[STREAM_BATCH];
+  struct iovec iov[STREAM_BATCH];
+  int count = 0;
+
+  for (int i = 0; i < s->pending; i++) {
+    s->packets_sent++;
+    s->bytes_sent += s->lengths[i];
+    if (s->loss_permille &&
+        (unsigned int)rand_r(&s->loss_seed) % 1000 < s->loss_permille) {
+      s->packets_lost++;
+      continue;
+    }
+    iov[count].iov_base = s->packets[i];
+    iov[count].iov_len = s->lengths[i];
+    memset(&msgs[count], 0, sizeof(msgs[count]));
+    msgs[count].msg_hdr.msg_name = &s->dest;
+    msgs[count].msg_hdr.msg_namelen = s->dest_length;
+    msgs[count].msg_hdr.msg_iov = &iov[count];
+    msgs[count].msg_hdr.msg_iovlen = 1;
+    count++;
+  }
+  s->pending = 0;
+
+  /* UDP: whatever the kernel will not take is simply lost */
+  for (int sent = 0; sent < count;) {
+    int n = sendmmsg(s->fd, msgs + sent, count - sent, MSG_DONTWAIT);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      s->packets_lost += count - sent;
+      break;
+    }
+    sent += n;
+  }
+}
+
+int stream_receiver_open(StreamReceiver *r, const char *address,
+                         uint16_t port, stream_apply_fn fn, void *data) {
+  struct addrinfo *addrs;
+  char destination[280];
+
+  memset(r, 0, sizeof(*r));
+  r->fd = -1;
+  r->fn = fn;
+  r->data = data;
+
+  snprintf(destination, sizeof(destination), "%s:%u",
+           address ? address : "", port);
+  if (resolve(destination, 1, &addrs) != 0) {
+    return -1;
+  }
+  for (struct addrinfo *a = addrs; a && r->fd < 0; a = a->ai_next) {
+    r->fd = socket(a->ai_family,
+                   a->ai_socktype | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (r->fd >= 0 && bind(r->fd, a->ai_addr, a->ai_addrlen) != 0) {
+      close(r->fd);
+      r->fd = -1;
+    }
+  }
+  freeaddrinfo(addrs);
+  if (r->fd < 0) {
+    fprintf(stderr, "Failed to listen on UDP port %u: %s\n", port,
+            strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+void stream_receiver_close(StreamReceiver *r) {
+  if (r->fd >= 0) {
+    close(r->fd);
+    r->fd = -1;
+  }
+}
+
+/*
+ * Applies every update of the packet this device has not seen yet, oldest
+ * first, so a press and release that both arrive late are still replayed
+ * as two edges.
+ */
+static void handle_packet(StreamReceiver *r, const uint8_t *p, size_t length) {
+  size_t offsets[STREAM_REDUNDANCY];
+  size_t pos = STREAM_HEADER_SIZE;
+
+  if (length < STREAM_HEADER_SIZE || p[0] != STREAM_MAGIC ||
+      p[1] >= STREAM_MAX_DEVICES || p[4] == 0 || p[4] > STREAM_REDUNDANCY) {
+    return;
+  }
+  int device = p[1];
+  uint16_t seq = (uint16_t)(p[2] | p[3] << 8);
+  int count = p[4];
+
+  for (int i = 0; i < count; i++) {
+    if (pos >= length || pos + update_length(p[pos]) > length) {
+      return;
+    }
+    offsets[i] = pos;
+    pos += update_length(p[pos]);
+  }
+  r->packets++;
+
+  for (int i = count - 1; i >= 0; i--) {
+    uint16_t update_seq = (uint16_t)(seq - i);
+    uint8_t mask = p[offsets[i]];
+
+    if (!r->synced[device]) {
+      if (!(mask & STREAM_FIELD_KEYFRAME)) {
+        continue;
+      }
+    } else {
+      int16_t ahead = (int16_t)(update_seq - r->last_seq[device]);
+      /*
+       * A keyframe further back than any repeated copy can be means the
+       * sender restarted its sequence: take it as a fresh start.
+       */
+      if (ahead <= 0 && (!(mask & STREAM_FIELD_KEYFRAME) ||
+                         ahead >= -STREAM_REDUNDANCY)) {
+        continue;
+      }
+      if (ahead > 0) {
+        r->gaps += ahead - 1;
+      }
+    }
+
+    apply_update(&r->state[device], p + offsets[i]);
+    r->synced[device] = 1;
+    r->last_seq[device] = update_seq;
+    r->updates++;
+    r->recovered += i > 0;
+    if (r->fn) {
+      r->fn(device, update_seq, &r->state[device], i > 0, r->data);
+    }
+  }
+}
+
+/* Drains the socket in recvmmsg() batches; returns packets read or -1 */
+int stream_receiver_poll(StreamReceiver *r) {
+  struct mmsghdr msgs[STREAM_BATCH];
+  struct iovec iov[STREAM_BATCH];
+  uint8_t buffers[STREAM_BATCH][STREAM_MAX_PACKET];
+  int total = 0;
+
+  for (;;) {
+    for (int i = 0; i < STREAM_BATCH; i++) {
+      iov[i].iov_base = buffers[i];
+      iov[i].iov_len = sizeof(buffers[i]);
+      memset(&msgs[i], 0, sizeof(msgs[i]));
+      msgs[i].msg_hdr.msg_iov = &iov[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    int n = recvmmsg(r->fd, msgs, STREAM_BATCH, MSG_DONTWAIT, NULL);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return errno == EAGAIN ? total : -1;
+    }
+    for (int i = 0; i < n; i++) {
+      if (!(msgs[i].msg_hdr.msg_flags & MSG_TRUNC)) {
+        handle_packet(r, buffers[i], msgs[i].msg_len);
+      }
+    }
+    total += n;
+    if (n < STREAM_BATCH) {
+      return total;
+    }
+  }
+}
+
+static void on_keyframe_timer(Timer *timer, uint64_t now) {
+  (void)now;
+  stream_sender_keyframes(&sender);
+  stream_sender_flush(&sender);
+  timer_schedule(engine_timers(), timer, STREAM_KEYFRAME_MS * NSEC_PER_MSEC);
+}
+
+/* Call after engine_init() and before the engine thread starts */
+int stream_start_sender(const char *destination) {
+  if (stream_sender_open(&sender, destination) != 0) {
+    return -1;
+  }
+  timer_init(&keyframe_timer, on_keyframe_timer, NULL);
+  timer_schedule(engine_timers(), &keyframe_timer,
+                 STREAM_KEYFRAME_MS * NSEC_PER_MSEC);
+  sender_open = 1;
+  return 0;
+}
+
+/* Call once the engine thread has stopped */
+void stream_stop_sender(void) {
+  if (!sender_open) {
+    return;
+  }
+  timer_cancel(engine_timers(), &keyframe_timer);
+  stream_sender_close(&sender);
+  sender_open = 0;
+}
+
+int stream_sending(void) { return sender_open; }
+
+void stream_send_state(int device, const ControllerState *state) {
+  StreamState quantised;
+  stream_quantise(state, &quantised);
+  stream_sender_push(&sender, device, &quantised, 0);
+}
+
+void stream_flush(void) {
+  if (sender.pending) {
+    stream_sender_flush(&sender);
+  }
+}
+
+static void on_remote_update(int device, uint16_t seq,
+                             const StreamState *state, int recovered,
+                             void *data) {
+  ControllerState decoded;
+  (void)seq;
+  (void)recovered;
+  (void)data;
+
+  if (device < receiver_devices) {
+    stream_dequantise(state, &decoded);
+    engine_feed_state(receiver_first + device, &decoded);
+  }
+}
+
+static void on_stream_readable(int fd, uint32_t events, void *data) {
+  (void)fd;
+  (void)events;
+  (void)data;
+  stream_receiver_poll(&receiver);
+}
+
+/*
+ * Call after engine_init() and before the engine thread starts. Remote
+ * device n is fed to engine device first_device + n, for n < devices.
+ */
+int stream_start_receiver(uint16_t port, int first_device, int devices) {
+  if (stream_receiver_open(&receiver, NULL, port, on_remote_update, NULL) !=
+      0) {
+    return -1;
+  }
+  if (engine_watch(receiver.fd, EPOLLIN, on_stream_readable, NULL) != 0) {
+    stream_receiver_close(&receiver);
+    return -1;
+  }
+  receiver_first = first_device;
+  receiver_devices = devices;
+  receiver_open = 1;
+  return 0;
+}
+
+/* Call once the engine thread has stopped */
+void stream_stop_receiver(void) {
+  if (!receiver_open) {
+    return;
+  }
+  engine_unwatch(receiver.fd);
+  stream_receiver_close(&receiver);
+  receiver_open = 0;
+}
+
+#define BENCH_RATE_HZ 1000
+#define BENCH_MAX_SECONDS 30
+
+typedef struct {
+  StreamReceiver receiver;
+  uint64_t sent_at[65536];
+  LatencyHistogram latency;
+  volatile int running;
+} BenchLink;
+
+static void bench_apply(int device, uint16_t seq, const StreamState *state,
+                        int recovered, void *data) {
+  BenchLink *link = data;
+  (void)device;
+  (void)state;
+  (void)recovered;
+
+  if (link->sent_at[seq]) {
+    latency_record(&link->latency, now_ns() - link->sent_at[seq]);
+    link->sent_at[seq] = 0;
+  }
+}
+
+static void *bench_receive(void *arg) {
+  BenchLink *link = arg;
+  struct pollfd pfd = {link->receiver.fd, POLLIN, 0};
+
+  while (link->running) {
+    if (poll(&pfd, 1, 10) > 0) {
+      stream_receiver_poll(&link->receiver);
+    }
+  }
+  stream_receiver_poll(&link->receiver);
+  return NULL;
+}
+
+/* A pad being played: sticks circling, a button tapped, a trigger ramp */
+static void bench_input(uint64_t tick, StreamState *state) {
+  double angle = 2 * M_PI * (double)(tick % 1500) / 1500;
+
+  state->buttons = (tick / 40) % 2 ? 0 : 1u << ((tick / 80) % XBOX_BUTTON_COUNT);
+  state->sticks[0] = (int8_t)(127 * cos(angle));
+  state->sticks[1] = (int8_t)(127 * sin(angle));
+  state->sticks[2] = 0;
+  state->sticks[3] = 0;
+  state->triggers[0] = (uint8_t)(tick / 4);
+  state->triggers[1] = 0;
+}
+
+static int bench_run(BenchLink *link, int loss_percent, int seconds) {
+  StreamSender s;
+  StreamState state;
+  struct sockaddr_storage addr;
+  socklen_t addr_length = sizeof(addr);
+  char destination[32];
+  pthread_t thread;
+
+  memset(link, 0, sizeof(*link));
+  if (stream_receiver_open(&link->receiver, "127.0.0.1", 0, bench_apply,
+                           link) != 0) {
+    return -1;
+  }
+  getsockname(link->receiver.fd, (struct sockaddr *)&addr, &addr_length);
+  snprintf(destination, sizeof(destination), "127.0.0.1:%u",
+           ntohs(((struct sockaddr_in *)&addr)->sin_port));
+  if (stream_sender_open(&s, destination) != 0) {
+    stream_receiver_close(&link->receiver);
+    return -1;
+  }
+  s.loss_permille = (unsigned int)loss_percent * 10;
+
+  link->running = 1;
+  if (pthread_create(&thread, NULL, bench_receive, link) != 0) {
+    stream_sender_close(&s);
+    stream_receiver_close(&link->receiver);
+    return -1;
+  }
+
+  struct timespec next;
+  clock_gettime(CLOCK_MONOTONIC, &next);
+  uint64_t ticks = (uint64_t)seconds * BENCH_RATE_HZ;
+  for (uint64_t tick = 0; tick < ticks; tick++) {
+    uint16_t before = s.seq[0];
+
+    bench_input(tick, &state);
+    stream_sender_push(&s, 0, &state, 0);
+    if (tick % STREAM_KEYFRAME_MS == 0) {
+      stream_sender_keyframes(&s);
+    }
+    uint64_t now = now_ns();
+    for (uint16_t seq = before + 1; seq != (uint16_t)(s.seq[0] + 1); seq++) {
+      link->sent_at[seq] = now;
+    }
+    stream_sender_flush(&s);
+
+    next.tv_nsec += NSEC_PER_SEC / BENCH_RATE_HZ;
+    if (next.tv_nsec >= (long)NSEC_PER_SEC) {
+      next.tv_nsec -= NSEC_PER_SEC;
+      next.tv_sec++;
+    }
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+  }
+
+  usleep(20000);
+  link->running = 0;
+  pthread_join(thread, NULL);
+
+  const StreamReceiver *r = &link->receiver;
+  printf("%5d%% %8llu %7.1f %8.1f %8llu %9.2f%% %9llu %6llu %7.1f %7.1f "
+         "%8.1f\n",
+         loss_percent, (unsigned long long)s.packets_sent,
+         (double)s.bytes_sent / s.packets_sent,
+         (double)s.bytes_sent / s.updates, (unsigned long long)s.updates,
+         100.0 * r->updates / s.updates, (unsigned long long)r->recovered,
+         (unsigned long long)r->gaps,
+         (double)latency_percentile(&link->latency, 50) / NSEC_PER_USEC,
+         (double)latency_percentile(&link->latency, 99) / NSEC_PER_USEC,
+         (double)link->latency.max_ns / NSEC_PER_USEC);
+
+  stream_sender_close(&s);
+  stream_receiver_close(&link->receiver);
+  return 0;
+}
+
+/*
+ * Streams a synthetic 1 kHz pad over loopback at increasing simulated loss
+ * and reports wire size, how much redundancy recovered, what was lost for
+ * good, and send-to-apply latency per update.
+ */
+int run_stream_benchmark(int seconds) {
+  static const int losses[] = {0, 1, 5, 10, 20};
+  static BenchLink link;
+
+  if (seconds > BENCH_MAX_SECONDS) {
+    seconds = BENCH_MAX_SECONDS;
+  }
+  printf("UDP stream benchmark: %d s per run at %d Hz over loopback, "
+         "redundancy %d, keyframe every %d ms\n",
+         seconds, BENCH_RATE_HZ, STREAM_REDUNDANCY, STREAM_KEYFRAME_MS);
+  printf("%6s %8s %7s %8s %8s %10s %9s %6s %7s %7s %8s\n", "loss",
+         "packets", "B/pkt", "B/update", "updates", "delivered", "recovered",
+         "gaps", "p50 us", "p99 us", "max us");
+  for (size_t i = 0; i < ARRAY_SIZE(losses); i++) {
+    if (bench_run(&link, losses[i], seconds) != 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
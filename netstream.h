@@ -0,0 +1,114 @@
+#ifndef NETSTREAM_H
+#define NETSTREAM_H
+
+#include "controller.h"
+#include <stdint.h>
+#include <sys/socket.h>
+
+/*
+ * Pad input over UDP, e.g. a controller on one machine driving the
+ * translator on another. Sticks are quantised to 8 bits and an update is
+ * only sent when the quantised state changes, carrying just the fields
+ * that changed since the previous update. Every packet repeats the last
+ * STREAM_REDUNDANCY updates, so a lost packet is repaired by the next one,
+ * and a keyframe (all fields) goes out every STREAM_KEYFRAME_MS to resync
+ * after longer losses.
+ *
+ * Packet: u8 STREAM_MAGIC, u8 device, u16 seq (of the newest update, LE),
+ * u8 count, then count updates newest first. Update: u8 field mask
+ * (STREAM_FIELD_*), then the present fields in mask order: u16 buttons,
+ * i8 sticks, u8 triggers.
+ */
+
+#define STREAM_DEFAULT_PORT 47800
+#define STREAM_MAGIC 0xfc
+#define STREAM_MAX_DEVICES 16
+#define STREAM_REDUNDANCY 3
+#define STREAM_KEYFRAME_MS 100
+#define STREAM_BATCH 16
+#define STREAM_HEADER_SIZE 5
+#define STREAM_UPDATE_MAX 9
+#define STREAM_MAX_PACKET                                                      \
+  (STREAM_HEADER_SIZE + STREAM_REDUNDANCY * STREAM_UPDATE_MAX)
+
+#define STREAM_FIELD_BUTTONS 0x01
+#define STREAM_FIELD_STICK(n) (0x02 << (n)) /* left x, left y, right x, y */
+#define STREAM_FIELD_TRIGGER(n) (0x20 << (n))
+#define STREAM_FIELD_KEYFRAME 0x80
+
+typedef struct {
+  uint16_t buttons;
+  int8_t sticks[4];
+  uint8_t triggers[2];
+} StreamState;
+
+typedef struct {
+  uint8_t length;
+  uint8_t data[STREAM_UPDATE_MAX];
+} StreamUpdate;
+
+typedef struct {
+  int fd;
+  struct sockaddr_storage dest;
+  socklen_t dest_length;
+  uint16_t seq[STREAM_MAX_DEVICES];
+  int has_last[STREAM_MAX_DEVICES];
+  StreamState last[STREAM_MAX_DEVICES];
+  StreamUpdate history[STREAM_MAX_DEVICES][STREAM_REDUNDANCY];
+  int history_count[STREAM_MAX_DEVICES];
+  uint8_t packets[STREAM_BATCH][STREAM_MAX_PACKET];
+  uint8_t lengths[STREAM_BATCH];
+  int pending;
+  unsigned int loss_permille; /* simulated loss, for testing */
+  unsigned int loss_seed;
+  uint64_t packets_sent;
+  uint64_t bytes_sent;
+  uint64_t packets_lost;
+  uint64_t updates;
+} StreamSender;
+
+/* Called once per applied update, oldest first */
+typedef void (*stream_apply_fn)(int device, uint16_t seq,
+                                const StreamState *state, int recovered,
+                                void *data);
+
+typedef struct {
+  int fd;
+  StreamState state[STREAM_MAX_DEVICES];
+  uint16_t last_seq[STREAM_MAX_DEVICES];
+  int synced[STREAM_MAX_DEVICES];
+  stream_apply_fn fn;
+  void *data;
+  uint64_t packets;
+  uint64_t updates;
+  uint64_t recovered; /* updates applied from a later packet's redundancy */
+  uint64_t gaps;      /* updates lost beyond what redundancy covers */
+} StreamReceiver;
+
+void stream_quantise(const ControllerState *state, StreamState *out);
+void stream_dequantise(const StreamState *state, ControllerState *out);
+
+int stream_sender_open(StreamSender *sender, const char *destination);
+void stream_sender_close(StreamSender *sender);
+void stream_sender_push(StreamSender *sender, int device,
+                        const StreamState *state, int keyframe);
+void stream_sender_keyframes(StreamSender *sender);
+void stream_sender_flush(StreamSender *sender);
+
+int stream_receiver_open(StreamReceiver *receiver, const char *address,
+                         uint16_t port, stream_apply_fn fn, void *data);
+void stream_receiver_close(StreamReceiver *receiver);
+int stream_receiver_poll(StreamReceiver *receiver);
+
+/* Engine glue: --stream-to and --receive */
+int stream_start_sender(const char *destination);
+void stream_stop_sender(void);
+int stream_sending(void);
+void stream_send_state(int device, const ControllerState *state);
+void stream_flush(void);
+int stream_start_receiver(uint16_t port, int first_device, int devices);
+void stream_stop_receiver(void);
+
+int run_stream_benchmark(int seconds);
+
+#endif /* NETSTREAM_H */
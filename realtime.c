@@ -0,0 +1,195 @@
+#define _GNU_SOURCE
+#include "realtime.h"
+#include "stats.h"
+#include "utils.h"
+#include <errno.h>
+#include <math.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <time.h>
+
+#define PREFAULT_STACK_SIZE (256 * 1024)
+#define JITTER_PERIOD_US 1000
+
+static int pick_cpu(const RealtimeConfig *config) {
+  if (config->cpu >= 0) {
+    return config->cpu;
+  }
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  return cpus > 0 ? (int)cpus - 1 : 0;
+}
+
+/*
+ * Locks everything mapped now and later, which also faults in the engine's
+ * static pools (macros, turbo streams, transfers) so the hot path never
+ * takes a page fault.
+ */
+int realtime_lock_memory(void) {
+  if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+    fprintf(stderr, "mlockall failed: %s\n", strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+void realtime_prefault_stack(void) {
+  volatile char stack[PREFAULT_STACK_SIZE];
+  for (size_t i = 0; i < sizeof(stack); i += 4096) {
+    stack[i] = 0;
+  }
+}
+
+int realtime_apply_thread(pthread_t thread, const RealtimeConfig *config) {
+  struct sched_param param;
+  cpu_set_t cpus;
+  int cpu = pick_cpu(config);
+  int ret;
+
+  CPU_ZERO(&cpus);
+  CPU_SET(cpu, &cpus);
+  ret = pthread_setaffinity_np(thread, sizeof(cpus), &cpus);
+  if (ret != 0) {
+    fprintf(stderr, "Failed to pin thread to CPU %d: %s\n", cpu,
+            strerror(ret));
+    return -1;
+  }
+
+  memset(&param, 0, sizeof(param));
+  param.sched_priority = config->priority;
+  ret = pthread_setschedparam(thread, SCHED_FIFO, &param);
+  if (ret != 0) {
+    fprintf(stderr, "Failed to set SCHED_FIFO priority %d: %s\n",
+            config->priority, strerror(ret));
+    return -1;
+  }
+  return 0;
+}
+
+typedef struct {
+  const RealtimeConfig *config;
+  int samples;
+  LatencyHistogram hist;
+  double sum_sq;
+} JitterRun;
+
+static volatile int hogs_running = 0;
+
+static void *cpu_hog(void *arg) {
+  volatile uint64_t spin = 0;
+  (void)arg;
+  while (hogs_running) {
+    spin++;
+  }
+  return NULL;
+}
+
+/* Periodic absolute sleeps, the same wake-up pattern as the engine's ticks */
+static void *jitter_thread(void *arg) {
+  JitterRun *run = arg;
+  struct timespec next;
+
+  if (run->config) {
+    realtime_prefault_stack();
+    if (realtime_apply_thread(pthread_self(), run->config) != 0) {
+      return NULL;
+    }
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &next);
+  for (int i = 0; i < run->samples; i++) {
+    next.tv_nsec += JITTER_PERIOD_US * 1000;
+    if (next.tv_nsec >= (long)NSEC_PER_SEC) {
+      next.tv_nsec -= NSEC_PER_SEC;
+      next.tv_sec++;
+    }
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+
+    uint64_t target = (uint64_t)next.tv_sec * NSEC_PER_SEC + next.tv_nsec;
+    uint64_t now = now_ns();
+    uint64_t late = now > target ? now - target : 0;
+    latency_record(&run->hist, late);
+    run->sum_sq += (double)late * late;
+  }
+  return NULL;
+}
+
+static int measure(JitterRun *run, int hogs, int cpu) {
+  pthread_t threads[64];
+  pthread_t thread;
+  int started = 0;
+
+  hogs_running = 1;
+  for (int i = 0; i < hogs && i < 64; i++) {
+    if (pthread_create(&threads[i], NULL, cpu_hog, NULL) != 0) {
+      break;
+    }
+    /* Keep every hog competing with the measured thread's CPU */
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    pthread_setaffinity_np(threads[i], sizeof(cpus), &cpus);
+    started++;
+  }
+
+  latency_reset(&run->hist);
+  run->sum_sq = 0;
+  int ret = pthread_create(&thread, NULL, jitter_thread, run);
+  if (ret == 0) {
+    pthread_join(thread, NULL);
+  }
+
+  hogs_running = 0;
+  for (int i = 0; i < started; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  return ret == 0 && run->hist.count > 0 ? 0 : -1;
+}
+
+static double stddev_us(const JitterRun *run) {
+  double mean = (double)run->hist.total_ns / run->hist.count;
+  double variance = run->sum_sq / run->hist.count - mean * mean;
+  return sqrt(variance > 0 ? variance : 0) / NSEC_PER_USEC;
+}
+
+/*
+ * Measures wake-up lateness of a 1 kHz periodic thread under CPU load, once
+ * with the default scheduler and once with the --realtime settings.
+ */
+int run_jitter_test(const RealtimeConfig *config, int seconds) {
+  JitterRun normal = {NULL, 0, {{0}, 0, 0, 0}, 0};
+  JitterRun realtime = {config, 0, {{0}, 0, 0, 0}, 0};
+  int cpu = pick_cpu(config);
+  int hogs = 2;
+
+  normal.samples = realtime.samples = seconds * (1000000 / JITTER_PERIOD_US);
+
+  printf("Jitter test: %d s per run at %d us period, %d CPU hogs on CPU %d\n",
+         seconds, JITTER_PERIOD_US, hogs, cpu);
+
+  if (measure(&normal, hogs, cpu) != 0) {
+    fprintf(stderr, "Default scheduler run failed\n");
+    return -1;
+  }
+  latency_print(&normal.hist, "SCHED_OTHER wake-up lateness", stdout);
+
+  realtime_lock_memory();
+  if (measure(&realtime, hogs, cpu) != 0) {
+    fprintf(stderr, "Real-time run failed (needs CAP_SYS_NICE / root)\n");
+    return -1;
+  }
+  latency_print(&realtime.hist, "SCHED_FIFO wake-up lateness", stdout);
+
+  double before = stddev_us(&normal);
+  double after = stddev_us(&realtime);
+  printf("Jitter (stddev): %.1fus -> %.1fus", before, after);
+  if (before > 0) {
+    printf(" (%.0f%% less)", 100.0 * (before - after) / before);
+  }
+  printf("\nMax lateness: %.1fus -> %.1fus\n",
+         (double)normal.hist.max_ns / NSEC_PER_USEC,
+         (double)realtime.hist.max_ns / NSEC_PER_USEC);
+  return 0;
+}
@@ -0,0 +1,19 @@
+#ifndef REALTIME_H
+#define REALTIME_H
+
+#include <pthread.h>
+
+#define RT_DEFAULT_PRIORITY 70
+
+typedef struct {
+  int enabled;
+  int cpu;      /* -1 picks the last online CPU */
+  int priority; /* SCHED_FIFO priority */
+} RealtimeConfig;
+
+int realtime_lock_memory(void);
+int realtime_apply_thread(pthread_t thread, const RealtimeConfig *config);
+void realtime_prefault_stack(void);
+int run_jitter_test(const RealtimeConfig *config, int seconds);
+
+#endif /* REALTIME_H */
@@ -0,0 +1,304 @@
+#include "recovery.h"
+#include "controller.h"
+#include "engine.h"
+#include "trace.h"
+#include "utils.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+static libusb_context *usb_ctx = NULL;
+static recovery_done_fn done_fn = NULL;
+static pthread_t worker;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t idle = PTHREAD_COND_INITIALIZER;
+static RecoveryJob *queue_head = NULL;
+static RecoveryJob *queue_tail = NULL;
+static RecoveryJob *done_head = NULL;
+static int running = 0; /* the worker is inside a job */
+static int stopping = 0;
+static int started = 0;
+static int event_fd = -1;
+
+const char *device_health_name(DeviceHealth health) {
+  switch (health) {
+  case DEVICE_HEALTHY:
+    return "healthy";
+  case DEVICE_STALLED:
+    return "stalled";
+  case DEVICE_RECLAIMING:
+    return "reclaiming";
+  case DEVICE_REOPENING:
+    return "reopening";
+  case DEVICE_GONE:
+    return "gone";
+  }
+  return "unknown";
+}
+
+/* Where to start for a failed transfer (LIBUSB_TRANSFER_*) */
+DeviceHealth recovery_step_for_status(int status) {
+  return status == LIBUSB_TRANSFER_NO_DEVICE ? DEVICE_REOPENING
+                                             : DEVICE_STALLED;
+}
+
+/* Where to start for a failed libusb call (LIBUSB_ERROR_*) */
+DeviceHealth recovery_step_for_error(int error) {
+  switch (error) {
+  case LIBUSB_ERROR_NO_DEVICE:
+    return DEVICE_REOPENING;
+  case LIBUSB_ERROR_BUSY:
+  case LIBUSB_ERROR_ACCESS:
+  case LIBUSB_ERROR_NOT_FOUND:
+    return DEVICE_RECLAIMING;
+  default:
+    return DEVICE_STALLED;
+  }
+}
+
+/* Doubles per attempt from RECOVERY_BASE_DELAY_MS up to the cap */
+uint64_t recovery_backoff_ns(int attempt) {
+  uint64_t delay = RECOVERY_BASE_DELAY_MS;
+
+  while (attempt-- > 0 && delay < RECOVERY_MAX_DELAY_MS) {
+    delay *= 2;
+  }
+  if (delay > RECOVERY_MAX_DELAY_MS) {
+    delay = RECOVERY_MAX_DELAY_MS;
+  }
+  return delay * NSEC_PER_MSEC;
+}
+
+/*
+ * The parts of a step that work on an open handle, synchronously. Also
+ * used by the setup wizard, which reads with blocking transfers anyway.
+ */
+int recovery_run_step(libusb_device_handle *handle, DeviceHealth step) {
+  switch (step) {
+  case DEVICE_STALLED:
+    return libusb_clear_halt(handle, 0x81);
+  case DEVICE_RECLAIMING:
+    libusb_release_interface(handle, 0);
+    return claim_interface_safe(handle) == 0 ? 0 : LIBUSB_ERROR_BUSY;
+  default:
+    return LIBUSB_ERROR_INVALID_PARAM;
+  }
+}
+
+/* Remembers where the pad is plugged in, so a reopen finds the same one */
+int recovery_locate(RecoveryJob *job, libusb_device_handle *handle) {
+  libusb_device *device = libusb_get_device(handle);
+  struct libusb_device_descriptor desc;
+  int count;
+
+  if (libusb_get_device_descriptor(device, &desc) != 0) {
+    return -1;
+  }
+  count = libusb_get_port_numbers(device, job->ports, RECOVERY_MAX_PORTS);
+  if (count < 0) {
+    return -1;
+  }
+  job->vendor_id = desc.idVendor;
+  job->product_id = desc.idProduct;
+  job->bus = libusb_get_bus_number(device);
+  job->port_count = count;
+  return 0;
+}
+
+static int same_port(const RecoveryJob *job, libusb_device *device) {
+  uint8_t ports[RECOVERY_MAX_PORTS];
+  int count = libusb_get_port_numbers(device, ports, RECOVERY_MAX_PORTS);
+
+  if (count != job->port_count || libusb_get_bus_number(device) != job->bus) {
+    return 0;
+  }
+  for (int i = 0; i < count; i++) {
+    if (ports[i] != job->ports[i]) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static int reopen(RecoveryJob *job) {
+  libusb_device **list;
+  libusb_device_handle *handle = NULL;
+  ssize_t count = libusb_get_device_list(usb_ctx, &list);
+  int ret = LIBUSB_ERROR_NO_DEVICE;
+
+  if (count < 0) {
+    return (int)count;
+  }
+  for (ssize_t i = 0; i < count; i++) {
+    struct libusb_device_descriptor desc;
+    if (libusb_get_device_descriptor(list[i], &desc) != 0 ||
+        desc.idVendor != job->vendor_id || desc.idProduct != job->product_id ||
+        !same_port(job, list[i])) {
+      continue;
+    }
+    ret = libusb_open(list[i], &handle);
+    break;
+  }
+  libusb_free_device_list(list, 1);
+  if (ret != 0) {
+    return ret;
+  }
+
+  if (claim_interface_safe(handle) != 0) {
+    libusb_close(handle);
+    return LIBUSB_ERROR_BUSY;
+  }
+  if (job->close_old) {
+    libusb_close(job->handle);
+  }
+  job->handle = handle;
+  return 0;
+}
+
+static void *recovery_thread(void *arg) {
+  (void)arg;
+
+  trace_thread("recovery");
+  pthread_mutex_lock(&lock);
+  for (;;) {
+    while (!queue_head && !stopping) {
+      pthread_cond_wait(&wake, &lock);
+    }
+    if (!queue_head) {
+      break;
+    }
+    RecoveryJob *job = queue_head;
+    queue_head = job->next;
+    if (!queue_head) {
+      queue_tail = NULL;
+    }
+    running = 1;
+    pthread_mutex_unlock(&lock);
+
+    TRACE_BEGIN(TRACE_RECOVERY);
+    if (job->step == DEVICE_REOPENING) {
+      job->result = reopen(job);
+    } else {
+      job->result = recovery_run_step(job->handle, job->step);
+    }
+    TRACE_END(TRACE_RECOVERY);
+
+    pthread_mutex_lock(&lock);
+    running = 0;
+    job->next = done_head;
+    done_head = job;
+    pthread_cond_broadcast(&idle);
+
+    uint64_t one = 1;
+    if (write(event_fd, &one, sizeof(one)) < 0) {
+      perror("Failed to signal recovery");
+    }
+  }
+  pthread_mutex_unlock(&lock);
+  return NULL;
+}
+
+/* Hands finished jobs to the callback, on the calling thread */
+static void drain_done(void) {
+  RecoveryJob *job;
+
+  pthread_mutex_lock(&lock);
+  job = done_head;
+  done_head = NULL;
+  pthread_mutex_unlock(&lock);
+
+  while (job) {
+    RecoveryJob *next = job->next;
+    job->busy = 0;
+    done_fn(job);
+    job = next;
+  }
+}
+
+static void on_recovery_event(int fd, uint32_t events, void *data) {
+  uint64_t value;
+  (void)events;
+  (void)data;
+
+  if (read(fd, &value, sizeof(value)) < 0) {
+    return;
+  }
+  drain_done();
+}
+
+/* Engine setup: fn is called on the engine loop as each job finishes */
+int recovery_start(libusb_context *lctx, recovery_done_fn fn) {
+  usb_ctx = lctx;
+  done_fn = fn;
+  stopping = 0;
+
+  event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (event_fd < 0) {
+    perror("Failed to create recovery eventfd");
+    return -1;
+  }
+  if (engine_watch(event_fd, EPOLLIN, on_recovery_event, NULL) != 0 ||
+      pthread_create(&worker, NULL, recovery_thread, NULL) != 0) {
+    fprintf(stderr, "Failed to start recovery worker\n");
+    engine_unwatch(event_fd);
+    close(event_fd);
+    event_fd = -1;
+    return -1;
+  }
+  started = 1;
+  return 0;
+}
+
+/*
+ * Engine thread, or any thread once the loop is stopped. The job must not
+ * be reposted before its callback ran.
+ */
+void recovery_post(RecoveryJob *job) {
+  job->busy = 1;
+  job->next = NULL;
+  pthread_mutex_lock(&lock);
+  if (queue_tail) {
+    queue_tail->next = job;
+  } else {
+    queue_head = job;
+  }
+  queue_tail = job;
+  pthread_cond_signal(&wake);
+  pthread_mutex_unlock(&lock);
+}
+
+/*
+ * With the engine loop stopped: waits out the queued jobs and runs their
+ * callbacks here, so no recovery touches a handle after it is released.
+ */
+void recovery_flush(void) {
+  if (!started) {
+    return;
+  }
+  pthread_mutex_lock(&lock);
+  while (queue_head || running) {
+    pthread_cond_wait(&idle, &lock);
+  }
+  pthread_mutex_unlock(&lock);
+  drain_done();
+}
+
+void recovery_stop(void) {
+  if (!started) {
+    return;
+  }
+  recovery_flush();
+  pthread_mutex_lock(&lock);
+  stopping = 1;
+  pthread_cond_signal(&wake);
+  pthread_mutex_unlock(&lock);
+  pthread_join(worker, NULL);
+  started = 0;
+
+  engine_unwatch(event_fd);
+  close(event_fd);
+  event_fd = -1;
+}
@@ -0,0 +1,66 @@
+#ifndef RECOVERY_H
+#define RECOVERY_H
+
+#include <libusb-1.0/libusb.h>
+#include <stdint.h>
+
+/*
+ * Transfer error recovery for libusb pads. A failed input transfer moves
+ * its device down healthy -> stalled -> reclaiming -> reopening -> gone,
+ * one step per failed attempt, with the retries spaced out by the engine's
+ * timer wheel. The steps themselves (clear_halt, release and claim, open)
+ * are synchronous libusb calls, so they run on a worker thread and hand
+ * their result back through an eventfd in the engine loop; a pad that
+ * stops answering only ever holds up its own recovery.
+ */
+
+#define RECOVERY_BASE_DELAY_MS 10
+#define RECOVERY_MAX_DELAY_MS 2000
+#define RECOVERY_STEP_ATTEMPTS 3 /* per step before escalating */
+#define RECOVERY_REOPEN_ATTEMPTS 8
+#define RECOVERY_MAX_PORTS 8
+
+typedef enum {
+  DEVICE_HEALTHY = 0,
+  DEVICE_STALLED,    /* clear the halt on the IN endpoint */
+  DEVICE_RECLAIMING, /* release and claim the interface again */
+  DEVICE_REOPENING,  /* open the pad again at the same port */
+  DEVICE_GONE
+} DeviceHealth;
+
+typedef struct RecoveryJob RecoveryJob;
+typedef void (*recovery_done_fn)(RecoveryJob *job);
+
+/*
+ * Owned by the worker between recovery_post() and the done callback. A
+ * reopen leaves the new handle in handle and, if close_old is set, closes
+ * the one it replaced.
+ */
+struct RecoveryJob {
+  RecoveryJob *next;
+  DeviceHealth step;
+  libusb_device_handle *handle;
+  int close_old;
+  uint16_t vendor_id;
+  uint16_t product_id;
+  uint8_t bus;
+  uint8_t ports[RECOVERY_MAX_PORTS];
+  int port_count;
+  int result; /* 0 or a LIBUSB_ERROR_* code */
+  int busy;
+  void *data;
+};
+
+int recovery_start(libusb_context *lctx, recovery_done_fn fn);
+void recovery_stop(void);
+void recovery_flush(void);
+void recovery_post(RecoveryJob *job);
+int recovery_locate(RecoveryJob *job, libusb_device_handle *handle);
+int recovery_run_step(libusb_device_handle *handle, DeviceHealth step);
+
+DeviceHealth recovery_step_for_status(int status);
+DeviceHealth recovery_step_for_error(int error);
+uint64_t recovery_backoff_ns(int attempt);
+const char *device_health_name(DeviceHealth health);
+
+#endif /* RECOVERY_H */
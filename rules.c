@@ -0,0 +1,494 @@
+#include "rules.h"
+#include "input.h"
+#include "utils.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RULE_AXES 6
+#define RULE_LAYERS 7 /* layer1 .. layer7 */
+#define BENCH_STATES 4096
+
+static const char *axis_names[RULE_AXES] = {"lx", "ly", "rx", "ry", "lt", "rt"};
+
+typedef struct {
+  const char *p;
+  RuleOp *code;
+  int length;
+  int failed;
+} RuleCompiler;
+
+static void skip_space(RuleCompiler *c) {
+  while (isspace((unsigned char)*c->p)) {
+    c->p++;
+  }
+}
+
+static int accept(RuleCompiler *c, const char *token) {
+  size_t len = strlen(token);
+
+  skip_space(c);
+  if (strncmp(c->p, token, len) != 0) {
+    return 0;
+  }
+  c->p += len;
+  return 1;
+}
+
+/* The last slot is kept for the closing RULE_OP_HALT */
+static void emit(RuleCompiler *c, int op, int dst, int a, int b, int32_t imm) {
+  if (c->length >= MAX_RULE_CODE - 1 || dst >= RULE_REGISTERS) {
+    c->failed = 1;
+    return;
+  }
+  RuleOp *ins = &c->code[c->length++];
+  ins->op = (uint8_t)op;
+  ins->dst = (uint8_t)dst;
+  ins->a = (uint8_t)a;
+  ins->b = (uint8_t)b;
+  ins->imm = imm;
+}
+
+static int32_t parse_number(RuleCompiler *c) {
+  char *end;
+
+  skip_space(c);
+  long value = strtol(c->p, &end, 10);
+  if (end == c->p || value < -65536 || value > 65536) {
+    c->failed = 1;
+    return 0;
+  }
+  c->p = end;
+  return (int32_t)value;
+}
+
+static void parse_or(RuleCompiler *c, int reg);
+
+static void parse_atom(RuleCompiler *c, int reg) {
+  char name[16];
+  size_t len = 0;
+
+  skip_space(c);
+  while ((isalnum((unsigned char)*c->p) || *c->p == '_') &&
+         len < sizeof(name) - 1) {
+    name[len++] = *c->p++;
+  }
+  name[len] = '\0';
+
+  int button = button_id_from_string(name);
+  if (button >= 0) {
+    if (accept(c, ">=") || accept(c, ">")) {
+      int32_t ms = parse_number(c);
+      if (!accept(c, "ms") || ms <= 0) {
+        c->failed = 1;
+      }
+      emit(c, RULE_OP_HELD, reg, button, 0, ms);
+    } else {
+      emit(c, RULE_OP_BUTTONS, reg, 0, 0, (int32_t)(1u << button));
+    }
+    return;
+  }
+
+  if (strncmp(name, "layer", 5) == 0) {
+    int layer = atoi(name + 5);
+    if (layer < 1 || layer > RULE_LAYERS) {
+      c->failed = 1;
+    }
+    emit(c, RULE_OP_LAYER, reg, layer - 1, 0, 0);
+    return;
+  }
+
+  for (int axis = 0; axis < RULE_AXES; axis++) {
+    if (strcmp(name, axis_names[axis]) != 0) {
+      continue;
+    }
+    if (accept(c, ">=")) {
+      emit(c, RULE_OP_ABOVE, reg, axis, 0, parse_number(c) - 1);
+    } else if (accept(c, ">")) {
+      emit(c, RULE_OP_ABOVE, reg, axis, 0, parse_number(c));
+    } else if (accept(c, "<=")) {
+      emit(c, RULE_OP_BELOW, reg, axis, 0, parse_number(c) + 1);
+    } else if (accept(c, "<")) {
+      emit(c, RULE_OP_BELOW, reg, axis, 0, parse_number(c));
+    } else {
+      c->failed = 1;
+    }
+    return;
+  }
+  c->failed = 1;
+}
+
+static void parse_unary(RuleCompiler *c, int reg) {
+  if (accept(c, "!")) {
+    parse_unary(c, reg);
+    emit(c, RULE_OP_NOT, reg, reg, 0, 0);
+  } else if (accept(c, "(")) {
+    parse_or(c, reg);
+    if (!accept(c, ")")) {
+      c->failed = 1;
+    }
+  } else {
+    parse_atom(c, reg);
+  }
+}
+
+/* "lb & a & x" becomes one op testing all three buttons */
+static void parse_and(RuleCompiler *c, int reg) {
+  parse_unary(c, reg);
+  while (!c->failed && accept(c, "&")) {
+    parse_unary(c, reg + 1);
+    if (c->failed) {
+      return;
+    }
+    RuleOp *last = &c->code[c->length - 1];
+    if (c->length >= 2 && last->op == RULE_OP_BUTTONS &&
+        last[-1].op == RULE_OP_BUTTONS && last[-1].dst == reg) {
+      last[-1].imm |= last->imm;
+      c->length--;
+    } else {
+      emit(c, RULE_OP_AND, reg, reg, reg + 1, 0);
+    }
+  }
+}
+
+/* Operands are evaluated into reg and reg + 1, so depth is the register */
+static void parse_or(RuleCompiler *c, int reg) {
+  parse_and(c, reg);
+  while (!c->failed && accept(c, "|")) {
+    parse_and(c, reg + 1);
+    emit(c, RULE_OP_OR, reg, reg, reg + 1, 0);
+  }
+}
+
+/* "<condition> -> [tap] KEY_*", compiled onto the end of the program */
+int add_rule(RuleProgram *program, const char *text) {
+  char condition[RULE_TEXT_LEN];
+  char words[2][32];
+  RuleCompiler c;
+  Rule rule;
+
+  const char *arrow = strstr(text, "->");
+  if (!arrow || strlen(text) >= RULE_TEXT_LEN ||
+      program->rule_count >= MAX_RULES) {
+    return -1;
+  }
+
+  memset(&rule, 0, sizeof(rule));
+  snprintf(rule.text, sizeof(rule.text), "%s", text);
+  int words_read = sscanf(arrow + 2, "%31s %31s", words[0], words[1]);
+  if (words_read == 2 && strcmp(words[0], "tap") == 0) {
+    rule.kind = RULE_TAP;
+    memmove(words[0], words[1], sizeof(words[0]));
+  } else if (words_read != 1) {
+    return -1;
+  }
+  int key = key_code_from_name(words[0]);
+  if (key < 0) {
+    return -1;
+  }
+  rule.key = (uint16_t)key;
+
+  snprintf(condition, sizeof(condition), "%.*s", (int)(arrow - text), text);
+  c.p = condition;
+  c.code = program->code;
+  c.length = program->code_length;
+  c.failed = 0;
+  parse_or(&c, 0);
+  skip_space(&c);
+  emit(&c, RULE_OP_OUT, 0, 0, 0, program->rule_count);
+
+  if (c.failed || *c.p) {
+    memset(&program->code[program->code_length], 0, sizeof(RuleOp));
+    return -1;
+  }
+  memset(&program->code[c.length], 0, sizeof(RuleOp));
+  program->code_length = c.length;
+  program->rules[program->rule_count++] = rule;
+  return 0;
+}
+
+/*
+ * For a program that was not compiled by add_rule(), e.g. read back from a
+ * bundle. rules_run() trusts the code completely, so every op, register
+ * and operand is checked, each rule must have exactly one output op, in
+ * order, and the program must end in RULE_OP_HALT.
+ */
+int check_rules(const RuleProgram *program) {
+  int outputs = 0;
+
+  if (program->rule_count < 0 || program->rule_count > MAX_RULES ||
+      program->code_length < 0 || program->code_length >= MAX_RULE_CODE ||
+      program->code[program->code_length].op != RULE_OP_HALT) {
+    return -1;
+  }
+  for (int i = 0; i < program->rule_count; i++) {
+    const Rule *rule = &program->rules[i];
+    if (rule->kind > RULE_TAP || rule->key >= OUTPUT_KEY_CNT ||
+        !memchr(rule->text, '\0', sizeof(rule->text))) {
+      return -1;
+    }
+  }
+
+  for (int i = 0; i < program->code_length; i++) {
+    const RuleOp *op = &program->code[i];
+    int ok;
+
+    if (op->dst >= RULE_REGISTERS) {
+      return -1;
+    }
+    switch (op->op) {
+    case RULE_OP_BUTTONS:
+      ok = 1;
+      break;
+    case RULE_OP_HELD:
+      ok = op->a < XBOX_BUTTON_COUNT && op->imm >= 0;
+      break;
+    case RULE_OP_LAYER:
+      ok = op->a < RULE_LAYERS;
+      break;
+    case RULE_OP_ABOVE:
+    case RULE_OP_BELOW:
+      ok = op->a < RULE_AXES;
+      break;
+    case RULE_OP_AND:
+    case RULE_OP_OR:
+      ok = op->a < RULE_REGISTERS && op->b < RULE_REGISTERS;
+      break;
+    case RULE_OP_NOT:
+      ok = op->a < RULE_REGISTERS;
+      break;
+    case RULE_OP_OUT:
+      ok = op->a < RULE_REGISTERS && op->imm == outputs++;
+      break;
+    default: /* HALT only at the end, or an unknown op */
+      ok = 0;
+      break;
+    }
+    if (!ok) {
+      return -1;
+    }
+  }
+  return outputs == program->rule_count ? 0 : -1;
+}
+
+void rules_reset(RuleState *state) { memset(state, 0, sizeof(*state)); }
+
+/*
+ * Runs every rule against one report and fills edges with the rules whose
+ * condition flipped, returning how many. deadline is set to when the
+ * earliest held-for condition still waiting would come true, 0 if none,
+ * so the caller can run the rules again then without a report.
+ */
+int rules_run(const RuleProgram *program, RuleState *state,
+              const ControllerState *pad, uint32_t layers, uint64_t now,
+              RuleEdge *edges, uint64_t *deadline) {
+  const RuleOp *pc = program->code;
+  uint32_t mask = pad->button_mask;
+  int32_t axes[RULE_AXES] = {pad->left_thumb_x,  pad->left_thumb_y,
+                             pad->right_thumb_x, pad->right_thumb_y,
+                             pad->left_trigger,  pad->right_trigger};
+  int32_t r[RULE_REGISTERS];
+  uint64_t next = 0;
+  int count = 0;
+
+  for (uint32_t bits = mask & ~state->prev_mask; bits; bits &= bits - 1) {
+    state->pressed_at[__builtin_ctz(bits)] = now;
+  }
+  state->prev_mask = mask;
+
+#ifdef __GNUC__
+/* Labels as values are a GNU extension, which -pedantic warns about */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+  static const void *dispatch[RULE_OP_COUNT] = {
+      [RULE_OP_HALT] = &&op_HALT,   [RULE_OP_BUTTONS] = &&op_BUTTONS,
+      [RULE_OP_HELD] = &&op_HELD,   [RULE_OP_LAYER] = &&op_LAYER,
+      [RULE_OP_ABOVE] = &&op_ABOVE, [RULE_OP_BELOW] = &&op_BELOW,
+      [RULE_OP_AND] = &&op_AND,     [RULE_OP_OR] = &&op_OR,
+      [RULE_OP_NOT] = &&op_NOT,     [RULE_OP_OUT] = &&op_OUT};
+#define CASE(name) op_##name
+#define NEXT() goto *dispatch[(++pc)->op]
+  goto *dispatch[pc->op];
+#else
+#define CASE(name) case RULE_OP_##name
+#define NEXT() goto next
+  for (;;) {
+    switch (pc->op) {
+#endif
+  CASE(HALT) : {
+    *deadline = next;
+    return count;
+  }
+  CASE(BUTTONS) : {
+    r[pc->dst] = (mask & (uint32_t)pc->imm) == (uint32_t)pc->imm;
+    NEXT();
+  }
+  CASE(HELD) : {
+    uint64_t due = state->pressed_at[pc->a] + (uint64_t)pc->imm * NSEC_PER_MSEC;
+    int held = CHECK_BIT(mask, pc->a);
+    r[pc->dst] = held && now >= due;
+    if (held && now < due && (!next || due < next)) {
+      next = due;
+    }
+    NEXT();
+  }
+  CASE(LAYER) : {
+    r[pc->dst] = CHECK_BIT(layers, pc->a);
+    NEXT();
+  }
+  CASE(ABOVE) : {
+    r[pc->dst] = axes[pc->a] > pc->imm;
+    NEXT();
+  }
+  CASE(BELOW) : {
+    r[pc->dst] = axes[pc->a] < pc->imm;
+    NEXT();
+  }
+  CASE(AND) : {
+    r[pc->dst] = r[pc->a] & r[pc->b];
+    NEXT();
+  }
+  CASE(OR) : {
+    r[pc->dst] = r[pc->a] | r[pc->b];
+    NEXT();
+  }
+  CASE(NOT) : {
+    r[pc->dst] = !r[pc->a];
+    NEXT();
+  }
+  CASE(OUT) : {
+    uint32_t *word = &state->active[pc->imm >> 5];
+    uint32_t bit = 1u << (pc->imm & 31);
+    if (r[pc->a] != ((*word & bit) != 0)) {
+      *word ^= bit;
+      edges[count].rule = (uint16_t)pc->imm;
+      edges[count].on = (uint8_t)r[pc->a];
+      count++;
+    }
+    NEXT();
+  }
+#ifdef __GNUC__
+#pragma GCC diagnostic pop
+#else
+    default:
+      *deadline = next;
+      return count;
+    }
+  next:
+    pc++;
+  }
+#endif
+#undef CASE
+#undef NEXT
+}
+
+/* Synthetic rules mixing every kind of condition, numbered by i */
+static void bench_rule(int i, char *text, size_t size) {
+  const char *first = button_id_to_string(i % 11);
+  const char *second = button_id_to_string((i + 3) % 11);
+  int key = 1 + i % 10;
+
+  switch (i % 5) {
+  case 0:
+    snprintf(text, size, "%s & %s -> KEY_F%d", first, second, key);
+    break;
+  case 1:
+    snprintf(text, size, "lx > %d & !%s -> KEY_F%d", 4000 + i * 200, first,
+             key);
+    break;
+  case 2:
+    snprintf(text, size, "(ry < -%d | %s) & !back -> KEY_F%d", 8000 + i * 100,
+             first, key);
+    break;
+  case 3:
+    snprintf(text, size, "layer%d & %s >= %dms -> tap KEY_F%d", 1 + i % 3,
+             first, 100 + i, key);
+    break;
+  default:
+    snprintf(text, size, "lt >= %d | rt >= %d -> KEY_F%d", 64 + i % 128,
+             192 - i % 128, key);
+    break;
+  }
+}
+
+/* A random walk: a button flips now and then, the axes drift */
+static void bench_states(ControllerState *states, int count) {
+  uint32_t seed = 0x2545f491u;
+  ControllerState pad;
+
+  memset(&pad, 0, sizeof(pad));
+  for (int i = 0; i < count; i++) {
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    if ((seed & 7) == 0) {
+      pad.button_mask ^= 1u << ((seed >> 3) % XBOX_BUTTON_COUNT);
+    }
+    pad.left_thumb_x = (int16_t)(pad.left_thumb_x + (int16_t)(seed >> 16) / 8);
+    pad.right_thumb_y =
+        (int16_t)(pad.right_thumb_y - (int16_t)(seed >> 8) / 8);
+    pad.left_trigger = (uint8_t)(pad.left_trigger + (seed >> 24) % 16);
+    pad.right_trigger = (uint8_t)(pad.right_trigger + (seed >> 20) % 16);
+    states[i] = pad;
+  }
+}
+
+/*
+ * --rules-bench: interpreter cost per report for growing rule counts, run
+ * over the same recorded input so only the program size changes.
+ */
+int run_rules_benchmark(int rules, int seconds) {
+  static ControllerState states[BENCH_STATES];
+  static RuleProgram program;
+  RuleEdge edges[MAX_RULES];
+  char text[RULE_TEXT_LEN];
+
+  if (rules < 1 || rules > MAX_RULES) {
+    fprintf(stderr, "Rules must be between 1 and %d\n", MAX_RULES);
+    return -1;
+  }
+
+  bench_states(states, BENCH_STATES);
+  printf("Rule evaluation benchmark: %d s per run, %zu-byte ops\n", seconds,
+         sizeof(RuleOp));
+  printf("%6s %6s %12s %14s %10s\n", "rules", "ops", "ns/report",
+         "reports/s", "edges/1k");
+
+  for (int count = MIN(16, rules); count <= rules;
+       count = count < rules ? MIN(count * 2, rules) : rules + 1) {
+    RuleState state;
+    uint64_t deadline;
+    uint64_t reports = 0, flips = 0;
+
+    memset(&program, 0, sizeof(program));
+    for (int i = 0; i < count; i++) {
+      bench_rule(i, text, sizeof(text));
+      if (add_rule(&program, text) != 0) {
+        fprintf(stderr, "Failed to compile rule %s\n", text);
+        return -1;
+      }
+    }
+    rules_reset(&state);
+
+    uint64_t start = now_ns();
+    uint64_t end = start + (uint64_t)seconds * NSEC_PER_SEC;
+    uint64_t now = start;
+    while (now < end) {
+      /* Reports 1 ms apart in pad time, the clock read every 1024 */
+      for (int i = 0; i < 1024; i++, reports++) {
+        const ControllerState *pad = &states[reports % BENCH_STATES];
+        flips += (uint64_t)rules_run(&program, &state, pad,
+                                     (uint32_t)(reports >> 8) & 7,
+                                     reports * NSEC_PER_MSEC, edges, &deadline);
+      }
+      now = now_ns();
+    }
+
+    double elapsed = (double)(now - start) / NSEC_PER_SEC;
+    printf("%6d %6d %12.1f %14.0f %10.1f\n", count, program.code_length,
+           elapsed * NSEC_PER_SEC / reports, reports / elapsed,
+           1000.0 * flips / reports);
+  }
+  return 0;
+}
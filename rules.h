@@ -0,0 +1,91 @@
+#ifndef RULES_H
+#define RULES_H
+
+#include "controller.h"
+#include <stdint.h>
+
+/*
+ * Mapping rules, "<condition> -> <action>", for what fixed bindings cannot
+ * say. A condition combines, with & | ! and parentheses:
+ *   a, lb, dpad_up ...     button held
+ *   a>=500ms               button held for at least that long
+ *   lx ly rx ry lt rt      axis compared with < <= > >= to a number
+ *   layer1 .. layer7       layer active
+ * The action is KEY_* (held while the condition is true) or tap KEY_*
+ * (tapped when it becomes true).
+ *
+ * Every rule of a profile is compiled at load time into one flat program
+ * for a small register machine: fixed-size ops, conditions on a button set
+ * or an axis fused into a single op, and one output op per rule that
+ * reports when its condition flips. Running it touches no memory besides
+ * the program, the rule state and the stack.
+ */
+
+#define MAX_RULES 128
+#define MAX_RULE_CODE 2048
+#define RULE_REGISTERS 16
+#define RULE_TEXT_LEN 96
+
+typedef enum {
+  RULE_OP_HALT = 0,
+  RULE_OP_BUTTONS, /* r[dst] = all buttons in imm held */
+  RULE_OP_HELD,    /* r[dst] = button a held for imm ms */
+  RULE_OP_LAYER,   /* r[dst] = layer bit a active */
+  RULE_OP_ABOVE,   /* r[dst] = axis a > imm */
+  RULE_OP_BELOW,   /* r[dst] = axis a < imm */
+  RULE_OP_AND,     /* r[dst] = r[a] & r[b] */
+  RULE_OP_OR,      /* r[dst] = r[a] | r[b] */
+  RULE_OP_NOT,     /* r[dst] = !r[a] */
+  RULE_OP_OUT,     /* rule imm is now r[a] */
+  RULE_OP_COUNT
+} RuleOpcode;
+
+typedef enum {
+  RULE_HOLD = 0,
+  RULE_TAP,
+} RuleKind;
+
+typedef struct {
+  uint8_t op;
+  uint8_t dst;
+  uint8_t a;
+  uint8_t b;
+  int32_t imm;
+} RuleOp;
+
+typedef struct {
+  uint8_t kind;
+  uint16_t key;
+  char text[RULE_TEXT_LEN];
+} Rule;
+
+/* Always ends in RULE_OP_HALT at code[code_length] */
+typedef struct {
+  int rule_count;
+  Rule rules[MAX_RULES];
+  int code_length;
+  RuleOp code[MAX_RULE_CODE];
+} RuleProgram;
+
+typedef struct {
+  uint32_t active[MAX_RULES / 32]; /* rules whose condition is true */
+  uint32_t prev_mask;
+  uint64_t pressed_at[XBOX_BUTTON_COUNT];
+} RuleState;
+
+typedef struct {
+  uint16_t rule;
+  uint8_t on;
+} RuleEdge;
+
+int add_rule(RuleProgram *program, const char *text);
+int check_rules(const RuleProgram *program);
+
+void rules_reset(RuleState *state);
+int rules_run(const RuleProgram *program, RuleState *state,
+              const ControllerState *pad, uint32_t layers, uint64_t now,
+              RuleEdge *edges, uint64_t *deadline);
+
+int run_rules_benchmark(int rules, int seconds);
+
+#endif /* RULES_H */
@@ -0,0 +1,246 @@
+#include "shm.h"
+#include "utils.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static ShmSegment *segment = NULL;
+static char segment_name[64];
+
+int shm_publisher_open(const char *name) {
+  if (!name) {
+    name = SHM_NAME;
+  }
+
+  /*
+   * Always a fresh segment owned by us: one left behind (or planted by
+   * another user) is unlinked, and if one still shows up before ours is
+   * created it is refused rather than adopted.
+   */
+  shm_unlink(name);
+  int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+  if (fd < 0) {
+    fprintf(stderr, "Failed to create shared memory %s: %s\n", name,
+            errno == EEXIST ? "it was created by someone else"
+                            : strerror(errno));
+    return -1;
+  }
+  /* Readers only ever need to map it read-only */
+  fchmod(fd, 0644);
+
+  if (ftruncate(fd, sizeof(ShmSegment)) != 0) {
+    fprintf(stderr, "Failed to size shared memory %s: %s\n", name,
+            strerror(errno));
+    close(fd);
+    shm_unlink(name);
+    return -1;
+  }
+
+  void *map = mmap(NULL, sizeof(ShmSegment), PROT_READ | PROT_WRITE,
+                   MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    fprintf(stderr, "Failed to map shared memory %s: %s\n", name,
+            strerror(errno));
+    shm_unlink(name);
+    return -1;
+  }
+
+  segment = map;
+  memset(segment, 0, sizeof(*segment));
+  segment->version = SHM_VERSION;
+  segment->record_size = sizeof(ShmDeviceState);
+  /* Magic last, so a reader never sees a half-initialised header */
+  __atomic_store_n(&segment->magic, SHM_MAGIC, __ATOMIC_RELEASE);
+  snprintf(segment_name, sizeof(segment_name), "%s", name);
+  return 0;
+}
+
+void shm_publisher_close(void) {
+  if (!segment) {
+    return;
+  }
+  munmap(segment, sizeof(ShmSegment));
+  shm_unlink(segment_name);
+  segment = NULL;
+}
+
+/*
+ * Single writer, never waits: bump to odd, copy, bump to even. Readers that
+ * overlap the copy see the sequence change and retry on their side.
+ */
+void shm_publish(int device, const ShmDeviceState *state) {
+  if (!segment || device < 0 || device >= SHM_MAX_DEVICES) {
+    return;
+  }
+
+  ShmDeviceState *record = &segment->devices[device];
+  uint32_t seq = record->seq;
+
+  __atomic_store_n(&record->seq, seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  record->vendor_id = state->vendor_id;
+  record->product_id = state->product_id;
+  record->buttons = state->buttons;
+  memcpy(record->axes, state->axes, sizeof(record->axes));
+  memcpy(record->triggers, state->triggers, sizeof(record->triggers));
+  record->flags = state->flags;
+  record->timestamp_ns = state->timestamp_ns;
+  record->sequence = state->sequence;
+  __atomic_store_n(&record->seq, seq + 2, __ATOMIC_RELEASE);
+
+  if ((uint32_t)device >= segment->device_count) {
+    __atomic_store_n(&segment->device_count, (uint32_t)device + 1,
+                     __ATOMIC_RELEASE);
+  }
+}
+
+#define BENCH_NAME "/faky-controller-bench"
+#define BENCH_MAX_READERS 16
+
+typedef struct {
+  pthread_t thread;
+  ShmReader reader;
+  uint64_t samples;
+  uint64_t retries;
+  uint64_t failures;
+  uint64_t torn;
+} BenchReader;
+
+static volatile int bench_running = 0;
+
+/*
+ * Every field is derived from one counter, so a reader can tell a torn copy
+ * from a consistent one without knowing what the writer wrote.
+ */
+static void bench_fill(ShmDeviceState *state, uint64_t n) {
+  state->vendor_id = (uint16_t)n;
+  state->product_id = (uint16_t)~n;
+  state->buttons = (uint32_t)n;
+  for (int i = 0; i < 4; i++) {
+    state->axes[i] = (int16_t)(n + i);
+  }
+  state->triggers[0] = (uint8_t)n;
+  state->triggers[1] = (uint8_t)(n >> 8);
+  state->flags = SHM_FLAG_ACTIVE;
+  state->timestamp_ns = n * 3;
+  state->sequence = n;
+}
+
+static int bench_consistent(const ShmDeviceState *state) {
+  ShmDeviceState expected;
+  bench_fill(&expected, state->sequence);
+  return state->vendor_id == expected.vendor_id &&
+         state->product_id == expected.product_id &&
+         state->buttons == expected.buttons &&
+         memcmp(state->axes, expected.axes, sizeof(expected.axes)) == 0 &&
+         state->triggers[0] == expected.triggers[0] &&
+         state->triggers[1] == expected.triggers[1] &&
+         state->timestamp_ns == expected.timestamp_ns;
+}
+
+static void *bench_reader(void *arg) {
+  BenchReader *r = arg;
+  ShmDeviceState state;
+
+  while (bench_running) {
+    int ret = shm_reader_sample(&r->reader, 0, &state);
+    if (ret < 0) {
+      r->failures++;
+      continue;
+    }
+    r->samples++;
+    r->retries += ret;
+    if (!bench_consistent(&state)) {
+      r->torn++;
+    }
+  }
+  return NULL;
+}
+
+/*
+ * One unthrottled writer against 0..readers threads sampling the same
+ * record, showing what readers cost the writer (nothing should block it)
+ * and how often readers have to retry.
+ */
+int run_shm_benchmark(int readers, int seconds) {
+  static BenchReader threads[BENCH_MAX_READERS];
+  ShmDeviceState state;
+  int ret = 0;
+
+  if (readers > BENCH_MAX_READERS) {
+    readers = BENCH_MAX_READERS;
+  }
+  if (shm_publisher_open(BENCH_NAME) != 0) {
+    return -1;
+  }
+  memset(&state, 0, sizeof(state));
+  bench_fill(&state, 0);
+  shm_publish(0, &state);
+
+  printf("Shared memory benchmark: %d s per run, record size %zu bytes\n",
+         seconds, sizeof(ShmDeviceState));
+  printf("%8s %14s %16s %12s %10s %6s\n", "readers", "publish ns/op",
+         "reader samples/s", "retries/1k", "failures", "torn");
+
+  for (int count = 0; count <= readers; count = count ? count * 2 : 1) {
+    int started = 0;
+    uint64_t n = 0;
+
+    bench_running = 1;
+    memset(threads, 0, sizeof(threads));
+    for (int i = 0; i < count; i++) {
+      if (shm_reader_open(&threads[i].reader, BENCH_NAME) != 0 ||
+          pthread_create(&threads[i].thread, NULL, bench_reader,
+                         &threads[i]) != 0) {
+        shm_reader_close(&threads[i].reader);
+        break;
+      }
+      started++;
+    }
+
+    uint64_t start = now_ns();
+    uint64_t end = start + (uint64_t)seconds * NSEC_PER_SEC;
+    uint64_t now = start;
+    while (now < end) {
+      /* Check the clock every 1024 publishes to keep it out of the loop */
+      for (int i = 0; i < 1024; i++) {
+        bench_fill(&state, ++n);
+        shm_publish(0, &state);
+      }
+      now = now_ns();
+    }
+
+    bench_running = 0;
+    uint64_t samples = 0, retries = 0, failures = 0, torn = 0;
+    for (int i = 0; i < started; i++) {
+      pthread_join(threads[i].thread, NULL);
+      shm_reader_close(&threads[i].reader);
+      samples += threads[i].samples;
+      retries += threads[i].retries;
+      failures += threads[i].failures;
+      torn += threads[i].torn;
+    }
+
+    double elapsed = (double)(now - start) / NSEC_PER_SEC;
+    printf("%8d %14.1f %16.0f %12.2f %10llu %6llu\n", started,
+           (double)(now - start) / n, samples / elapsed,
+           samples ? 1000.0 * retries / samples : 0.0,
+           (unsigned long long)failures, (unsigned long long)torn);
+    if (torn) {
+      ret = -1;
+    }
+    if (started < count) {
+      fprintf(stderr, "Only %d of %d readers started\n", started, count);
+      break;
+    }
+  }
+
+  shm_publisher_close();
+  return ret;
+}
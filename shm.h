@@ -0,0 +1,69 @@
+#ifndef SHM_H
+#define SHM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Shared-memory publication of every device's decoded state. The daemon is
+ * the only writer; each device record is guarded by its own seqlock (odd
+ * while being written), so any number of readers can map the segment
+ * read-only and sample it without syscalls and without ever making the
+ * writer wait. Records are one cache line each so devices do not share
+ * lines. This header has no other dependencies so tools can use the
+ * reader functions from shm_reader.c on their own.
+ */
+
+#define SHM_NAME "/faky-controller"
+#define SHM_MAGIC 0x594b4146 /* "FAKY" */
+#define SHM_VERSION 1
+#define SHM_MAX_DEVICES 16
+#define SHM_READ_RETRIES 64
+
+#define SHM_FLAG_ACTIVE 0x01
+#define SHM_FLAG_PAUSED 0x02
+
+typedef struct {
+  uint32_t seq;      /* seqlock, odd while the writer is inside */
+  uint16_t vendor_id;
+  uint16_t product_id;
+  uint32_t buttons;  /* bit n set when XBOX_BUTTON_n is held */
+  int16_t axes[4];   /* left x, left y, right x, right y */
+  uint8_t triggers[2];
+  uint8_t flags;
+  uint8_t reserved;
+  uint64_t timestamp_ns; /* CLOCK_MONOTONIC time of the report */
+  uint64_t sequence;     /* reports published for this device */
+  uint8_t pad[24];
+} ShmDeviceState;
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t device_count;
+  uint32_t record_size;
+  uint8_t pad[48];
+  ShmDeviceState devices[SHM_MAX_DEVICES];
+} ShmSegment;
+
+typedef char shm_record_is_one_line[sizeof(ShmDeviceState) == 64 ? 1 : -1];
+
+typedef struct {
+  const ShmSegment *segment;
+  size_t size;
+} ShmReader;
+
+/* Writer side, used by the engine */
+int shm_publisher_open(const char *name);
+void shm_publisher_close(void);
+void shm_publish(int device, const ShmDeviceState *state);
+int run_shm_benchmark(int readers, int seconds);
+
+/* Reader library */
+int shm_reader_open(ShmReader *reader, const char *name);
+void shm_reader_close(ShmReader *reader);
+int shm_reader_device_count(const ShmReader *reader);
+int shm_reader_sample(const ShmReader *reader, int device,
+                      ShmDeviceState *state);
+
+#endif /* SHM_H */
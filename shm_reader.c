@@ -0,0 +1,81 @@
+#include "shm.h"
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Maps the segment read-only; returns -1 if no daemon is publishing */
+int shm_reader_open(ShmReader *reader, const char *name) {
+  struct stat st;
+
+  reader->segment = NULL;
+  reader->size = 0;
+
+  int fd = shm_open(name ? name : SHM_NAME, O_RDONLY, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ShmSegment)) {
+    close(fd);
+    return -1;
+  }
+
+  void *map = mmap(NULL, sizeof(ShmSegment), PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    return -1;
+  }
+
+  const ShmSegment *segment = map;
+  if (__atomic_load_n(&segment->magic, __ATOMIC_ACQUIRE) != SHM_MAGIC ||
+      segment->version != SHM_VERSION ||
+      segment->record_size != sizeof(ShmDeviceState)) {
+    munmap(map, sizeof(ShmSegment));
+    return -1;
+  }
+
+  reader->segment = segment;
+  reader->size = sizeof(ShmSegment);
+  return 0;
+}
+
+void shm_reader_close(ShmReader *reader) {
+  if (reader->segment) {
+    munmap((void *)reader->segment, reader->size);
+    reader->segment = NULL;
+  }
+}
+
+int shm_reader_device_count(const ShmReader *reader) {
+  uint32_t count =
+      __atomic_load_n(&reader->segment->device_count, __ATOMIC_ACQUIRE);
+  return count > SHM_MAX_DEVICES ? SHM_MAX_DEVICES : (int)count;
+}
+
+/*
+ * Copies one consistent record. Returns the number of retries it took (0
+ * when the writer was not in the way), or -1 for a bad device or if the
+ * writer kept overlapping for SHM_READ_RETRIES attempts.
+ */
+int shm_reader_sample(const ShmReader *reader, int device,
+                      ShmDeviceState *state) {
+  if (device < 0 || device >= SHM_MAX_DEVICES) {
+    return -1;
+  }
+
+  const ShmDeviceState *record = &reader->segment->devices[device];
+  for (int tries = 0; tries < SHM_READ_RETRIES; tries++) {
+    uint32_t begin = __atomic_load_n(&record->seq, __ATOMIC_ACQUIRE);
+    if (begin & 1) {
+      continue;
+    }
+    memcpy(state, (const void *)record, sizeof(*state));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&record->seq, __ATOMIC_RELAXED) == begin) {
+      state->seq = begin;
+      return tries;
+    }
+  }
+  return -1;
+}
@@ -0,0 +1,64 @@
+#include "stats.h"
+#include "utils.h"
+#include <string.h>
+
+void latency_reset(LatencyHistogram *hist) { memset(hist, 0, sizeof(*hist)); }
+
+void latency_record(LatencyHistogram *hist, uint64_t ns) {
+  uint64_t us = ns / NSEC_PER_USEC;
+  int bucket = us ? 64 - __builtin_clzll(us) : 0;
+
+  if (bucket >= LATENCY_BUCKETS) {
+    bucket = LATENCY_BUCKETS - 1;
+  }
+
+  hist->buckets[bucket]++;
+  hist->count++;
+  hist->total_ns += ns;
+  if (ns > hist->max_ns) {
+    hist->max_ns = ns;
+  }
+}
+
+/* Returns the upper bound of the bucket holding the given percentile */
+uint64_t latency_percentile(const LatencyHistogram *hist, double percentile) {
+  if (hist->count == 0) {
+    return 0;
+  }
+
+  uint64_t target = (uint64_t)(hist->count * percentile / 100.0);
+  uint64_t seen = 0;
+
+  for (int i = 0; i < LATENCY_BUCKETS; i++) {
+    seen += hist->buckets[i];
+    if (seen > target) {
+      uint64_t bound = (1ULL << i) * NSEC_PER_USEC;
+      return MIN(bound, hist->max_ns);
+    }
+  }
+  return hist->max_ns;
+}
+
+void latency_print(const LatencyHistogram *hist, const char *label,
+                   FILE *out) {
+  if (hist->count == 0) {
+    fprintf(out, "%s: no samples\n", label);
+    return;
+  }
+
+  fprintf(out, "%s: %llu samples, avg %.1fus, p50 <%.1fus, p99 <%.1fus, "
+               "max %.1fus\n",
+          label, (unsigned long long)hist->count,
+          (double)hist->total_ns / hist->count / NSEC_PER_USEC,
+          (double)latency_percentile(hist, 50.0) / NSEC_PER_USEC,
+          (double)latency_percentile(hist, 99.0) / NSEC_PER_USEC,
+          (double)hist->max_ns / NSEC_PER_USEC);
+
+  for (int i = 0; i < LATENCY_BUCKETS; i++) {
+    if (hist->buckets[i] == 0) {
+      continue;
+    }
+    fprintf(out, "  < %8lluus : %llu\n", 1ULL << i,
+            (unsigned long long)hist->buckets[i]);
+  }
+}
@@ -0,0 +1,23 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* Bucket i counts samples in [2^(i-1), 2^i) microseconds, bucket 0 is < 1us */
+#define LATENCY_BUCKETS 24
+
+typedef struct {
+  uint64_t buckets[LATENCY_BUCKETS];
+  uint64_t count;
+  uint64_t total_ns;
+  uint64_t max_ns;
+} LatencyHistogram;
+
+void latency_reset(LatencyHistogram *hist);
+void latency_record(LatencyHistogram *hist, uint64_t ns);
+uint64_t latency_percentile(const LatencyHistogram *hist, double percentile);
+void latency_print(const LatencyHistogram *hist, const char *label,
+                   FILE *out);
+
+#endif /* STATS_H */
@@ -0,0 +1,539 @@
+#include "store.h"
+#include "utils.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define STORE_INDEX_HEADER "# faky-controller profile index v1"
+
+static uint32_t device_key(uint16_t vendor_id, uint16_t product_id) {
+  return (uint32_t)vendor_id << 16 | product_id;
+}
+
+static uint32_t hash_device(uint32_t key) {
+  key ^= key >> 16;
+  key *= 0x45d9f3b;
+  key ^= key >> 16;
+  return key;
+}
+
+static uint32_t hash_file(const char *file) {
+  uint32_t hash = 2166136261u;
+  while (*file) {
+    hash = (hash ^ (uint8_t)*file++) * 16777619u;
+  }
+  return hash;
+}
+
+static int make_dirs(const char *dir) {
+  char path[STORE_DIR_LEN];
+
+  snprintf(path, sizeof(path), "%s", dir);
+  for (char *p = path + 1; *p; p++) {
+    if (*p == '/') {
+      *p = '\0';
+      if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+        return -1;
+      }
+      *p = '/';
+    }
+  }
+  return mkdir(path, 0755) != 0 && errno != EEXIST ? -1 : 0;
+}
+
+static void default_dir(char *dir, size_t size) {
+  const char *env = getenv("FAKY_PROFILE_DIR");
+  if (env && *env) {
+    snprintf(dir, size, "%s", env);
+  } else if ((env = getenv("XDG_CONFIG_HOME")) && *env) {
+    snprintf(dir, size, "%s/faky-controller/profiles", env);
+  } else if ((env = getenv("HOME")) && *env) {
+    snprintf(dir, size, "%s/.config/faky-controller/profiles", env);
+  } else {
+    snprintf(dir, size, "profiles");
+  }
+}
+
+/* Rebuilt after any change to the entry list; lookups stay O(1) */
+static int rebuild_tables(ProfileStore *store) {
+  int size = 64;
+  while (size < store->count * 2) {
+    size *= 2;
+  }
+
+  if (size != store->table_size) {
+    int *defaults = realloc(store->defaults, size * sizeof(int));
+    if (!defaults) {
+      return -1;
+    }
+    store->defaults = defaults;
+    int *files = realloc(store->files, size * sizeof(int));
+    if (!files) {
+      return -1;
+    }
+    store->files = files;
+    store->table_size = size;
+  }
+  memset(store->defaults, 0xff, size * sizeof(int));
+  memset(store->files, 0xff, size * sizeof(int));
+
+  uint32_t mask = size - 1;
+  for (int i = 0; i < store->count; i++) {
+    const StoreEntry *entry = &store->entries[i];
+    uint32_t slot = hash_file(entry->file) & mask;
+    while (store->files[slot] >= 0) {
+      slot = (slot + 1) & mask;
+    }
+    store->files[slot] = i;
+
+    if (entry->is_default) {
+      slot = hash_device(device_key(entry->vendor_id, entry->product_id)) &
+             mask;
+      while (store->defaults[slot] >= 0) {
+        slot = (slot + 1) & mask;
+      }
+      store->defaults[slot] = i;
+    }
+  }
+  return 0;
+}
+
+static int find_file(const ProfileStore *store, const char *file) {
+  if (!store->table_size) {
+    return -1;
+  }
+  uint32_t mask = store->table_size - 1;
+  for (uint32_t slot = hash_file(file) & mask; store->files[slot] >= 0;
+       slot = (slot + 1) & mask) {
+    if (strcmp(store->entries[store->files[slot]].file, file) == 0) {
+      return store->files[slot];
+    }
+  }
+  return -1;
+}
+
+static StoreEntry *append_entry(ProfileStore *store) {
+  if (store->count == store->capacity) {
+    int capacity = store->capacity ? store->capacity * 2 : 64;
+    StoreEntry *entries = realloc(store->entries, capacity * sizeof(*entries));
+    if (!entries) {
+      return NULL;
+    }
+    store->entries = entries;
+    store->capacity = capacity;
+  }
+  StoreEntry *entry = &store->entries[store->count++];
+  memset(entry, 0, sizeof(*entry));
+  return entry;
+}
+
+static void clean_name(char *name) {
+  for (char *p = name; *p; p++) {
+    if (*p == '\t' || *p == '\n' || *p == '\r') {
+      *p = ' ';
+    }
+  }
+}
+
+/*
+ * Fills VID:PID from a "vvvv_pppp_..." file name and the name from the
+ * profile's name= line, falling back to the file name.
+ */
+static void parse_profile_file(const ProfileStore *store, StoreEntry *entry) {
+  char path[STORE_DIR_LEN + STORE_FILE_LEN];
+  char line[256];
+  unsigned int vid, pid;
+
+  entry->vendor_id = entry->product_id = 0;
+  if (sscanf(entry->file, "%4x_%4x_", &vid, &pid) == 2) {
+    entry->vendor_id = vid;
+    entry->product_id = pid;
+  }
+
+  snprintf(entry->name, sizeof(entry->name), "%.*s",
+           (int)(strlen(entry->file) - 4), entry->file);
+
+  snprintf(path, sizeof(path), "%s/%s", store->dir, entry->file);
+  FILE *file = fopen(path, "r");
+  if (!file) {
+    return;
+  }
+  for (int i = 0; i < 32 && fgets(line, sizeof(line), file); i++) {
+    line[strcspn(line, "\n")] = 0;
+    if (strncmp(line, "name=", 5) == 0 && line[5]) {
+      snprintf(entry->name, sizeof(entry->name), "%s", line + 5);
+      break;
+    }
+  }
+  fclose(file);
+  clean_name(entry->name);
+}
+
+static int load_index(ProfileStore *store) {
+  char path[STORE_DIR_LEN + 16];
+  char line[STORE_FILE_LEN + STORE_NAME_LEN + 64];
+
+  snprintf(path, sizeof(path), "%s/%s", store->dir, STORE_INDEX_FILE);
+  FILE *file = fopen(path, "r");
+  if (!file) {
+    return -1;
+  }
+
+  if (!fgets(line, sizeof(line), file) ||
+      strncmp(line, STORE_INDEX_HEADER, strlen(STORE_INDEX_HEADER)) != 0) {
+    fclose(file);
+    return -1;
+  }
+
+  while (fgets(line, sizeof(line), file)) {
+    unsigned int vid, pid, is_default;
+    long mtime;
+    int offset = 0;
+
+    line[strcspn(line, "\n")] = 0;
+    if (sscanf(line, "%4x:%4x\t%ld\t%u\t%n", &vid, &pid, &mtime, &is_default,
+               &offset) != 4 ||
+        !offset) {
+      continue;
+    }
+    char *file_name = line + offset;
+    char *name = strchr(file_name, '\t');
+    if (!name) {
+      continue;
+    }
+    *name++ = '\0';
+
+    StoreEntry *entry = append_entry(store);
+    if (!entry) {
+      break;
+    }
+    entry->vendor_id = vid;
+    entry->product_id = pid;
+    entry->mtime = (time_t)mtime;
+    entry->is_default = is_default != 0;
+    snprintf(entry->file, sizeof(entry->file), "%s", file_name);
+    snprintf(entry->name, sizeof(entry->name), "%s", name);
+  }
+  fclose(file);
+  return 0;
+}
+
+int store_save_index(const ProfileStore *store) {
+  char path[STORE_DIR_LEN + 16];
+  char tmp[STORE_DIR_LEN + 16];
+
+  snprintf(path, sizeof(path), "%s/%s", store->dir, STORE_INDEX_FILE);
+  snprintf(tmp, sizeof(tmp), "%s/%s.tmp", store->dir, STORE_INDEX_FILE);
+
+  FILE *file = fopen(tmp, "w");
+  if (!file) {
+    fprintf(stderr, "Failed to write profile index %s\n", tmp);
+    return -1;
+  }
+  fprintf(file, "%s\n", STORE_INDEX_HEADER);
+  for (int i = 0; i < store->count; i++) {
+    const StoreEntry *entry = &store->entries[i];
+    fprintf(file, "%04x:%04x\t%ld\t%d\t%s\t%s\n", entry->vendor_id,
+            entry->product_id, (long)entry->mtime, entry->is_default,
+            entry->file, entry->name);
+  }
+  if (fclose(file) != 0 || rename(tmp, path) != 0) {
+    fprintf(stderr, "Failed to replace profile index %s\n", path);
+    return -1;
+  }
+  return 0;
+}
+
+/*
+ * Claims the device of an entry in a scratch table, returns 1 if the device
+ * had no owner yet.
+ */
+static int claim_device(int *owners, uint32_t mask, const StoreEntry *entries,
+                        int index) {
+  uint32_t key = device_key(entries[index].vendor_id, entries[index].product_id);
+  uint32_t slot = hash_device(key) & mask;
+
+  for (; owners[slot] >= 0; slot = (slot + 1) & mask) {
+    const StoreEntry *owner = &entries[owners[slot]];
+    if (device_key(owner->vendor_id, owner->product_id) == key) {
+      return 0;
+    }
+  }
+  owners[slot] = index;
+  return 1;
+}
+
+/* Every device that has profiles gets exactly one default */
+static int fix_defaults(ProfileStore *store) {
+  int size = 64;
+  while (size < store->count * 2) {
+    size *= 2;
+  }
+  int *owners = malloc(size * sizeof(int));
+  if (!owners) {
+    return -1;
+  }
+  memset(owners, 0xff, size * sizeof(int));
+
+  for (int i = 0; i < store->count; i++) {
+    if (store->entries[i].is_default) {
+      store->entries[i].is_default =
+          claim_device(owners, size - 1, store->entries, i);
+    }
+  }
+  for (int i = 0; i < store->count; i++) {
+    if (!store->entries[i].is_default) {
+      store->entries[i].is_default =
+          claim_device(owners, size - 1, store->entries, i);
+    }
+  }
+  free(owners);
+  return 0;
+}
+
+/*
+ * Reconciles the index with the directory: only profiles that are new or
+ * whose mtime changed are opened, and the index is only rewritten when
+ * something actually changed.
+ */
+int store_refresh(ProfileStore *store) {
+  int changed = 0;
+  DIR *dir = opendir(store->dir);
+  struct dirent *ent;
+
+  if (!dir) {
+    fprintf(stderr, "Failed to open profile store %s\n", store->dir);
+    return -1;
+  }
+
+  for (int i = 0; i < store->count; i++) {
+    store->entries[i].seen = 0;
+  }
+
+  while ((ent = readdir(dir)) != NULL) {
+    char path[STORE_DIR_LEN + STORE_FILE_LEN];
+    struct stat st;
+    size_t len = strlen(ent->d_name);
+
+    if (len < 5 || len >= STORE_FILE_LEN ||
+        strcmp(ent->d_name + len - 4, ".cfg") != 0) {
+      continue;
+    }
+    snprintf(path, sizeof(path), "%s/%.*s", store->dir, (int)len, ent->d_name);
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+      continue;
+    }
+
+    int index = find_file(store, ent->d_name);
+    StoreEntry *entry;
+    if (index < 0) {
+      entry = append_entry(store);
+      if (!entry) {
+        break;
+      }
+      memcpy(entry->file, ent->d_name, len + 1);
+    } else {
+      entry = &store->entries[index];
+      if (entry->mtime == st.st_mtime) {
+        entry->seen = 1;
+        continue;
+      }
+    }
+    parse_profile_file(store, entry);
+    entry->mtime = st.st_mtime;
+    entry->seen = 1;
+    changed = 1;
+  }
+  closedir(dir);
+
+  int kept = 0;
+  for (int i = 0; i < store->count; i++) {
+    if (store->entries[i].seen) {
+      store->entries[kept++] = store->entries[i];
+    }
+  }
+  if (kept != store->count) {
+    store->count = kept;
+    changed = 1;
+  }
+
+  if (!changed) {
+    return 0;
+  }
+  if (fix_defaults(store) != 0 || rebuild_tables(store) != 0) {
+    return -1;
+  }
+  return store_save_index(store);
+}
+
+int store_open(ProfileStore *store, const char *dir) {
+  memset(store, 0, sizeof(*store));
+  if (dir) {
+    snprintf(store->dir, sizeof(store->dir), "%s", dir);
+  } else {
+    default_dir(store->dir, sizeof(store->dir));
+  }
+
+  if (make_dirs(store->dir) != 0) {
+    fprintf(stderr, "Failed to create profile store %s: %s\n", store->dir,
+            strerror(errno));
+    return -1;
+  }
+
+  load_index(store);
+  if (rebuild_tables(store) != 0 || store_refresh(store) != 0) {
+    store_close(store);
+    return -1;
+  }
+  return 0;
+}
+
+void store_close(ProfileStore *store) {
+  free(store->entries);
+  free(store->defaults);
+  free(store->files);
+  store->entries = NULL;
+  store->defaults = store->files = NULL;
+  store->count = store->capacity = store->table_size = 0;
+}
+
+int store_find_default(const ProfileStore *store, uint16_t vendor_id,
+                       uint16_t product_id) {
+  if (!store->table_size) {
+    return -1;
+  }
+  uint32_t key = device_key(vendor_id, product_id);
+  uint32_t mask = store->table_size - 1;
+  for (uint32_t slot = hash_device(key) & mask; store->defaults[slot] >= 0;
+       slot = (slot + 1) & mask) {
+    const StoreEntry *entry = &store->entries[store->defaults[slot]];
+    if (device_key(entry->vendor_id, entry->product_id) == key) {
+      return store->defaults[slot];
+    }
+  }
+  return -1;
+}
+
+int store_find(const ProfileStore *store, uint16_t vendor_id,
+               uint16_t product_id, const char *name) {
+  for (int i = 0; i < store->count; i++) {
+    const StoreEntry *entry = &store->entries[i];
+    if (entry->vendor_id == vendor_id && entry->product_id == product_id &&
+        strcmp(entry->name, name) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/*
+ * Returns the entry for a profile, creating it (and picking a file name in
+ * the store) if needed. The first profile of a device becomes its default.
+ * Call store_touch() once the file has been written.
+ */
+int store_add(ProfileStore *store, uint16_t vendor_id, uint16_t product_id,
+              const char *name) {
+  char stem[STORE_NAME_LEN];
+  char file[STORE_FILE_LEN];
+  int index = store_find(store, vendor_id, product_id, name);
+
+  if (index >= 0) {
+    return index;
+  }
+
+  snprintf(stem, sizeof(stem), "%s", name);
+  for (char *p = stem; *p; p++) {
+    if (!((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') ||
+          (*p >= '0' && *p <= '9') || *p == '-')) {
+      *p = '_';
+    }
+  }
+  snprintf(file, sizeof(file), "%04x_%04x_%s.cfg", vendor_id, product_id,
+           stem);
+  for (int n = 2; find_file(store, file) >= 0; n++) {
+    snprintf(file, sizeof(file), "%04x_%04x_%s-%d.cfg", vendor_id, product_id,
+             stem, n);
+  }
+
+  StoreEntry *entry = append_entry(store);
+  if (!entry) {
+    return -1;
+  }
+  entry->vendor_id = vendor_id;
+  entry->product_id = product_id;
+  entry->is_default = store_find_default(store, vendor_id, product_id) < 0;
+  snprintf(entry->name, sizeof(entry->name), "%s", name);
+  clean_name(entry->name);
+  snprintf(entry->file, sizeof(entry->file), "%s", file);
+
+  if (rebuild_tables(store) != 0) {
+    store->count--;
+    return -1;
+  }
+  return store->count - 1;
+}
+
+int store_touch(ProfileStore *store, int index) {
+  char path[STORE_DIR_LEN + STORE_FILE_LEN];
+  struct stat st;
+
+  if (store_path(store, index, path, sizeof(path)) != 0 ||
+      stat(path, &st) != 0) {
+    return -1;
+  }
+  store->entries[index].mtime = st.st_mtime;
+  return store_save_index(store);
+}
+
+int store_set_default(ProfileStore *store, int index) {
+  if (index < 0 || index >= store->count) {
+    return -1;
+  }
+
+  StoreEntry *target = &store->entries[index];
+  for (int i = 0; i < store->count; i++) {
+    StoreEntry *entry = &store->entries[i];
+    if (entry->vendor_id == target->vendor_id &&
+        entry->product_id == target->product_id) {
+      entry->is_default = i == index;
+    }
+  }
+  if (rebuild_tables(store) != 0) {
+    return -1;
+  }
+  return store_save_index(store);
+}
+
+int store_path(const ProfileStore *store, int index, char *path,
+               size_t size) {
+  if (index < 0 || index >= store->count) {
+    return -1;
+  }
+  snprintf(path, size, "%s/%s", store->dir, store->entries[index].file);
+  return 0;
+}
+
+/*
+ * Stick calibration lives next to the profiles, one .cal file per pad: by
+ * serial number when the pad has one, else shared by its VID:PID.
+ */
+void store_calibration_path(const ProfileStore *store, uint16_t vendor_id,
+                            uint16_t product_id, const char *serial,
+                            char *path, size_t size) {
+  char name[STORE_NAME_LEN] = "";
+
+  if (serial && *serial) {
+    snprintf(name, sizeof(name), "_%s", serial);
+    for (char *p = name + 1; *p; p++) {
+      if (!isalnum((unsigned char)*p)) {
+        *p = '-';
+      }
+    }
+  }
+  snprintf(path, size, "%s/%04x_%04x%s.cal", store->dir, vendor_id,
+           product_id, name);
+}
@@ -0,0 +1,61 @@
+#ifndef STORE_H
+#define STORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * Profile store: one directory of .cfg profiles plus an index file mapping
+ * VID:PID, name and modification time to each profile. Opening the store
+ * re-reads only profiles whose mtime changed since the index was written,
+ * and the default profile of a device is found through a hash table, so
+ * neither grows with a full rescan of the directory.
+ */
+
+#define STORE_INDEX_FILE "index"
+#define STORE_NAME_LEN 64
+#define STORE_FILE_LEN 128
+#define STORE_DIR_LEN 256
+
+typedef struct {
+  uint16_t vendor_id;
+  uint16_t product_id;
+  char name[STORE_NAME_LEN];
+  char file[STORE_FILE_LEN];
+  time_t mtime;
+  int is_default;
+  int seen;
+} StoreEntry;
+
+typedef struct {
+  char dir[STORE_DIR_LEN];
+  StoreEntry *entries;
+  int count;
+  int capacity;
+
+  /* Open addressing tables of entry indices, -1 marks an empty slot */
+  int *defaults;
+  int *files;
+  int table_size;
+} ProfileStore;
+
+int store_open(ProfileStore *store, const char *dir);
+void store_close(ProfileStore *store);
+int store_refresh(ProfileStore *store);
+int store_save_index(const ProfileStore *store);
+
+int store_find_default(const ProfileStore *store, uint16_t vendor_id,
+                       uint16_t product_id);
+int store_find(const ProfileStore *store, uint16_t vendor_id,
+               uint16_t product_id, const char *name);
+int store_add(ProfileStore *store, uint16_t vendor_id, uint16_t product_id,
+              const char *name);
+int store_touch(ProfileStore *store, int index);
+int store_set_default(ProfileStore *store, int index);
+int store_path(const ProfileStore *store, int index, char *path, size_t size);
+void store_calibration_path(const ProfileStore *store, uint16_t vendor_id,
+                            uint16_t product_id, const char *serial,
+                            char *path, size_t size);
+
+#endif /* STORE_H */
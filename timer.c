@@ -0,0 +1,215 @@
+#include "timer.h"
+#include "utils.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+static void set_timerfd(TimerWheel *wheel, int enable, uint64_t tick) {
+  struct itimerspec its;
+  memset(&its, 0, sizeof(its));
+
+  if (enable) {
+    uint64_t start = wheel->base_ns + tick * wheel->tick_ns;
+    its.it_value.tv_sec = start / NSEC_PER_SEC;
+    its.it_value.tv_nsec = start % NSEC_PER_SEC;
+  }
+
+  if (timerfd_settime(wheel->fd, enable ? TFD_TIMER_ABSTIME : 0, &its,
+                      NULL) != 0) {
+    perror("timerfd_settime");
+    return;
+  }
+  wheel->armed = enable;
+  wheel->armed_tick = tick;
+}
+
+static uint64_t tick_at(const TimerWheel *wheel, uint64_t ns) {
+  return ns > wheel->base_ns ? (ns - wheel->base_ns) / wheel->tick_ns : 0;
+}
+
+static void link_timer(TimerWheel *wheel, Timer *timer) {
+  uint64_t expires = MAX(timer->expires, wheel->current);
+  uint64_t delta = expires - wheel->current;
+  Timer **slot;
+  int level;
+
+  for (level = 0; level < TIMER_WHEEL_LEVELS - 1; level++) {
+    if (delta < (1ULL << ((level + 1) * TIMER_WHEEL_BITS))) {
+      break;
+    }
+  }
+
+  if (level == TIMER_WHEEL_LEVELS - 1) {
+    uint64_t limit = (1ULL << (TIMER_WHEEL_LEVELS * TIMER_WHEEL_BITS)) - 1;
+    if (delta > limit) {
+      expires = wheel->current + limit;
+    }
+  }
+
+  slot = &wheel->slots[level]
+                      [(expires >> (level * TIMER_WHEEL_BITS)) &
+                       TIMER_WHEEL_MASK];
+  timer->next = *slot;
+  if (*slot) {
+    (*slot)->pprev = &timer->next;
+  }
+  timer->pprev = slot;
+  *slot = timer;
+}
+
+static void unlink_timer(Timer *timer) {
+  *timer->pprev = timer->next;
+  if (timer->next) {
+    timer->next->pprev = timer->pprev;
+  }
+  timer->next = NULL;
+  timer->pprev = NULL;
+}
+
+static int cascade(TimerWheel *wheel, int level) {
+  int index = (wheel->current >> (level * TIMER_WHEEL_BITS)) & TIMER_WHEEL_MASK;
+  Timer *timer = wheel->slots[level][index];
+
+  wheel->slots[level][index] = NULL;
+  while (timer) {
+    Timer *next = timer->next;
+    link_timer(wheel, timer);
+    timer = next;
+  }
+  return index;
+}
+
+/*
+ * First tick with something to do: a level 0 slot to run, or a boundary
+ * where a higher level slot holding timers cascades down. Each level is
+ * scanned for one full turn of its slots.
+ */
+static uint64_t next_tick(const TimerWheel *wheel) {
+  uint64_t next = UINT64_MAX;
+
+  for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+    int shift = level * TIMER_WHEEL_BITS;
+    uint64_t unit = 1ULL << shift;
+    uint64_t tick = (wheel->current + unit - 1) & ~(unit - 1);
+
+    for (int i = 0; i < TIMER_WHEEL_SLOTS && tick < next; i++, tick += unit) {
+      if (wheel->slots[level][(tick >> shift) & TIMER_WHEEL_MASK]) {
+        next = tick;
+        break;
+      }
+    }
+  }
+  return next;
+}
+
+static void run_tick(TimerWheel *wheel, uint64_t now) {
+  int index = wheel->current & TIMER_WHEEL_MASK;
+
+  if (index == 0) {
+    for (int level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+      if (cascade(wheel, level) != 0) {
+        break;
+      }
+    }
+  }
+
+  /* Callbacks may add timers to this very slot, so drain it until empty */
+  Timer **slot = &wheel->slots[0][index];
+  while (*slot) {
+    Timer *timer = *slot;
+    unlink_timer(timer);
+    wheel->pending--;
+    latency_record(&wheel->lateness,
+                   now > timer->deadline_ns ? now - timer->deadline_ns : 0);
+    timer->fn(timer, now);
+  }
+
+  wheel->current++;
+}
+
+int timer_wheel_init(TimerWheel *wheel, uint32_t tick_us) {
+  memset(wheel, 0, sizeof(*wheel));
+
+  wheel->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (wheel->fd < 0) {
+    perror("timerfd_create");
+    return -1;
+  }
+
+  wheel->tick_ns = (uint64_t)tick_us * NSEC_PER_USEC;
+  wheel->base_ns = now_ns();
+  return 0;
+}
+
+void timer_wheel_destroy(TimerWheel *wheel) {
+  if (wheel->fd >= 0) {
+    close(wheel->fd);
+    wheel->fd = -1;
+  }
+}
+
+void timer_wheel_process(TimerWheel *wheel) {
+  uint64_t expirations;
+  while (read(wheel->fd, &expirations, sizeof(expirations)) > 0) {
+  }
+
+  uint64_t now = now_ns();
+  uint64_t target = tick_at(wheel, now);
+
+  while (wheel->pending > 0 && wheel->current <= target) {
+    run_tick(wheel, now);
+  }
+
+  if (wheel->pending == 0) {
+    wheel->current = target + 1;
+    if (wheel->armed) {
+      set_timerfd(wheel, 0, 0);
+    }
+  } else {
+    set_timerfd(wheel, 1, next_tick(wheel));
+  }
+}
+
+void timer_init(Timer *timer, timer_fn fn, void *data) {
+  memset(timer, 0, sizeof(*timer));
+  timer->fn = fn;
+  timer->data = data;
+}
+
+void timer_schedule_at(TimerWheel *wheel, Timer *timer, uint64_t deadline_ns) {
+  if (timer->pprev) {
+    timer_cancel(wheel, timer);
+  }
+
+  if (wheel->pending == 0 && !wheel->armed) {
+    wheel->current = tick_at(wheel, now_ns()) + 1;
+  }
+
+  timer->deadline_ns = deadline_ns;
+  timer->expires = deadline_ns > wheel->base_ns
+                       ? (deadline_ns - wheel->base_ns + wheel->tick_ns - 1) /
+                             wheel->tick_ns
+                       : 0;
+  link_timer(wheel, timer);
+  wheel->pending++;
+
+  uint64_t tick = MAX(timer->expires, wheel->current);
+  if (!wheel->armed || tick < wheel->armed_tick) {
+    set_timerfd(wheel, 1, tick);
+  }
+}
+
+void timer_schedule(TimerWheel *wheel, Timer *timer, uint64_t delay_ns) {
+  timer_schedule_at(wheel, timer, now_ns() + delay_ns);
+}
+
+void timer_cancel(TimerWheel *wheel, Timer *timer) {
+  if (!timer->pprev) {
+    return;
+  }
+  unlink_timer(timer);
+  wheel->pending--;
+}
+
+int timer_pending(const Timer *timer) { return timer->pprev != NULL; }
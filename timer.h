@@ -0,0 +1,57 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include "stats.h"
+#include <stdint.h>
+
+/*
+ * Hierarchical timing wheel driven by a single timerfd. Each level has 64
+ * slots, a tick only touches one level 0 slot (plus a cascade every 64
+ * ticks), so the cost per tick does not depend on how many timers are
+ * pending. Timers are intrusive: the owner embeds a Timer and nothing is
+ * allocated when scheduling. The timerfd is armed one-shot for the next
+ * tick with work, so a long timer costs no wakeups until it is due.
+ */
+
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_LEVELS 4
+
+#define TIMER_TICK_US 1000
+
+typedef struct Timer Timer;
+typedef void (*timer_fn)(Timer *timer, uint64_t now);
+
+struct Timer {
+  Timer *next;
+  Timer **pprev;
+  uint64_t deadline_ns;
+  uint64_t expires;
+  timer_fn fn;
+  void *data;
+};
+
+typedef struct {
+  int fd;
+  int armed;
+  int pending;
+  uint64_t armed_tick;
+  uint64_t tick_ns;
+  uint64_t base_ns;
+  uint64_t current;
+  Timer *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+  LatencyHistogram lateness;
+} TimerWheel;
+
+int timer_wheel_init(TimerWheel *wheel, uint32_t tick_us);
+void timer_wheel_destroy(TimerWheel *wheel);
+void timer_wheel_process(TimerWheel *wheel);
+
+void timer_init(Timer *timer, timer_fn fn, void *data);
+void timer_schedule_at(TimerWheel *wheel, Timer *timer, uint64_t deadline_ns);
+void timer_schedule(TimerWheel *wheel, Timer *timer, uint64_t delay_ns);
+void timer_cancel(TimerWheel *wheel, Timer *timer);
+int timer_pending(const Timer *timer);
+
+#endif /* TIMER_H */
@@ -0,0 +1,189 @@
+#include "trace.h"
+#include "utils.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#define TRACE_MASK (TRACE_BUFFER_EVENTS - 1)
+
+typedef struct {
+  uint64_t ts_ns;
+  uint8_t stage;
+  char phase;
+} TraceEvent;
+
+/* Single producer (the owning thread), single consumer (the flusher) */
+typedef struct {
+  volatile uint32_t head;
+  volatile uint32_t tail;
+  uint32_t open;                /* ends owed, their room is reserved */
+  uint32_t skipped;             /* stages whose begin was dropped */
+  uint8_t depth[TRACE_STAGES];  /* recorded begins awaiting their end */
+  uint64_t dropped;
+  const char *name;
+  TraceEvent events[TRACE_BUFFER_EVENTS];
+} TraceBuffer;
+
+static const char *stage_names[TRACE_STAGES] = {
+    "usb", "decode", "map", "timers", "flush", "recovery"};
+
+volatile int trace_on = 0;
+static TraceBuffer buffers[TRACE_MAX_THREADS];
+static int buffer_count = 0;
+static __thread TraceBuffer *local = NULL;
+static __thread const char *local_name = NULL;
+static FILE *trace_file = NULL;
+static const char *trace_path = NULL;
+static uint64_t start_ns;
+static uint64_t written;
+static pthread_t flusher;
+static volatile int flushing = 0;
+
+/* Names the calling thread on the timeline; call before its first span */
+void trace_thread(const char *name) { local_name = name; }
+
+static TraceBuffer *claim_buffer(void) {
+  if (__atomic_load_n(&buffer_count, __ATOMIC_ACQUIRE) >= TRACE_MAX_THREADS) {
+    return NULL;
+  }
+  int index = __atomic_fetch_add(&buffer_count, 1, __ATOMIC_ACQ_REL);
+  if (index >= TRACE_MAX_THREADS) {
+    return NULL;
+  }
+  buffers[index].name = local_name ? local_name : "thread";
+  return &buffers[index];
+}
+
+/*
+ * Only reached while tracing; a full ring drops rather than waits. Whole
+ * spans are dropped: a begin needs room for itself and its end on top of
+ * the ends already owed, and the end of a dropped begin is skipped, so
+ * the file never holds half a span.
+ */
+void trace_event(TraceStage stage, char phase) {
+  TraceBuffer *buffer = local;
+
+  if (!buffer && !(buffer = local = claim_buffer())) {
+    return;
+  }
+
+  uint32_t head = buffer->head;
+  if (phase == 'B') {
+    if (head - __atomic_load_n(&buffer->tail, __ATOMIC_ACQUIRE) +
+                buffer->open + 2 >
+            TRACE_BUFFER_EVENTS ||
+        (buffer->skipped & (1u << stage))) {
+      /* Nested begins of a dropped stage go with it */
+      buffer->skipped |= 1u << stage;
+      buffer->dropped++;
+      return;
+    }
+    buffer->open++;
+    buffer->depth[stage]++;
+  } else {
+    if (!buffer->depth[stage]) {
+      /* Its begin was dropped, or came before tracing started */
+      if (buffer->skipped & (1u << stage)) {
+        buffer->skipped &= ~(1u << stage);
+        buffer->dropped++;
+      }
+      return;
+    }
+    buffer->open--;
+    buffer->depth[stage]--;
+  }
+  TraceEvent *event = &buffer->events[head & TRACE_MASK];
+  event->ts_ns = now_ns();
+  event->stage = (uint8_t)stage;
+  event->phase = phase;
+  __atomic_store_n(&buffer->head, head + 1, __ATOMIC_RELEASE);
+}
+
+static void drain(void) {
+  int count = MIN(__atomic_load_n(&buffer_count, __ATOMIC_ACQUIRE),
+                  TRACE_MAX_THREADS);
+
+  for (int i = 0; i < count; i++) {
+    TraceBuffer *buffer = &buffers[i];
+    uint32_t head = __atomic_load_n(&buffer->head, __ATOMIC_ACQUIRE);
+
+    for (uint32_t tail = buffer->tail; tail != head; tail++) {
+      const TraceEvent *event = &buffer->events[tail & TRACE_MASK];
+      uint64_t ts = event->ts_ns > start_ns ? event->ts_ns - start_ns : 0;
+      fprintf(trace_file,
+              "%s{\"name\":\"%s\",\"cat\":\"pipeline\",\"ph\":\"%c\","
+              "\"ts\":%llu.%03llu,\"pid\":1,\"tid\":%d}",
+              written++ ? ",\n" : "", stage_names[event->stage], event->phase,
+              (unsigned long long)(ts / NSEC_PER_USEC),
+              (unsigned long long)(ts % NSEC_PER_USEC), i);
+    }
+    __atomic_store_n(&buffer->tail, head, __ATOMIC_RELEASE);
+  }
+  fflush(trace_file);
+}
+
+static void *flush_thread(void *arg) {
+  (void)arg;
+
+  while (flushing) {
+    drain();
+    SLEEP_MS(TRACE_FLUSH_MS);
+  }
+  return NULL;
+}
+
+/* Chrome trace-event JSON, timestamps in us from the start of the trace */
+int trace_start(const char *path) {
+  trace_file = fopen(path, "w");
+  if (!trace_file) {
+    fprintf(stderr, "Failed to open trace %s\n", path);
+    return -1;
+  }
+  fprintf(trace_file, "{\"traceEvents\":[\n");
+  trace_path = path;
+  start_ns = now_ns();
+  written = 0;
+
+  flushing = 1;
+  if (pthread_create(&flusher, NULL, flush_thread, NULL) != 0) {
+    fprintf(stderr, "Failed to start trace flusher\n");
+    flushing = 0;
+    fclose(trace_file);
+    trace_file = NULL;
+    return -1;
+  }
+  __atomic_store_n(&trace_on, 1, __ATOMIC_RELEASE);
+  return 0;
+}
+
+/* Stops recording, writes out what is left and names the threads */
+void trace_stop(void) {
+  uint64_t dropped = 0;
+
+  if (!trace_file) {
+    return;
+  }
+  __atomic_store_n(&trace_on, 0, __ATOMIC_RELEASE);
+  flushing = 0;
+  pthread_join(flusher, NULL);
+  drain();
+
+  int count = MIN(buffer_count, TRACE_MAX_THREADS);
+  for (int i = 0; i < count; i++) {
+    fprintf(trace_file,
+            "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+            "\"args\":{\"name\":\"%s\"}}",
+            written++ ? ",\n" : "", i, buffers[i].name);
+    dropped += buffers[i].dropped;
+  }
+  fprintf(trace_file, "\n]}\n");
+  fclose(trace_file);
+  trace_file = NULL;
+
+  printf("Trace written to %s (%llu events", trace_path,
+         (unsigned long long)(written - (uint64_t)count));
+  if (dropped) {
+    printf(", %llu dropped with full buffers", (unsigned long long)dropped);
+  }
+  printf(")\n");
+}
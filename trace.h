@@ -0,0 +1,49 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+/*
+ * Opt-in pipeline tracing. Spans around the engine's stages are recorded
+ * into one lock-free ring per thread; a background thread drains the rings
+ * into a Chrome trace-event JSON file that chrome://tracing or
+ * ui.perfetto.dev shows as a timeline. While tracing is off a span costs
+ * the one well-predicted branch on trace_on.
+ */
+
+#define TRACE_MAX_THREADS 8
+#define TRACE_BUFFER_EVENTS 8192 /* per thread, power of two */
+#define TRACE_FLUSH_MS 50
+
+typedef enum {
+  TRACE_USB = 0,  /* libusb event handling, completions included */
+  TRACE_DECODE,   /* report to ControllerState */
+  TRACE_MAP,      /* calibration, debounce, rules and translation */
+  TRACE_TIMERS,   /* expired timers: macros, turbo, tap/hold, debounce */
+  TRACE_FLUSH,    /* the engine pass's uinput frame */
+  TRACE_RECOVERY, /* a recovery step on the worker thread */
+  TRACE_STAGES
+} TraceStage;
+
+extern volatile int trace_on;
+
+#define TRACE_BEGIN(stage)                                                     \
+  do {                                                                         \
+    if (__builtin_expect(trace_on, 0)) {                                       \
+      trace_event((stage), 'B');                                               \
+    }                                                                          \
+  } while (0)
+
+#define TRACE_END(stage)                                                       \
+  do {                                                                         \
+    if (__builtin_expect(trace_on, 0)) {                                       \
+      trace_event((stage), 'E');                                               \
+    }                                                                          \
+  } while (0)
+
+int trace_start(const char *path);
+void trace_stop(void);
+void trace_thread(const char *name);
+void trace_event(TraceStage stage, char phase);
+
+#endif /* TRACE_H */
@@ -0,0 +1,872 @@
+#include "translator.h"
+#include "utils.h"
+#include <linux/input.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+void init_profile(Profile *profile) {
+  memset(profile, 0, sizeof(*profile));
+}
+
+/* Highest active layer with a binding wins, unbound buttons fall through */
+static void compile_keymap(Profile *profile) {
+  for (int state = 0; state < LAYER_STATES; state++) {
+    for (int button = 0; button < XBOX_BUTTON_COUNT; button++) {
+      Action action = profile->layers[0][button];
+      for (int layer = MAX_LAYERS - 1; layer > 0; layer--) {
+        if (CHECK_BIT(state, layer - 1) &&
+            profile->layers[layer][button].type != ACTION_NONE) {
+          action = profile->layers[layer][button];
+          break;
+        }
+      }
+      profile->keymap[state][button] = action;
+    }
+  }
+}
+
+int compile_profile(Profile *profile) {
+  compile_keymap(profile);
+  return compile_combos(&profile->combos);
+}
+
+/* The config is XBOX_BUTTON_COUNT bit/byte pairs, then the name */
+typedef char config_is_pairs[offsetof(ControllerConfig, controller_name) ==
+                                     2 * XBOX_BUTTON_COUNT
+                                 ? 1
+                                 : -1];
+
+/* Dual-role halves are plain keys or layers, never an index themselves */
+static int check_action(const Profile *profile, const Action *action,
+                        int indexed) {
+  switch (action->type) {
+  case ACTION_NONE:
+    return 0;
+  case ACTION_KEY:
+    return action->code < OUTPUT_KEY_CNT ? 0 : -1;
+  case ACTION_LAYER:
+    return action->code >= 1 && action->code < MAX_LAYERS ? 0 : -1;
+  case ACTION_MACRO:
+    return indexed && action->code < profile->macro_count ? 0 : -1;
+  case ACTION_TAP_HOLD:
+    return indexed && action->code < profile->dual_role_count ? 0 : -1;
+  case ACTION_TURBO:
+    return indexed && action->code < profile->turbo_count ? 0 : -1;
+  default:
+    return -1;
+  }
+}
+
+/*
+ * For a compiled profile that did not come from load_profile(), e.g. read
+ * back from a bundle. The translator indexes the profile's tables with
+ * what it finds in it, so every count, index and code is checked here.
+ */
+int check_profile(const Profile *profile) {
+  const uint8_t *pairs = (const uint8_t *)&profile->config;
+
+  for (int button = 0; button < XBOX_BUTTON_COUNT; button++) {
+    if (pairs[2 * button] > 7 ||
+        pairs[2 * button + 1] >= MAX_INPUT_PACKET_SIZE) {
+      return -1;
+    }
+  }
+  if (!memchr(profile->config.controller_name, '\0',
+              sizeof(profile->config.controller_name)) ||
+      profile->macro_count < 0 || profile->macro_count > MAX_MACROS ||
+      profile->dual_role_count < 0 ||
+      profile->dual_role_count > MAX_DUAL_ROLES ||
+      profile->turbo_count < 0 || profile->turbo_count > MAX_TURBOS) {
+    return -1;
+  }
+
+  for (int button = 0; button < XBOX_BUTTON_COUNT; button++) {
+    for (int layer = 0; layer < MAX_LAYERS; layer++) {
+      if (check_action(profile, &profile->layers[layer][button], 1) != 0) {
+        return -1;
+      }
+    }
+    for (int state = 0; state < LAYER_STATES; state++) {
+      if (check_action(profile, &profile->keymap[state][button], 1) != 0) {
+        return -1;
+      }
+    }
+    if (profile->debounce.window_ms[button] > DEBOUNCE_MAX_MS) {
+      return -1;
+    }
+  }
+  for (int i = 0; i < profile->macro_count; i++) {
+    const Macro *macro = &profile->macros[i];
+    if (macro->button < 0 || macro->button >= XBOX_BUTTON_COUNT ||
+        macro->layer < 0 || macro->layer >= MAX_LAYERS ||
+        check_macro(macro) != 0) {
+      return -1;
+    }
+  }
+  for (int i = 0; i < profile->dual_role_count; i++) {
+    if (check_action(profile, &profile->dual_roles[i].tap, 0) != 0 ||
+        check_action(profile, &profile->dual_roles[i].hold, 0) != 0) {
+      return -1;
+    }
+  }
+  for (int i = 0; i < profile->turbo_count; i++) {
+    if (profile->turbos[i].key >= OUTPUT_KEY_CNT) {
+      return -1;
+    }
+  }
+  if (profile->debounce.deferred & ~((1u << XBOX_BUTTON_COUNT) - 1)) {
+    return -1;
+  }
+  return check_combos(&profile->combos) == 0 &&
+                 check_rules(&profile->rules) == 0
+             ? 0
+             : -1;
+}
+
+int bind_macro(Profile *profile, int layer, int button, const Macro *macro) {
+  int index;
+
+  for (index = 0; index < profile->macro_count; index++) {
+    if (profile->macros[index].button == button &&
+        profile->macros[index].layer == layer) {
+      break;
+    }
+  }
+  if (index == MAX_MACROS) {
+    fprintf(stderr, "Profile already has %d macros\n", MAX_MACROS);
+    return -1;
+  }
+  if (index == profile->macro_count) {
+    profile->macro_count++;
+  }
+
+  profile->macros[index] = *macro;
+  profile->macros[index].button = button;
+  profile->macros[index].layer = layer;
+  profile->layers[layer][button].type = ACTION_MACRO;
+  profile->layers[layer][button].code = (uint16_t)index;
+  compile_keymap(profile);
+  return 0;
+}
+
+/* "<button>[@<layer>]" */
+static int parse_target(char *text, int *layer) {
+  char *at = strchr(text, '@');
+
+  *layer = 0;
+  if (at) {
+    *at++ = '\0';
+    *layer = atoi(at);
+    if (*layer < 0 || *layer >= MAX_LAYERS) {
+      return -1;
+    }
+  }
+  return button_id_from_string(text);
+}
+
+static int parse_action(const char *value, Action *action) {
+  if (strncmp(value, "LAYER_", 6) == 0) {
+    int layer = atoi(value + 6);
+    if (layer < 1 || layer >= MAX_LAYERS) {
+      return -1;
+    }
+    action->type = ACTION_LAYER;
+    action->code = (uint16_t)layer;
+    return 0;
+  }
+
+  int code = key_code_from_name(value);
+  if (code < 0) {
+    return -1;
+  }
+  action->type = ACTION_KEY;
+  action->code = (uint16_t)code;
+  return 0;
+}
+
+/* "<tap> <hold> [term_ms] [permissive] [interrupt]" */
+static int parse_dual_role(const char *value, DualRole *dual) {
+  char buffer[128];
+  char *saveptr = NULL;
+
+  memset(dual, 0, sizeof(*dual));
+  dual->term_ms = DEFAULT_TAPPING_TERM_MS;
+  snprintf(buffer, sizeof(buffer), "%s", value);
+
+  char *tap = strtok_r(buffer, " \t", &saveptr);
+  char *hold = strtok_r(NULL, " \t", &saveptr);
+  if (!tap || !hold || parse_action(tap, &dual->tap) != 0 ||
+      parse_action(hold, &dual->hold) != 0 ||
+      dual->tap.type != ACTION_KEY) {
+    return -1;
+  }
+
+  for (char *opt = strtok_r(NULL, " \t", &saveptr); opt;
+       opt = strtok_r(NULL, " \t", &saveptr)) {
+    if (strcmp(opt, "permissive") == 0) {
+      dual->flags |= DUAL_PERMISSIVE_HOLD;
+    } else if (strcmp(opt, "interrupt") == 0) {
+      dual->flags |= DUAL_HOLD_ON_OTHER_PRESS;
+    } else if (atoi(opt) > 0) {
+      dual->term_ms = (uint16_t)atoi(opt);
+    } else {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/* "<KEY> <rate_hz> [toggle]" */
+static int parse_turbo(const char *value, TurboBinding *turbo) {
+  char key[32], mode[16] = "";
+  int rate = 0;
+
+  memset(turbo, 0, sizeof(*turbo));
+  if (sscanf(value, "%31s %d %15s", key, &rate, mode) < 2 || rate <= 0) {
+    return -1;
+  }
+
+  int code = key_code_from_name(key);
+  if (code < 0 || (mode[0] && strcmp(mode, "toggle") != 0)) {
+    return -1;
+  }
+
+  turbo->key = (uint16_t)code;
+  turbo->rate_hz = (uint16_t)MIN(rate, MAX_TURBO_RATE_HZ);
+  turbo->latched = mode[0] != '\0';
+  return 0;
+}
+
+/* "<ms> [eager|deferred]" */
+static int parse_debounce(const char *value, uint8_t *window, int *deferred) {
+  char mode[16] = "";
+  int ms = -1;
+
+  if (sscanf(value, "%d %15s", &ms, mode) < 1 || ms < 0 ||
+      ms > DEBOUNCE_MAX_MS) {
+    return -1;
+  }
+  if (mode[0] && strcmp(mode, "eager") != 0 && strcmp(mode, "deferred") != 0) {
+    return -1;
+  }
+  *window = (uint8_t)ms;
+  *deferred = strcmp(mode, "deferred") == 0;
+  return 0;
+}
+
+static void set_debounce(DebounceConfig *config, int button, uint8_t window,
+                         int deferred) {
+  config->window_ms[button] = window;
+  if (deferred) {
+    SET_BIT(config->deferred, button);
+  } else {
+    CLEAR_BIT(config->deferred, button);
+  }
+}
+
+/*
+ * Profiles share the .cfg file with the ControllerConfig written by
+ * save_config(), adding:
+ *   bind_<button>[@<layer>]=KEY_*    map a button to a key or mouse button
+ *   bind_<button>=LAYER_<n>          hold the button to stack layer n
+ *   macro_<button>[@<layer>]=<steps> bind a macro, see parse_macro()
+ *   taphold_<button>[@<layer>]=<tap> <hold> [term_ms] [permissive]
+ *                              [interrupt]  dual-role button
+ *   turbo_<button>[@<layer>]=KEY_* <hz> [toggle]  autofire while held
+ *   combo=<pattern> KEY_* [ms]       chord or sequence, see parse_combo()
+ *   rule=<condition> -> [tap] KEY_*  mapping rule, see rules.h
+ *   debounce[_<button>]=<ms> [eager|deferred]  bounce filter, all buttons
+ *                              or one (see debounce.h)
+ */
+int load_profile(Profile *profile, const char *filename) {
+  init_profile(profile);
+
+  if (load_config(&profile->config, filename) != 0) {
+    return -1;
+  }
+
+  FILE *file = fopen(filename, "r");
+  if (!file) {
+    return -1;
+  }
+
+  char line[1100];
+  while (fgets(line, sizeof(line), file)) {
+    line[strcspn(line, "\n")] = 0;
+
+    char *value = strchr(line, '=');
+    if (!value) {
+      continue;
+    }
+    *value++ = '\0';
+
+    if (strncmp(line, "bind_", 5) == 0) {
+      int layer;
+      int button = parse_target(line + 5, &layer);
+      Action action;
+      if (button < 0 || parse_action(value, &action) != 0) {
+        fprintf(stderr, "Ignoring binding %s=%s\n", line, value);
+        continue;
+      }
+      profile->layers[layer][button] = action;
+    } else if (strncmp(line, "macro_", 6) == 0) {
+      int layer;
+      int button = parse_target(line + 6, &layer);
+      Macro macro;
+      if (button < 0 || parse_macro(value, &macro) != 0) {
+        fprintf(stderr, "Ignoring macro %s\n", line);
+        continue;
+      }
+      bind_macro(profile, layer, button, &macro);
+    } else if (strncmp(line, "taphold_", 8) == 0) {
+      int layer;
+      int button = parse_target(line + 8, &layer);
+      DualRole dual;
+      if (button < 0 || profile->dual_role_count >= MAX_DUAL_ROLES ||
+          parse_dual_role(value, &dual) != 0) {
+        fprintf(stderr, "Ignoring tap/hold %s=%s\n", line, value);
+        continue;
+      }
+      profile->dual_roles[profile->dual_role_count] = dual;
+      profile->layers[layer][button].type = ACTION_TAP_HOLD;
+      profile->layers[layer][button].code =
+          (uint16_t)profile->dual_role_count++;
+    } else if (strncmp(line, "turbo_", 6) == 0) {
+      int layer;
+      int button = parse_target(line + 6, &layer);
+      TurboBinding turbo;
+      if (button < 0 || profile->turbo_count >= MAX_TURBOS ||
+          parse_turbo(value, &turbo) != 0) {
+        fprintf(stderr, "Ignoring turbo %s=%s\n", line, value);
+        continue;
+      }
+      profile->turbos[profile->turbo_count] = turbo;
+      profile->layers[layer][button].type = ACTION_TURBO;
+      profile->layers[layer][button].code = (uint16_t)profile->turbo_count++;
+    } else if (strncmp(line, "debounce", 8) == 0) {
+      int button = line[8] == '_' ? button_id_from_string(line + 9) : -1;
+      uint8_t window;
+      int deferred;
+      if ((line[8] && button < 0) ||
+          parse_debounce(value, &window, &deferred) != 0) {
+        fprintf(stderr, "Ignoring debounce %s=%s\n", line, value);
+        continue;
+      }
+      for (int i = 0; i < XBOX_BUTTON_COUNT; i++) {
+        if (button < 0 || i == button) {
+          set_debounce(&profile->debounce, i, window, deferred);
+        }
+      }
+    } else if (strcmp(line, "combo") == 0) {
+      ComboRule rule;
+      if (parse_combo(value, &rule) != 0 ||
+          add_combo(&profile->combos, &rule) != 0) {
+        fprintf(stderr, "Ignoring combo %s\n", value);
+      }
+    } else if (strcmp(line, "rule") == 0) {
+      if (add_rule(&profile->rules, value) != 0) {
+        fprintf(stderr, "Ignoring rule %s\n", value);
+      }
+    }
+  }
+
+  fclose(file);
+  return compile_profile(profile);
+}
+
+static const char *action_name(const Action *action, char *buffer,
+                               size_t size) {
+  if (action->type == ACTION_LAYER) {
+    snprintf(buffer, size, "LAYER_%d", action->code);
+    return buffer;
+  }
+  return key_name_from_code(action->code);
+}
+
+static void write_target(FILE *file, const char *prefix, int button,
+                         int layer) {
+  fprintf(file, "%s%s", prefix, button_id_to_string(button));
+  if (layer > 0) {
+    fprintf(file, "@%d", layer);
+  }
+  fprintf(file, "=");
+}
+
+int save_profile(const Profile *profile, const char *filename) {
+  save_config(&profile->config, filename);
+
+  FILE *file = fopen(filename, "a");
+  if (!file) {
+    fprintf(stderr, "Failed to open profile %s for writing\n", filename);
+    return -1;
+  }
+
+  fprintf(file, "[Bindings]\n");
+  for (int layer = 0; layer < MAX_LAYERS; layer++) {
+    for (int i = 0; i < XBOX_BUTTON_COUNT; i++) {
+      const Action *action = &profile->layers[layer][i];
+      if (action->type == ACTION_KEY && key_name_from_code(action->code)) {
+        write_target(file, "bind_", i, layer);
+        fprintf(file, "%s\n", key_name_from_code(action->code));
+      } else if (action->type == ACTION_LAYER) {
+        write_target(file, "bind_", i, layer);
+        fprintf(file, "LAYER_%d\n", action->code);
+      } else if (action->type == ACTION_TAP_HOLD) {
+        const DualRole *dual = &profile->dual_roles[action->code];
+        char tap[16], hold[16];
+        const char *tap_name = action_name(&dual->tap, tap, sizeof(tap));
+        const char *hold_name = action_name(&dual->hold, hold, sizeof(hold));
+        if (!tap_name || !hold_name) {
+          continue;
+        }
+        write_target(file, "taphold_", i, layer);
+        fprintf(file, "%s %s %d%s%s\n", tap_name, hold_name, dual->term_ms,
+                dual->flags & DUAL_PERMISSIVE_HOLD ? " permissive" : "",
+                dual->flags & DUAL_HOLD_ON_OTHER_PRESS ? " interrupt" : "");
+      } else if (action->type == ACTION_TURBO) {
+        const TurboBinding *turbo = &profile->turbos[action->code];
+        if (!key_name_from_code(turbo->key)) {
+          continue;
+        }
+        write_target(file, "turbo_", i, layer);
+        fprintf(file, "%s %d%s\n", key_name_from_code(turbo->key),
+                turbo->rate_hz, turbo->latched ? " toggle" : "");
+      }
+    }
+  }
+
+  fprintf(file, "[Macros]\n");
+  for (int i = 0; i < profile->macro_count; i++) {
+    const Macro *macro = &profile->macros[i];
+    write_target(file, "macro_", macro->button, macro->layer);
+    write_macro(file, macro);
+    fprintf(file, "\n");
+  }
+
+  fprintf(file, "[Debounce]\n");
+  for (int i = 0; i < XBOX_BUTTON_COUNT; i++) {
+    if (profile->debounce.window_ms[i]) {
+      fprintf(file, "debounce_%s=%d %s\n", button_id_to_string(i),
+              profile->debounce.window_ms[i],
+              CHECK_BIT(profile->debounce.deferred, i) ? "deferred" : "eager");
+    }
+  }
+
+  fprintf(file, "[Combos]\n");
+  for (int i = 0; i < profile->combos.rule_count; i++) {
+    fprintf(file, "combo=%s\n", profile->combos.rules[i].text);
+  }
+
+  fprintf(file, "[Rules]\n");
+  for (int i = 0; i < profile->rules.rule_count; i++) {
+    fprintf(file, "rule=%s\n", profile->rules.rules[i].text);
+  }
+
+  fclose(file);
+  return 0;
+}
+
+static void on_dual_timeout(Timer *timer, uint64_t now);
+static void on_rule_timer(Timer *timer, uint64_t now);
+static void on_chord_timeout(Timer *timer, uint64_t now);
+
+void translator_init(Translator *translator, const Profile *profile,
+                     OutputDevice *out, TimerWheel *timers) {
+  memset(translator, 0, sizeof(*translator));
+  translator->profile = profile;
+  translator->out = out;
+  translator->timers = timers;
+  translator->dual_pending = -1;
+  timer_init(&translator->dual_timer, on_dual_timeout, translator);
+  timer_init(&translator->rule_timer, on_rule_timer, translator);
+  timer_init(&translator->chord_timer, on_chord_timeout, translator);
+  combo_reset(&translator->combo);
+  rules_reset(&translator->rules);
+}
+
+static int translate_combos(Translator *translator, uint32_t mask,
+                            uint64_t now) {
+  const ComboMachine *machine = &translator->profile->combos;
+  uint16_t pressed[MAX_ACTIVE_CHORDS], released[MAX_ACTIVE_CHORDS];
+  int pressed_count, released_count;
+
+  combo_step(machine, &translator->combo, translator->prev_mask, mask, now,
+             pressed, &pressed_count, released, &released_count);
+
+  for (int i = 0; i < released_count; i++) {
+    uint16_t key = machine->rules[released[i]].key;
+    emit_key(translator->out, key, 0);
+    macro_record_event(EV_KEY, key, 0);
+  }
+  for (int i = 0; i < pressed_count; i++) {
+    const ComboRule *rule = &machine->rules[pressed[i]];
+    if (rule->kind == COMBO_CHORD) {
+      /* Members already sent (past the term) keep their own release */
+      translator->chord_swallowed |=
+          rule->mask &
+          (translator->chord_held_back | (mask & ~translator->prev_mask));
+      translator->chord_held_back &= ~translator->chord_swallowed;
+    }
+    emit_key(translator->out, rule->key, 1);
+    macro_record_event(EV_KEY, rule->key, 1);
+    if (rule->kind == COMBO_SEQUENCE) {
+      emit_key(translator->out, rule->key, 0);
+      macro_record_event(EV_KEY, rule->key, 0);
+    }
+  }
+
+  return pressed_count + released_count;
+}
+
+static int run_turbo(Translator *translator, int button, const Action *action,
+                     int pressed) {
+  const TurboBinding *turbo = &translator->profile->turbos[action->code];
+  TurboStream **stream = &translator->turbo[button];
+
+  if (pressed && !*stream) {
+    *stream = turbo_start(translator->out, translator->timers, turbo->key,
+                          turbo->rate_hz);
+  } else if (*stream && (!turbo->latched || pressed)) {
+    turbo_stop(*stream);
+    *stream = NULL;
+  }
+  return 0;
+}
+
+static int apply_action(Translator *translator, const Action *action,
+                        int pressed) {
+  switch (action->type) {
+  case ACTION_KEY:
+    emit_key(translator->out, action->code, pressed);
+    macro_record_event(EV_KEY, action->code, pressed);
+    return 1;
+  case ACTION_MACRO:
+    if (pressed) {
+      macro_play(&translator->profile->macros[action->code], translator->out,
+                 translator->timers, translator);
+    }
+    return 0;
+  case ACTION_LAYER:
+    if (pressed) {
+      SET_BIT(translator->layer_state, action->code - 1);
+    } else {
+      CLEAR_BIT(translator->layer_state, action->code - 1);
+    }
+    return 0;
+  default:
+    return 0;
+  }
+}
+
+static int process_change(Translator *translator, int button, int pressed);
+
+/*
+ * Settles the pending tap/hold button, then replays whatever was deferred
+ * while it was undecided. This always runs while handling the deciding
+ * report (or the tapping term timer), so no extra latency is added.
+ */
+static int decide_dual_role(Translator *translator, int hold) {
+  int button = translator->dual_pending;
+  const DualRole *dual =
+      &translator->profile->dual_roles[translator->held[button].code];
+  uint8_t deferred[MAX_DEFERRED_EVENTS];
+  int deferred_count = translator->deferred_count;
+  int emitted = 0;
+
+  translator->dual_pending = -1;
+  translator->deferred_count = 0;
+  timer_cancel(translator->timers, &translator->dual_timer);
+  memcpy(deferred, translator->deferred, (size_t)deferred_count);
+
+  if (hold) {
+    SET_BIT(translator->dual_hold_mask, button);
+    emitted |= apply_action(translator, &dual->hold, 1);
+  } else {
+    emitted |= apply_action(translator, &dual->tap, 1);
+    emitted |= apply_action(translator, &dual->tap, 0);
+  }
+
+  for (int i = 0; i < deferred_count; i++) {
+    emitted |= process_change(translator, deferred[i] & 0x7f,
+                              deferred[i] >> 7);
+  }
+  return emitted;
+}
+
+static void on_dual_timeout(Timer *timer, uint64_t now) {
+  Translator *translator = timer->data;
+  (void)now;
+
+  if (translator->dual_pending >= 0 && decide_dual_role(translator, 1)) {
+    emit_sync(translator->out);
+  }
+}
+
+/*
+ * The action is resolved once on press and remembered, so a release always
+ * undoes what the press did even if the layers changed in between.
+ */
+static int run_action(Translator *translator, int button, int pressed) {
+  const Action *action = &translator->held[button];
+
+  if (pressed) {
+    translator->held[button] =
+        translator->profile->keymap[translator->layer_state][button];
+  }
+
+  if (action->type == ACTION_TURBO) {
+    return run_turbo(translator, button, action, pressed);
+  }
+  if (action->type != ACTION_TAP_HOLD) {
+    return apply_action(translator, action, pressed);
+  }
+
+  if (pressed) {
+    const DualRole *dual = &translator->profile->dual_roles[action->code];
+    translator->dual_pending = button;
+    translator->dual_pressed_during = 0;
+    timer_schedule(translator->timers, &translator->dual_timer,
+                   dual->term_ms * NSEC_PER_MSEC);
+    return 0;
+  }
+
+  if (CHECK_BIT(translator->dual_hold_mask, button)) {
+    CLEAR_BIT(translator->dual_hold_mask, button);
+    return apply_action(translator,
+                        &translator->profile->dual_roles[action->code].hold, 0);
+  }
+  if (translator->dual_pending == button) {
+    return decide_dual_role(translator, 0);
+  }
+  return 0;
+}
+
+static int defer_change(Translator *translator, int button, int pressed) {
+  if (translator->deferred_count >= MAX_DEFERRED_EVENTS) {
+    return -1;
+  }
+  translator->deferred[translator->deferred_count++] =
+      (uint8_t)(button | (pressed << 7));
+  return 0;
+}
+
+static int process_change(Translator *translator, int button, int pressed) {
+  int pending = translator->dual_pending;
+  int emitted = 0;
+
+  if (pending >= 0 && button != pending) {
+    const DualRole *dual =
+        &translator->profile->dual_roles[translator->held[pending].code];
+
+    if (pressed && !(dual->flags & DUAL_HOLD_ON_OTHER_PRESS) &&
+        defer_change(translator, button, 1) == 0) {
+      SET_BIT(translator->dual_pressed_during, button);
+      return 0;
+    }
+    if (!pressed && CHECK_BIT(translator->dual_pressed_during, button)) {
+      if (defer_change(translator, button, 0) == 0) {
+        if (dual->flags & DUAL_PERMISSIVE_HOLD) {
+          return decide_dual_role(translator, 1);
+        }
+        return 0;
+      }
+    }
+    if (pressed || CHECK_BIT(translator->dual_pressed_during, button)) {
+      emitted = decide_dual_role(translator, 1);
+    }
+  }
+
+  return emitted | run_action(translator, button, pressed);
+}
+
+/* The chord term ran out, or something else happened first */
+static int flush_chord_buttons(Translator *translator) {
+  uint32_t held = translator->chord_held_back;
+  int emitted = 0;
+
+  translator->chord_held_back = 0;
+  timer_cancel(translator->timers, &translator->chord_timer);
+  for (; held; held &= held - 1) {
+    emitted |= process_change(translator, __builtin_ctz(held), 1);
+  }
+  return emitted;
+}
+
+static void on_chord_timeout(Timer *timer, uint64_t now) {
+  Translator *translator = timer->data;
+  (void)now;
+
+  if (flush_chord_buttons(translator)) {
+    emit_sync(translator->out);
+  }
+}
+
+/* Returns 1 if the change was held back or swallowed for a chord */
+static int hold_chord_button(Translator *translator, int button, int pressed) {
+  const ComboMachine *machine = &translator->profile->combos;
+
+  if (CHECK_BIT(translator->chord_swallowed, button)) {
+    if (!pressed) {
+      CLEAR_BIT(translator->chord_swallowed, button);
+    }
+    return 1;
+  }
+  if (!pressed || !CHECK_BIT(machine->chord_buttons, button)) {
+    return 0;
+  }
+  SET_BIT(translator->chord_held_back, button);
+  if (!timer_pending(&translator->chord_timer)) {
+    timer_schedule(translator->timers, &translator->chord_timer,
+                   machine->chord_term_ms * NSEC_PER_MSEC);
+  }
+  return 1;
+}
+
+static int translate_buttons(Translator *translator, uint32_t mask,
+                             uint64_t now) {
+  uint32_t changed = mask ^ translator->prev_mask;
+  uint32_t layer_keys = 0;
+  int emitted = translate_combos(translator, mask, now) > 0;
+
+  translator->prev_mask = mask;
+
+  /* Layer switches go first so the rest of the report sees the new layers */
+  for (uint32_t bits = changed; bits; bits &= bits - 1) {
+    int button = __builtin_ctz(bits);
+    int pressed = CHECK_BIT(mask, button);
+    const Action *action =
+        pressed ? &translator->profile->keymap[translator->layer_state][button]
+                : &translator->held[button];
+    if (action->type == ACTION_LAYER) {
+      run_action(translator, button, pressed);
+      layer_keys |= 1u << button;
+    }
+  }
+
+  for (uint32_t bits = changed & ~layer_keys; bits; bits &= bits - 1) {
+    int button = __builtin_ctz(bits);
+    int pressed = CHECK_BIT(mask, button);
+    if (hold_chord_button(translator, button, pressed)) {
+      continue;
+    }
+    /* Anything else goes out after the held presses, in order */
+    if (translator->chord_held_back) {
+      emitted |= flush_chord_buttons(translator);
+    }
+    emitted |= process_change(translator, button, pressed);
+  }
+  return emitted;
+}
+
+static int translate_rules(Translator *translator, uint64_t now) {
+  const RuleProgram *program = &translator->profile->rules;
+  RuleEdge edges[MAX_RULES];
+  uint64_t deadline;
+
+  int count = rules_run(program, &translator->rules, &translator->pad,
+                        translator->layer_state, now, edges, &deadline);
+  for (int i = 0; i < count; i++) {
+    const Rule *rule = &program->rules[edges[i].rule];
+    if (rule->kind == RULE_TAP) {
+      if (edges[i].on) {
+        emit_key(translator->out, rule->key, 1);
+        emit_key(translator->out, rule->key, 0);
+        macro_record_event(EV_KEY, rule->key, 1);
+        macro_record_event(EV_KEY, rule->key, 0);
+      }
+    } else {
+      emit_key(translator->out, rule->key, edges[i].on);
+      macro_record_event(EV_KEY, rule->key, edges[i].on);
+    }
+  }
+
+  if (deadline && (!timer_pending(&translator->rule_timer) ||
+                   translator->rule_timer.deadline_ns != deadline)) {
+    timer_schedule_at(translator->timers, &translator->rule_timer, deadline);
+  }
+  return count > 0;
+}
+
+static void on_rule_timer(Timer *timer, uint64_t now) {
+  Translator *translator = timer->data;
+
+  if (translate_rules(translator, now)) {
+    emit_sync(translator->out);
+  }
+}
+
+/* Rules can read the axes, so unlike buttons they run on every report */
+void translate_state(Translator *translator, const ControllerState *state,
+                     uint64_t now) {
+  int emitted = 0;
+
+  if (state->button_mask != translator->prev_mask) {
+    emitted = translate_buttons(translator, state->button_mask, now);
+  }
+  if (translator->profile->rules.rule_count) {
+    translator->pad = *state;
+    emitted |= translate_rules(translator, now);
+  }
+
+  if (emitted) {
+    emit_sync(translator->out);
+  }
+}
+
+/*
+ * Releases everything the translator is holding down (keys, hold actions,
+ * chords, turbo streams, running macros) and forgets the button state, so
+ * the next report starts from scratch. Used before pausing or switching
+ * profiles.
+ */
+void translator_reset(Translator *translator) {
+  const Profile *profile = translator->profile;
+  int emitted = 0;
+
+  timer_cancel(translator->timers, &translator->dual_timer);
+  timer_cancel(translator->timers, &translator->rule_timer);
+  timer_cancel(translator->timers, &translator->chord_timer);
+  /* Its macros point into the profile, which may be freed right after */
+  macro_cancel(translator->timers, translator);
+
+  for (int i = 0; i < translator->combo.active_count; i++) {
+    uint16_t key = profile->combos.rules[translator->combo.active[i]].key;
+    emit_key(translator->out, key, 0);
+    emitted = 1;
+  }
+
+  for (int i = 0; i < profile->rules.rule_count; i++) {
+    if (CHECK_BIT(translator->rules.active[i / 32], i % 32) &&
+        profile->rules.rules[i].kind == RULE_HOLD) {
+      emit_key(translator->out, profile->rules.rules[i].key, 0);
+      emitted = 1;
+    }
+  }
+
+  for (int button = 0; button < XBOX_BUTTON_COUNT; button++) {
+    const Action *action = &translator->held[button];
+
+    if (translator->turbo[button]) {
+      turbo_stop(translator->turbo[button]);
+    }
+    /* Held back or swallowed chord presses never went out */
+    if (!CHECK_BIT(translator->prev_mask & ~(translator->chord_held_back |
+                                              translator->chord_swallowed),
+                   button)) {
+      continue;
+    }
+    if (action->type == ACTION_KEY) {
+      emitted |= apply_action(translator, action, 0);
+    } else if (action->type == ACTION_TAP_HOLD &&
+               CHECK_BIT(translator->dual_hold_mask, button)) {
+      emitted |= apply_action(translator,
+                              &profile->dual_roles[action->code].hold, 0);
+    }
+  }
+
+  if (emitted) {
+    emit_sync(translator->out);
+  }
+  translator_init(translator, profile, translator->out, translator->timers);
+}
@@ -0,0 +1,122 @@
+#ifndef TRANSLATOR_H
+#define TRANSLATOR_H
+
+#include "combo.h"
+#include "controller.h"
+#include "debounce.h"
+#include "input.h"
+#include "macro.h"
+#include "rules.h"
+#include "timer.h"
+#include "turbo.h"
+#include <stdint.h>
+
+/* Layer 0 is the base map, layers 1..MAX_LAYERS-1 stack on top of it */
+#define MAX_LAYERS 8
+#define LAYER_STATES (1 << (MAX_LAYERS - 1))
+
+#define MAX_DUAL_ROLES 16
+#define MAX_DEFERRED_EVENTS 32
+#define DEFAULT_TAPPING_TERM_MS 200
+#define MAX_TURBOS 16
+
+typedef enum {
+  ACTION_NONE = 0,
+  ACTION_KEY,
+  ACTION_MACRO,
+  ACTION_LAYER,
+  ACTION_TAP_HOLD,
+  ACTION_TURBO,
+} ActionType;
+
+typedef struct {
+  uint8_t type;
+  uint16_t code; /* key code, layer number or macro/dual/turbo index */
+} Action;
+
+typedef enum {
+  DUAL_PERMISSIVE_HOLD = 1 << 0, /* hold if another key is tapped inside */
+  DUAL_HOLD_ON_OTHER_PRESS = 1 << 1, /* hold as soon as another key goes down */
+} DualRoleFlags;
+
+/* Repeats a key while held, or until pressed again when latched */
+typedef struct {
+  uint16_t key;
+  uint16_t rate_hz;
+  uint8_t latched;
+} TurboBinding;
+
+/* One action on tap, another when held past the tapping term */
+typedef struct {
+  Action tap;
+  Action hold;
+  uint16_t term_ms;
+  uint8_t flags;
+} DualRole;
+
+typedef struct {
+  ControllerConfig config;
+  Action layers[MAX_LAYERS][XBOX_BUTTON_COUNT];
+  int macro_count;
+  Macro macros[MAX_MACROS];
+  int dual_role_count;
+  DualRole dual_roles[MAX_DUAL_ROLES];
+  int turbo_count;
+  TurboBinding turbos[MAX_TURBOS];
+  ComboMachine combos;
+  RuleProgram rules;
+  DebounceConfig debounce;
+
+  /*
+   * Effective action for every combination of active layers, built by
+   * compile_profile(). Indexed by the active layer bits (layer 1 is bit 0).
+   */
+  Action keymap[LAYER_STATES][XBOX_BUTTON_COUNT];
+} Profile;
+
+typedef struct {
+  const Profile *profile;
+  OutputDevice *out;
+  TimerWheel *timers;
+  uint32_t prev_mask;
+  uint32_t layer_state;
+  Action held[XBOX_BUTTON_COUNT];
+  TurboStream *turbo[XBOX_BUTTON_COUNT];
+  ComboTracker combo;
+
+  /*
+   * Chord button presses wait out the chord term; a chord that completes
+   * swallows them, so only the chord's key goes out.
+   */
+  Timer chord_timer;
+  uint32_t chord_held_back;
+  uint32_t chord_swallowed;
+
+  /* Rules rerun from the last report when a held-for condition comes due */
+  RuleState rules;
+  Timer rule_timer;
+  ControllerState pad;
+
+  /* Tap/hold decision in progress, other buttons are deferred until then */
+  Timer dual_timer;
+  int dual_pending;
+  uint32_t dual_hold_mask;
+  uint32_t dual_pressed_during;
+  int deferred_count;
+  uint8_t deferred[MAX_DEFERRED_EVENTS];
+} Translator;
+
+void init_profile(Profile *profile);
+int load_profile(Profile *profile, const char *filename);
+int save_profile(const Profile *profile, const char *filename);
+int compile_profile(Profile *profile);
+int check_profile(const Profile *profile);
+int bind_macro(Profile *profile, int layer, int button, const Macro *macro);
+
+void translator_init(Translator *translator, const Profile *profile,
+                     OutputDevice *out, TimerWheel *timers);
+void translate_state(Translator *translator, const ControllerState *state,
+                     uint64_t now);
+void translator_reset(Translator *translator);
+
+#endif /* TRANSLATOR_H */
@@ -1,10 +1,13 @@
 #include "tui.h"
 #include "controller.h"
+#include "engine.h"
+#include "store.h"
+#include "translator.h"
 #include "utils.h"
+#include <errno.h>
+#include <poll.h>
 #include <string.h>
 #include <unistd.h>
-#include <dirent.h>
-#include <sys/stat.h>
 #include <ncurses.h>
 #include <stdlib.h>
 
@@ -15,9 +18,35 @@
 #define COLOR_ERROR 5
 #define COLOR_SUCCESS 6
 
+#define TUI_EVENT_TIMEOUT (-2)
+#define TUI_EVENT_INPUT (-3)
+#define TUI_ESC_DELAY_MS 25
+#define DISCOVERY_TIMEOUT_S 60
+#define RELEASE_TIMEOUT_S 10
+
+#define MONITOR_FPS 30
+#define MONITOR_BUTTONS_PER_ROW 5
+#define MONITOR_BUTTON_WIDTH 12
+#define STICK_BOX_HEIGHT 11
+#define STICK_BOX_WIDTH 23
+#define TRIGGER_BAR_WIDTH 40
+
+typedef struct {
+    WINDOW *buttons;
+    WINDOW *sticks[2];
+    WINDOW *triggers;
+    WINDOW *status;
+    int dot_y[2];
+    int dot_x[2];
+} MonitorView;
+
 static WINDOW *main_win = NULL;
 static WINDOW *content_win = NULL;
 static int screen_height, screen_width;
+static ProfileStore store;
+static const ProfileStore *sort_store = NULL;
+
+static int load_existing_config(libusb_context *lctx);
 
 static const char* button_names[] = {
     "A Button", "B Button", "X Button", "Y Button",
@@ -44,6 +73,7 @@ int init_tui(void) {
     cbreak();
     noecho();
     keypad(stdscr, TRUE);
+    set_escdelay(TUI_ESC_DELAY_MS);
     curs_set(0);  
     
     getmaxyx(stdscr, screen_height, screen_width);
@@ -72,6 +102,58 @@ void cleanup_tui(void) {
     endwin();
 }
 
+/*
+ * Every TUI wait goes through here: one poll over the terminal and, when
+ * want_input is set, the input engine's notification fd, bounded by an
+ * optional deadline (0 waits forever). Returns the key pressed,
+ * TUI_EVENT_INPUT when the engine published new controller state, or
+ * TUI_EVENT_TIMEOUT once the deadline has passed.
+ */
+static int tui_wait_event(uint64_t deadline_ns, int want_input) {
+    struct pollfd fds[2];
+    int nfds;
+
+    while (1) {
+        /* ncurses may already hold buffered keys poll() cannot see */
+        nodelay(stdscr, TRUE);
+        int ch = getch();
+        nodelay(stdscr, FALSE);
+        if (ch != ERR) {
+            return ch;
+        }
+
+        int timeout_ms = -1;
+        if (deadline_ns) {
+            uint64_t now = now_ns();
+            if (now >= deadline_ns) {
+                return TUI_EVENT_TIMEOUT;
+            }
+            timeout_ms = (int)((deadline_ns - now + NSEC_PER_MSEC - 1) / NSEC_PER_MSEC);
+        }
+
+        fds[0].fd = STDIN_FILENO;
+        fds[0].events = POLLIN;
+        nfds = 1;
+        if (want_input && engine_notify_fd() >= 0) {
+            fds[1].fd = engine_notify_fd();
+            fds[1].events = POLLIN;
+            nfds = 2;
+        }
+
+        if (poll(fds, nfds, timeout_ms) < 0 && errno != EINTR) {
+            return TUI_EVENT_TIMEOUT;
+        }
+        if (nfds == 2 && (fds[1].revents & POLLIN)) {
+            engine_ack_notify();
+            return TUI_EVENT_INPUT;
+        }
+    }
+}
+
+static int tui_read_key(void) {
+    return tui_wait_event(0, 0);
+}
+
 void draw_header(const char *title) {
     werase(stdscr);
     
@@ -137,11 +219,12 @@ void show_message(const char *message, int timeout_ms) {
     refresh();
     
     if (timeout_ms > 0) {
-        usleep(timeout_ms * 1000);
+        /* Any key dismisses the message early */
+        tui_wait_event(now_ns() + (uint64_t)timeout_ms * NSEC_PER_MSEC, 0);
     } else {
         mvprintw(start_y + 3, start_x + 3, "Press any key...");
         refresh();
-        getch();
+        tui_read_key();
     }
 }
 
@@ -167,7 +250,7 @@ void show_error(const char *error) {
     attroff(COLOR_PAIR(COLOR_ERROR));
     
     refresh();
-    getch();
+    tui_read_key();
 }
 
 int get_string_input(const char *prompt, char *buffer, int max_len) {
@@ -206,10 +289,12 @@ int show_main_menu(void) {
     char *menu_items[] = {
         "Configure New Controller",
         "Load Existing Configuration",
+        "Live Input Monitor",
+        "Calibrate Sticks",
         "About",
         "Exit"
     };
-    int n_items = 4;
+    int n_items = 6;
     int selected = 0;
     int ch;
     
@@ -236,7 +321,7 @@ int show_main_menu(void) {
         
         refresh();
         
-        ch = getch();
+        ch = tui_read_key();
         switch (ch) {
             case KEY_UP:
                 selected = (selected - 1 + n_items) % n_items;
@@ -250,9 +335,9 @@ int show_main_menu(void) {
                 return selected;
             case 'q':
             case 'Q':
-                return 3; 
+                return n_items - 1;
             case 27: 
-                return 3;
+                return n_items - 1;
         }
     }
 }
@@ -275,7 +360,7 @@ int wait_for_key_press(char *key_name, int *keycode) {
     mvprintw(screen_height / 2 + 2, (screen_width - 40) / 2, "Press any key (ESC to cancel)...");
     refresh();
     
-    int ch = getch();
+    int ch = tui_read_key();
     if (ch == 27) { 
         return -1;
     }
@@ -311,43 +396,60 @@ int wait_for_key_press(char *key_name, int *keycode) {
     return 0;
 }
 
-int wait_for_controller_input(libusb_device_handle *handle, ControllerState *state) {
+int wait_for_controller_input(ControllerState *state) {
     mvprintw(screen_height / 2 + 2, (screen_width - 50) / 2, "Press any button or move stick (ESC to cancel)...");
     refresh();
     
-    ControllerState prev_state = {0};
-    
-    nodelay(stdscr, TRUE);
+    ControllerState prev_state;
+    if (engine_snapshot(0, &prev_state, NULL) != 0) {
+        memset(&prev_state, 0, sizeof(prev_state));
+    }
     
     while (1) {
-        int ch = getch();
-        if (ch == 27) { 
-            nodelay(stdscr, FALSE);
+        int ev = tui_wait_event(0, 1);
+        if (ev == 27) { 
             return -1;
         }
         
-        if (read_input(handle, state) == 0) {
+        if (ev == TUI_EVENT_INPUT && engine_snapshot(0, state, NULL) == 0) {
             if (memcmp(state, &prev_state, sizeof(ControllerState)) != 0) {
-                nodelay(stdscr, FALSE);
                 return 0;
             }
         }
-        
-        prev_state = *state;
-        usleep(50000); 
     }
 }
 
-int wait_for_button_press_tui(libusb_device_handle *handle, const char *button_name,
-                               uint8_t *found_byte, uint8_t *found_bit) {
-    uint8_t buffer[MAX_INPUT_PACKET_SIZE];
-    uint8_t last_buffer[MAX_INPUT_PACKET_SIZE] = {0};
-    int attempts = 0;
-    const int max_attempts = 600; 
+static int wait_for_button_release(int byte, uint8_t mask) {
+    ControllerState state;
+    uint64_t deadline = now_ns() + (uint64_t)RELEASE_TIMEOUT_S * NSEC_PER_SEC;
     
-    nodelay(stdscr, TRUE);
+    while (1) {
+        if (engine_snapshot(0, &state, NULL) == 0 && !(state.buttons[byte - 2] & mask)) {
+            mvprintw(screen_height / 2 + 3, (screen_width - 30) / 2, 
+                    "✓ Button released");
+            refresh();
+            tui_wait_event(now_ns() + NSEC_PER_SEC, 0);
+            return 0;
+        }
+        
+        int ev = tui_wait_event(deadline, 1);
+        if (ev == TUI_EVENT_TIMEOUT) {
+            show_error("Timeout waiting for button release");
+            return -1;
+        }
+    }
+}
+
+/*
+ * Watches the raw button bytes (report bytes 2-5) in the engine's snapshots
+ * for a bit going from released to pressed.
+ */
+int wait_for_button_press_tui(const char *button_name, uint8_t *found_byte,
+                              uint8_t *found_bit) {
+    ControllerState state;
+    uint8_t last_buttons[sizeof(state.buttons)] = {0};
+    uint64_t deadline = now_ns() + (uint64_t)DISCOVERY_TIMEOUT_S * NSEC_PER_SEC;
     
-    clear();
     draw_header("Button Discovery");
     
     int info_y = screen_height / 2 - 3;
@@ -357,40 +459,37 @@ int wait_for_button_press_tui(libusb_device_handle *handle, const char *button_n
     mvprintw(info_y + 3, (screen_width - 30) / 2, "Listening for button press...");
     refresh();
     
-    while (attempts < max_attempts) {
-        int ch = getch();
-        if (ch == 27) { 
-            nodelay(stdscr, FALSE);
-            return -1;
+    if (engine_snapshot(0, &state, NULL) == 0) {
+        memcpy(last_buttons, state.buttons, sizeof(last_buttons));
+    }
+    
+    while (1) {
+        uint64_t now = now_ns();
+        if (now >= deadline) {
+            break;
         }
         
-        int actual_length = 0;
-        int ret = libusb_interrupt_transfer(handle, 0x81, buffer, sizeof(buffer),
-                                          &actual_length, 100); 
+        /* Wake on input, a key or the next whole second of the countdown */
+        uint64_t left = deadline - now;
+        mvprintw(info_y + 4, (screen_width - 30) / 2, "Timeout in %d seconds... ", 
+                (int)(left / NSEC_PER_SEC));
+        refresh();
         
-        if (ret == LIBUSB_ERROR_TIMEOUT) {
-            attempts++;
-            if (attempts % 10 == 0) { 
-                mvprintw(info_y + 4, (screen_width - 30) / 2, "Timeout in %d seconds...", 
-                        (max_attempts - attempts) / 10);
-                refresh();
-            }
-            continue;
+        int ev = tui_wait_event(now + (left % NSEC_PER_SEC ? left % NSEC_PER_SEC : NSEC_PER_SEC), 1);
+        if (ev == 27) { 
+            return -1;
         }
-        
-        if (ret < 0 || actual_length < 20) {
-            attempts++;
+        if (ev != TUI_EVENT_INPUT || engine_snapshot(0, &state, NULL) != 0) {
             continue;
         }
         
         for (int byte = 2; byte < 6; byte++) {
             for (int bit = 0; bit < 8; bit++) {
                 uint8_t mask = (1 << bit);
-                if ((buffer[byte] & mask) && !(last_buffer[byte] & mask)) {
+                if ((state.buttons[byte - 2] & mask) && !(last_buttons[byte - 2] & mask)) {
                     *found_byte = byte;
                     *found_bit = bit;
                     
-                    clear();
                     draw_header("Button Discovered!");
                     
                     mvprintw(screen_height / 2 - 1, (screen_width - 50) / 2, 
@@ -401,43 +500,24 @@ int wait_for_button_press_tui(libusb_device_handle *handle, const char *button_n
                             "Please release the button...");
                     refresh();
                     
-                    int release_attempts = 0;
-                    while (release_attempts < 100) { 
-                        int release_ret = libusb_interrupt_transfer(handle, 0x81, buffer,
-                                                sizeof(buffer), &actual_length, 100);
-                        
-                        if (release_ret == 0 && actual_length >= 20) {
-                            if (!(buffer[byte] & mask)) {
-                                mvprintw(screen_height / 2 + 3, (screen_width - 30) / 2, 
-                                        "✓ Button released");
-                                refresh();
-                                usleep(1000000); 
-                                nodelay(stdscr, FALSE);
-                                return 0;
-                            }
-                        }
-                        release_attempts++;
-                        usleep(100000);
-                    }
-                    
-                    show_error("Timeout waiting for button release");
-                    nodelay(stdscr, FALSE);
-                    return -1;
+                    return wait_for_button_release(byte, mask);
                 }
             }
         }
         
-        memcpy(last_buffer, buffer, sizeof(last_buffer));
-        attempts++;
-        usleep(10000); 
+        memcpy(last_buttons, state.buttons, sizeof(last_buttons));
     }
     
     show_error("Timeout waiting for button press");
-    nodelay(stdscr, FALSE);
     return -1;
 }
 
 int run_tui_config(libusb_context *lctx) {
+    if (store_open(&store, NULL) != 0) {
+        show_error("Failed to open the profile store");
+        return -1;
+    }
+    
     while (1) {
         int choice = show_main_menu();
         
@@ -460,7 +540,8 @@ int run_tui_config(libusb_context *lctx) {
                 if (selected_controller >= 0) {
                     libusb_device_handle *handle;
                     if (open_controller(controllers[selected_controller].device, &handle) == 0) {
-                        if (claim_interface_safe(handle) != 0) {
+                        if (engine_init(lctx) != 0 || start_input_reader(handle, NULL) != 0) {
+                            engine_shutdown();
                             show_error("Failed to setup interface for configuration");
                             close_controller(handle);
                         } else {
@@ -468,11 +549,12 @@ int run_tui_config(libusb_context *lctx) {
                             session.controller = &controllers[selected_controller];
                             strcpy(session.config_name, controllers[selected_controller].name);
                             
-                            if (show_button_mapping_screen(&session, handle) == 0) {
+                            if (show_button_mapping_screen(&session) == 0) {
                                 show_save_config_dialog(&session);
                             }
                             
-                            release_interface_safe(handle);
+                            stop_input_reader();
+                            engine_shutdown();
                             close_controller(handle);
                         }
                     } else {
@@ -483,22 +565,16 @@ int run_tui_config(libusb_context *lctx) {
                 free_controllers(controllers, count);
                 break;
             }
-            case 1: { 
-                char configs[20][MAX_CONFIG_NAME];
-                int config_count = load_config_list(configs, 20);
-                
-                if (config_count == 0) {
-                    show_error("No saved configurations found");
-                    continue;
-                }
-                
-                int selected_config = show_config_menu("Select Configuration");
-                if (selected_config >= 0) {
-                    show_message("Configuration loading not implemented yet", 2000);
-                }
+            case 1:
+                load_existing_config(lctx);
                 break;
-            }
-            case 2: { 
+            case 2:
+                show_live_monitor(lctx);
+                break;
+            case 3:
+                show_calibration(lctx);
+                break;
+            case 4: { 
                 draw_header("About Faky Controller");
                 draw_footer("Press any key to return");
                 
@@ -516,11 +592,12 @@ int run_tui_config(libusb_context *lctx) {
                 mvprintw(start_y + 7, start_x + 2, "License: MIT");
                 
                 refresh();
-                getch();
+                tui_read_key();
                 break;
             }
-            case 3: 
+            case 5: 
             default:
+                store_close(&store);
                 return 0;
         }
     }
@@ -561,7 +638,7 @@ int show_controller_list(libusb_context *lctx __attribute__((unused)), Controlle
         
         refresh();
         
-        ch = getch();
+        ch = tui_read_key();
         switch (ch) {
             case KEY_UP:
                 selected = (selected - 1 + *count) % *count;
@@ -579,58 +656,177 @@ int show_controller_list(libusb_context *lctx __attribute__((unused)), Controlle
     }
 }
 
-int show_config_menu(const char *controller_name __attribute__((unused))) {
-    char configs[20][MAX_CONFIG_NAME];
-    int config_count = load_config_list(configs, 20);
+static int compare_entries(const void *a, const void *b) {
+    const StoreEntry *ea = &sort_store->entries[*(const int *)a];
+    const StoreEntry *eb = &sort_store->entries[*(const int *)b];
+    int ret = strcmp(ea->name, eb->name);
+    return ret ? ret : (int)(ea->vendor_id << 16 | ea->product_id) - (int)(eb->vendor_id << 16 | eb->product_id);
+}
+
+/*
+ * Lists every profile in the store index, sorted by name and scrolled to
+ * fit the terminal. Returns the selected entry index or -1.
+ */
+int show_config_menu(const ProfileStore *profiles) {
+    int config_count = profiles->count;
     
     if (config_count == 0) {
         show_error("No configurations found");
         return -1;
     }
     
+    int *order = malloc(config_count * sizeof(int));
+    if (!order) {
+        return -1;
+    }
+    for (int i = 0; i < config_count; i++) {
+        order[i] = i;
+    }
+    sort_store = profiles;
+    qsort(order, config_count, sizeof(int), compare_entries);
+    
     int selected = 0;
+    int top = 0;
+    int rows = MIN(config_count, screen_height - 8);
+    int result = -1;
     int ch;
     
     while (1) {
         draw_header("Select Configuration");
-        draw_footer("↑/↓: Navigate | Enter: Select | ESC: Back");
+        draw_footer("↑/↓/PgUp/PgDn: Navigate | Enter: Select | ESC: Back | * default");
         
-        int start_y = (screen_height - config_count) / 2 - 2;
-        int start_x = (screen_width - 50) / 2;
+        if (selected < top) top = selected;
+        if (selected >= top + rows) top = selected - rows + 1;
         
-        draw_box(start_y - 1, start_x - 2, config_count + 4, 54, "Saved Configurations");
+        int start_y = (screen_height - rows) / 2 - 1;
+        int start_x = (screen_width - 60) / 2;
+        char title[48];
+        snprintf(title, sizeof(title), "Saved Configurations (%d/%d)", selected + 1, config_count);
         
-        for (int i = 0; i < config_count; i++) {
-            if (i == selected) {
+        draw_box(start_y - 1, start_x - 2, rows + 2, 64, title);
+        
+        for (int i = 0; i < rows; i++) {
+            const StoreEntry *entry = &profiles->entries[order[top + i]];
+            char line[64];
+            snprintf(line, sizeof(line), "%-40.40s %04x:%04x %c", entry->name,
+                     entry->vendor_id, entry->product_id, entry->is_default ? '*' : ' ');
+            
+            if (top + i == selected) {
                 attron(COLOR_PAIR(COLOR_HIGHLIGHT));
-                mvprintw(start_y + i + 1, start_x, " > %-46s ", configs[i]);
+                mvprintw(start_y + i, start_x, " > %-56s ", line);
                 attroff(COLOR_PAIR(COLOR_HIGHLIGHT));
             } else {
-                mvprintw(start_y + i + 1, start_x, "   %-46s ", configs[i]);
+                mvprintw(start_y + i, start_x, "   %-56s ", line);
             }
         }
         
         refresh();
         
-        ch = getch();
-        switch (ch) {
-            case KEY_UP:
-                selected = (selected - 1 + config_count) % config_count;
-                break;
-            case KEY_DOWN:
-                selected = (selected + 1) % config_count;
+        ch = tui_read_key();
+        if (ch == KEY_UP) {
+            selected = (selected - 1 + config_count) % config_count;
+        } else if (ch == KEY_DOWN) {
+            selected = (selected + 1) % config_count;
+        } else if (ch == KEY_PPAGE) {
+            selected = MAX(selected - rows, 0);
+        } else if (ch == KEY_NPAGE) {
+            selected = MIN(selected + rows, config_count - 1);
+        } else if (ch == '\n' || ch == '\r' || ch == KEY_ENTER) {
+            result = order[selected];
+            break;
+        } else if (ch == 27) {
+            break;
+        }
+    }
+    
+    free(order);
+    return result;
+}
+
+/*
+ * Opens a stored profile for editing on a connected controller with the
+ * same VID:PID, saves it back in place (keeping its bindings) and makes it
+ * that controller's default.
+ */
+static int load_existing_config(libusb_context *lctx) {
+    static Profile profile;
+    ControllerInfo *controllers = NULL;
+    libusb_device_handle *handle = NULL;
+    char path[STORE_DIR_LEN + STORE_FILE_LEN];
+    char error[96];
+    int count = 0;
+    int match = -1;
+    
+    store_refresh(&store);
+    int index = show_config_menu(&store);
+    if (index < 0) {
+        return -1;
+    }
+    const StoreEntry *entry = &store.entries[index];
+    
+    store_path(&store, index, path, sizeof(path));
+    if (load_profile(&profile, path) != 0) {
+        show_error("Failed to load configuration");
+        return -1;
+    }
+    
+    if (find_all_controllers(lctx, &controllers, &count) == 0) {
+        for (int i = 0; i < count; i++) {
+            if (controllers[i].vendor_id == entry->vendor_id &&
+                controllers[i].product_id == entry->product_id) {
+                match = i;
                 break;
-            case '\n':
-            case '\r':
-            case KEY_ENTER:
-                return selected;
-            case 27: 
-                return -1;
+            }
+        }
+    }
+    if (match < 0) {
+        snprintf(error, sizeof(error), "Controller %04x:%04x is not connected",
+                 entry->vendor_id, entry->product_id);
+        show_error(error);
+        free(controllers);
+        return -1;
+    }
+    
+    if (open_controller(controllers[match].device, &handle) != 0) {
+        show_error("Failed to open controller");
+        free_controllers(controllers, count);
+        return -1;
+    }
+    if (engine_init(lctx) != 0 || start_input_reader(handle, NULL) != 0) {
+        engine_shutdown();
+        close_controller(handle);
+        show_error("Failed to setup interface for configuration");
+        free_controllers(controllers, count);
+        return -1;
+    }
+    
+    TUIConfigSession session = {0};
+    session.controller = &controllers[match];
+    session.config = profile.config;
+    snprintf(session.config_name, sizeof(session.config_name), "%s", entry->name);
+    
+    int ret = show_button_mapping_screen(&session);
+    
+    stop_input_reader();
+    engine_shutdown();
+    close_controller(handle);
+    
+    if (ret == 0) {
+        profile.config = session.config;
+        if (save_profile(&profile, path) == 0 && store_touch(&store, index) == 0 &&
+            store_set_default(&store, index) == 0) {
+            show_message("Configuration saved and set as default", 2000);
+        } else {
+            show_error("Failed to save configuration");
+            ret = -1;
         }
     }
+    
+    free_controllers(controllers, count);
+    return ret;
 }
 
-int show_button_mapping_screen(TUIConfigSession *session, libusb_device_handle *handle) {
+int show_button_mapping_screen(TUIConfigSession *session) {
     int current_button = 0;
     const char* button_names[] = {
         "A", "B", "X", "Y", 
@@ -648,9 +844,6 @@ int show_button_mapping_screen(TUIConfigSession *session, libusb_device_handle *
         draw_footer("Enter: Map | S: Skip | ESC: Cancel | N: Finish");
         
         
-        clear();
-        
-        
         int info_y = 2;
         attron(COLOR_PAIR(COLOR_TITLE));
         mvprintw(info_y, 2, "Controller: %s", session->controller->name);
@@ -740,14 +933,14 @@ int show_button_mapping_screen(TUIConfigSession *session, libusb_device_handle *
         
         refresh();
         
-        ch = getch();
+        ch = tui_read_key();
         switch (ch) {
             case '\n':
             case '\r':
             case KEY_ENTER: {
                 
                 if (byte_ptr && bit_ptr) {
-                    if (wait_for_button_press_tui(handle, button_names[current_button], 
+                    if (wait_for_button_press_tui(button_names[current_button], 
                                                 byte_ptr, bit_ptr) == 0) {
                         show_message("Button discovered successfully!", 1000);
                         current_button++;
@@ -775,6 +968,240 @@ int show_button_mapping_screen(TUIConfigSession *session, libusb_device_handle *
     return 0;
 }
 
+static void destroy_monitor_view(MonitorView *view) {
+    if (view->buttons) delwin(view->buttons);
+    if (view->sticks[0]) delwin(view->sticks[0]);
+    if (view->sticks[1]) delwin(view->sticks[1]);
+    if (view->triggers) delwin(view->triggers);
+    if (view->status) delwin(view->status);
+    memset(view, 0, sizeof(*view));
+}
+
+static int create_monitor_view(MonitorView *view) {
+    int rows = (XBOX_BUTTON_COUNT + MONITOR_BUTTONS_PER_ROW - 1) / MONITOR_BUTTONS_PER_ROW;
+    int width = MONITOR_BUTTONS_PER_ROW * MONITOR_BUTTON_WIDTH + 4;
+    int x = (screen_width - width) / 2;
+    int y = 2;
+
+    memset(view, 0, sizeof(*view));
+    if (screen_height < rows + STICK_BOX_HEIGHT + 12 || screen_width < width) {
+        return -1;
+    }
+
+    view->buttons = newwin(rows + 2, width, y, x);
+    y += rows + 2;
+    view->sticks[0] = newwin(STICK_BOX_HEIGHT, STICK_BOX_WIDTH, y, x);
+    view->sticks[1] = newwin(STICK_BOX_HEIGHT, STICK_BOX_WIDTH, y, x + width - STICK_BOX_WIDTH);
+    y += STICK_BOX_HEIGHT;
+    view->triggers = newwin(4, width, y, x);
+    view->status = newwin(1, width, y + 4, x);
+
+    if (!view->buttons || !view->sticks[0] || !view->sticks[1] ||
+        !view->triggers || !view->status) {
+        destroy_monitor_view(view);
+        return -1;
+    }
+
+    box(view->buttons, 0, 0);
+    mvwprintw(view->buttons, 0, 2, " Buttons ");
+    for (int i = 0; i < 2; i++) {
+        box(view->sticks[i], 0, 0);
+        mvwprintw(view->sticks[i], 0, 2, i == 0 ? " Left Stick " : " Right Stick ");
+        mvwaddch(view->sticks[i], STICK_BOX_HEIGHT / 2, STICK_BOX_WIDTH / 2, '+');
+        view->dot_y[i] = STICK_BOX_HEIGHT / 2;
+        view->dot_x[i] = STICK_BOX_WIDTH / 2;
+    }
+    box(view->triggers, 0, 0);
+    mvwprintw(view->triggers, 0, 2, " Triggers ");
+    mvwprintw(view->triggers, 1, 2, "LT");
+    mvwprintw(view->triggers, 2, 2, "RT");
+    return 0;
+}
+
+static void draw_monitor_button(MonitorView *view, int button, int pressed) {
+    int y = 1 + button / MONITOR_BUTTONS_PER_ROW;
+    int x = 2 + (button % MONITOR_BUTTONS_PER_ROW) * MONITOR_BUTTON_WIDTH;
+
+    if (pressed) wattron(view->buttons, COLOR_PAIR(COLOR_SUCCESS));
+    mvwprintw(view->buttons, y, x, " %-*s", MONITOR_BUTTON_WIDTH - 2,
+              button_id_to_string(button));
+    if (pressed) wattroff(view->buttons, COLOR_PAIR(COLOR_SUCCESS));
+}
+
+/* Moves the stick marker, restoring only the cell it left */
+static void draw_monitor_stick(MonitorView *view, int stick, int16_t sx, int16_t sy) {
+    WINDOW *win = view->sticks[stick];
+    long half_w = (STICK_BOX_WIDTH - 3) / 2;
+    long half_h = (STICK_BOX_HEIGHT - 3) / 2;
+    int x = STICK_BOX_WIDTH / 2 + (int)((sx * half_w + (sx < 0 ? -16384 : 16384)) / 32768);
+    int y = STICK_BOX_HEIGHT / 2 - (int)((sy * half_h + (sy < 0 ? -16384 : 16384)) / 32768);
+
+    if (y != view->dot_y[stick] || x != view->dot_x[stick]) {
+        int centre = view->dot_y[stick] == STICK_BOX_HEIGHT / 2 &&
+                     view->dot_x[stick] == STICK_BOX_WIDTH / 2;
+        mvwaddch(win, view->dot_y[stick], view->dot_x[stick], centre ? '+' : ' ');
+        view->dot_y[stick] = y;
+        view->dot_x[stick] = x;
+    }
+    mvwaddch(win, y, x, '@' | A_BOLD);
+    mvwprintw(win, STICK_BOX_HEIGHT - 1, 2, " %6d,%6d ", sx, sy);
+}
+
+static void draw_monitor_trigger(MonitorView *view, int trigger, uint8_t value) {
+    int filled = value * TRIGGER_BAR_WIDTH / 255;
+
+    wmove(view->triggers, 1 + trigger, 5);
+    wattron(view->triggers, COLOR_PAIR(COLOR_HIGHLIGHT));
+    for (int i = 0; i < filled; i++) waddch(view->triggers, ' ');
+    wattroff(view->triggers, COLOR_PAIR(COLOR_HIGHLIGHT));
+    for (int i = filled; i < TRIGGER_BAR_WIDTH; i++) waddch(view->triggers, '.');
+    wprintw(view->triggers, " %3d", value);
+}
+
+/*
+ * Compares against what is on screen and redraws only the parts that
+ * changed, then queues the touched windows for a single doupdate().
+ */
+static void update_monitor_view(MonitorView *view, const ControllerState *shown,
+                                const ControllerState *state, int force) {
+    int touched_buttons = 0, touched_triggers = 0;
+
+    for (int i = 0; i < XBOX_BUTTON_COUNT; i++) {
+        int pressed = (state->button_mask >> i) & 1;
+        if (force || pressed != (int)((shown->button_mask >> i) & 1)) {
+            draw_monitor_button(view, i, pressed);
+            touched_buttons = 1;
+        }
+    }
+    if (touched_buttons) wnoutrefresh(view->buttons);
+
+    if (force || state->left_thumb_x != shown->left_thumb_x ||
+        state->left_thumb_y != shown->left_thumb_y) {
+        draw_monitor_stick(view, 0, state->left_thumb_x, state->left_thumb_y);
+        wnoutrefresh(view->sticks[0]);
+    }
+    if (force || state->right_thumb_x != shown->right_thumb_x ||
+        state->right_thumb_y != shown->right_thumb_y) {
+        draw_monitor_stick(view, 1, state->right_thumb_x, state->right_thumb_y);
+        wnoutrefresh(view->sticks[1]);
+    }
+
+    if (force || state->left_trigger != shown->left_trigger) {
+        draw_monitor_trigger(view, 0, state->left_trigger);
+        touched_triggers = 1;
+    }
+    if (force || state->right_trigger != shown->right_trigger) {
+        draw_monitor_trigger(view, 1, state->right_trigger);
+        touched_triggers = 1;
+    }
+    if (touched_triggers) wnoutrefresh(view->triggers);
+}
+
+/*
+ * Redraws when the engine reports new state, at most MONITOR_FPS times a
+ * second; an idle pad costs no wakeups at all.
+ */
+static void run_monitor_loop(MonitorView *view, const char *name) {
+    const uint64_t frame_ns = NSEC_PER_SEC / MONITOR_FPS;
+    ControllerState shown, latest;
+    uint32_t shown_seq = 0, seq;
+    uint32_t frames = 0;
+    uint64_t next_frame = 0;
+    int first = 1;
+    int dirty = 1;
+
+    memset(&shown, 0, sizeof(shown));
+    wnoutrefresh(view->buttons);
+    wnoutrefresh(view->sticks[0]);
+    wnoutrefresh(view->sticks[1]);
+    wnoutrefresh(view->triggers);
+
+    while (1) {
+        uint64_t now = now_ns();
+
+        if (dirty && now >= next_frame) {
+            /* A torn read leaves dirty set and is retried next frame */
+            if (engine_snapshot(0, &latest, &seq) == 0) {
+                dirty = 0;
+                if (first || seq != shown_seq) {
+                    update_monitor_view(view, &shown, &latest, first);
+                    shown = latest;
+                    shown_seq = seq;
+                    frames++;
+                    first = 0;
+                    werase(view->status);
+                    mvwprintw(view->status, 0, 0, "%.40s | %u redraws @ %d fps max",
+                              name, frames, MONITOR_FPS);
+                    wnoutrefresh(view->status);
+                }
+            }
+            doupdate();
+            next_frame = now + frame_ns;
+        }
+
+        int ev = tui_wait_event(dirty ? next_frame : 0, 1);
+        if (ev == TUI_EVENT_INPUT) {
+            dirty = 1;
+        } else if (ev == 27 || ev == 'q' || ev == 'Q') {
+            break;
+        }
+    }
+}
+
+/*
+ * Live view of one controller. The engine decodes input on its own thread
+ * and this screen only reads its published snapshots, so a slow terminal
+ * never holds up the input path.
+ */
+int show_live_monitor(libusb_context *lctx) {
+    ControllerInfo *controllers = NULL;
+    libusb_device_handle *handle = NULL;
+    MonitorView view;
+    int count = 0;
+
+    if (find_all_controllers(lctx, &controllers, &count) != 0 || count == 0) {
+        show_error("No controllers found. Please connect a controller.");
+        free(controllers);
+        return -1;
+    }
+
+    int selected = show_controller_list(lctx, &controllers, &count);
+    if (selected < 0) {
+        free_controllers(controllers, count);
+        return -1;
+    }
+
+    if (open_controller(controllers[selected].device, &handle) != 0) {
+        show_error("Failed to open controller");
+        free_controllers(controllers, count);
+        return -1;
+    }
+
+    if (engine_init(lctx) != 0 || start_input_reader(handle, NULL) != 0) {
+        engine_shutdown();
+        close_controller(handle);
+        show_error("Failed to start input engine");
+        free_controllers(controllers, count);
+        return -1;
+    }
+
+    draw_header("Live Input Monitor");
+    draw_footer("Q/ESC: Back");
+
+    if (create_monitor_view(&view) != 0) {
+        show_error("Terminal too small for the monitor");
+    } else {
+        run_monitor_loop(&view, controllers[selected].name);
+        destroy_monitor_view(&view);
+    }
+
+    stop_input_reader();
+    engine_shutdown();
+    close_controller(handle);
+    free_controllers(controllers, count);
+    return 0;
+}
+
 int show_save_config_dialog(TUIConfigSession *session) {
     char config_name[MAX_CONFIG_NAME];
     strcpy(config_name, session->config_name);
@@ -795,8 +1222,12 @@ int show_save_config_dialog(TUIConfigSession *session) {
 }
 
 int save_tui_config(const TUIConfigSession *session) {
-    char filename[256];
-    snprintf(filename, sizeof(filename), "%s.cfg", session->config_name);
+    char filename[STORE_DIR_LEN + STORE_FILE_LEN];
+    int index = store_add(&store, session->controller->vendor_id,
+                          session->controller->product_id, session->config_name);
+    if (index < 0 || store_path(&store, index, filename, sizeof(filename)) != 0) {
+        return -1;
+    }
     
     FILE *file = fopen(filename, "w");
     if (!file) {
@@ -867,26 +1298,201 @@ int save_tui_config(const TUIConfigSession *session) {
         fprintf(file, "dpad_right_bit=%d\n", session->config.dpad_right_bit);
     }
     fclose(file);
+    return store_touch(&store, index);
+}
+
+#define CAL_REST_SAMPLE_MS 1000
+#define CAL_MIN_STICK_SPAN 8192
+#define CAL_MIN_TRIGGER_SPAN 64
+
+static void state_axes(const ControllerState *state, int32_t *values) {
+    values[CAL_LEFT_X] = state->left_thumb_x;
+    values[CAL_LEFT_Y] = state->left_thumb_y;
+    values[CAL_RIGHT_X] = state->right_thumb_x;
+    values[CAL_RIGHT_Y] = state->right_thumb_y;
+    values[CAL_LEFT_TRIGGER] = state->left_trigger;
+    values[CAL_RIGHT_TRIGGER] = state->right_trigger;
+}
+
+/* Averages the published state while the pad is left alone */
+static int sample_rest(Calibration *cal) {
+    uint64_t deadline = now_ns() + (uint64_t)CAL_REST_SAMPLE_MS * NSEC_PER_MSEC;
+    int64_t sums[CAL_AXES] = {0};
+    int32_t values[CAL_AXES];
+    ControllerState state;
+    uint32_t seq;
+    int samples = 0;
+
+    /* A wired 360 pad only reports changes, so start from what it last sent */
+    memset(&state, 0, sizeof(state));
+    while (1) {
+        ControllerState latest;
+
+        if (samples == 0 && engine_snapshot(0, &latest, &seq) == 0) {
+            state = latest;
+        }
+        state_axes(&state, values);
+        for (int axis = 0; axis < CAL_AXES; axis++) {
+            sums[axis] += values[axis];
+        }
+        samples++;
+
+        int ev = tui_wait_event(deadline, 1);
+        if (ev == 27) {
+            return -1;
+        }
+        if (ev == TUI_EVENT_TIMEOUT) {
+            break;
+        }
+        if (ev == TUI_EVENT_INPUT && engine_snapshot(0, &latest, &seq) == 0) {
+            state = latest;
+        }
+    }
+
+    for (int axis = 0; axis < CAL_AXES; axis++) {
+        int32_t rest = (int32_t)(sums[axis] / samples);
+        cal->axes[axis].min = rest;
+        cal->axes[axis].center = axis < CAL_STICK_AXES ? rest : 0;
+        cal->axes[axis].max = rest;
+    }
     return 0;
 }
 
-int load_config_list(char configs[][MAX_CONFIG_NAME], int max_configs) {
-    DIR *dir = opendir(".");
-    if (!dir) return 0;
-    
-    struct dirent *entry;
+static int range_ok(const Calibration *cal) {
+    for (int axis = 0; axis < CAL_STICK_AXES; axis++) {
+        const AxisRange *range = &cal->axes[axis];
+        if (range->max - range->center < CAL_MIN_STICK_SPAN ||
+            range->center - range->min < CAL_MIN_STICK_SPAN) {
+            return 0;
+        }
+    }
+    for (int axis = CAL_STICK_AXES; axis < CAL_AXES; axis++) {
+        if (cal->axes[axis].max - cal->axes[axis].min < CAL_MIN_TRIGGER_SPAN) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void draw_calibration(const Calibration *cal, int start_y, int start_x) {
+    for (int axis = 0; axis < CAL_AXES; axis++) {
+        const AxisRange *range = &cal->axes[axis];
+        if (axis < CAL_STICK_AXES) {
+            mvprintw(start_y + axis, start_x, "%-14s min %6d  centre %6d  max %6d",
+                     get_axis_name(axis), range->min, range->center, range->max);
+        } else {
+            mvprintw(start_y + axis, start_x, "%-14s min %6d                 max %6d",
+                     get_axis_name(axis), range->min, range->max);
+        }
+    }
+    refresh();
+}
+
+/* Widens the ranges with everything published until Enter or ESC */
+static int sample_range(Calibration *cal, int start_y, int start_x) {
+    int32_t values[CAL_AXES];
+    ControllerState state;
+    uint32_t seq;
+
+    draw_calibration(cal, start_y, start_x);
+    while (1) {
+        int ev = tui_wait_event(0, 1);
+        if (ev == 27 || ev == 'q' || ev == 'Q') {
+            return -1;
+        }
+        if (ev == '\n' || ev == '\r' || ev == KEY_ENTER) {
+            if (range_ok(cal)) {
+                return 0;
+            }
+            mvprintw(start_y + CAL_AXES + 1, start_x,
+                     "Not the full range yet, keep moving the sticks");
+            refresh();
+            continue;
+        }
+        if (ev != TUI_EVENT_INPUT || engine_snapshot(0, &state, &seq) != 0) {
+            continue;
+        }
+        state_axes(&state, values);
+        for (int axis = 0; axis < CAL_AXES; axis++) {
+            cal->axes[axis].min = MIN(cal->axes[axis].min, values[axis]);
+            cal->axes[axis].max = MAX(cal->axes[axis].max, values[axis]);
+        }
+        draw_calibration(cal, start_y, start_x);
+    }
+}
+
+/*
+ * Centres from the pad at rest, ranges from sweeping the sticks and
+ * triggers, saved to the store for this pad. The engine runs uncalibrated
+ * meanwhile so the raw values are what gets measured.
+ */
+int show_calibration(libusb_context *lctx) {
+    ControllerInfo *controllers = NULL;
+    libusb_device_handle *handle = NULL;
+    Calibration cal;
+    char serial[64];
+    char path[STORE_DIR_LEN + STORE_FILE_LEN];
     int count = 0;
-    
-    while ((entry = readdir(dir)) != NULL && count < max_configs) {
-        char *ext = strrchr(entry->d_name, '.');
-        if (ext && strcmp(ext, ".cfg") == 0) {
-            *ext = '\0';
-            strncpy(configs[count], entry->d_name, MAX_CONFIG_NAME - 1);
-            configs[count][MAX_CONFIG_NAME - 1] = '\0';
-            count++;
+    int ret = -1;
+
+    if (find_all_controllers(lctx, &controllers, &count) != 0 || count == 0) {
+        show_error("No controllers found. Please connect a controller.");
+        free(controllers);
+        return -1;
+    }
+
+    int selected = show_controller_list(lctx, &controllers, &count);
+    if (selected < 0) {
+        free_controllers(controllers, count);
+        return -1;
+    }
+
+    if (open_controller(controllers[selected].device, &handle) != 0) {
+        show_error("Failed to open controller");
+        free_controllers(controllers, count);
+        return -1;
+    }
+
+    engine_set_calibration(NULL);
+    if (engine_init(lctx) != 0 || start_input_reader(handle, NULL) != 0) {
+        engine_shutdown();
+        close_controller(handle);
+        show_error("Failed to start input engine");
+        free_controllers(controllers, count);
+        return -1;
+    }
+
+    int start_y = (screen_height - CAL_AXES) / 2 - 2;
+    int start_x = (screen_width - 60) / 2;
+
+    draw_header("Stick Calibration");
+    draw_footer("ESC: Cancel");
+    draw_box(start_y - 2, start_x - 2, CAL_AXES + 6, 64, "Step 1 of 2");
+    mvprintw(start_y, start_x, "Let go of both sticks and triggers...");
+    refresh();
+
+    if (sample_rest(&cal) == 0) {
+        draw_header("Stick Calibration");
+        draw_footer("Enter: Save | ESC: Cancel");
+        draw_box(start_y - 3, start_x - 2, CAL_AXES + 7, 64, "Step 2 of 2");
+        mvprintw(start_y - 1, start_x,
+                 "Circle both sticks and press both triggers all the way");
+        if (sample_range(&cal, start_y + 1, start_x) == 0) {
+            get_controller_serial(handle, serial, sizeof(serial));
+            store_calibration_path(&store, controllers[selected].vendor_id,
+                                   controllers[selected].product_id, serial,
+                                   path, sizeof(path));
+            ret = calibration_save(&cal, path);
         }
     }
-    
-    closedir(dir);
-    return count;
+
+    stop_input_reader();
+    engine_shutdown();
+    close_controller(handle);
+    free_controllers(controllers, count);
+
+    if (ret == 0) {
+        show_message("Calibration saved", 1500);
+    }
+    return ret;
 }
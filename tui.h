@@ -3,6 +3,7 @@
 
 #include <ncurses.h>
 #include "controller.h"
+#include "store.h"
 
 #define MAX_MENU_ITEMS 20
 #define MAX_CONFIG_NAME 64
@@ -37,9 +38,11 @@ int run_tui_config(libusb_context *lctx);
 
 int show_main_menu(void);
 int show_controller_list(libusb_context *lctx, ControllerInfo **controllers, int *count);
-int show_config_menu(const char *controller_name);
-int show_button_mapping_screen(TUIConfigSession *session, libusb_device_handle *handle);
+int show_config_menu(const ProfileStore *profiles);
+int show_button_mapping_screen(TUIConfigSession *session);
 int show_save_config_dialog(TUIConfigSession *session);
+int show_live_monitor(libusb_context *lctx);
+int show_calibration(libusb_context *lctx);
 
 void draw_header(const char *title);
 void draw_footer(const char *help_text);
@@ -49,10 +52,9 @@ void show_error(const char *error);
 int get_string_input(const char *prompt, char *buffer, int max_len);
 
 int wait_for_key_press(char *key_name, int *keycode);
-int wait_for_controller_input(libusb_device_handle *handle, ControllerState *state);
+int wait_for_controller_input(ControllerState *state);
 
 int save_tui_config(const TUIConfigSession *session);
-int load_config_list(char configs[][MAX_CONFIG_NAME], int max_configs);
 
 const char* get_button_name(int button_index);
 const char* get_axis_name(int axis_index);
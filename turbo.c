@@ -0,0 +1,87 @@
+#include "turbo.h"
+#include "utils.h"
+#include <stdio.h>
+
+static TurboStream streams[MAX_TURBO_STREAMS];
+static TurboStream *free_streams = NULL;
+static int pool_ready = 0;
+static int active_streams = 0;
+
+static void init_pool(void) {
+  free_streams = NULL;
+  for (int i = MAX_TURBO_STREAMS - 1; i >= 0; i--) {
+    streams[i].next_free = free_streams;
+    free_streams = &streams[i];
+  }
+  pool_ready = 1;
+}
+
+static void on_turbo_tick(Timer *timer, uint64_t now) {
+  TurboStream *stream = timer->data;
+  uint64_t deadline = timer->deadline_ns + stream->half_period_ns;
+
+  stream->down = !stream->down;
+  emit_key(stream->out, stream->key, stream->down);
+
+  /* After a stall skip whole periods instead of bursting to catch up */
+  while (deadline <= now) {
+    deadline += 2 * stream->half_period_ns;
+  }
+  timer_schedule_at(stream->wheel, &stream->timer, deadline);
+}
+
+TurboStream *turbo_start(OutputDevice *out, TimerWheel *wheel, uint16_t key,
+                         uint16_t rate_hz) {
+  if (!pool_ready) {
+    init_pool();
+  }
+  if (!free_streams) {
+    fprintf(stderr, "Turbo stream pool exhausted\n");
+    return NULL;
+  }
+
+  rate_hz = MAX(1, MIN(rate_hz, MAX_TURBO_RATE_HZ));
+
+  TurboStream *stream = free_streams;
+  free_streams = stream->next_free;
+  active_streams++;
+
+  stream->out = out;
+  stream->wheel = wheel;
+  stream->key = key;
+  stream->half_period_ns = NSEC_PER_SEC / (2ULL * rate_hz);
+  stream->down = 1;
+  stream->in_use = 1;
+  timer_init(&stream->timer, on_turbo_tick, stream);
+
+  emit_key(out, key, 1);
+  timer_schedule(wheel, &stream->timer, stream->half_period_ns);
+  return stream;
+}
+
+void turbo_stop(TurboStream *stream) {
+  if (!stream || !stream->in_use) {
+    return;
+  }
+
+  timer_cancel(stream->wheel, &stream->timer);
+  if (stream->down) {
+    emit_key(stream->out, stream->key, 0);
+  }
+
+  stream->in_use = 0;
+  stream->next_free = free_streams;
+  free_streams = stream;
+  active_streams--;
+}
+
+void turbo_stop_all(void) {
+  if (!pool_ready) {
+    return;
+  }
+  for (int i = 0; i < MAX_TURBO_STREAMS; i++) {
+    turbo_stop(&streams[i]);
+  }
+}
+
+int turbo_active_count(void) { return active_streams; }
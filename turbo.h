@@ -0,0 +1,35 @@
+#ifndef TURBO_H
+#define TURBO_H
+
+#include "input.h"
+#include "timer.h"
+#include <stdint.h>
+
+#define MAX_TURBO_STREAMS 256
+#define MAX_TURBO_RATE_HZ 500
+
+/*
+ * A turbo stream toggles one key at a fixed rate. Every stream, whatever pad
+ * it belongs to, is a Timer on the engine's wheel scheduled on absolute
+ * deadlines, so rates don't drift and no stream needs its own thread.
+ * Events are written without a SYN_REPORT; the engine flushes the output
+ * once per loop iteration so streams due on the same tick share a report.
+ */
+typedef struct TurboStream {
+  Timer timer;
+  OutputDevice *out;
+  TimerWheel *wheel;
+  uint64_t half_period_ns;
+  uint16_t key;
+  uint8_t down;
+  uint8_t in_use;
+  struct TurboStream *next_free;
+} TurboStream;
+
+TurboStream *turbo_start(OutputDevice *out, TimerWheel *wheel, uint16_t key,
+                         uint16_t rate_hz);
+void turbo_stop(TurboStream *stream);
+void turbo_stop_all(void);
+int turbo_active_count(void);
+
+#endif /* TURBO_H */
@@ -0,0 +1,406 @@
+#define _GNU_SOURCE
+#include "uhid.h"
+#include "evdev.h"
+#include "hidraw.h"
+#include "stats.h"
+#include "utils.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/input.h>
+#include <linux/uhid.h>
+#include <linux/uinput.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+/*
+ * The wired Xbox 360 input report as a HID gamepad: u8 type, u8 length,
+ * 16 button bits (d-pad, start, back, L3, R3, LB, RB, guide, -, A, B, X,
+ * Y), u8 triggers, le16 sticks, 6 bytes padding. The pad itself is not HID
+ * class, so the descriptor is written to describe the captured reports
+ * byte for byte; hidraw then hands the engine exactly what the USB path
+ * sees, and hid-generic gives the evdev backend a regular gamepad.
+ */
+static const uint8_t xbox360_descriptor[] = {
+    0x05, 0x01,       /* Usage Page (Generic Desktop) */
+    0x09, 0x05,       /* Usage (Game Pad) */
+    0xa1, 0x01,       /* Collection (Application) */
+    0x75, 0x08,       /*   Report Size (8) */
+    0x95, 0x02,       /*   Report Count (2) */
+    0x81, 0x01,       /*   Input (Constant): type, length */
+    0x05, 0x09,       /*   Usage Page (Button) */
+    0x19, 0x01,       /*   Usage Minimum (1) */
+    0x29, 0x10,       /*   Usage Maximum (16) */
+    0x15, 0x00,       /*   Logical Minimum (0) */
+    0x25, 0x01,       /*   Logical Maximum (1) */
+    0x75, 0x01,       /*   Report Size (1) */
+    0x95, 0x10,       /*   Report Count (16) */
+    0x81, 0x02,       /*   Input (Data, Variable, Absolute) */
+    0x05, 0x01,       /*   Usage Page (Generic Desktop) */
+    0x09, 0x32,       /*   Usage (Z) */
+    0x09, 0x35,       /*   Usage (Rz) */
+    0x15, 0x00,       /*   Logical Minimum (0) */
+    0x26, 0xff, 0x00, /*   Logical Maximum (255) */
+    0x75, 0x08,       /*   Report Size (8) */
+    0x95, 0x02,       /*   Report Count (2) */
+    0x81, 0x02,       /*   Input (Data, Variable, Absolute) */
+    0x09, 0x30,       /*   Usage (X) */
+    0x09, 0x31,       /*   Usage (Y) */
+    0x09, 0x33,       /*   Usage (Rx) */
+    0x09, 0x34,       /*   Usage (Ry) */
+    0x16, 0x00, 0x80, /*   Logical Minimum (-32768) */
+    0x26, 0xff, 0x7f, /*   Logical Maximum (32767) */
+    0x75, 0x10,       /*   Report Size (16) */
+    0x95, 0x04,       /*   Report Count (4) */
+    0x81, 0x02,       /*   Input (Data, Variable, Absolute) */
+    0x75, 0x08,       /*   Report Size (8) */
+    0x95, 0x06,       /*   Report Count (6) */
+    0x81, 0x01,       /*   Input (Constant): padding */
+    0xc0,             /* End Collection */
+};
+
+int uhid_pad_create(UhidPad *pad, const char *name, uint16_t vendor_id,
+                    uint16_t product_id) {
+  struct uhid_event ev;
+
+  pad->fd = open("/dev/uhid", O_RDWR | O_NONBLOCK | O_CLOEXEC);
+  if (pad->fd < 0) {
+    fprintf(stderr, "Failed to open /dev/uhid: %s\n", strerror(errno));
+    return -1;
+  }
+
+  memset(&ev, 0, sizeof(ev));
+  ev.type = UHID_CREATE2;
+  snprintf((char *)ev.u.create2.name, sizeof(ev.u.create2.name), "%s", name);
+  snprintf((char *)ev.u.create2.phys, sizeof(ev.u.create2.phys),
+           "faky-uhid/%d", (int)getpid());
+  ev.u.create2.rd_size = sizeof(xbox360_descriptor);
+  ev.u.create2.bus = BUS_VIRTUAL;
+  ev.u.create2.vendor = vendor_id;
+  ev.u.create2.product = product_id;
+  memcpy(ev.u.create2.rd_data, xbox360_descriptor,
+         sizeof(xbox360_descriptor));
+  if (write(pad->fd, &ev, sizeof(ev)) != (ssize_t)sizeof(ev)) {
+    fprintf(stderr, "Failed to create uhid device: %s\n", strerror(errno));
+    close(pad->fd);
+    pad->fd = -1;
+    return -1;
+  }
+  pad->vendor_id = vendor_id;
+  pad->product_id = product_id;
+  return 0;
+}
+
+int uhid_pad_send(UhidPad *pad, const uint8_t *report, size_t length) {
+  struct uhid_event ev;
+  size_t size = offsetof(struct uhid_event, u.input2.data) + length;
+
+  if (length > UHID_DATA_MAX) {
+    return -1;
+  }
+  ev.type = UHID_INPUT2;
+  ev.u.input2.size = (uint16_t)length;
+  memcpy(ev.u.input2.data, report, length);
+  return write(pad->fd, &ev, size) == (ssize_t)size ? 0 : -1;
+}
+
+/* Start/open/close notices from the kernel; nothing to answer for these */
+void uhid_pad_drain(UhidPad *pad) {
+  static struct uhid_event ev;
+
+  while (read(pad->fd, &ev, sizeof(ev)) > 0) {
+  }
+}
+
+void uhid_pad_destroy(UhidPad *pad) {
+  struct uhid_event ev;
+
+  if (pad->fd < 0) {
+    return;
+  }
+  memset(&ev, 0, sizeof(ev));
+  ev.type = UHID_DESTROY;
+  if (write(pad->fd, &ev, sizeof(ev)) < 0) {
+    perror("Failed to destroy uhid device");
+  }
+  close(pad->fd);
+  pad->fd = -1;
+}
+
+#define BENCH_KEY KEY_F24
+#define BENCH_LATENCY_HZ 250
+#define BENCH_WINDOW 16
+#define BENCH_TIMEOUT_MS 100
+#define BENCH_WAIT_MS 2000
+#define BENCH_MAX_SECONDS 60
+
+typedef struct {
+  UhidPad pad;
+  int output_fd;
+  int pressed; /* state the last sent report asked for */
+  uint32_t sent;
+  uint64_t echoed;
+  uint64_t lost;
+} BenchRig;
+
+/* A pressed (byte 3 bit 4), sticks circling so every report decodes */
+static void bench_report(uint8_t *report, uint32_t n, int pressed) {
+  int16_t x = (int16_t)((int32_t)(n % 512) * 128 - 32768);
+
+  memset(report, 0, UHID_REPORT_SIZE);
+  report[1] = UHID_REPORT_SIZE;
+  report[3] = pressed ? 0x10 : 0x00;
+  report[6] = (uint8_t)(x & 0xff);
+  report[7] = (uint8_t)((uint16_t)x >> 8);
+}
+
+static int bench_send(BenchRig *rig) {
+  uint8_t report[UHID_REPORT_SIZE];
+
+  rig->pressed = !rig->pressed;
+  bench_report(report, rig->sent++, rig->pressed);
+  return uhid_pad_send(&rig->pad, report, sizeof(report));
+}
+
+/* The pad's node once the kernel has bound it, or -1 after BENCH_WAIT_MS */
+static int open_pad_node(int use_evdev, EvdevPad *evdev, uint16_t *vendor_id,
+                         uint16_t *product_id) {
+  for (int waited = 0; waited < BENCH_WAIT_MS; waited += 20) {
+    if (use_evdev) {
+      EvdevInfo found[EVDEV_MAX_DEVICES];
+      int count = evdev_find_controllers(found, EVDEV_MAX_DEVICES);
+      for (int i = 0; i < count; i++) {
+        if (strncmp(found[i].name, UHID_PAD_NAME, strlen(UHID_PAD_NAME)) ==
+            0) {
+          *vendor_id = found[i].vendor_id;
+          *product_id = found[i].product_id;
+          return evdev_open(found[i].path, 1, evdev);
+        }
+      }
+    } else {
+      HidrawInfo found[HIDRAW_MAX_DEVICES];
+      int count = hidraw_find_controllers(found, HIDRAW_MAX_DEVICES);
+      for (int i = 0; i < count; i++) {
+        if (strcmp(found[i].name, UHID_PAD_NAME) == 0) {
+          *vendor_id = found[i].vendor_id;
+          *product_id = found[i].product_id;
+          return hidraw_open(found[i].path);
+        }
+      }
+    }
+    SLEEP_MS(20);
+  }
+  fprintf(stderr, "The uhid pad's %s node did not show up\n",
+          use_evdev ? "evdev" : "hidraw");
+  return -1;
+}
+
+/*
+ * The engine's uinput device, grabbed so the benchmark's key presses stay
+ * out of the desktop, with event times on CLOCK_MONOTONIC like now_ns().
+ */
+static int open_output_node(void) {
+  char sysname[32];
+  char path[96];
+  struct dirent *entry;
+  int clock = CLOCK_MONOTONIC;
+
+  if (ioctl(engine_output()->fd, UI_GET_SYSNAME(sizeof(sysname)), sysname) <
+      0) {
+    fprintf(stderr, "Failed to get the uinput device name: %s\n",
+            strerror(errno));
+    return -1;
+  }
+  snprintf(path, sizeof(path), "/sys/devices/virtual/input/%s", sysname);
+
+  for (int waited = 0; waited < BENCH_WAIT_MS; waited += 20) {
+    DIR *dir = opendir(path);
+    while (dir && (entry = readdir(dir))) {
+      if (strncmp(entry->d_name, "event", 5) != 0) {
+        continue;
+      }
+      char node[64];
+      snprintf(node, sizeof(node), "/dev/input/%.20s", entry->d_name);
+      int fd = open(node, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+      if (fd < 0) {
+        break;
+      }
+      closedir(dir);
+      ioctl(fd, EVIOCGRAB, 1);
+      ioctl(fd, EVIOCSCLOCKID, &clock);
+      return fd;
+    }
+    if (dir) {
+      closedir(dir);
+    }
+    SLEEP_MS(20);
+  }
+  fprintf(stderr, "The output device's event node did not show up\n");
+  return -1;
+}
+
+/*
+ * Reads output events, waiting up to timeout_ms for the first one. Each
+ * BENCH_KEY edge acknowledges one report; its kernel timestamp is written
+ * to *at. Returns the number of edges seen.
+ */
+static int read_edges(BenchRig *rig, int timeout_ms, uint64_t *at) {
+  struct input_event events[64];
+  struct pollfd pfd = {rig->output_fd, POLLIN, 0};
+  int edges = 0;
+
+  if (poll(&pfd, 1, timeout_ms) <= 0) {
+    return 0;
+  }
+  for (;;) {
+    ssize_t n = read(rig->output_fd, events, sizeof(events));
+    if (n <= 0) {
+      break;
+    }
+    for (size_t i = 0; i < (size_t)n / sizeof(events[0]); i++) {
+      if (events[i].type == EV_KEY && events[i].code == BENCH_KEY &&
+          events[i].value != 2) {
+        *at = (uint64_t)events[i].time.tv_sec * NSEC_PER_SEC +
+              (uint64_t)events[i].time.tv_usec * NSEC_PER_USEC;
+        edges++;
+      }
+    }
+  }
+  return edges;
+}
+
+/* One report at a time at BENCH_LATENCY_HZ, report write to output event */
+static void bench_latency(BenchRig *rig, int seconds, LatencyHistogram *hist) {
+  struct timespec next;
+  uint64_t at = 0;
+
+  latency_reset(hist);
+  clock_gettime(CLOCK_MONOTONIC, &next);
+  for (int i = 0; i < seconds * BENCH_LATENCY_HZ; i++) {
+    uint64_t sent = now_ns();
+    if (bench_send(rig) != 0) {
+      rig->lost++;
+      continue;
+    }
+    if (read_edges(rig, BENCH_TIMEOUT_MS, &at) > 0 && at >= sent) {
+      latency_record(hist, at - sent);
+      rig->echoed++;
+    } else {
+      rig->lost++;
+    }
+    uhid_pad_drain(&rig->pad);
+
+    next.tv_nsec += NSEC_PER_SEC / BENCH_LATENCY_HZ;
+    if (next.tv_nsec >= (long)NSEC_PER_SEC) {
+      next.tv_nsec -= NSEC_PER_SEC;
+      next.tv_sec++;
+    }
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+  }
+}
+
+/*
+ * As fast as the pipeline keeps up, with at most BENCH_WINDOW reports in
+ * flight so the hidraw/evdev queues never overflow. Returns reports/s.
+ */
+static double bench_throughput(BenchRig *rig, int seconds) {
+  uint64_t at;
+  uint64_t start = now_ns();
+  uint64_t end = start + (uint64_t)seconds * NSEC_PER_SEC;
+  uint64_t sent = 0;
+  uint64_t echoed = 0;
+
+  while (now_ns() < end) {
+    while (sent - echoed < BENCH_WINDOW) {
+      if (bench_send(rig) != 0) {
+        break;
+      }
+      sent++;
+    }
+    int edges = read_edges(rig, BENCH_TIMEOUT_MS, &at);
+    if (edges == 0) {
+      /* Stalled: count what is in flight as lost and start over */
+      rig->lost += sent - echoed;
+      echoed = sent;
+      continue;
+    }
+    echoed += (uint64_t)edges;
+    uhid_pad_drain(&rig->pad);
+  }
+  rig->echoed += echoed;
+  return (double)echoed * NSEC_PER_SEC / (double)(now_ns() - start);
+}
+
+/*
+ * Drives the whole input -> engine -> uinput path with a uhid pad whose
+ * buttons all map to BENCH_KEY: first paced single reports for latency,
+ * then a windowed flood for throughput.
+ */
+int run_uhid_benchmark(libusb_context *lctx, int use_evdev, int seconds) {
+  static Profile profile;
+  static EvdevPad evdev;
+  static BenchRig rig;
+  LatencyHistogram hist;
+  uint16_t vendor_id = 0;
+  uint16_t product_id = 0;
+  int ret = -1;
+
+  if (seconds > BENCH_MAX_SECONDS) {
+    seconds = BENCH_MAX_SECONDS;
+  }
+  memset(&rig, 0, sizeof(rig));
+  rig.output_fd = -1;
+
+  init_profile(&profile);
+  get_default_config(&profile.config);
+  for (int button = 0; button < XBOX_BUTTON_COUNT; button++) {
+    profile.layers[0][button].type = ACTION_KEY;
+    profile.layers[0][button].code = BENCH_KEY;
+  }
+  if (compile_profile(&profile) != 0) {
+    return -1;
+  }
+
+  if (uhid_pad_create(&rig.pad, UHID_PAD_NAME, VENDOR_MICROSOFT,
+                      PRODUCT_XBOX_360) != 0) {
+    return -1;
+  }
+  int fd = open_pad_node(use_evdev, &evdev, &vendor_id, &product_id);
+  if (fd < 0) {
+    uhid_pad_destroy(&rig.pad);
+    return -1;
+  }
+  if (engine_init(lctx) != 0) {
+    close(fd);
+    uhid_pad_destroy(&rig.pad);
+    return -1;
+  }
+
+  int started = use_evdev ? start_evdev_device(fd, &evdev, vendor_id,
+                                               product_id, &profile)
+                          : start_hidraw_device(fd, vendor_id, product_id,
+                                                &profile);
+  rig.output_fd = started == 0 ? open_output_node() : -1;
+  if (rig.output_fd >= 0) {
+    printf("uhid end-to-end benchmark through %s, %d s per phase\n",
+           use_evdev ? "evdev" : "hidraw", seconds);
+
+    bench_latency(&rig, seconds, &hist);
+    latency_print(&hist, "Report to output event", stdout);
+
+    double rate = bench_throughput(&rig, seconds);
+    printf("Throughput: %.0f reports/s (window %d)\n", rate, BENCH_WINDOW);
+    printf("Reports echoed %llu, lost %llu\n",
+           (unsigned long long)rig.echoed, (unsigned long long)rig.lost);
+    ret = 0;
+    close(rig.output_fd);
+  }
+
+  stop_input_reader();
+  engine_shutdown();
+  uhid_pad_destroy(&rig.pad);
+  return ret;
+}
@@ -0,0 +1,34 @@
+#ifndef UHID_H
+#define UHID_H
+
+#include "engine.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * End-to-end benchmark with no hardware: a virtual HID gamepad is created
+ * through /dev/uhid and fed reports in the wired Xbox 360 layout, the
+ * engine reads it through the hidraw or evdev backend and translates it
+ * through uinput as it would a real pad, and the harness reads the
+ * uinput device's events back. Latency is taken from the kernel's
+ * timestamp on the output event, so reading it back adds nothing.
+ */
+
+#define UHID_PAD_NAME "Faky uhid gamepad"
+#define UHID_REPORT_SIZE 20
+
+typedef struct {
+  int fd;
+  uint16_t vendor_id;
+  uint16_t product_id;
+} UhidPad;
+
+int uhid_pad_create(UhidPad *pad, const char *name, uint16_t vendor_id,
+                    uint16_t product_id);
+int uhid_pad_send(UhidPad *pad, const uint8_t *report, size_t length);
+void uhid_pad_drain(UhidPad *pad);
+void uhid_pad_destroy(UhidPad *pad);
+
+int run_uhid_benchmark(libusb_context *lctx, int use_evdev, int seconds);
+
+#endif /* UHID_H */
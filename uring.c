@@ -0,0 +1,581 @@
+#define _GNU_SOURCE
+#include "uring.h"
+#include "utils.h"
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/* Not in pre-6.7 uapi headers */
+#define URING_OP_READ_MULTISHOT 49
+
+#define TAG(slot, generation) ((uint64_t)(generation) << 8 | (uint64_t)(slot))
+#define TAG_SLOT(tag) ((int)((tag)&0xff))
+#define TAG_GENERATION(tag) ((uint32_t)((tag) >> 8))
+#define TAG_CANCEL UINT64_MAX
+
+static int uring_setup(unsigned int entries, struct io_uring_params *p) {
+  return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uring_enter(UringReader *r, unsigned int to_submit) {
+  r->enters++;
+  return (int)syscall(__NR_io_uring_enter, r->fd, to_submit, 0, 0, NULL, 0);
+}
+
+static int uring_register(UringReader *r, unsigned int opcode, void *arg,
+                          unsigned int count) {
+  return (int)syscall(__NR_io_uring_register, r->fd, opcode, arg, count);
+}
+
+static int supports_multishot_read(UringReader *r) {
+  size_t size = sizeof(struct io_uring_probe) +
+                256 * sizeof(struct io_uring_probe_op);
+  struct io_uring_probe *probe = calloc(1, size);
+  int supported = 0;
+
+  if (probe && uring_register(r, IORING_REGISTER_PROBE, probe, 256) == 0) {
+    supported = probe->last_op >= URING_OP_READ_MULTISHOT &&
+                (probe->ops[URING_OP_READ_MULTISHOT].flags &
+                 IO_URING_OP_SUPPORTED);
+  }
+  free(probe);
+  return supported;
+}
+
+static void provide_buffer(UringReader *r, uint16_t bid) {
+  struct io_uring_buf *buf =
+      &r->buf_ring->bufs[r->buf_tail & (URING_BUFFERS - 1)];
+
+  buf->addr = (uint64_t)(uintptr_t)(r->buffers + (size_t)bid *
+                                                     URING_BUFFER_SIZE);
+  buf->len = URING_BUFFER_SIZE;
+  buf->bid = bid;
+  r->buf_tail++;
+}
+
+static void publish_buffers(UringReader *r) {
+  __atomic_store_n(&r->buf_ring->tail, r->buf_tail, __ATOMIC_RELEASE);
+}
+
+/* Zeroed, queued SQE; submitted by the next submit() */
+static struct io_uring_sqe *next_sqe(UringReader *r) {
+  uint32_t head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+
+  if (r->sq_local_tail - head >= r->sq_entries) {
+    return NULL;
+  }
+  uint32_t index = r->sq_local_tail & r->sq_mask;
+  struct io_uring_sqe *sqe = &r->sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  r->sq_array[index] = index;
+  r->sq_local_tail++;
+  return sqe;
+}
+
+static void submit(UringReader *r) {
+  uint32_t pending = r->sq_local_tail - *r->sq_tail;
+
+  if (pending == 0) {
+    return;
+  }
+  __atomic_store_n(r->sq_tail, r->sq_local_tail, __ATOMIC_RELEASE);
+  while (uring_enter(r, pending) < 0 && errno == EINTR) {
+  }
+}
+
+static int arm(UringReader *r, int slot) {
+  struct io_uring_sqe *sqe = next_sqe(r);
+
+  if (!sqe) {
+    submit(r);
+    sqe = next_sqe(r);
+    if (!sqe) {
+      return -1;
+    }
+  }
+  sqe->opcode = URING_OP_READ_MULTISHOT;
+  sqe->fd = slot;
+  sqe->flags = IOSQE_FIXED_FILE | IOSQE_BUFFER_SELECT;
+  sqe->buf_group = URING_BUFFER_GROUP;
+  sqe->user_data = TAG(slot, r->slots[slot].generation);
+  r->slots[slot].armed = 1;
+  return 0;
+}
+
+static int update_file(UringReader *r, int slot, int fd) {
+  struct io_uring_files_update update;
+
+  memset(&update, 0, sizeof(update));
+  update.offset = (uint32_t)slot;
+  update.fds = (uint64_t)(uintptr_t)&fd;
+  return uring_register(r, IORING_REGISTER_FILES_UPDATE, &update, 1) == 1
+             ? 0
+             : -1;
+}
+
+int uring_reader_open(UringReader *r) {
+  struct io_uring_params p;
+  struct io_uring_buf_reg reg;
+  int files[URING_MAX_FDS];
+
+  memset(r, 0, sizeof(*r));
+  r->fd = -1;
+  r->ring = r->buffers = MAP_FAILED;
+  r->sqes = MAP_FAILED;
+  r->buf_ring = MAP_FAILED;
+  for (int i = 0; i < URING_MAX_FDS; i++) {
+    r->slots[i].fd = -1;
+    files[i] = -1;
+  }
+
+  memset(&p, 0, sizeof(p));
+  p.flags = IORING_SETUP_CQSIZE;
+  p.cq_entries = URING_CQ_ENTRIES;
+  r->fd = uring_setup(URING_SQ_ENTRIES, &p);
+  if (r->fd < 0) {
+    fprintf(stderr, "io_uring_setup failed: %s\n", strerror(errno));
+    return -1;
+  }
+  if (!(p.features & IORING_FEAT_SINGLE_MMAP) ||
+      !supports_multishot_read(r)) {
+    fprintf(stderr, "io_uring has no multishot reads on this kernel\n");
+    uring_reader_close(r);
+    return -1;
+  }
+
+  r->ring_size = MAX(p.sq_off.array + p.sq_entries * sizeof(uint32_t),
+                     p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe));
+  r->ring = mmap(NULL, r->ring_size, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+  r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+  r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+  r->buf_ring = mmap(NULL, URING_BUFFERS * sizeof(struct io_uring_buf),
+                     PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+  r->buffers = mmap(NULL, (size_t)URING_BUFFERS * URING_BUFFER_SIZE,
+                    PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+  if (r->ring == MAP_FAILED || r->sqes == MAP_FAILED ||
+      r->buf_ring == MAP_FAILED || r->buffers == MAP_FAILED) {
+    perror("Failed to map io_uring");
+    uring_reader_close(r);
+    return -1;
+  }
+
+  uint8_t *ring = r->ring;
+  r->sq_head = (uint32_t *)(ring + p.sq_off.head);
+  r->sq_tail = (uint32_t *)(ring + p.sq_off.tail);
+  r->sq_array = (uint32_t *)(ring + p.sq_off.array);
+  r->sq_mask = *(uint32_t *)(ring + p.sq_off.ring_mask);
+  r->sq_entries = p.sq_entries;
+  r->sq_local_tail = *r->sq_tail;
+  r->cq_head = (uint32_t *)(ring + p.cq_off.head);
+  r->cq_tail = (uint32_t *)(ring + p.cq_off.tail);
+  r->cq_mask = *(uint32_t *)(ring + p.cq_off.ring_mask);
+  r->cqes = (struct io_uring_cqe *)(ring + p.cq_off.cqes);
+
+  /* Sparse file table, filled in by uring_reader_add() */
+  if (uring_register(r, IORING_REGISTER_FILES, files, URING_MAX_FDS) != 0) {
+    fprintf(stderr, "Failed to register io_uring files: %s\n",
+            strerror(errno));
+    uring_reader_close(r);
+    return -1;
+  }
+
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = (uint64_t)(uintptr_t)r->buf_ring;
+  reg.ring_entries = URING_BUFFERS;
+  reg.bgid = URING_BUFFER_GROUP;
+  if (uring_register(r, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+    fprintf(stderr, "Failed to register io_uring buffers: %s\n",
+            strerror(errno));
+    uring_reader_close(r);
+    return -1;
+  }
+  for (int i = 0; i < URING_BUFFERS; i++) {
+    provide_buffer(r, (uint16_t)i);
+  }
+  publish_buffers(r);
+  return 0;
+}
+
+void uring_reader_close(UringReader *r) {
+  /* Closing the ring cancels every read and drops the registrations */
+  if (r->fd >= 0) {
+    close(r->fd);
+    r->fd = -1;
+  }
+  if (r->ring != MAP_FAILED && r->ring) {
+    munmap(r->ring, r->ring_size);
+  }
+  if (r->sqes != MAP_FAILED && r->sqes) {
+    munmap(r->sqes, r->sqes_size);
+  }
+  if (r->buf_ring != MAP_FAILED && r->buf_ring) {
+    munmap(r->buf_ring, URING_BUFFERS * sizeof(struct io_uring_buf));
+  }
+  if (r->buffers != MAP_FAILED && r->buffers) {
+    munmap(r->buffers, (size_t)URING_BUFFERS * URING_BUFFER_SIZE);
+  }
+  r->ring = r->buffers = NULL;
+  r->sqes = NULL;
+  r->buf_ring = NULL;
+}
+
+/* fn runs on the thread calling uring_reader_reap() */
+int uring_reader_add(UringReader *r, int fd, uring_data_fn fn, void *data) {
+  for (int i = 0; i < URING_MAX_FDS; i++) {
+    UringSlot *slot = &r->slots[i];
+    if (slot->fd >= 0) {
+      continue;
+    }
+    if (update_file(r, i, fd) != 0) {
+      fprintf(stderr, "Failed to register fd with io_uring: %s\n",
+              strerror(errno));
+      return -1;
+    }
+    slot->fd = fd;
+    slot->fn = fn;
+    slot->data = data;
+    if (arm(r, i) != 0) {
+      uring_reader_remove(r, fd);
+      return -1;
+    }
+    submit(r);
+    return 0;
+  }
+  fprintf(stderr, "Too many fds for io_uring (max %d)\n", URING_MAX_FDS);
+  return -1;
+}
+
+/*
+ * Cancels the fd's read and frees its slot; completions still in flight
+ * for it are recognised by the generation and discarded.
+ */
+void uring_reader_remove(UringReader *r, int fd) {
+  for (int i = 0; i < URING_MAX_FDS; i++) {
+    UringSlot *slot = &r->slots[i];
+    if (slot->fd != fd) {
+      continue;
+    }
+    if (slot->armed) {
+      struct io_uring_sqe *sqe = next_sqe(r);
+      if (!sqe) {
+        submit(r);
+        sqe = next_sqe(r);
+      }
+      if (sqe) {
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = TAG(i, slot->generation);
+        sqe->user_data = TAG_CANCEL;
+      }
+    }
+    submit(r);
+    update_file(r, i, -1);
+    slot->fd = -1;
+    slot->armed = 0;
+    slot->generation++;
+    return;
+  }
+}
+
+static void handle_completion(UringReader *r, const struct io_uring_cqe *cqe) {
+  if (cqe->user_data == TAG_CANCEL) {
+    return;
+  }
+  UringSlot *slot = &r->slots[TAG_SLOT(cqe->user_data)];
+  int current =
+      slot->fd >= 0 && slot->generation == TAG_GENERATION(cqe->user_data);
+
+  if (cqe->flags & IORING_CQE_F_BUFFER) {
+    uint16_t bid = (uint16_t)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+    if (current && cqe->res > 0) {
+      slot->fn(slot->fd, r->buffers + (size_t)bid * URING_BUFFER_SIZE,
+               cqe->res, slot->data);
+    }
+    provide_buffer(r, bid);
+  }
+  if (!current || (cqe->flags & IORING_CQE_F_MORE)) {
+    return;
+  }
+
+  /* The multishot read ended: out of buffers, or the fd is done */
+  slot->armed = 0;
+  if (cqe->res > 0 || cqe->res == -ENOBUFS) {
+    r->rearm = 1;
+  } else {
+    slot->fn(slot->fd, NULL, cqe->res, slot->data);
+  }
+}
+
+/*
+ * Handles every completion queued so far, then hands the buffers back and
+ * restarts reads that ran out of them with at most one io_uring_enter().
+ * Returns the number of completions.
+ */
+int uring_reader_reap(UringReader *r) {
+  uint32_t head = *r->cq_head;
+  uint32_t tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+  int count = 0;
+
+  for (; head != tail; head++, count++) {
+    handle_completion(r, &r->cqes[head & r->cq_mask]);
+  }
+  __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+  publish_buffers(r);
+
+  if (r->rearm) {
+    r->rearm = 0;
+    for (int i = 0; i < URING_MAX_FDS; i++) {
+      if (r->slots[i].fd >= 0 && !r->slots[i].armed) {
+        arm(r, i);
+      }
+    }
+  }
+  submit(r);
+  r->completions += (uint64_t)count;
+  return count;
+}
+
+/*
+ * Benchmark: a thread plays N pads reporting at a fixed rate over
+ * SOCK_SEQPACKET socketpairs (one read() per report, like hidraw), and the
+ * calling thread consumes them either with epoll plus read() until EAGAIN
+ * or through the ring, counting its own syscalls and CPU time.
+ */
+
+#define BENCH_REPORT_SIZE 20
+#define BENCH_MAX_SECONDS 30
+
+typedef struct {
+  int devices;
+  int rate_hz;
+  int fds[URING_MAX_FDS][2];
+  volatile int running;
+  uint64_t produced;
+  uint64_t dropped;
+} BenchLoad;
+
+typedef struct {
+  uint64_t reports;
+  uint64_t syscalls;
+  uint64_t wakeups;
+  uint64_t cpu_ns;
+  uint64_t checksum;
+} BenchResult;
+
+static void *bench_produce(void *arg) {
+  BenchLoad *load = arg;
+  uint8_t report[BENCH_REPORT_SIZE];
+  struct timespec next;
+  long period = (long)(NSEC_PER_SEC / (uint64_t)load->rate_hz);
+
+  memset(report, 0, sizeof(report));
+  clock_gettime(CLOCK_MONOTONIC, &next);
+  for (uint32_t tick = 0; load->running; tick++) {
+    for (int i = 0; i < load->devices; i++) {
+      memcpy(report + 4, &tick, sizeof(tick));
+      report[3] = (uint8_t)i;
+      if (write(load->fds[i][1], report, sizeof(report)) ==
+          (ssize_t)sizeof(report)) {
+        load->produced++;
+      } else {
+        load->dropped++;
+      }
+    }
+    next.tv_nsec += period;
+    while (next.tv_nsec >= (long)NSEC_PER_SEC) {
+      next.tv_nsec -= NSEC_PER_SEC;
+      next.tv_sec++;
+    }
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+  }
+  return NULL;
+}
+
+static uint64_t thread_cpu_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return (uint64_t)ts.tv_sec * NSEC_PER_SEC + (uint64_t)ts.tv_nsec;
+}
+
+static void bench_consume(int fd, uint8_t *data, int length, void *user) {
+  BenchResult *result = user;
+  (void)fd;
+
+  if (length > 0) {
+    result->reports++;
+    result->checksum += data[4];
+  }
+}
+
+/* Runs the consumer until deadline; epfd watches the devices or the ring */
+static void bench_loop(int epfd, UringReader *r, uint64_t deadline,
+                       BenchLoad *load, BenchResult *result) {
+  struct epoll_event events[URING_MAX_FDS];
+  uint8_t buffer[64];
+
+  while (now_ns() < deadline) {
+    int n = epoll_wait(epfd, events, URING_MAX_FDS, 100);
+    result->syscalls++;
+    result->wakeups++;
+    for (int i = 0; i < n; i++) {
+      if (r) {
+        uring_reader_reap(r);
+        continue;
+      }
+      int fd = load->fds[events[i].data.u32][0];
+      for (;;) {
+        ssize_t length = read(fd, buffer, sizeof(buffer));
+        result->syscalls++;
+        if (length <= 0) {
+          break;
+        }
+        bench_consume(fd, buffer, (int)length, result);
+      }
+    }
+  }
+}
+
+static int bench_run(BenchLoad *load, int use_ring, int seconds) {
+  static UringReader ring;
+  BenchResult result;
+  struct epoll_event ev;
+  pthread_t thread;
+  int ret = -1;
+
+  memset(&result, 0, sizeof(result));
+  int epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (epfd < 0) {
+    perror("epoll_create1");
+    return -1;
+  }
+  if (use_ring && uring_reader_open(&ring) != 0) {
+    close(epfd);
+    return -1;
+  }
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  for (int i = 0; i < load->devices; i++) {
+    if (use_ring) {
+      if (uring_reader_add(&ring, load->fds[i][0], bench_consume, &result) !=
+          0) {
+        goto out;
+      }
+    } else {
+      ev.data.u32 = (uint32_t)i;
+      epoll_ctl(epfd, EPOLL_CTL_ADD, load->fds[i][0], &ev);
+    }
+  }
+  if (use_ring) {
+    ev.data.u32 = 0;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, ring.fd, &ev);
+  }
+
+  load->produced = load->dropped = 0;
+  load->running = 1;
+  if (pthread_create(&thread, NULL, bench_produce, load) != 0) {
+    load->running = 0;
+    goto out;
+  }
+
+  /* Warm up, then measure from a clean slate */
+  bench_loop(epfd, use_ring ? &ring : NULL, now_ns() + 200 * NSEC_PER_MSEC,
+             load, &result);
+  uint64_t enters = ring.enters;
+  memset(&result, 0, sizeof(result));
+  uint64_t produced = load->produced;
+  uint64_t cpu = thread_cpu_ns();
+  uint64_t start = now_ns();
+  bench_loop(epfd, use_ring ? &ring : NULL,
+             start + (uint64_t)seconds * NSEC_PER_SEC, load, &result);
+  uint64_t elapsed = now_ns() - start;
+  result.cpu_ns = thread_cpu_ns() - cpu;
+  produced = load->produced - produced;
+  if (use_ring) {
+    result.syscalls += ring.enters - enters;
+  }
+
+  load->running = 0;
+  pthread_join(thread, NULL);
+
+  double secs = (double)elapsed / NSEC_PER_SEC;
+  double per_k = result.reports ? 1000.0 / (double)result.reports : 0;
+  printf("%-8s %7d %9llu %9.2f%% %10.0f %12.1f %10.1f %12.1f\n",
+         use_ring ? "io_uring" : "epoll", load->rate_hz,
+         (unsigned long long)result.reports,
+         produced ? 100.0 * (double)result.reports / (double)produced : 0.0,
+         (double)result.syscalls / secs, (double)result.syscalls * per_k,
+         (double)result.wakeups * per_k,
+         (double)result.cpu_ns / NSEC_PER_USEC * per_k);
+  ret = 0;
+
+out:
+  if (use_ring) {
+    uring_reader_close(&ring);
+  }
+  close(epfd);
+  return ret;
+}
+
+/*
+ * Synthetic multi-device load against both ingestion paths, at a typical
+ * 1 kHz pad and an 8 kHz (USB high-speed) one. Syscalls and CPU are the
+ * consumer's only; delivered is against what was produced in the window.
+ */
+int run_uring_benchmark(int devices, int seconds) {
+  static const int rates[] = {1000, 8000};
+  static BenchLoad load;
+  int ret = 0;
+
+  if (devices < 1 || devices > URING_MAX_FDS) {
+    fprintf(stderr, "Devices must be between 1 and %d\n", URING_MAX_FDS);
+    return -1;
+  }
+  if (seconds > BENCH_MAX_SECONDS) {
+    seconds = BENCH_MAX_SECONDS;
+  }
+
+  memset(&load, 0, sizeof(load));
+  load.devices = devices;
+  for (int i = 0; i < devices; i++) {
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0,
+                   load.fds[i]) != 0) {
+      perror("socketpair");
+      for (int j = 0; j < i; j++) {
+        close(load.fds[j][0]);
+        close(load.fds[j][1]);
+      }
+      return -1;
+    }
+  }
+
+  printf("Report ingestion benchmark: %d devices, %d-byte reports, %d s per "
+         "run\n",
+         devices, BENCH_REPORT_SIZE, seconds);
+  printf("%-8s %7s %9s %10s %10s %12s %10s %12s\n", "backend", "Hz/dev",
+         "reports", "delivered", "syscalls/s", "syscalls/1k", "wakes/1k",
+         "cpu us/1k");
+  for (size_t i = 0; i < ARRAY_SIZE(rates) && ret == 0; i++) {
+    load.rate_hz = rates[i];
+    for (int use_ring = 0; use_ring <= 1 && ret == 0; use_ring++) {
+      ret = bench_run(&load, use_ring, seconds);
+    }
+  }
+
+  for (int i = 0; i < devices; i++) {
+    close(load.fds[i][0]);
+    close(load.fds[i][1]);
+  }
+  return ret;
+}
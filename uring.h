@@ -0,0 +1,78 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * hidraw/evdev reads through io_uring instead of epoll plus one read() per
+ * report. Every device fd is registered with the ring once and gets one
+ * multishot read that keeps completing into a shared group of registered
+ * buffers, so the reports of all devices are reaped from the completion
+ * queue in one batch without a syscall each. The ring's own fd is what the
+ * engine's epoll loop waits on. Talks to the kernel through the raw
+ * syscalls; multishot reads need Linux 6.7 (checked at open, callers fall
+ * back to epoll).
+ */
+
+#define URING_MAX_FDS 64
+#define URING_SQ_ENTRIES 64
+#define URING_CQ_ENTRIES 1024
+#define URING_BUFFERS 256 /* power of two */
+#define URING_BUFFER_SIZE 1536
+#define URING_BUFFER_GROUP 0
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct io_uring_buf_ring;
+
+/*
+ * One completed read of length bytes, which the callback may modify in
+ * place. length <= 0 means the fd hit EOF or failed (-errno) and its read
+ * has stopped.
+ */
+typedef void (*uring_data_fn)(int fd, uint8_t *data, int length, void *user);
+
+typedef struct {
+  int fd; /* -1 if the slot is free */
+  uint32_t generation;
+  int armed;
+  uring_data_fn fn;
+  void *data;
+} UringSlot;
+
+typedef struct {
+  int fd;
+  void *ring;
+  size_t ring_size;
+  struct io_uring_sqe *sqes;
+  size_t sqes_size;
+  uint32_t *sq_head;
+  uint32_t *sq_tail;
+  uint32_t *sq_array;
+  uint32_t sq_mask;
+  uint32_t sq_entries;
+  uint32_t sq_local_tail;
+  uint32_t *cq_head;
+  uint32_t *cq_tail;
+  uint32_t cq_mask;
+  struct io_uring_cqe *cqes;
+  struct io_uring_buf_ring *buf_ring;
+  uint8_t *buffers;
+  uint16_t buf_tail;
+  int rearm; /* a slot's multishot read ended and needs resubmitting */
+  UringSlot slots[URING_MAX_FDS];
+  uint64_t completions;
+  uint64_t enters; /* io_uring_enter() calls */
+} UringReader;
+
+int uring_reader_open(UringReader *reader);
+void uring_reader_close(UringReader *reader);
+int uring_reader_add(UringReader *reader, int fd, uring_data_fn fn,
+                     void *data);
+void uring_reader_remove(UringReader *reader, int fd);
+int uring_reader_reap(UringReader *reader);
+
+int run_uring_benchmark(int devices, int seconds);
+
+#endif /* URING_H */
@@ -2,6 +2,7 @@
 #define UTILS_H
 
 #include <stdint.h>
+#include <time.h>
 #include <unistd.h>
 
 #define SLEEP_MS(ms) usleep((ms) * 1000)
@@ -23,4 +24,14 @@
 #define TOGGLE_BIT(value, bit) ((value) ^= (1 << (bit)))
 #define CHECK_BIT(value, bit) (((value) >> (bit)) & 1)
 
+#define NSEC_PER_USEC 1000ULL
+#define NSEC_PER_MSEC 1000000ULL
+#define NSEC_PER_SEC 1000000000ULL
+
+static inline uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * NSEC_PER_SEC + (uint64_t)ts.tv_nsec;
+}
+
 #endif /* UTILS_H */
\ No newline at end of file